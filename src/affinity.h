@@ -0,0 +1,191 @@
+// CPU topology and thread pinning for the multi-threaded benchmarks.
+//
+// online_cpus() lists the CPUs this process may run on, with the socket
+// (physical package), core and NUMA node each belongs to, as reported by
+// sysfs.
+// placement() orders them for a given number of threads:
+//
+//   compact  fill the cores of one socket before moving to the next, one
+//            hardware thread per core before the SMT siblings
+//   scatter  alternate between sockets, so both memory controllers are used
+//            from the second thread on
+//
+// Pinning is a no-op (returns false) where the OS does not support it; on a
+// single-socket host both placements are the same.
+
+#ifndef AFFINITY_H_
+#define AFFINITY_H_
+
+#include <algorithm>
+#include <cstdio>
+#include <map>
+#include <thread>
+#include <vector>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace affinity {
+
+struct cpu {
+  int id;
+  int socket;
+  int core;
+  // 0 for the first hardware thread of a core, 1 for its SMT sibling, ...
+  int smt;
+  // NUMA node, 0 without NUMA support
+  int node;
+};
+
+namespace detail {
+inline int read_int(const char *format, int cpu, int fallback) {
+  char path[128];
+  snprintf(path, sizeof(path), format, cpu);
+  FILE *f = fopen(path, "r");
+  if (f == nullptr) {
+    return fallback;
+  }
+  int v = fallback;
+  if (fscanf(f, "%d", &v) != 1) {
+    v = fallback;
+  }
+  fclose(f);
+  return v;
+}
+
+// A sysfs list such as "0-3,8,10-11"; empty if the file is missing.
+inline std::vector<int> read_list(const char *path) {
+  std::vector<int> ids;
+  FILE *f = fopen(path, "r");
+  if (f == nullptr) {
+    return ids;
+  }
+  int first, last;
+  char separator;
+  while (fscanf(f, "%d", &first) == 1) {
+    last = first;
+    if (fscanf(f, "%c", &separator) == 1 && separator == '-') {
+      if (fscanf(f, "%d", &last) != 1) {
+        break;
+      }
+      if (fscanf(f, "%c", &separator) != 1) {
+        separator = 0;
+      }
+    }
+    for (int i = first; i <= last; i++) {
+      ids.push_back(i);
+    }
+    if (separator != ',') {
+      break;
+    }
+  }
+  fclose(f);
+  return ids;
+}
+} // namespace detail
+
+inline std::vector<cpu> online_cpus() {
+  std::vector<cpu> cpus;
+#if defined(__linux__)
+  std::map<int, int> node_of;
+  for (int node : detail::read_list("/sys/devices/system/node/online")) {
+    char path[128];
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+    for (int c : detail::read_list(path)) {
+      node_of[c] = node;
+    }
+  }
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+    for (int c = 0; c < CPU_SETSIZE; c++) {
+      if (CPU_ISSET(c, &set)) {
+        const int socket = detail::read_int(
+            "/sys/devices/system/cpu/cpu%d/topology/physical_package_id", c, 0);
+        const int core = detail::read_int(
+            "/sys/devices/system/cpu/cpu%d/topology/core_id", c, c);
+        cpus.push_back({c, socket < 0 ? 0 : socket, core, 0,
+                        node_of.count(c) ? node_of[c] : 0});
+      }
+    }
+  }
+#endif
+  if (cpus.empty()) {
+    const int n = std::max(1u, std::thread::hardware_concurrency());
+    for (int c = 0; c < n; c++) {
+      cpus.push_back({c, 0, c, 0, 0});
+    }
+  }
+  std::map<std::pair<int, int>, int> seen;
+  for (cpu &c : cpus) {
+    c.smt = seen[{c.socket, c.core}]++;
+  }
+  return cpus;
+}
+
+inline int socket_count(const std::vector<cpu> &cpus) {
+  std::vector<int> sockets;
+  for (const cpu &c : cpus) {
+    sockets.push_back(c.socket);
+  }
+  std::sort(sockets.begin(), sockets.end());
+  return int(std::unique(sockets.begin(), sockets.end()) - sockets.begin());
+}
+
+inline int node_count(const std::vector<cpu> &cpus) {
+  std::vector<int> nodes;
+  for (const cpu &c : cpus) {
+    nodes.push_back(c.node);
+  }
+  std::sort(nodes.begin(), nodes.end());
+  return int(std::unique(nodes.begin(), nodes.end()) - nodes.begin());
+}
+
+// CPU ids in the order threads should be placed on them.
+inline std::vector<int> placement(const std::vector<cpu> &cpus, bool scatter) {
+  std::vector<cpu> order(cpus);
+  std::sort(order.begin(), order.end(), [](const cpu &a, const cpu &b) {
+    if (a.smt != b.smt) { return a.smt < b.smt; }
+    if (a.socket != b.socket) { return a.socket < b.socket; }
+    return a.id < b.id;
+  });
+  if (scatter) {
+    // round-robin over the sockets, keeping the order within each
+    std::map<int, std::vector<int>> by_socket;
+    for (const cpu &c : order) {
+      by_socket[c.socket].push_back(c.id);
+    }
+    std::vector<int> ids;
+    for (size_t i = 0; ids.size() < order.size(); i++) {
+      for (auto &s : by_socket) {
+        if (i < s.second.size()) {
+          ids.push_back(s.second[i]);
+        }
+      }
+    }
+    return ids;
+  }
+  std::vector<int> ids;
+  for (const cpu &c : order) {
+    ids.push_back(c.id);
+  }
+  return ids;
+}
+
+inline bool pin_current_thread(int cpu_id) {
+#if defined(__linux__)
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu_id, &set);
+  return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+  (void)cpu_id;
+  return false;
+#endif
+}
+
+} // namespace affinity
+
+#endif // AFFINITY_H_
@@ -0,0 +1,120 @@
+// Software-pipelined batch lookups (AMAC, "asynchronous memory access
+// chaining", Kocberber et al., VLDB 2015).
+//
+// Most filter lookups are one or two dependent cache misses. Issued one key at
+// a time, they are latency bound: the core waits on each miss in turn. The
+// executor below keeps up to InFlight lookups open, each one written as a
+// small state machine that stops right after prefetching the next cache line
+// it needs. Open lookups are resumed round-robin, so by the time one is
+// resumed its line has usually arrived, and the misses of different keys
+// overlap.
+//
+// A filter opts in by specializing LookupSteps<Table> with
+//
+//   struct State { ... };
+//   // hash the key into s and prefetch the first line(s) to probe
+//   static void Start(const Table *table, uint64_t key, State *s);
+//   // probe; return true with *found set when the lookup is complete, or
+//   // false after prefetching another line (the lookup is resumed later)
+//   static bool Resume(const Table *table, State *s, bool *found);
+//
+// No per-filter batch loop is needed. See ContainMany in filterapi.h for the
+// FilterAPI entry point.
+
+#ifndef BATCHLOOKUP_H_
+#define BATCHLOOKUP_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+template <typename Table> struct LookupSteps {};
+
+template <typename Table, typename = void>
+struct has_lookup_steps : std::false_type {};
+
+template <typename Table>
+struct has_lookup_steps<Table,
+                        std::void_t<typename LookupSteps<Table>::State>>
+    : std::true_type {};
+
+// Look up n keys. Bit i of out_bitmap, which must hold (n + 63) / 64 words, is
+// set if keys[i] may be in the filter.
+template <typename Table, size_t InFlight = 16>
+void PipelinedContainMany(const Table *table, const uint64_t *keys,
+                          const size_t n, uint64_t *out_bitmap) {
+  using Steps = LookupSteps<Table>;
+  typename Steps::State state[InFlight];
+  size_t index[InFlight];
+  memset(out_bitmap, 0, ((n + 63) / 64) * sizeof(uint64_t));
+  size_t next = 0;
+  size_t open = 0;
+  for (; open < InFlight && next < n; open++, next++) {
+    Steps::Start(table, keys[next], &state[open]);
+    index[open] = next;
+  }
+  while (open > 0) {
+    for (size_t s = 0; s < open;) {
+      bool found;
+      if (!Steps::Resume(table, &state[s], &found)) {
+        s++;
+        continue;
+      }
+      out_bitmap[index[s] >> 6] |= uint64_t(found) << (index[s] & 63);
+      if (next < n) {
+        // reuse the slot for the next key
+        Steps::Start(table, keys[next], &state[s]);
+        index[s] = next++;
+        s++;
+      } else {
+        // drain: move the last open lookup into this slot
+        open--;
+        state[s] = state[open];
+        index[s] = index[open];
+      }
+    }
+  }
+}
+
+// The index of one of keys[0, n) that may be in the filter, or n if none
+// is. All lookups are started (prefetched) up front, InFlight at a time, and
+// the first one found ends the batch: the keys are alternatives, such as the
+// candidate keys of one URL.
+template <typename Table, size_t InFlight = 16>
+size_t PipelinedContainAny(const Table *table, const uint64_t *keys,
+                           const size_t n) {
+  using Steps = LookupSteps<Table>;
+  typename Steps::State state[InFlight];
+  size_t index[InFlight];
+  size_t next = 0;
+  size_t open = 0;
+  for (; open < InFlight && next < n; open++, next++) {
+    Steps::Start(table, keys[next], &state[open]);
+    index[open] = next;
+  }
+  while (open > 0) {
+    for (size_t s = 0; s < open;) {
+      bool found;
+      if (!Steps::Resume(table, &state[s], &found)) {
+        s++;
+        continue;
+      }
+      if (found) {
+        return index[s];
+      }
+      if (next < n) {
+        Steps::Start(table, keys[next], &state[s]);
+        index[s] = next++;
+        s++;
+      } else {
+        open--;
+        state[s] = state[open];
+        index[s] = index[open];
+      }
+    }
+  }
+  return n;
+}
+
+#endif // BATCHLOOKUP_H_
@@ -7,12 +7,23 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include "../hugepage.h"
 #ifndef XOR_MAX_ITERATIONS
 #define XOR_MAX_ITERATIONS \
   100 // probability of success should always be > 0.5 so 100 iterations is
       // highly unlikely
 #endif
 
+// Compile with -DBINARY_FUSE_CONSTRUCTION_STATS to have Populate() record
+// where its time goes (see ConstructionStats). Off by default: the timers and
+// the queue high-water check sit inside the construction loops.
+#ifdef BINARY_FUSE_CONSTRUCTION_STATS
+#include <chrono>
+#define BINARY_FUSE_STATS(...) __VA_ARGS__
+#else
+#define BINARY_FUSE_STATS(...)
+#endif
+
 namespace binary_fuse
 {
   static int cmpfunc(const void *a, const void *b)
@@ -194,6 +205,67 @@ namespace binary_fuse
     return x > 2 ? x - 3 : x;
   }
 
+  // What the last call to Populate() spent its time on. The phase times are
+  // those of the attempt that succeeded; everything spent on attempts that
+  // were thrown away (a slot left empty, a peeling that got stuck, the
+  // deduplication of the keys) is in retry_ns. All zero unless compiled with
+  // BINARY_FUSE_CONSTRUCTION_STATS.
+  struct ConstructionStats
+  {
+    uint64_t hash_ns = 0;   // hashing the keys and bucketing them by segment
+    uint64_t count_ns = 0;  // t2count / t2hash accumulation
+    uint64_t peel_ns = 0;   // finding the single-key slots and peeling
+    uint64_t assign_ns = 0; // back-assignment of the fingerprints
+    uint64_t retry_ns = 0;
+    uint32_t retries = 0;
+    uint32_t duplicates_removed = 0;
+    uint32_t queue_high_water = 0; // largest size of the peeling queue
+
+    uint64_t total_ns() const
+    {
+      return hash_ns + count_ns + peel_ns + assign_ns + retry_ns;
+    }
+
+    // hash, count, peel, assign, retry (ns), retries, duplicates removed,
+    // queue high-water, appended to the current row
+    void write_csv(FILE *filename) const
+    {
+      fprintf(filename, ",%llu,%llu,%llu,%llu,%llu,%u,%u,%u",
+              (unsigned long long)hash_ns, (unsigned long long)count_ns,
+              (unsigned long long)peel_ns, (unsigned long long)assign_ns,
+              (unsigned long long)retry_ns, retries, duplicates_removed,
+              queue_high_water);
+    }
+  };
+
+#ifdef BINARY_FUSE_CONSTRUCTION_STATS
+  struct construction_timer
+  {
+    std::chrono::steady_clock::time_point last = std::chrono::steady_clock::now();
+
+    // ns since the previous lap, also added to *phase
+    uint64_t lap(uint64_t *phase = NULL)
+    {
+      const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+      const uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(now - last).count();
+      last = now;
+      if (phase != NULL)
+      {
+        *phase += ns;
+      }
+      return ns;
+    }
+  };
+
+  // Moves the phase times of a failed attempt, and the time since, to retry_ns.
+  static inline void discard_attempt(ConstructionStats *stats, construction_timer *timer)
+  {
+    stats->retry_ns += stats->hash_ns + stats->count_ns + stats->peel_ns + timer->lap();
+    stats->hash_ns = stats->count_ns = stats->peel_ns = 0;
+    stats->retries++;
+  }
+#endif
+
   typedef struct binary_hashes_s
   {
     uint32_t h0;
@@ -252,9 +324,14 @@ namespace binary_fuse
     }
 
     binary_fuse_t *filter;
+    ConstructionStats Stats;
+    // backing of the fingerprints and of the Populate() scratch arrays
+    hugepage::policy Pages;
 
   public:
-    BinaryFuseFilter(const size_t size)
+    BinaryFuseFilter(const size_t size,
+                     hugepage::policy pages = hugepage::default_policy())
+        : Pages(pages)
     {
       uint32_t arity = 3;
       SegmentLength = size == 0 ? 4 : calculate_segment_length(arity, size);
@@ -282,13 +359,13 @@ namespace binary_fuse
       ArrayLength =
           (SegmentCount + arity - 1) * SegmentLength;
       SegmentCountLength = SegmentCount * SegmentLength;
-      Fingerprints = (FingerprintType *)malloc(ArrayLength * sizeof(FingerprintType));
+      Fingerprints = hugepage::allocate<FingerprintType>(ArrayLength, Pages);
       // return Fingerprints != NULL;
     }
 
     ~BinaryFuseFilter()
     {
-      free(Fingerprints);
+      hugepage::release(Fingerprints);
       Fingerprints = NULL;
       Seed = 0;
       SegmentLength = 0;
@@ -300,6 +377,17 @@ namespace binary_fuse
 
     bool Populate(uint64_t *keys, uint32_t size);
 
+    const ConstructionStats &GetConstructionStats() const
+    {
+      return Stats;
+    }
+
+    // what the fingerprints got, which may be less than asked for
+    hugepage::policy PageBacking() const
+    {
+      return hugepage::backing(Fingerprints);
+    }
+
     bool Contain(const ItemType key) const
     {
       uint64_t hash = murmur64(key + Seed);
@@ -319,14 +407,16 @@ namespace binary_fuse
   template <typename ItemType, typename FingerprintType>
   bool BinaryFuseFilter<ItemType, FingerprintType>::Populate(uint64_t *keys, uint32_t size)
   {
+    Stats = ConstructionStats();
+    BINARY_FUSE_STATS(construction_timer timer; const uint32_t initial_size = size;)
     uint64_t rng_counter = 0x726b2b9d438b9d4d;
     Seed = rng_splitmix64(&rng_counter);
-    uint64_t *reverseOrder = (uint64_t *)calloc((size + 1), sizeof(uint64_t));
+    uint64_t *reverseOrder = hugepage::allocate<uint64_t>(size + 1, Pages, true);
     uint32_t capacity = ArrayLength;
-    uint32_t *alone = (uint32_t *)malloc(capacity * sizeof(uint32_t));
-    uint8_t *t2count = (uint8_t *)calloc(capacity, sizeof(uint8_t));
-    uint8_t *reverseH = (uint8_t *)malloc(size * sizeof(uint8_t));
-    uint64_t *t2hash = (uint64_t *)calloc(capacity, sizeof(uint64_t));
+    uint32_t *alone = hugepage::allocate<uint32_t>(capacity, Pages);
+    uint8_t *t2count = hugepage::allocate<uint8_t>(capacity, Pages, true);
+    uint8_t *reverseH = hugepage::allocate<uint8_t>(size, Pages);
+    uint64_t *t2hash = hugepage::allocate<uint64_t>(capacity, Pages, true);
 
     uint32_t blockBits = 1;
     while (((uint32_t)1 << blockBits) < SegmentCount)
@@ -334,21 +424,22 @@ namespace binary_fuse
       blockBits += 1;
     }
     uint32_t block = ((uint32_t)1 << blockBits);
-    uint32_t *startPos = (uint32_t *)malloc((1 << blockBits) * sizeof(uint32_t));
+    uint32_t *startPos = hugepage::allocate<uint32_t>(1 << blockBits, Pages);
     uint32_t h012[5];
 
     if ((alone == NULL) || (t2count == NULL) || (reverseH == NULL) ||
         (t2hash == NULL) || (reverseOrder == NULL) || (startPos == NULL))
     {
-      free(alone);
-      free(t2count);
-      free(reverseH);
-      free(t2hash);
-      free(reverseOrder);
-      free(startPos);
+      hugepage::release(alone);
+      hugepage::release(t2count);
+      hugepage::release(reverseH);
+      hugepage::release(t2hash);
+      hugepage::release(reverseOrder);
+      hugepage::release(startPos);
       return false;
     }
     reverseOrder[size] = 1;
+    BINARY_FUSE_STATS(timer.lap();)
     for (int loop = 0; true; ++loop)
     {
       if (loop + 1 > XOR_MAX_ITERATIONS)
@@ -356,12 +447,12 @@ namespace binary_fuse
         // The probability of this happening is lower than the
         // the cosmic-ray probability (i.e., a cosmic ray corrupts your system)
         memset(Fingerprints, ~0, ArrayLength);
-        free(alone);
-        free(t2count);
-        free(reverseH);
-        free(t2hash);
-        free(reverseOrder);
-        free(startPos);
+        hugepage::release(alone);
+        hugepage::release(t2count);
+        hugepage::release(reverseH);
+        hugepage::release(t2hash);
+        hugepage::release(reverseOrder);
+        hugepage::release(startPos);
         return false;
       }
 
@@ -385,6 +476,7 @@ namespace binary_fuse
         reverseOrder[startPos[segment_index]] = hash;
         startPos[segment_index]++;
       }
+      BINARY_FUSE_STATS(timer.lap(&Stats.hash_ns);)
       int error = 0;
       uint32_t duplicates = 0;
       for (uint32_t i = 0; i < size; i++)
@@ -420,12 +512,14 @@ namespace binary_fuse
         error = (t2count[h1] < 4) ? 1 : error;
         error = (t2count[h2] < 4) ? 1 : error;
       }
+      BINARY_FUSE_STATS(timer.lap(&Stats.count_ns);)
       if (error)
       {
         memset(reverseOrder, 0, sizeof(uint64_t) * size);
         memset(t2count, 0, sizeof(uint8_t) * capacity);
         memset(t2hash, 0, sizeof(uint64_t) * capacity);
         Seed = rng_splitmix64(&rng_counter);
+        BINARY_FUSE_STATS(discard_attempt(&Stats, &timer);)
         continue;
       }
 
@@ -437,6 +531,7 @@ namespace binary_fuse
         alone[Qsize] = i;
         Qsize += ((t2count[i] >> 2) == 1) ? 1 : 0;
       }
+      BINARY_FUSE_STATS(Stats.queue_high_water = Qsize > Stats.queue_high_water ? Qsize : Stats.queue_high_water;)
       uint32_t stacksize = 0;
       while (Qsize > 0)
       {
@@ -469,12 +564,15 @@ namespace binary_fuse
           t2count[other_index2] -= 4;
           t2count[other_index2] ^= mod3(found + 2);
           t2hash[other_index2] ^= hash;
+          BINARY_FUSE_STATS(Stats.queue_high_water = Qsize > Stats.queue_high_water ? Qsize : Stats.queue_high_water;)
         }
       }
+      BINARY_FUSE_STATS(timer.lap(&Stats.peel_ns);)
       if (stacksize + duplicates == size)
       {
         // success
         size = stacksize;
+        BINARY_FUSE_STATS(Stats.duplicates_removed = initial_size - size;)
         break;
       }
       else if (duplicates > 0)
@@ -485,6 +583,7 @@ namespace binary_fuse
       memset(t2count, 0, sizeof(uint8_t) * capacity);
       memset(t2hash, 0, sizeof(uint64_t) * capacity);
       Seed = rng_splitmix64(&rng_counter);
+      BINARY_FUSE_STATS(discard_attempt(&Stats, &timer);)
     }
 
     for (uint32_t i = size - 1; i < size; i--)
@@ -502,12 +601,13 @@ namespace binary_fuse
                                   Fingerprints[h012[found + 1]] ^
                                   Fingerprints[h012[found + 2]];
     }
-    free(alone);
-    free(t2count);
-    free(reverseH);
-    free(t2hash);
-    free(reverseOrder);
-    free(startPos);
+    BINARY_FUSE_STATS(timer.lap(&Stats.assign_ns);)
+    hugepage::release(alone);
+    hugepage::release(t2count);
+    hugepage::release(reverseH);
+    hugepage::release(t2hash);
+    hugepage::release(reverseOrder);
+    hugepage::release(startPos);
     return true;
   }
 } // namespace binary_fuse
@@ -5,8 +5,11 @@
 #include <assert.h>
 #include <sstream>
 #include <climits>
+#include <thread>
+#include <vector>
 
 #include "hashutil.h"
+#include "../hugepage.h"
 
 using namespace std;
 using namespace hashing;
@@ -111,17 +114,22 @@ namespace bloomfilter
 
     double BitsPerItem() const { return k; }
 
-    explicit BloomFilter(const size_t n) : hasher()
+    explicit BloomFilter(const size_t n,
+                         hugepage::policy pages = hugepage::default_policy())
+        : hasher()
     {
       this->size = 0;
       this->kk = getBestK(bits_per_item);
       this->bitCount = n * bits_per_item;
       this->arrayLength = (bitCount + 63) / 64;
-      data = new uint64_t[arrayLength];
-      std::fill_n(data, arrayLength, 0);
+      data = hugepage::allocate<uint64_t>(arrayLength, pages, true);
+      if (data == nullptr)
+      {
+        throw std::bad_alloc();
+      }
     }
 
-    ~BloomFilter() { delete[] data; }
+    ~BloomFilter() { hugepage::release(data); }
 
     // Add an item to the filter.
     Status Add(const ItemType &item);
@@ -134,6 +142,17 @@ namespace bloomfilter
     }
     Status AddAll(const ItemType *data, const size_t start,
                   const size_t end);
+
+    // Add multiple items to the filter using several threads. Inserts are
+    // commutative bit-ORs, so each thread takes a slice of the keys and sets
+    // its bits with a relaxed atomic OR. threads == 0 means one per core.
+    Status AddAllParallel(const vector<ItemType> &data, const size_t start,
+                          const size_t end, size_t threads = 0)
+    {
+      return AddAllParallel(data.data(), start, end, threads);
+    }
+    Status AddAllParallel(const ItemType *data, const size_t start,
+                          const size_t end, size_t threads = 0);
     // Report if the item is inserted, with false positive rate.
     Status Contain(const ItemType &item) const;
 
@@ -146,6 +165,8 @@ namespace bloomfilter
 
     // size of the filter in bytes.
     size_t SizeInBytes() const { return arrayLength * 8; }
+    // what the array got, which may be less than asked for
+    hugepage::policy PageBacking() const { return hugepage::backing(data); }
   };
 
   template <typename ItemType, size_t bits_per_item, bool branchless,
@@ -228,6 +249,55 @@ namespace bloomfilter
     return Ok;
   }
 
+  template <typename ItemType, size_t bits_per_item, bool branchless,
+            typename HashFamily, int k>
+  Status BloomFilter<ItemType, bits_per_item, branchless, HashFamily, k>::AddAllParallel(
+      const ItemType *keys, const size_t start, const size_t end,
+      size_t threads)
+  {
+    if (threads == 0)
+    {
+      threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    // below a few blocks worth of keys the thread start-up dominates
+    if (threads == 1 || end - start < (size_t)blockLen * threads)
+    {
+      return AddAll(keys, start, end);
+    }
+    auto worker = [this, keys](size_t from, size_t to)
+    {
+      for (size_t i = from; i < to; i++)
+      {
+        uint64_t hash = hasher(keys[i]);
+        uint64_t a = (hash >> 32) | (hash << 32);
+        uint64_t b = hash;
+        for (int j = 0; j < k; j++)
+        {
+          uint64_t *word = data + fastrangesize(a, this->arrayLength);
+          uint64_t bit = getBit(a);
+          // skip the read-for-ownership when the bit is already set
+          if ((__atomic_load_n(word, __ATOMIC_RELAXED) & bit) == 0)
+          {
+            __atomic_fetch_or(word, bit, __ATOMIC_RELAXED);
+          }
+          a += b;
+        }
+      }
+    };
+    std::vector<std::thread> pool;
+    const size_t n = end - start;
+    for (size_t t = 0; t < threads; t++)
+    {
+      pool.emplace_back(worker, start + n * t / threads,
+                        start + n * (t + 1) / threads);
+    }
+    for (std::thread &th : pool)
+    {
+      th.join();
+    }
+    return Ok;
+  }
+
   char bittest64(const uint64_t *t, uint64_t bit)
   {
     return (*t & (1L << (bit & 63))) != 0;
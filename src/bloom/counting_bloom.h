@@ -5,6 +5,7 @@
 #include <assert.h>
 
 #include "hashutil.h"
+#include "../hugepage.h"
 
 #if defined(__BMI2__)
 #include <immintrin.h>
@@ -213,17 +214,24 @@ class CountingBloomFilter {
   void AddBlock(uint32_t *tmp, int block, int len);
 
 public:
-  explicit CountingBloomFilter(const size_t n) : hasher() {
+  explicit CountingBloomFilter(const size_t n,
+                               hugepage::policy pages = hugepage::default_policy())
+      : hasher() {
     size_t bitCount = 4 * n * bits_per_item;
     this->arrayLength = (bitCount + 63) / 64;
-    data = new uint64_t[arrayLength]();
+    data = hugepage::allocate<uint64_t>(arrayLength, pages, true);
+    if (data == nullptr) {
+      throw std::bad_alloc();
+    }
   }
-  ~CountingBloomFilter() { delete[] data; }
+  ~CountingBloomFilter() { hugepage::release(data); }
   Status Add(const ItemType &item);
   Status AddAll(const vector<ItemType>& data, const size_t start, const size_t end);
   Status Remove(const ItemType &item);
   Status Contain(const ItemType &item) const;
   size_t SizeInBytes() const { return arrayLength * 8; }
+  // what the array got, which may be less than asked for
+  hugepage::policy PageBacking() const { return hugepage::backing(data); }
 };
 
 template <typename ItemType, size_t bits_per_item, bool branchless,
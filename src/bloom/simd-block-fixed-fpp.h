@@ -14,12 +14,19 @@
 
 #include <cstdint>
 #include <cstdlib>
+#include <cstring>
 
 #include <algorithm>
+#include <condition_variable>
+#include <mutex>
 #include <new>
+#include <thread>
+#include <vector>
 
 
 #include "hashutil.h"
+#include "../cpudispatch.h"
+#include "../hugepage.h"
 
 using uint32_t = ::std::uint32_t;
 using uint64_t = ::std::uint64_t;
@@ -38,9 +45,147 @@ static inline uint64_t rotl64(uint64_t n, unsigned int c) {
     return (n << c) | ( n >> ((-c) & mask));
 }
 
-#ifdef __AVX2__
+// Number of keys hashed and prefetched ahead by FindMany(). The buckets of one
+// batch are loaded while the next batch is being hashed.
+const size_t findBatchLen = 8;
+
+// The FindMany() of all the variants below. test(hash, bucket_idx, len, first)
+// tests one batch of len keys and sets bits first .. first + len - 1 of
+// out_bitmap, which is cleared here; the next batch is hashed and its buckets
+// prefetched before it is called.
+template <typename HashFamily, typename Bucket, typename Test>
+inline void simdBlockFindMany(const HashFamily& hasher, const Bucket* directory,
+                              const uint32_t bucketCount, const uint64_t* keys,
+                              const size_t n, uint64_t* out_bitmap, Test test) {
+  memset(out_bitmap, 0, ((n + 63) / 64) * sizeof(uint64_t));
+  uint64_t hash[2][findBatchLen];
+  uint32_t bucket_idx[2][findBatchLen];
+  auto prepare = [&](size_t buffer, size_t from, size_t len) {
+    for (size_t j = 0; j < len; j++) {
+      hash[buffer][j] = hasher(keys[from + j]);
+      bucket_idx[buffer][j] = reduce(rotl64(hash[buffer][j], 32), bucketCount);
+      __builtin_prefetch(&directory[bucket_idx[buffer][j]]);
+    }
+  };
+  size_t cur = 0;
+  size_t len = ::std::min(n, findBatchLen);
+  prepare(cur, 0, len);
+  for (size_t i = 0; i < n; i += findBatchLen) {
+    // hash and prefetch the next batch while this one is in flight
+    const size_t next = i + findBatchLen;
+    const size_t next_len = next < n ? ::std::min(n - next, findBatchLen) : 0;
+    prepare(cur ^ 1, next, next_len);
+    test(hash[cur], bucket_idx[cur], len, i);
+    cur ^= 1;
+    len = next_len;
+  }
+}
+
+const int blockShift = 14;
+const int blockLen = 1 << blockShift;
+
+// Lets the threads of simdBlockAddAllParallel() through together, once all
+// count of them have called Wait().
+class SimdBlockBarrier {
+ public:
+  explicit SimdBlockBarrier(const size_t count) : count_(count) {}
+  void Wait() {
+    ::std::unique_lock<::std::mutex> lock(mutex_);
+    const uint64_t round = round_;
+    if (++waiting_ == count_) {
+      waiting_ = 0;
+      round_++;
+      released_.notify_all();
+    } else {
+      released_.wait(lock, [&] { return round_ != round; });
+    }
+  }
+
+ private:
+  const size_t count_;
+  size_t waiting_ = 0;
+  uint64_t round_ = 0;
+  ::std::mutex mutex_;
+  ::std::condition_variable released_;
+};
+
+// The AddAllParallel() of the variants that have one. The keys go in rounds
+// of blockLen keys per thread, so that the scratch space stays at about
+// 16 bytes x blockLen x threads however many keys there are. In a round,
+// each of threads threads hashes a slice of the round's keys into
+// (hash, bucket_idx) pairs, partitioned by bucket range; then each thread
+// sets the bits of one partition with apply(pairs, len), len counting both
+// words of a pair. A partition is whole cache lines of bucketsPerLine
+// buckets, so that no two threads write to the same line and no atomics are
+// needed.
+template <typename HashFamily, typename Apply>
+void simdBlockAddAllParallel(const HashFamily& hasher, const uint32_t bucketCount,
+                             const uint32_t bucketsPerLine, const uint64_t* keys,
+                             const size_t start, const size_t end, const size_t threads,
+                             Apply apply) {
+    const uint64_t lines = (bucketCount + bucketsPerLine - 1) / bucketsPerLine;
+    const size_t round = (size_t)blockLen * threads;
+    // parts[t * threads + p] holds the pairs of the round hashed by thread t
+    // that land in partition p.
+    ::std::vector<::std::vector<uint64_t>> parts(threads * threads);
+    for (::std::vector<uint64_t>& part : parts) {
+        part.reserve(2 * blockLen / threads + 64);
+    }
+    SimdBlockBarrier barrier(threads);
+    auto work = [&](size_t t) {
+        for (size_t first = start; first < end; first += round) {
+            const size_t n = ::std::min(round, end - first);
+            const size_t from = first + n * t / threads;
+            const size_t to = first + n * (t + 1) / threads;
+            for (size_t p = 0; p < threads; p++) {
+                parts[t * threads + p].clear();
+            }
+            for (size_t i = from; i < to; i++) {
+                uint64_t hash = hasher(keys[i]);
+                uint32_t bucket_idx = reduce(rotl64(hash, 32), bucketCount);
+                size_t p = ((bucket_idx / bucketsPerLine) * threads) / lines;
+                ::std::vector<uint64_t>& out = parts[t * threads + p];
+                out.push_back(hash);
+                out.push_back(bucket_idx);
+            }
+            barrier.Wait();
+            for (size_t u = 0; u < threads; u++) {
+                const ::std::vector<uint64_t>& in = parts[u * threads + t];
+                apply(in.data(), in.size());
+            }
+            // the parts are refilled only once every thread is done with them
+            barrier.Wait();
+        }
+    };
+    ::std::vector<::std::thread> pool;
+    for (size_t t = 0; t < threads; t++) {
+        pool.emplace_back(work, t);
+    }
+    for (::std::thread& th : pool) {
+        th.join();
+    }
+}
+
+// The number of threads AddAllParallel() uses for n keys: one per core if
+// threads is 0, and 1 when there are too few keys to be worth it.
+inline size_t simdBlockAddThreads(size_t threads, const size_t n) {
+    if (threads == 0) {
+        threads = ::std::max(1u, ::std::thread::hardware_concurrency());
+    }
+    return n < (size_t)blockLen * threads ? 1 : threads;
+}
+
+#if CPUDISPATCH_X86
 #include <x86intrin.h>
 
+// The AVX2 kernels below are compiled with target attributes and chosen at run
+// time (see cpudispatch.h); the scalar versions set exactly the same bits, so a
+// filter built on one path can be queried on the other.
+
+// The odd rehashing contants of MakeMask, for the scalar kernels:
+static constexpr uint32_t simdBlockRehash[8] = {0x47b6137bU, 0x44974d91U,
+    0x8824ad5bU, 0xa2b7289dU, 0x705495c7U, 0x2df1424bU, 0x9efc4947U, 0x5c6bfb31U};
+
 template<typename HashFamily = ::hashing::SimpleMixSplit>
 class SimdBlockFilterFixed {
  private:
@@ -55,7 +200,8 @@ class SimdBlockFilterFixed {
 
  public:
   // Consumes at most (1 << log_heap_space) bytes on the heap:
-  explicit SimdBlockFilterFixed(const int bits);
+  explicit SimdBlockFilterFixed(const int bits,
+                                hugepage::policy pages = hugepage::default_policy());
   ~SimdBlockFilterFixed() noexcept;
   void Add(const uint64_t key) noexcept;
 
@@ -65,20 +211,59 @@ class SimdBlockFilterFixed {
   }
   void AddAll(const uint64_t* data, const size_t start, const size_t end);
 
+  // Add multiple items using several threads. Keys are radix-partitioned by
+  // bucket range so that each thread owns disjoint cache lines and needs no
+  // atomics. threads == 0 means one per core.
+  void AddAllParallel(const vector<uint64_t> & data, const size_t start, const size_t end,
+                      size_t threads = 0) {
+    return AddAllParallel(data.data(), start, end, threads);
+  }
+  void AddAllParallel(const uint64_t* data, const size_t start, const size_t end,
+                      size_t threads = 0);
+
   bool Find(const uint64_t key) const noexcept;
+  // Look up n keys at once. Bit i of out_bitmap (which must hold (n + 63) / 64
+  // words) is set if keys[i] may be in the filter.
+  void FindMany(const uint64_t* keys, const size_t n, uint64_t* out_bitmap) const noexcept;
   uint64_t SizeInBytes() const { return sizeof(Bucket) * bucketCount; }
+  // what the directory got, which may be less than asked for
+  hugepage::policy PageBacking() const { return hugepage::backing(directory_); }
 
  private:
   // A helper function for Insert()/Find(). Turns a 32-bit hash into a 256-bit Bucket
   // with 1 single 1-bit set in each 32-bit lane.
-  static __m256i MakeMask(const uint32_t hash) noexcept;
+  CPUDISPATCH_AVX2 static __m256i MakeMask(const uint32_t hash) noexcept;
+
+  CPUDISPATCH_AVX2 void AddAvx2(const uint64_t hash, const uint32_t bucket_idx) noexcept;
+  void AddScalar(const uint64_t hash, const uint32_t bucket_idx) noexcept;
+  CPUDISPATCH_AVX2 bool FindAvx2(const uint64_t hash, const uint32_t bucket_idx) const noexcept;
+  bool FindScalar(const uint64_t hash, const uint32_t bucket_idx) const noexcept;
+
+  // Sets the bits of len / 2 (hash, bucket_idx) pairs.
+  void ApplyPairs(const uint64_t* pairs, size_t len) noexcept;
+  CPUDISPATCH_AVX2 void ApplyPairsAvx2(const uint64_t* pairs, size_t len) noexcept;
+
+  // Tests one FindMany() batch; bit (first + j) of out_bitmap is set for hit j.
+  void FindBatch(const uint64_t* hash, const uint32_t* bucket_idx, size_t len,
+                 size_t first, uint64_t* out_bitmap) const noexcept;
+  CPUDISPATCH_AVX2 void FindBatchAvx2(const uint64_t* hash, const uint32_t* bucket_idx,
+                                      size_t len, size_t first,
+                                      uint64_t* out_bitmap) const noexcept;
 
   void ApplyBlock(uint64_t* tmp, int block, int len);
 
+  // A filter over a directory it does not own, for FilterImage (see
+  // filter_image.h), which clears directory_ before destroying it.
+  template <typename Table> friend struct FilterImage;
+  SimdBlockFilterFixed(const int bucket_count, const HashFamily &hasher,
+                       Bucket *directory) noexcept
+    : bucketCount(bucket_count), directory_(directory), hasher_(hasher) {}
+
 };
 
 template<typename HashFamily>
-SimdBlockFilterFixed<HashFamily>::SimdBlockFilterFixed(const int bits)
+SimdBlockFilterFixed<HashFamily>::SimdBlockFilterFixed(const int bits,
+                                                   hugepage::policy pages)
     // bits / 16: fpp 0.1777%, 75.1%
     // bits / 20: fpp 0.4384%, 63.4%
     // bits / 22: fpp 0.6692%, 61.1%
@@ -89,19 +274,14 @@ SimdBlockFilterFixed<HashFamily>::SimdBlockFilterFixed(const int bits)
   : bucketCount(::std::max(1, bits / 24)),
     directory_(nullptr),
     hasher_() {
-  if (!__builtin_cpu_supports("avx2")) {
-    throw ::std::runtime_error("SimdBlockFilterFixed does not work without AVX2 instructions");
-  }
   const size_t alloc_size = bucketCount * sizeof(Bucket);
-  const int malloc_failed =
-      posix_memalign(reinterpret_cast<void**>(&directory_), 64, alloc_size);
-  if (malloc_failed) throw ::std::bad_alloc();
-  memset(directory_, 0, alloc_size);
+  directory_ = static_cast<Bucket*>(hugepage::allocate(alloc_size, pages, true));
+  if (directory_ == nullptr) throw ::std::bad_alloc();
 }
 
 template<typename HashFamily>
 SimdBlockFilterFixed<HashFamily>::~SimdBlockFilterFixed() noexcept {
-  free(directory_);
+  hugepage::release(directory_);
   directory_ = nullptr;
 }
 
@@ -125,29 +305,57 @@ SimdBlockFilterFixed<HashFamily>::MakeMask(const uint32_t hash) noexcept {
 }
 
 template <typename HashFamily>
-[[gnu::always_inline]] inline void
-SimdBlockFilterFixed<HashFamily>::Add(const uint64_t key) noexcept {
-  const auto hash = hasher_(key);
-  const uint32_t bucket_idx = reduce(rotl64(hash, 32), bucketCount);
+inline void
+SimdBlockFilterFixed<HashFamily>::AddAvx2(const uint64_t hash, const uint32_t bucket_idx) noexcept {
   const __m256i mask = MakeMask(hash);
   __m256i* const bucket = &reinterpret_cast<__m256i*>(directory_)[bucket_idx];
   _mm256_store_si256(bucket, _mm256_or_si256(*bucket, mask));
 }
 
-const int blockShift = 14;
-const int blockLen = 1 << blockShift;
+template <typename HashFamily>
+inline void
+SimdBlockFilterFixed<HashFamily>::AddScalar(const uint64_t hash, const uint32_t bucket_idx) noexcept {
+  for (int i = 0; i < 8; i++) {
+    directory_[bucket_idx][i] |= 1U << ((uint32_t(hash) * simdBlockRehash[i]) >> 27);
+  }
+}
+
+template <typename HashFamily>
+[[gnu::always_inline]] inline void
+SimdBlockFilterFixed<HashFamily>::Add(const uint64_t key) noexcept {
+  const auto hash = hasher_(key);
+  const uint32_t bucket_idx = reduce(rotl64(hash, 32), bucketCount);
+  if (cpudispatch::avx2()) {
+    AddAvx2(hash, bucket_idx);
+  } else {
+    AddScalar(hash, bucket_idx);
+  }
+}
 
 template<typename HashFamily>
-void SimdBlockFilterFixed<HashFamily>::ApplyBlock(uint64_t* tmp, int block, int len) {
-    for (int i = 0; i < len; i += 2) {
-        uint64_t hash = tmp[(block << blockShift) + i];
-        uint32_t bucket_idx = tmp[(block << blockShift) + i + 1];
-        const __m256i mask = MakeMask(hash);
-        __m256i* const bucket = &reinterpret_cast<__m256i*>(directory_)[bucket_idx];
+void SimdBlockFilterFixed<HashFamily>::ApplyPairsAvx2(const uint64_t* pairs, size_t len) noexcept {
+    for (size_t i = 0; i < len; i += 2) {
+        const __m256i mask = MakeMask(pairs[i]);
+        __m256i* const bucket = &reinterpret_cast<__m256i*>(directory_)[pairs[i + 1]];
         _mm256_store_si256(bucket, _mm256_or_si256(*bucket, mask));
     }
 }
 
+template<typename HashFamily>
+void SimdBlockFilterFixed<HashFamily>::ApplyPairs(const uint64_t* pairs, size_t len) noexcept {
+    if (cpudispatch::avx2()) {
+        return ApplyPairsAvx2(pairs, len);
+    }
+    for (size_t i = 0; i < len; i += 2) {
+        AddScalar(pairs[i], pairs[i + 1]);
+    }
+}
+
+template<typename HashFamily>
+void SimdBlockFilterFixed<HashFamily>::ApplyBlock(uint64_t* tmp, int block, int len) {
+    ApplyPairs(tmp + (block << blockShift), len);
+}
+
 template<typename HashFamily>
 void SimdBlockFilterFixed<HashFamily>::AddAll(
     const uint64_t* keys, const size_t start, const size_t end) {
@@ -175,11 +383,21 @@ void SimdBlockFilterFixed<HashFamily>::AddAll(
     delete[] tmpLen;
 }
 
+template<typename HashFamily>
+void SimdBlockFilterFixed<HashFamily>::AddAllParallel(
+    const uint64_t* keys, const size_t start, const size_t end, size_t threads) {
+    threads = simdBlockAddThreads(threads, end - start);
+    if (threads == 1) {
+        return AddAll(keys, start, end);
+    }
+    // two 32-byte buckets per line
+    simdBlockAddAllParallel(hasher_, bucketCount, 2, keys, start, end, threads,
+                            [this](const uint64_t* pairs, size_t len) { ApplyPairs(pairs, len); });
+}
+
 template <typename HashFamily>
-[[gnu::always_inline]] inline bool
-SimdBlockFilterFixed<HashFamily>::Find(const uint64_t key) const noexcept {
-  const auto hash = hasher_(key);
-  const uint32_t bucket_idx = reduce(rotl64(hash, 32), bucketCount);
+inline bool
+SimdBlockFilterFixed<HashFamily>::FindAvx2(const uint64_t hash, const uint32_t bucket_idx) const noexcept {
   const __m256i mask = MakeMask(hash);
   const __m256i bucket = reinterpret_cast<__m256i*>(directory_)[bucket_idx];
   // We should return true if 'bucket' has a one wherever 'mask' does. _mm256_testc_si256
@@ -189,6 +407,58 @@ SimdBlockFilterFixed<HashFamily>::Find(const uint64_t key) const noexcept {
   return _mm256_testc_si256(bucket, mask);
 }
 
+template <typename HashFamily>
+inline bool
+SimdBlockFilterFixed<HashFamily>::FindScalar(const uint64_t hash, const uint32_t bucket_idx) const noexcept {
+  uint32_t missing = 0;
+  for (int i = 0; i < 8; i++) {
+    missing |= ~directory_[bucket_idx][i] & (1U << ((uint32_t(hash) * simdBlockRehash[i]) >> 27));
+  }
+  return missing == 0;
+}
+
+template <typename HashFamily>
+[[gnu::always_inline]] inline bool
+SimdBlockFilterFixed<HashFamily>::Find(const uint64_t key) const noexcept {
+  const auto hash = hasher_(key);
+  const uint32_t bucket_idx = reduce(rotl64(hash, 32), bucketCount);
+  if (cpudispatch::avx2()) {
+    return FindAvx2(hash, bucket_idx);
+  }
+  return FindScalar(hash, bucket_idx);
+}
+
+template <typename HashFamily>
+void SimdBlockFilterFixed<HashFamily>::FindBatchAvx2(
+    const uint64_t* hash, const uint32_t* bucket_idx, size_t len, size_t first,
+    uint64_t* out_bitmap) const noexcept {
+  for (size_t j = 0; j < len; j++) {
+    const __m256i mask = MakeMask(hash[j]);
+    const __m256i bucket = reinterpret_cast<__m256i*>(directory_)[bucket_idx[j]];
+    out_bitmap[(first + j) >> 6] |= uint64_t(_mm256_testc_si256(bucket, mask)) << ((first + j) & 63);
+  }
+}
+
+template <typename HashFamily>
+void SimdBlockFilterFixed<HashFamily>::FindBatch(
+    const uint64_t* hash, const uint32_t* bucket_idx, size_t len, size_t first,
+    uint64_t* out_bitmap) const noexcept {
+  if (cpudispatch::avx2()) {
+    return FindBatchAvx2(hash, bucket_idx, len, first, out_bitmap);
+  }
+  for (size_t j = 0; j < len; j++) {
+    out_bitmap[(first + j) >> 6] |= uint64_t(FindScalar(hash[j], bucket_idx[j])) << ((first + j) & 63);
+  }
+}
+
+template <typename HashFamily>
+void SimdBlockFilterFixed<HashFamily>::FindMany(
+    const uint64_t* keys, const size_t n, uint64_t* out_bitmap) const noexcept {
+  simdBlockFindMany(hasher_, directory_, bucketCount, keys, n, out_bitmap,
+                    [&](const uint64_t* hash, const uint32_t* bucket_idx, size_t len,
+                        size_t first) { FindBatch(hash, bucket_idx, len, first, out_bitmap); });
+}
+
 ///////////////////////////////////////////////////////////////////
 /// 64-byte version
 ///////////////////////////////////////////////////////////////////
@@ -201,6 +471,10 @@ struct mask64bytes {
 
 typedef struct mask64bytes mask64bytes_t;
 
+// MakeMask of the 64-byte version interleaves the eight rehashed lanes; 64-bit
+// word w of a bucket takes its bit from lane simdBlock64Lane[w].
+static constexpr int simdBlock64Lane[8] = {2, 3, 6, 7, 0, 1, 4, 5};
+
 template<typename HashFamily = ::hashing::SimpleMixSplit>
 class SimdBlockFilterFixed64 {
  private:
@@ -220,12 +494,23 @@ class SimdBlockFilterFixed64 {
   void Add(const uint64_t key) noexcept;
 
   bool Find(const uint64_t key) const noexcept;
+  // Batched lookup, see SimdBlockFilterFixed::FindMany.
+  void FindMany(const uint64_t* keys, const size_t n, uint64_t* out_bitmap) const noexcept;
   uint64_t SizeInBytes() const { return sizeof(Bucket) * bucketCount; }
 
  private:
-  static mask64bytes_t MakeMask(const uint64_t hash) noexcept;
-
-
+  CPUDISPATCH_AVX2 static mask64bytes_t MakeMask(const uint64_t hash) noexcept;
+
+  CPUDISPATCH_AVX2 void AddAvx2(const uint64_t hash, const uint32_t bucket_idx) noexcept;
+  void AddScalar(const uint64_t hash, const uint32_t bucket_idx) noexcept;
+  CPUDISPATCH_AVX2 bool FindAvx2(const uint64_t hash, const uint32_t bucket_idx) const noexcept;
+  bool FindScalar(const uint64_t hash, const uint32_t bucket_idx) const noexcept;
+
+  void FindBatch(const uint64_t* hash, const uint32_t* bucket_idx, size_t len,
+                 size_t first, uint64_t* out_bitmap) const noexcept;
+  CPUDISPATCH_AVX2 void FindBatchAvx2(const uint64_t* hash, const uint32_t* bucket_idx,
+                                      size_t len, size_t first,
+                                      uint64_t* out_bitmap) const noexcept;
 };
 
 template<typename HashFamily>
@@ -234,9 +519,6 @@ SimdBlockFilterFixed64<HashFamily>::SimdBlockFilterFixed64(const int bits)
   : bucketCount(::std::max(1, bits / 50)),
     directory_(nullptr),
     hasher_() {
-  if (!__builtin_cpu_supports("avx2")) {
-    throw ::std::runtime_error("SimdBlockFilterFixed64 does not work without AVX2 instructions");
-  }
   const size_t alloc_size = bucketCount * sizeof(Bucket);
   const int malloc_failed =
       posix_memalign(reinterpret_cast<void**>(&directory_), 64, alloc_size);
@@ -270,10 +552,8 @@ SimdBlockFilterFixed64<HashFamily>::MakeMask(const uint64_t hash) noexcept {
 }
 
 template <typename HashFamily>
-[[gnu::always_inline]] inline void
-SimdBlockFilterFixed64<HashFamily>::Add(const uint64_t key) noexcept {
-  const auto hash = hasher_(key);
-  const uint32_t bucket_idx = reduce(rotl64(hash, 32), bucketCount);
+inline void
+SimdBlockFilterFixed64<HashFamily>::AddAvx2(const uint64_t hash, const uint32_t bucket_idx) noexcept {
   mask64bytes_t mask = MakeMask(hash);
   mask64bytes_t* const bucket = &reinterpret_cast<mask64bytes_t*>(directory_)[bucket_idx];
   bucket->first = _mm256_or_si256(mask.first, bucket->first);
@@ -281,16 +561,91 @@ SimdBlockFilterFixed64<HashFamily>::Add(const uint64_t key) noexcept {
 }
 
 template <typename HashFamily>
-[[gnu::always_inline]] inline bool
-SimdBlockFilterFixed64<HashFamily>::Find(const uint64_t key) const noexcept {
+inline void
+SimdBlockFilterFixed64<HashFamily>::AddScalar(const uint64_t hash, const uint32_t bucket_idx) noexcept {
+  uint64_t* const bucket = reinterpret_cast<uint64_t*>(&directory_[bucket_idx]);
+  for (int w = 0; w < 8; w++) {
+    bucket[w] |= UINT64_C(1) << ((uint32_t(hash) * simdBlockRehash[simdBlock64Lane[w]]) >> 26);
+  }
+}
+
+template <typename HashFamily>
+[[gnu::always_inline]] inline void
+SimdBlockFilterFixed64<HashFamily>::Add(const uint64_t key) noexcept {
   const auto hash = hasher_(key);
   const uint32_t bucket_idx = reduce(rotl64(hash, 32), bucketCount);
+  if (cpudispatch::avx2()) {
+    AddAvx2(hash, bucket_idx);
+  } else {
+    AddScalar(hash, bucket_idx);
+  }
+}
+
+template <typename HashFamily>
+inline bool
+SimdBlockFilterFixed64<HashFamily>::FindAvx2(const uint64_t hash, const uint32_t bucket_idx) const noexcept {
   const mask64bytes_t mask = MakeMask(hash);
   const mask64bytes_t  bucket = reinterpret_cast<mask64bytes_t*>(directory_)[bucket_idx];
   return _mm256_testc_si256(bucket.first, mask.first) & _mm256_testc_si256(bucket.second, mask.second);
 }
 
-#endif //__AVX2__
+template <typename HashFamily>
+inline bool
+SimdBlockFilterFixed64<HashFamily>::FindScalar(const uint64_t hash, const uint32_t bucket_idx) const noexcept {
+  const uint64_t* const bucket = reinterpret_cast<const uint64_t*>(&directory_[bucket_idx]);
+  uint64_t missing = 0;
+  for (int w = 0; w < 8; w++) {
+    missing |= ~bucket[w] &
+               (UINT64_C(1) << ((uint32_t(hash) * simdBlockRehash[simdBlock64Lane[w]]) >> 26));
+  }
+  return missing == 0;
+}
+
+template <typename HashFamily>
+[[gnu::always_inline]] inline bool
+SimdBlockFilterFixed64<HashFamily>::Find(const uint64_t key) const noexcept {
+  const auto hash = hasher_(key);
+  const uint32_t bucket_idx = reduce(rotl64(hash, 32), bucketCount);
+  if (cpudispatch::avx2()) {
+    return FindAvx2(hash, bucket_idx);
+  }
+  return FindScalar(hash, bucket_idx);
+}
+
+template <typename HashFamily>
+void SimdBlockFilterFixed64<HashFamily>::FindBatchAvx2(
+    const uint64_t* hash, const uint32_t* bucket_idx, size_t len, size_t first,
+    uint64_t* out_bitmap) const noexcept {
+  for (size_t j = 0; j < len; j++) {
+    const mask64bytes_t mask = MakeMask(hash[j]);
+    const mask64bytes_t bucket = directory_[bucket_idx[j]];
+    const int found = _mm256_testc_si256(bucket.first, mask.first) &
+                      _mm256_testc_si256(bucket.second, mask.second);
+    out_bitmap[(first + j) >> 6] |= uint64_t(found) << ((first + j) & 63);
+  }
+}
+
+template <typename HashFamily>
+void SimdBlockFilterFixed64<HashFamily>::FindBatch(
+    const uint64_t* hash, const uint32_t* bucket_idx, size_t len, size_t first,
+    uint64_t* out_bitmap) const noexcept {
+  if (cpudispatch::avx2()) {
+    return FindBatchAvx2(hash, bucket_idx, len, first, out_bitmap);
+  }
+  for (size_t j = 0; j < len; j++) {
+    out_bitmap[(first + j) >> 6] |= uint64_t(FindScalar(hash[j], bucket_idx[j])) << ((first + j) & 63);
+  }
+}
+
+template <typename HashFamily>
+void SimdBlockFilterFixed64<HashFamily>::FindMany(
+    const uint64_t* keys, const size_t n, uint64_t* out_bitmap) const noexcept {
+  simdBlockFindMany(hasher_, directory_, bucketCount, keys, n, out_bitmap,
+                    [&](const uint64_t* hash, const uint32_t* bucket_idx, size_t len,
+                        size_t first) { FindBatch(hash, bucket_idx, len, first, out_bitmap); });
+}
+
+#endif // CPUDISPATCH_X86
 
 ///////////////////
 // 16-byte version ARM
@@ -312,7 +667,8 @@ class SimdBlockFilterFixed {
 
  public:
   // Consumes at most (1 << log_heap_space) bytes on the heap:
-  explicit SimdBlockFilterFixed(const int bits);
+  explicit SimdBlockFilterFixed(const int bits,
+                                hugepage::policy pages = hugepage::default_policy());
   ~SimdBlockFilterFixed() noexcept;
   void Add(const uint64_t key) noexcept;
 
@@ -323,33 +679,55 @@ class SimdBlockFilterFixed {
 
   void AddAll(const uint64_t* data, const size_t start, const size_t end);
 
+  // Add multiple items using several threads, as the x86 version does.
+  void AddAllParallel(const vector<uint64_t> & data, const size_t start, const size_t end,
+                      size_t threads = 0) {
+    return AddAllParallel(data.data(), start, end, threads);
+  }
+  void AddAllParallel(const uint64_t* data, const size_t start, const size_t end,
+                      size_t threads = 0);
+
   bool Find(const uint64_t key) const noexcept;
+  // Batched lookup, see the x86 SimdBlockFilterFixed::FindMany.
+  void FindMany(const uint64_t* keys, const size_t n, uint64_t* out_bitmap) const noexcept;
   uint64_t SizeInBytes() const { return sizeof(Bucket) * bucketCount; }
+  // what the directory got, which may be less than asked for
+  hugepage::policy PageBacking() const { return hugepage::backing(directory_); }
 
  private:
   // A helper function for Insert()/Find(). Turns a 32-bit hash into a 256-bit Bucket
   // with 1 single 1-bit set in each 32-bit lane.
   static Bucket MakeMask(const uint16_t hash) noexcept;
 
+  bool FindBucket(const uint64_t hash, const uint32_t bucket_idx) const noexcept;
+  // Sets the bits of len / 2 (hash, bucket_idx) pairs.
+  void ApplyPairs(const uint64_t* pairs, size_t len) noexcept;
+
   void ApplyBlock(uint64_t* tmp, int block, int len);
 
+  // A filter over a directory it does not own, for FilterImage (see
+  // filter_image.h), which clears directory_ before destroying it.
+  template <typename Table> friend struct FilterImage;
+  SimdBlockFilterFixed(const int bucket_count, const HashFamily &hasher,
+                       Bucket *directory) noexcept
+    : bucketCount(bucket_count), directory_(directory), hasher_(hasher) {}
+
 };
 
 template<typename HashFamily>
-SimdBlockFilterFixed<HashFamily>::SimdBlockFilterFixed(const int bits)
+SimdBlockFilterFixed<HashFamily>::SimdBlockFilterFixed(const int bits,
+                                                   hugepage::policy pages)
   : bucketCount(::std::max(1, bits / 10)),
     directory_(nullptr),
     hasher_() {
   const size_t alloc_size = bucketCount * sizeof(Bucket);
-  const int malloc_failed =
-      posix_memalign(reinterpret_cast<void**>(&directory_), 64, alloc_size);
-  if (malloc_failed) throw ::std::bad_alloc();
-  memset(directory_, 0, alloc_size);
+  directory_ = static_cast<Bucket*>(hugepage::allocate(alloc_size, pages, true));
+  if (directory_ == nullptr) throw ::std::bad_alloc();
 }
 
 template<typename HashFamily>
 SimdBlockFilterFixed<HashFamily>::~SimdBlockFilterFixed() noexcept {
-  free(directory_);
+  hugepage::release(directory_);
   directory_ = nullptr;
 }
 
@@ -375,11 +753,37 @@ SimdBlockFilterFixed<HashFamily>::Add(const uint64_t key) noexcept {
   directory_[bucket_idx] = vorrq_u16(mask, bucket);
 }
 
+template <typename HashFamily>
+void SimdBlockFilterFixed<HashFamily>::ApplyPairs(const uint64_t* pairs, size_t len) noexcept {
+  for (size_t i = 0; i < len; i += 2) {
+    directory_[pairs[i + 1]] = vorrq_u16(MakeMask(pairs[i]), directory_[pairs[i + 1]]);
+  }
+}
+
+template <typename HashFamily>
+void SimdBlockFilterFixed<HashFamily>::AddAll(
+    const uint64_t* keys, const size_t start, const size_t end) {
+  for (size_t i = start; i < end; i++) {
+    Add(keys[i]);
+  }
+}
+
+template<typename HashFamily>
+void SimdBlockFilterFixed<HashFamily>::AddAllParallel(
+    const uint64_t* keys, const size_t start, const size_t end, size_t threads) {
+  threads = simdBlockAddThreads(threads, end - start);
+  if (threads == 1) {
+    return AddAll(keys, start, end);
+  }
+  // four 16-byte buckets per line
+  simdBlockAddAllParallel(hasher_, bucketCount, 4, keys, start, end, threads,
+                          [this](const uint64_t* pairs, size_t len) { ApplyPairs(pairs, len); });
+}
+
 template <typename HashFamily>
 [[gnu::always_inline]] inline bool
-SimdBlockFilterFixed<HashFamily>::Find(const uint64_t key) const noexcept {
-  const auto hash = hasher_(key);
-  const uint32_t bucket_idx = reduce(rotl64(hash, 32), bucketCount);
+SimdBlockFilterFixed<HashFamily>::FindBucket(const uint64_t hash,
+                                             const uint32_t bucket_idx) const noexcept {
   const uint16x8_t mask = MakeMask(hash);
   const uint16x8_t bucket = directory_[bucket_idx];
   uint16x8_t an = vbicq_u16(mask, bucket);
@@ -389,6 +793,26 @@ SimdBlockFilterFixed<HashFamily>::Find(const uint64_t key) const noexcept {
   return vget_lane_u64(result, 0) == 0;
 }
 
+template <typename HashFamily>
+[[gnu::always_inline]] inline bool
+SimdBlockFilterFixed<HashFamily>::Find(const uint64_t key) const noexcept {
+  const auto hash = hasher_(key);
+  return FindBucket(hash, reduce(rotl64(hash, 32), bucketCount));
+}
+
+template <typename HashFamily>
+void SimdBlockFilterFixed<HashFamily>::FindMany(
+    const uint64_t* keys, const size_t n, uint64_t* out_bitmap) const noexcept {
+  simdBlockFindMany(hasher_, directory_, bucketCount, keys, n, out_bitmap,
+                    [&](const uint64_t* hash, const uint32_t* bucket_idx, size_t len,
+                        size_t first) {
+    for (size_t j = 0; j < len; j++) {
+      out_bitmap[(first + j) >> 6] |=
+          uint64_t(FindBucket(hash[j], bucket_idx[j])) << ((first + j) & 63);
+    }
+  });
+}
+
 
 
 #endif // __aarch64__
@@ -398,7 +822,7 @@ SimdBlockFilterFixed<HashFamily>::Find(const uint64_t key) const noexcept {
 /// 16-byte version (not very good)
 ///////////////////////////////////////////////////////////////////
 
-#ifdef __SSE41__
+#ifdef __SSE4_1__
 
 #include <smmintrin.h>
 
@@ -421,6 +845,8 @@ class SimdBlockFilterFixed16 {
   void Add(const uint64_t key) noexcept;
 
   bool Find(const uint64_t key) const noexcept;
+  // Batched lookup, see SimdBlockFilterFixed::FindMany.
+  void FindMany(const uint64_t* keys, const size_t n, uint64_t* out_bitmap) const noexcept;
   uint64_t SizeInBytes() const { return sizeof(Bucket) * bucketCount; }
 
  private:
@@ -485,4 +911,19 @@ SimdBlockFilterFixed16<HashFamily>::Find(const uint64_t key) const noexcept {
   return _mm_testc_si128(bucketvalue,mask);
 }
 
-#endif // #ifdef __SSE41__
+template <typename HashFamily>
+void SimdBlockFilterFixed16<HashFamily>::FindMany(
+    const uint64_t* keys, const size_t n, uint64_t* out_bitmap) const noexcept {
+  simdBlockFindMany(hasher_, directory_, bucketCount, keys, n, out_bitmap,
+                    [&](const uint64_t* hash, const uint32_t* bucket_idx, size_t len,
+                        size_t first) {
+    for (size_t j = 0; j < len; j++) {
+      const __m128i mask = MakeMask(hash[j]);
+      const __m128i bucketvalue = _mm_loadu_si128(directory_ + bucket_idx[j]);
+      out_bitmap[(first + j) >> 6] |=
+          uint64_t(_mm_testc_si128(bucketvalue, mask)) << ((first + j) & 63);
+    }
+  });
+}
+
+#endif // #ifdef __SSE4_1__
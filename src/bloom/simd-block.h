@@ -21,6 +21,7 @@
 #include <immintrin.h>
 
 #include "hashutil.h"
+#include "../cpudispatch.h"
 
 using uint32_t = ::std::uint32_t;
 using uint64_t = ::std::uint64_t;
@@ -65,7 +66,18 @@ class SimdBlockFilter {
  private:
   // A helper function for Insert()/Find(). Turns a 32-bit hash into a 256-bit Bucket
   // with 1 single 1-bit set in each 32-bit lane.
-  static __m256i MakeMask(const uint32_t hash) noexcept;
+  CPUDISPATCH_AVX2 static __m256i MakeMask(const uint32_t hash) noexcept;
+
+  // The AVX2 kernels are picked at run time (see cpudispatch.h); the scalar
+  // ones set and test exactly the same bits.
+  CPUDISPATCH_AVX2 void AddAvx2(const uint32_t hash, const uint32_t bucket_idx) noexcept;
+  void AddScalar(const uint32_t hash, const uint32_t bucket_idx) noexcept;
+  CPUDISPATCH_AVX2 bool FindAvx2(const uint32_t hash, const uint32_t bucket_idx) const noexcept;
+  bool FindScalar(const uint32_t hash, const uint32_t bucket_idx) const noexcept;
+
+  // Odd contants for hashing:
+  static constexpr uint32_t rehash_[8] = {0x47b6137bU, 0x44974d91U, 0x8824ad5bU,
+      0xa2b7289dU, 0x705495c7U, 0x2df1424bU, 0x9efc4947U, 0x5c6bfb31U};
 
   SimdBlockFilter(const SimdBlockFilter&) = delete;
   void operator=(const SimdBlockFilter&) = delete;
@@ -81,9 +93,6 @@ SimdBlockFilter<HashFamily>::SimdBlockFilter(const int log_heap_space)
     directory_mask_((1ull << ::std::min(63, log_num_buckets_)) - 1),
     directory_(nullptr),
     hasher_() {
-  if (!__builtin_cpu_supports("avx2")) {
-    throw ::std::runtime_error("SimdBlockFilter does not work without AVX2 instructions");
-  }
   const size_t alloc_size = 1ull << (log_num_buckets_ + LOG_BUCKET_BYTE_SIZE);
   const int malloc_failed =
       posix_memalign(reinterpret_cast<void**>(&directory_), 64, alloc_size);
@@ -117,21 +126,37 @@ SimdBlockFilter<HashFamily>::MakeMask(const uint32_t hash) noexcept {
 }
 
 template <typename HashFamily>
-[[gnu::always_inline]] inline void
-SimdBlockFilter<HashFamily>::Add(const uint64_t key) noexcept {
-  const auto hash = hasher_(key);
-  const uint32_t bucket_idx = hash & directory_mask_;
-  const __m256i mask = MakeMask(hash >> log_num_buckets_);
+inline void
+SimdBlockFilter<HashFamily>::AddAvx2(const uint32_t hash, const uint32_t bucket_idx) noexcept {
+  const __m256i mask = MakeMask(hash);
   __m256i* const bucket = &reinterpret_cast<__m256i*>(directory_)[bucket_idx];
   _mm256_store_si256(bucket, _mm256_or_si256(*bucket, mask));
 }
 
 template <typename HashFamily>
-[[gnu::always_inline]] inline bool
-SimdBlockFilter<HashFamily>::Find(const uint64_t key) const noexcept {
+inline void
+SimdBlockFilter<HashFamily>::AddScalar(const uint32_t hash, const uint32_t bucket_idx) noexcept {
+  for (int i = 0; i < 8; i++) {
+    directory_[bucket_idx][i] |= 1U << ((hash * rehash_[i]) >> 27);
+  }
+}
+
+template <typename HashFamily>
+[[gnu::always_inline]] inline void
+SimdBlockFilter<HashFamily>::Add(const uint64_t key) noexcept {
   const auto hash = hasher_(key);
   const uint32_t bucket_idx = hash & directory_mask_;
-  const __m256i mask = MakeMask(hash >> log_num_buckets_);
+  if (cpudispatch::avx2()) {
+    AddAvx2(hash >> log_num_buckets_, bucket_idx);
+  } else {
+    AddScalar(hash >> log_num_buckets_, bucket_idx);
+  }
+}
+
+template <typename HashFamily>
+inline bool
+SimdBlockFilter<HashFamily>::FindAvx2(const uint32_t hash, const uint32_t bucket_idx) const noexcept {
+  const __m256i mask = MakeMask(hash);
   const __m256i bucket = reinterpret_cast<__m256i*>(directory_)[bucket_idx];
   // We should return true if 'bucket' has a one wherever 'mask' does. _mm256_testc_si256
   // takes the negation of its first argument and ands that with its second argument. In
@@ -140,4 +165,25 @@ SimdBlockFilter<HashFamily>::Find(const uint64_t key) const noexcept {
   return _mm256_testc_si256(bucket, mask);
 }
 
+template <typename HashFamily>
+inline bool
+SimdBlockFilter<HashFamily>::FindScalar(const uint32_t hash, const uint32_t bucket_idx) const noexcept {
+  uint32_t missing = 0;
+  for (int i = 0; i < 8; i++) {
+    missing |= ~directory_[bucket_idx][i] & (1U << ((hash * rehash_[i]) >> 27));
+  }
+  return missing == 0;
+}
+
+template <typename HashFamily>
+[[gnu::always_inline]] inline bool
+SimdBlockFilter<HashFamily>::Find(const uint64_t key) const noexcept {
+  const auto hash = hasher_(key);
+  const uint32_t bucket_idx = hash & directory_mask_;
+  if (cpudispatch::avx2()) {
+    return FindAvx2(hash >> log_num_buckets_, bucket_idx);
+  }
+  return FindScalar(hash >> log_num_buckets_, bucket_idx);
+}
+
 
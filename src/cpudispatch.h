@@ -0,0 +1,89 @@
+// Runtime CPU feature dispatch.
+//
+// Filters with hand-written SIMD kernels compile them with target attributes
+// (CPUDISPATCH_AVX2, CPUDISPATCH_AVX512) instead of requiring -mavx2 or
+// -march=native on the command line, and pick a kernel at run time from the
+// ISA level selected here, once, at startup. A single binary then uses the
+// fastest path each host supports.
+//
+// The level can be lowered (never raised) with the FILTER_ISA environment
+// variable, e.g. FILTER_ISA=scalar, to benchmark the fallbacks on a fast box.
+
+#ifndef CPUDISPATCH_H_
+#define CPUDISPATCH_H_
+
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CPUDISPATCH_X86 1
+#include <immintrin.h>
+#define CPUDISPATCH_AVX2 __attribute__((target("avx2,bmi,bmi2,lzcnt,popcnt")))
+#define CPUDISPATCH_AVX512                                                     \
+  __attribute__((target(                                                       \
+      "avx512f,avx512bw,avx512vl,avx512vbmi,avx2,bmi,bmi2,lzcnt,popcnt")))
+#else
+#define CPUDISPATCH_X86 0
+#endif
+
+namespace cpudispatch {
+
+// avx2 is the x86-64-v3 level (AVX2 + BMI1/BMI2 + LZCNT); avx512 adds
+// AVX-512 BW/VL/VBMI.
+enum class isa { scalar = 0, avx2 = 1, avx512 = 2 };
+
+inline const char *isa_name(isa i) {
+  switch (i) {
+  case isa::avx512:
+    return "avx512";
+  case isa::avx2:
+    return "avx2";
+  default:
+    return "scalar";
+  }
+}
+
+inline isa detect() {
+#if CPUDISPATCH_X86
+  __builtin_cpu_init();
+  const bool v3 = __builtin_cpu_supports("avx2") &&
+                  __builtin_cpu_supports("bmi") &&
+                  __builtin_cpu_supports("bmi2");
+  if (v3 && __builtin_cpu_supports("avx512bw") &&
+      __builtin_cpu_supports("avx512vl") &&
+      __builtin_cpu_supports("avx512vbmi")) {
+    return isa::avx512;
+  }
+  if (v3) {
+    return isa::avx2;
+  }
+#endif
+  return isa::scalar;
+}
+
+inline isa select() {
+  isa best = detect();
+  const char *env = getenv("FILTER_ISA");
+  if (env == nullptr) {
+    return best;
+  }
+  isa wanted = best;
+  if (strcmp(env, "scalar") == 0) {
+    wanted = isa::scalar;
+  } else if (strcmp(env, "avx2") == 0) {
+    wanted = isa::avx2;
+  } else if (strcmp(env, "avx512") == 0) {
+    wanted = isa::avx512;
+  }
+  return (wanted < best) ? wanted : best;
+}
+
+// Selected once, during static initialization.
+inline const isa selected = select();
+
+inline bool avx2() { return selected >= isa::avx2; }
+inline bool avx512() { return selected >= isa::avx512; }
+
+} // namespace cpudispatch
+
+#endif // CPUDISPATCH_H_
@@ -145,6 +145,16 @@ namespace cuckoofilter
     // Report if the item is inserted, with false positive rate.
     Status Contain(const ItemType &item) const;
 
+    // Contain() split in two for software-pipelined batches, see
+    // CuckooFilter::ContainStart.
+    struct ContainState
+    {
+      size_t i1, i2;
+      uint32_t tag;
+    };
+    void ContainStart(const ItemType &item, ContainState *s) const;
+    Status ContainFinish(const ContainState &s) const;
+
     // Delete an key from the filter
     Status Delete(const ItemType &item);
 
@@ -234,6 +244,34 @@ namespace cuckoofilter
     }
   }
 
+  template <typename ItemType, size_t bits_per_item,
+            template <size_t> class TableType, typename HashFamily>
+  void CuckooFilterStable<ItemType, bits_per_item, TableType, HashFamily>::ContainStart(
+      const ItemType &key, ContainState *s) const
+  {
+    GenerateIndexTagHash(key, &s->i1, &s->tag);
+    s->i2 = AltIndex(s->i1, s->tag);
+    table_->PrefetchBucket(s->i1);
+    table_->PrefetchBucket(s->i2);
+  }
+
+  template <typename ItemType, size_t bits_per_item,
+            template <size_t> class TableType, typename HashFamily>
+  Status CuckooFilterStable<ItemType, bits_per_item, TableType, HashFamily>::ContainFinish(
+      const ContainState &s) const
+  {
+    bool found = victim_.used && (s.tag == victim_.tag) &&
+                 (s.i1 == victim_.index || s.i2 == victim_.index);
+    if (found || table_->FindTagInBuckets(s.i1, s.i2, s.tag))
+    {
+      return Ok;
+    }
+    else
+    {
+      return NotFound;
+    }
+  }
+
   template <typename ItemType, size_t bits_per_item,
             template <size_t> class TableType, typename HashFamily>
   Status CuckooFilterStable<ItemType, bits_per_item, TableType, HashFamily>::Delete(
@@ -41,6 +41,11 @@ class PackedTable {
     return num_buckets_;
   }
 
+  // hint that bucket i is about to be read
+  void PrefetchBucket(const size_t i) const {
+    __builtin_prefetch(buckets_ + (kBitsPerBucket * i) / 8);
+  }
+
   size_t SizeInTags() const { 
     return 4 * num_buckets_; 
   }
@@ -45,6 +45,11 @@ class SingleTable {
     return num_buckets_;
   }
 
+  // hint that bucket i is about to be read
+  void PrefetchBucket(const size_t i) const {
+    __builtin_prefetch(buckets_[i].bits_);
+  }
+
   size_t SizeInBytes() const { 
     return kBytesPerBucket * num_buckets_; 
   }
@@ -0,0 +1,212 @@
+// Hot swap of a live, immutable filter.
+//
+// The static filters (xor, binary fuse, ribbon, ...) cannot be updated in
+// place, so a new key set means a new filter. FilterHandle owns the current
+// one behind an atomic pointer: a builder thread constructs (or maps) the
+// replacement on the side and Publish()es it, and query threads keep going
+// without ever taking a lock.
+//
+// The old filter is freed by epoch-based reclamation. Every query thread
+// holds a Reader, which owns one slot of the handle. For the duration of a
+// lookup the slot holds the global epoch read on entry; Publish() swaps the
+// pointer, advances the epoch and retires the old filter tagged with the new
+// epoch. A retired filter is freed once every slot is idle or shows an epoch
+// at least that recent -- such a reader loaded the pointer after the swap.
+// A reader costs one load and one store around each lookup (or batch of
+// lookups, see Reader::Read).
+//
+// Publish() also reports how long the swap took and, once it is known, how
+// long the old filter took to drain (see SwapStats).
+
+#ifndef FILTER_HANDLE_H_
+#define FILTER_HANDLE_H_
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+template <typename Table> struct FilterAPI;
+
+struct SwapStats {
+  size_t swaps = 0;
+  size_t reclaimed = 0;
+  // filters retired but still possibly in use
+  size_t pending = 0;
+  // pointer exchange and epoch advance, as seen by the publisher
+  uint64_t last_publish_ns = 0;
+  uint64_t max_publish_ns = 0;
+  // from Publish() to the old filter being freed
+  uint64_t last_drain_ns = 0;
+  uint64_t max_drain_ns = 0;
+};
+
+// Deleter is whatever frees a published filter: delete by default, an munmap
+// for a filter mapped from a file.
+template <typename Table, typename Deleter = std::default_delete<Table>>
+class FilterHandle {
+  struct Slot;
+
+ public:
+  using pointer = std::unique_ptr<Table, Deleter>;
+
+  // At most max_readers Readers may exist at the same time.
+  explicit FilterHandle(pointer initial, size_t max_readers = 256)
+      : slots_(max_readers), current_(initial.release()) {}
+
+  FilterHandle(const FilterHandle &) = delete;
+  FilterHandle &operator=(const FilterHandle &) = delete;
+
+  // All Readers must be gone.
+  ~FilterHandle() {
+    for (Retired &r : retired_) {
+      deleter_(r.table);
+    }
+    if (current_.load() != nullptr) {
+      deleter_(current_.load());
+    }
+  }
+
+  class Reader {
+   public:
+    explicit Reader(FilterHandle &handle) : handle_(handle), slot_(handle.Claim()) {}
+    Reader(const Reader &) = delete;
+    Reader &operator=(const Reader &) = delete;
+    ~Reader() { slot_->in_use.store(false, std::memory_order_release); }
+
+    // Calls f(Table *) on the current filter; the filter stays alive until f
+    // returns. Use it to amortize the entry cost over a batch of lookups.
+    // Calls must not nest.
+    template <typename F>
+    auto Read(const F &f) {
+      // The epoch load must be acquire (here seq_cst), pairing with the
+      // publisher's fetch_add: a reader that sees epoch e then also sees the
+      // pointer exchanged before e was published, so the filter it loads was
+      // not retired at e or earlier. A relaxed load could return e with the
+      // previous pointer, which Publish() frees once the slot shows e. The
+      // slot store and the pointer load are seq_cst so that the reclaimer
+      // either sees the slot or the reader sees the new pointer.
+      slot_->epoch.store(handle_.epoch_.load(std::memory_order_seq_cst));
+      Table *table = handle_.current_.load();
+      struct Exit {
+        Slot *slot;
+        ~Exit() { slot->epoch.store(0, std::memory_order_release); }
+      } exit{slot_};
+      return f(table);
+    }
+
+    bool Contain(uint64_t key) {
+      return Read([key](Table *table) { return FilterAPI<Table>::Contain(key, table); });
+    }
+
+   private:
+    FilterHandle &handle_;
+    Slot *slot_;
+  };
+
+  // Makes next the filter new lookups see and retires the previous one. Safe
+  // to call from several threads; never waits for readers.
+  void Publish(pointer next) {
+    std::lock_guard<std::mutex> lock(publish_mutex_);
+    const auto start = std::chrono::steady_clock::now();
+    Table *old = current_.exchange(next.release());
+    const uint64_t epoch = epoch_.fetch_add(1) + 1;
+    const auto published = std::chrono::steady_clock::now();
+    const uint64_t ns = Nanoseconds(published - start);
+    stats_.swaps++;
+    stats_.last_publish_ns = ns;
+    stats_.max_publish_ns = std::max(stats_.max_publish_ns, ns);
+    if (old != nullptr) {
+      retired_.push_back({old, epoch, start});
+    }
+    ReclaimLocked();
+  }
+
+  // Frees the retired filters no reader can still see; returns how many
+  // remain. Publish() calls it too, so a builder that publishes regularly
+  // need not.
+  size_t Reclaim() {
+    std::lock_guard<std::mutex> lock(publish_mutex_);
+    return ReclaimLocked();
+  }
+
+  SwapStats Stats() {
+    std::lock_guard<std::mutex> lock(publish_mutex_);
+    SwapStats s = stats_;
+    s.pending = retired_.size();
+    return s;
+  }
+
+ private:
+  struct alignas(64) Slot {
+    // 0 when the reader is not in a lookup
+    std::atomic<uint64_t> epoch{0};
+    std::atomic<bool> in_use{false};
+  };
+
+  struct Retired {
+    Table *table;
+    uint64_t epoch;
+    std::chrono::steady_clock::time_point since;
+  };
+
+  static uint64_t Nanoseconds(std::chrono::steady_clock::duration d) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(d).count();
+  }
+
+  Slot *Claim() {
+    for (Slot &s : slots_) {
+      bool expected = false;
+      if (!s.in_use.load(std::memory_order_relaxed) &&
+          s.in_use.compare_exchange_strong(expected, true)) {
+        return &s;
+      }
+    }
+    throw std::runtime_error("FilterHandle: too many readers");
+  }
+
+  size_t ReclaimLocked() {
+    if (retired_.empty()) {
+      return 0;
+    }
+    // the oldest epoch a reader is in
+    uint64_t oldest = UINT64_MAX;
+    for (Slot &s : slots_) {
+      const uint64_t e = s.epoch.load();
+      if (e != 0 && e < oldest) {
+        oldest = e;
+      }
+    }
+    const auto now = std::chrono::steady_clock::now();
+    size_t kept = 0;
+    for (Retired &r : retired_) {
+      if (r.epoch <= oldest) {
+        deleter_(r.table);
+        const uint64_t ns = Nanoseconds(now - r.since);
+        stats_.reclaimed++;
+        stats_.last_drain_ns = ns;
+        stats_.max_drain_ns = std::max(stats_.max_drain_ns, ns);
+      } else {
+        retired_[kept++] = r;
+      }
+    }
+    retired_.resize(kept);
+    return kept;
+  }
+
+  std::vector<Slot> slots_;
+  std::atomic<Table *> current_;
+  // starts at 1 so that 0 can mean idle
+  std::atomic<uint64_t> epoch_{1};
+  Deleter deleter_;
+  std::mutex publish_mutex_;
+  std::vector<Retired> retired_;
+  SwapStats stats_;
+};
+
+#endif // FILTER_HANDLE_H_
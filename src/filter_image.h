@@ -0,0 +1,208 @@
+// Filters as flat images.
+//
+// A built static filter is a few scalars and one or two arrays scattered on
+// the heap. FilterImage<Table> copies it into one contiguous block and makes
+// a working filter over such a block without copying it back, which is what
+// placing a filter in shared memory (shm_filter.h) or on a given NUMA node
+// (numa_filter.h) takes. Specialized for the xor, 4-wise binary fuse,
+// blocked Bloom and balanced ribbon filters.
+
+#ifndef FILTER_IMAGE_H_
+#define FILTER_IMAGE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <typeinfo>
+
+#include "filterapi.h"
+
+// How a filter is laid out as a flat image. Write() stores table in the
+// Bytes(table) bytes at image, which are zeroed and 64-byte aligned; the
+// scalar state comes first, then the arrays, each 64-byte aligned. View()
+// constructs at where a table that looks keys up in the arrays of an image;
+// Release() destroys it, leaving them alone.
+template <typename Table> struct FilterImage;
+
+namespace filter_image {
+inline size_t Align(size_t bytes) { return (bytes + 63) & ~size_t(63); }
+
+// Identifies the type of filter an image was written from, so that it is
+// not read back as another one: a hash of the type's name, which holds for
+// the build that wrote it.
+template <typename Table> uint64_t TypeHash() {
+  // FNV-1a
+  uint64_t h = 0xcbf29ce484222325ULL;
+  for (const char *c = typeid(Table).name(); *c != 0; c++) {
+    h = (h ^ (unsigned char)*c) * 0x100000001b3ULL;
+  }
+  return h;
+}
+} // namespace filter_image
+
+template <typename ItemType, typename FingerprintType, typename HashFamily>
+struct FilterImage<xorfilter::XorFilter<ItemType, FingerprintType, HashFamily>> {
+  using Table = xorfilter::XorFilter<ItemType, FingerprintType, HashFamily>;
+  static_assert(std::is_trivially_copyable<HashFamily>::value,
+                "the hash function is copied byte for byte");
+  struct State {
+    size_t size;
+    size_t arrayLength;
+    size_t blockLength;
+    HashFamily hasher;
+  };
+
+  static size_t Bytes(const Table &table) {
+    return filter_image::Align(sizeof(State)) + table.arrayLength * sizeof(FingerprintType);
+  }
+  static void Write(const Table &table, char *image) {
+    State s{table.size, table.arrayLength, table.blockLength, *table.hasher};
+    memcpy(image, &s, sizeof(s));
+    memcpy(image + filter_image::Align(sizeof(State)), table.fingerprints,
+           table.arrayLength * sizeof(FingerprintType));
+  }
+  static void View(const char *image, Table *where) {
+    const State *s = reinterpret_cast<const State *>(image);
+    // the smallest filter, whose array is then swapped for the image's
+    Table *table = new (where) Table(0);
+    delete[] table->fingerprints;
+    table->size = s->size;
+    table->arrayLength = s->arrayLength;
+    table->blockLength = s->blockLength;
+    *table->hasher = s->hasher;
+    table->fingerprints = reinterpret_cast<FingerprintType *>(
+        const_cast<char *>(image) + filter_image::Align(sizeof(State)));
+  }
+  static void Release(Table *view) {
+    view->fingerprints = nullptr;
+    view->~Table();
+  }
+};
+
+template <typename ItemType, typename FingerprintType, typename HashFamily>
+struct FilterImage<xorbinaryfusefilter_lowmem4wise::XorBinaryFuseFilter<
+    ItemType, FingerprintType, HashFamily>> {
+  using Table = xorbinaryfusefilter_lowmem4wise::XorBinaryFuseFilter<
+      ItemType, FingerprintType, HashFamily>;
+  static_assert(std::is_trivially_copyable<HashFamily>::value,
+                "the hash function is copied byte for byte");
+  struct State {
+    size_t size;
+    size_t arrayLength;
+    size_t segmentCount;
+    size_t segmentCountLength;
+    size_t segmentLength;
+    size_t segmentLengthMask;
+    HashFamily hasher;
+  };
+
+  static size_t Bytes(const Table &table) {
+    return filter_image::Align(sizeof(State)) + table.arrayLength * sizeof(FingerprintType);
+  }
+  static void Write(const Table &table, char *image) {
+    State s{table.size,          table.arrayLength,
+            table.segmentCount,  table.segmentCountLength,
+            table.segmentLength, table.segmentLengthMask,
+            *table.hasher};
+    memcpy(image, &s, sizeof(s));
+    memcpy(image + filter_image::Align(sizeof(State)), table.fingerprints,
+           table.arrayLength * sizeof(FingerprintType));
+  }
+  static void View(const char *image, Table *where) {
+    const State *s = reinterpret_cast<const State *>(image);
+    // a small filter (the segment length is undefined for none), whose array
+    // is then swapped for the image's
+    Table *table = new (where) Table(64);
+    delete[] table->fingerprints;
+    table->size = s->size;
+    table->arrayLength = s->arrayLength;
+    table->segmentCount = s->segmentCount;
+    table->segmentCountLength = s->segmentCountLength;
+    table->segmentLength = s->segmentLength;
+    table->segmentLengthMask = s->segmentLengthMask;
+    *table->hasher = s->hasher;
+    table->fingerprints = reinterpret_cast<FingerprintType *>(
+        const_cast<char *>(image) + filter_image::Align(sizeof(State)));
+  }
+  static void Release(Table *view) {
+    view->fingerprints = nullptr;
+    view->~Table();
+  }
+};
+
+#if CPUDISPATCH_X86 || defined(__aarch64__)
+template <typename HashFamily>
+struct FilterImage<SimdBlockFilterFixed<HashFamily>> {
+  using Table = SimdBlockFilterFixed<HashFamily>;
+  using Bucket = typename Table::Bucket;
+  static_assert(std::is_trivially_copyable<HashFamily>::value,
+                "the hash function is copied byte for byte");
+  struct State {
+    int bucketCount;
+    HashFamily hasher;
+  };
+
+  static size_t Bytes(const Table &table) {
+    return filter_image::Align(sizeof(State)) + table.SizeInBytes();
+  }
+  static void Write(const Table &table, char *image) {
+    State s{table.bucketCount, table.hasher_};
+    memcpy(image, &s, sizeof(s));
+    memcpy(image + filter_image::Align(sizeof(State)), table.directory_,
+           table.SizeInBytes());
+  }
+  static void View(const char *image, Table *where) {
+    const State *s = reinterpret_cast<const State *>(image);
+    new (where) Table(s->bucketCount, s->hasher,
+                      reinterpret_cast<Bucket *>(const_cast<char *>(image) +
+                                                 filter_image::Align(sizeof(State))));
+  }
+  static void Release(Table *view) {
+    view->directory_ = nullptr;
+    view->~Table();
+  }
+};
+#endif
+
+template <typename CoeffType, uint32_t kNumColumns, uint32_t kMinPctOverhead,
+          uint32_t kMilliBitsPerKey>
+struct FilterImage<BalancedRibbonFilter<CoeffType, kNumColumns, kMinPctOverhead,
+                                        kMilliBitsPerKey>> {
+  using Table = BalancedRibbonFilter<CoeffType, kNumColumns, kMinPctOverhead,
+                                     kMilliBitsPerKey>;
+  struct State {
+    uint32_t log2_vshards;
+    uint64_t num_slots;
+    uint64_t bytes;
+    uint64_t num_starts;
+    uint64_t meta_bytes;
+  };
+
+  static size_t Bytes(const Table &table) {
+    return filter_image::Align(sizeof(State)) + filter_image::Align(table.bytes) +
+           table.meta_bytes;
+  }
+  static void Write(const Table &table, char *image) {
+    if (!table.ptr) {
+      throw std::invalid_argument("FilterImage: a view cannot be written");
+    }
+    State s{table.log2_vshards, table.num_slots, table.bytes,
+            table.soln.GetNumStarts(), table.meta_bytes};
+    memcpy(image, &s, sizeof(s));
+    char *data = image + filter_image::Align(sizeof(State));
+    memcpy(data, table.ptr.get(), table.bytes);
+    memcpy(data + filter_image::Align(table.bytes), table.meta_ptr.get(), table.meta_bytes);
+  }
+  static void View(const char *image, Table *where) {
+    const State *s = reinterpret_cast<const State *>(image);
+    char *data = const_cast<char *>(image) + filter_image::Align(sizeof(State));
+    new (where) Table(s->log2_vshards, s->num_slots, s->bytes, s->num_starts, data,
+                      s->meta_bytes, data + filter_image::Align(s->bytes));
+  }
+  static void Release(Table *view) { view->~Table(); }
+};
+
+#endif // FILTER_IMAGE_H_
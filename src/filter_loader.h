@@ -0,0 +1,840 @@
+// Loading filters and key sets from disk at the speed of the disk.
+//
+// Reading a file of a few GB with read() or an ifstream does one request at
+// a time and leaves the checking and parsing until after, on the same
+// thread; mapping it instead moves the I/O to page faults, which the first
+// queries then pay for. The functions below split a file into chunks, keep
+// many aligned reads of them in flight, and verify or parse each chunk as it
+// arrives while the next ones are being read:
+//
+//   uring    io_uring, raw system calls (no liburing needed); the calling
+//            thread submits the reads and reaps them
+//   threads  a pool of threads doing pread(), for kernels without io_uring
+//            or where it is not allowed (seccomp); picked automatically
+//
+// A chunk whose destination, file offset and length are multiples of 4 KB is
+// read with O_DIRECT, bypassing the page cache, where the filesystem allows
+// it.
+//
+// Files:
+//
+//   SaveFilter / LoadedFilter  a filter's image (see FilterImage): the
+//       fingerprint arrays are read straight into the memory the filter is
+//       then queried from, with a checksum per chunk, checked on arrival
+//   WriteKeys / ReadKeys       a key set: 64-bit keys, read straight into a
+//       vector, checksummed the same way
+//   HashLines                  a text file of URLs, one per line, hashed as
+//       the contiguous part of the file grows
+//
+// Filter and key files start with a header (magic, version, filter type,
+// sizes, chunk size) and the table of chunk checksums; the data follows at
+// the next 4 KB boundary. Like segments (shm_filter.h), they are meant to be
+// read by the build that wrote them.
+
+#ifndef FILTER_LOADER_H_
+#define FILTER_LOADER_H_
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#if defined(__linux__) && defined(__NR_io_uring_setup)
+#include <linux/io_uring.h>
+#define FILTER_LOADER_URING 1
+#else
+#define FILTER_LOADER_URING 0
+#endif
+
+#include "filter_image.h"
+#include "filterapi.h"
+
+namespace loader {
+
+enum backend { automatic, uring, threads };
+
+inline const char *name(backend b) {
+  switch (b) {
+  case uring:
+    return "uring";
+  case threads:
+    return "threads";
+  default:
+    return "auto";
+  }
+}
+
+struct Options {
+  backend use = automatic;
+  // bytes per read, rounded up to 4 KB; for filter and key files, the chunk
+  // size they were written with is used instead
+  size_t chunk_bytes = size_t(1) << 20;
+  // reads in flight
+  unsigned queue_depth = 32;
+  // pread threads, for the thread backend
+  unsigned threads = 4;
+  // O_DIRECT for the aligned chunks
+  bool direct = true;
+};
+
+struct Stats {
+  backend used = automatic;
+  size_t bytes = 0;
+  double seconds = 0;
+};
+
+constexpr size_t kAlignment = 4096;
+
+inline size_t RoundUp(size_t n, size_t to) { return (n + to - 1) / to * to; }
+
+[[noreturn]] inline void Fail(int error, const char *what, const std::string &path) {
+  throw std::system_error(error, std::generic_category(),
+                          std::string("loader: ") + what + " " + path);
+}
+
+// A fast 64-bit checksum (four lanes of xxHash64 rounds). Not
+// cryptographic: it catches torn and truncated files, and disk errors.
+inline uint64_t Checksum(const void *data, size_t bytes) {
+  constexpr uint64_t P1 = 0x9E3779B185EBCA87ULL, P2 = 0xC2B2AE3D27D4EB4FULL;
+  auto round = [](uint64_t acc, uint64_t w) {
+    acc += w * P2;
+    acc = (acc << 31) | (acc >> 33);
+    return acc * P1;
+  };
+  const char *p = static_cast<const char *>(data);
+  uint64_t lane[4] = {P1 + P2, P2, 0, 0 - P1};
+  size_t i = 0;
+  for (; i + 32 <= bytes; i += 32) {
+    for (int l = 0; l < 4; l++) {
+      uint64_t w;
+      memcpy(&w, p + i + 8 * l, 8);
+      lane[l] = round(lane[l], w);
+    }
+  }
+  uint64_t h = bytes;
+  for (int l = 0; l < 4; l++) {
+    h = round(h, lane[l]);
+  }
+  for (; i < bytes; i++) {
+    h = round(h, (unsigned char)p[i]);
+  }
+  h ^= h >> 33;
+  h *= P2;
+  return h ^ (h >> 29);
+}
+
+// A file open for reading, once buffered and, where possible, once with
+// O_DIRECT.
+class File {
+ public:
+  File(const std::string &path, bool direct) : path_(path) {
+    fd_ = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd_ < 0) {
+      Fail(errno, "open", path);
+    }
+    struct stat st;
+    if (fstat(fd_, &st) != 0) {
+      const int error = errno;
+      close(fd_);
+      Fail(error, "fstat", path);
+    }
+    size_ = st.st_size;
+#ifdef O_DIRECT
+    if (direct) {
+      // -1 where the filesystem does not do direct I/O (tmpfs)
+      direct_ = open(path.c_str(), O_RDONLY | O_CLOEXEC | O_DIRECT);
+    }
+#else
+    (void)direct;
+#endif
+  }
+  File(const File &) = delete;
+  File &operator=(const File &) = delete;
+  ~File() {
+    close(fd_);
+    if (direct_ >= 0) {
+      close(direct_);
+    }
+  }
+
+  size_t size() const { return size_; }
+  const std::string &path() const { return path_; }
+
+  // The descriptor to read length bytes at offset into dest with.
+  int For(const char *dest, uint64_t offset, size_t length) const {
+    const bool aligned = reinterpret_cast<uintptr_t>(dest) % kAlignment == 0 &&
+                         offset % kAlignment == 0 && length % kAlignment == 0;
+    return aligned && direct_ >= 0 ? direct_ : fd_;
+  }
+
+  // Reads exactly length bytes at offset, on the calling thread.
+  void ReadFully(char *dest, uint64_t offset, size_t length) const {
+    while (length > 0) {
+      const ssize_t n = pread(fd_, dest, length, offset);
+      if (n <= 0) {
+        if (n < 0 && errno == EINTR) {
+          continue;
+        }
+        Fail(n == 0 ? EIO : errno, "read", path_);
+      }
+      dest += n;
+      offset += n;
+      length -= n;
+    }
+  }
+
+ private:
+  std::string path_;
+  int fd_ = -1;
+  int direct_ = -1;
+  size_t size_ = 0;
+};
+
+namespace detail {
+
+struct Chunk {
+  // relative to the start of the read
+  size_t position;
+  size_t length;
+  // what the file has of it: less than length at the end of the file
+  size_t needed;
+  // read so far, when the kernel returned less
+  size_t done;
+  iovec io;
+};
+
+#if FILTER_LOADER_URING
+// A submission and a completion queue, mapped from the kernel.
+class Ring {
+ public:
+  explicit Ring(unsigned entries) {
+    io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    fd_ = int(syscall(__NR_io_uring_setup, entries, &p));
+    if (fd_ < 0) {
+      return;
+    }
+    sq_bytes_ = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cq_bytes_ = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    const bool single = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single) {
+      sq_bytes_ = cq_bytes_ = std::max(sq_bytes_, cq_bytes_);
+    }
+    sq_ = Map(sq_bytes_, IORING_OFF_SQ_RING);
+    cq_ = single ? sq_ : Map(cq_bytes_, IORING_OFF_CQ_RING);
+    sqes_bytes_ = p.sq_entries * sizeof(io_uring_sqe);
+    sqes_ = static_cast<io_uring_sqe *>(Map(sqes_bytes_, IORING_OFF_SQES));
+    if (sq_ == nullptr || cq_ == nullptr || sqes_ == nullptr) {
+      Unmap();
+      return;
+    }
+    char *sq = static_cast<char *>(sq_), *cq = static_cast<char *>(cq_);
+    sq_head_ = reinterpret_cast<unsigned *>(sq + p.sq_off.head);
+    sq_tail_ = reinterpret_cast<unsigned *>(sq + p.sq_off.tail);
+    sq_mask_ = *reinterpret_cast<unsigned *>(sq + p.sq_off.ring_mask);
+    sq_array_ = reinterpret_cast<unsigned *>(sq + p.sq_off.array);
+    cq_head_ = reinterpret_cast<unsigned *>(cq + p.cq_off.head);
+    cq_tail_ = reinterpret_cast<unsigned *>(cq + p.cq_off.tail);
+    cq_mask_ = *reinterpret_cast<unsigned *>(cq + p.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<io_uring_cqe *>(cq + p.cq_off.cqes);
+    entries_ = p.sq_entries;
+  }
+  Ring(const Ring &) = delete;
+  Ring &operator=(const Ring &) = delete;
+  ~Ring() { Unmap(); }
+
+  bool ok() const { return entries_ > 0; }
+  unsigned entries() const { return entries_; }
+
+  // Queues a read of io; false if the queue is full.
+  bool Push(int fd, const iovec *io, uint64_t offset, uint64_t user_data) {
+    const unsigned tail = *sq_tail_;
+    if (tail - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) == entries_) {
+      return false;
+    }
+    const unsigned index = tail & sq_mask_;
+    io_uring_sqe *sqe = &sqes_[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_READV;
+    sqe->fd = fd;
+    sqe->off = offset;
+    sqe->addr = reinterpret_cast<uint64_t>(io);
+    sqe->len = 1;
+    sqe->user_data = user_data;
+    sq_array_[index] = index;
+    __atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+    queued_++;
+    return true;
+  }
+
+  // Submits the queued reads and waits for at least wait_for completions.
+  // Returns errno on failure, else 0.
+  int Enter(unsigned wait_for) {
+    for (;;) {
+      const long r = syscall(__NR_io_uring_enter, fd_, queued_, wait_for,
+                             wait_for > 0 ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+      if (r >= 0) {
+        queued_ -= unsigned(r);
+        return 0;
+      }
+      if (errno != EINTR) {
+        return errno;
+      }
+    }
+  }
+
+  // Takes back the reads pushed but not submitted, which the kernel has not
+  // seen yet; returns how many.
+  unsigned Drop() {
+    const unsigned dropped = queued_;
+    __atomic_store_n(sq_tail_, *sq_tail_ - dropped, __ATOMIC_RELEASE);
+    queued_ = 0;
+    return dropped;
+  }
+
+  // Calls f(user_data, result) for every completion.
+  template <typename F> void Reap(const F &f) {
+    unsigned head = *cq_head_;
+    const unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+    for (; head != tail; head++) {
+      const io_uring_cqe &cqe = cqes_[head & cq_mask_];
+      f(cqe.user_data, cqe.res);
+    }
+    __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+  }
+
+ private:
+  void *Map(size_t bytes, uint64_t offset) {
+    void *p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, offset);
+    return p == MAP_FAILED ? nullptr : p;
+  }
+  void Unmap() {
+    if (sqes_ != nullptr) {
+      munmap(sqes_, sqes_bytes_);
+    }
+    if (cq_ != nullptr && cq_ != sq_) {
+      munmap(cq_, cq_bytes_);
+    }
+    if (sq_ != nullptr) {
+      munmap(sq_, sq_bytes_);
+    }
+    if (fd_ >= 0) {
+      close(fd_);
+    }
+    sq_ = cq_ = nullptr;
+    sqes_ = nullptr;
+    fd_ = -1;
+    entries_ = 0;
+  }
+
+  int fd_ = -1;
+  void *sq_ = nullptr, *cq_ = nullptr;
+  io_uring_sqe *sqes_ = nullptr;
+  size_t sq_bytes_ = 0, cq_bytes_ = 0, sqes_bytes_ = 0;
+  unsigned *sq_head_ = nullptr, *sq_tail_ = nullptr, *sq_array_ = nullptr;
+  unsigned *cq_head_ = nullptr, *cq_tail_ = nullptr;
+  unsigned sq_mask_ = 0, cq_mask_ = 0, entries_ = 0, queued_ = 0;
+  io_uring_cqe *cqes_ = nullptr;
+};
+
+// Reads the chunks with ring; false if the ring could not be used at all,
+// before anything was read.
+template <typename OnChunk>
+bool ReadWithRing(Ring &ring, const File &file, char *dest, uint64_t offset,
+                  std::vector<Chunk> &chunks, unsigned depth, const OnChunk &on_chunk) {
+  depth = std::min(depth, ring.entries());
+  std::deque<size_t> todo;
+  for (size_t i = 0; i < chunks.size(); i++) {
+    todo.push_back(i);
+  }
+  unsigned in_flight = 0;
+  int error = 0;
+  bool started = false;
+  while (in_flight > 0 || (!todo.empty() && error == 0)) {
+    while (error == 0 && in_flight < depth && !todo.empty()) {
+      Chunk &c = chunks[todo.front()];
+      char *to = dest + c.position + c.done;
+      const uint64_t at = offset + c.position + c.done;
+      c.io.iov_base = to;
+      c.io.iov_len = c.length - c.done;
+      if (!ring.Push(file.For(to, at, c.length - c.done), &c.io, at, todo.front())) {
+        break;
+      }
+      todo.pop_front();
+      in_flight++;
+    }
+    // in_flight counts the reads queued as well as those submitted, and only
+    // completions (or Drop) take them off
+    const int e = ring.Enter(in_flight > 0 ? 1 : 0);
+    if (e != 0) {
+      if (!started) {
+        // nothing was submitted: let the caller fall back
+        return false;
+      }
+      if (e != EAGAIN && e != EBUSY) {
+        // give up on the queued reads; the submitted ones still complete,
+        // into the ring, and are waited for
+        error = error != 0 ? error : e;
+        in_flight -= ring.Drop();
+      }
+      // else short of kernel resources: the reads stay queued for the next
+      // Enter, once some completions are reaped
+      std::this_thread::yield();
+    }
+    started = true;
+    ring.Reap([&](uint64_t i, int result) {
+      in_flight--;
+      Chunk &c = chunks[i];
+      if (result == -EINTR || result == -EAGAIN) {
+        todo.push_front(i);
+        return;
+      }
+      if (result < 0 || (result == 0 && c.done < c.needed)) {
+        error = error != 0 ? error : (result < 0 ? -result : EIO);
+        return;
+      }
+      c.done += result;
+      if (c.done < c.needed) {
+        // short read: ask for the rest
+        todo.push_front(i);
+      } else if (error == 0) {
+        on_chunk(c.position, c.needed);
+      }
+    });
+  }
+  if (error != 0) {
+    Fail(error, "read", file.path());
+  }
+  return true;
+}
+#endif
+
+template <typename OnChunk>
+void ReadWithThreads(const File &file, char *dest, uint64_t offset,
+                     std::vector<Chunk> &chunks, unsigned thread_count,
+                     const OnChunk &on_chunk) {
+  std::atomic<size_t> next{0};
+  std::atomic<int> error{0};
+  std::mutex lock;
+  std::condition_variable arrived;
+  std::deque<size_t> done;
+  size_t finished = 0;
+  std::vector<std::thread> pool;
+  const size_t n = std::min<size_t>(std::max(1u, thread_count), chunks.size());
+  for (size_t t = 0; t < n; t++) {
+    pool.emplace_back([&]() {
+      for (size_t i; error.load(std::memory_order_relaxed) == 0 &&
+                     (i = next.fetch_add(1)) < chunks.size();) {
+        Chunk &c = chunks[i];
+        while (c.done < c.needed) {
+          char *to = dest + c.position + c.done;
+          const uint64_t at = offset + c.position + c.done;
+          const ssize_t r = pread(file.For(to, at, c.length - c.done), to, c.length - c.done, at);
+          if (r <= 0) {
+            if (r < 0 && errno == EINTR) {
+              continue;
+            }
+            int expected = 0;
+            error.compare_exchange_strong(expected, r == 0 ? EIO : errno);
+            break;
+          }
+          c.done += r;
+        }
+        std::lock_guard<std::mutex> guard(lock);
+        done.push_back(i);
+        arrived.notify_one();
+      }
+      std::lock_guard<std::mutex> guard(lock);
+      finished++;
+      arrived.notify_one();
+    });
+  }
+  for (;;) {
+    std::unique_lock<std::mutex> guard(lock);
+    arrived.wait(guard, [&]() { return !done.empty() || finished == n; });
+    if (done.empty()) {
+      break;
+    }
+    const size_t i = done.front();
+    done.pop_front();
+    guard.unlock();
+    if (error.load() == 0) {
+      on_chunk(chunks[i].position, chunks[i].needed);
+    }
+  }
+  for (std::thread &t : pool) {
+    t.join();
+  }
+  if (error.load() != 0) {
+    Fail(error.load(), "read", file.path());
+  }
+}
+
+} // namespace detail
+
+// Reads length bytes at offset of file into dest, in chunks of
+// options.chunk_bytes, as options says; length may go past the end of the
+// file, to read a last partial page directly. on_chunk(position, bytes) is
+// called on the calling thread for each chunk once it is in dest, in the
+// order the chunks arrive; position is relative to dest, and bytes stops at
+// the end of the file. It must not throw. Throws
+// std::system_error on a read error, once no read is in flight any more.
+// Returns the backend used.
+template <typename OnChunk>
+backend ReadInto(const File &file, char *dest, uint64_t offset, size_t length,
+                 const Options &options, const OnChunk &on_chunk) {
+  const size_t chunk = RoundUp(std::max<size_t>(options.chunk_bytes, 1), kAlignment);
+  std::vector<detail::Chunk> chunks;
+  const size_t available = file.size() > offset ? file.size() - offset : 0;
+  for (size_t p = 0; p < length; p += chunk) {
+    const size_t bytes = std::min(chunk, length - p);
+    chunks.push_back({p, bytes, std::min(bytes, available > p ? available - p : 0), 0, iovec()});
+  }
+  if (chunks.empty()) {
+    return options.use == automatic ? threads : options.use;
+  }
+#if FILTER_LOADER_URING
+  if (options.use != threads) {
+    detail::Ring ring(std::max(1u, std::min(options.queue_depth, 4096u)));
+    if (ring.ok() && detail::ReadWithRing(ring, file, dest, offset, chunks,
+                                          std::max(1u, options.queue_depth), on_chunk)) {
+      return uring;
+    }
+    if (options.use == uring) {
+      Fail(ENOSYS, "io_uring", file.path());
+    }
+  }
+#else
+  if (options.use == uring) {
+    Fail(ENOSYS, "io_uring", file.path());
+  }
+#endif
+  detail::ReadWithThreads(file, dest, offset, chunks, options.threads, on_chunk);
+  return threads;
+}
+
+// Page-aligned memory for reads; zero-filled.
+class Buffer {
+ public:
+  Buffer() = default;
+  explicit Buffer(size_t bytes) : length_(RoundUp(std::max<size_t>(bytes, 1), kAlignment)) {
+    void *p = mmap(nullptr, length_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+      throw std::bad_alloc();
+    }
+    data_ = static_cast<char *>(p);
+  }
+  Buffer(Buffer &&other) noexcept
+      : data_(std::exchange(other.data_, nullptr)), length_(other.length_) {}
+  Buffer &operator=(Buffer &&other) noexcept {
+    std::swap(data_, other.data_);
+    std::swap(length_, other.length_);
+    return *this;
+  }
+  ~Buffer() {
+    if (data_ != nullptr) {
+      munmap(data_, length_);
+    }
+  }
+  char *data() const { return data_; }
+  // a multiple of 4 KB
+  size_t capacity() const { return length_; }
+
+ private:
+  char *data_ = nullptr;
+  size_t length_ = 0;
+};
+
+// The start of a filter or key file.
+struct FileHeader {
+  static constexpr uint64_t kMagic = 0x3144414f4c544c46ULL; // "FLTLOAD1"
+  static constexpr uint32_t kVersion = 1;
+
+  uint64_t magic;
+  uint32_t version;
+  uint32_t chunk_bytes;
+  // filter_image::TypeHash of the filter, or of uint64_t for keys
+  uint64_t type;
+  // where the data starts, a multiple of 4 KB
+  uint64_t data_offset;
+  uint64_t data_bytes;
+  // SizeInBytes() of a filter, the number of keys of a key file
+  uint64_t count;
+  uint64_t chunk_count;
+  // of the chunk checksums, which follow the header
+  uint64_t table_checksum;
+};
+
+namespace detail {
+inline void WriteFile(const std::string &path, uint64_t type, uint64_t count,
+                      const char *data, size_t bytes, size_t chunk_bytes) {
+  chunk_bytes = RoundUp(std::max<size_t>(chunk_bytes, 1), kAlignment);
+  FileHeader h;
+  memset(&h, 0, sizeof(h));
+  h.magic = FileHeader::kMagic;
+  h.version = FileHeader::kVersion;
+  h.chunk_bytes = uint32_t(chunk_bytes);
+  h.type = type;
+  h.data_bytes = bytes;
+  h.count = count;
+  h.chunk_count = (bytes + chunk_bytes - 1) / chunk_bytes;
+  std::vector<uint64_t> sums;
+  for (size_t p = 0; p < bytes; p += chunk_bytes) {
+    sums.push_back(Checksum(data + p, std::min(chunk_bytes, bytes - p)));
+  }
+  h.table_checksum = Checksum(sums.data(), sums.size() * sizeof(uint64_t));
+  h.data_offset = RoundUp(sizeof(h) + sums.size() * sizeof(uint64_t), kAlignment);
+
+  const int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    Fail(errno, "create", path);
+  }
+  std::vector<char> head(h.data_offset, 0);
+  memcpy(head.data(), &h, sizeof(h));
+  memcpy(head.data() + sizeof(h), sums.data(), sums.size() * sizeof(uint64_t));
+  // the data is padded to 4 KB, so that its last chunk can be read directly
+  const std::vector<char> padding(RoundUp(bytes, kAlignment) - bytes, 0);
+  const std::pair<const char *, size_t> parts[] = {
+      {head.data(), head.size()}, {data, bytes}, {padding.data(), padding.size()}};
+  for (const auto &part : parts) {
+    for (size_t done = 0; done < part.second;) {
+      const ssize_t n = write(fd, part.first + done, part.second - done);
+      if (n < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        const int error = errno;
+        close(fd);
+        Fail(error, "write", path);
+      }
+      done += n;
+    }
+  }
+  if (close(fd) != 0) {
+    Fail(errno, "close", path);
+  }
+}
+
+// Reads and checks the header and checksum table of file.
+inline FileHeader ReadHeader(const File &file, uint64_t type, std::vector<uint64_t> *sums) {
+  FileHeader h;
+  if (file.size() < sizeof(h)) {
+    throw std::runtime_error("loader: " + file.path() + " is not a filter or key file");
+  }
+  file.ReadFully(reinterpret_cast<char *>(&h), 0, sizeof(h));
+  if (h.magic != FileHeader::kMagic || h.version != FileHeader::kVersion ||
+      h.chunk_bytes == 0 || h.chunk_bytes % kAlignment != 0 ||
+      h.chunk_count != (h.data_bytes + h.chunk_bytes - 1) / h.chunk_bytes ||
+      h.data_offset < sizeof(h) + h.chunk_count * sizeof(uint64_t) ||
+      h.data_offset + RoundUp(h.data_bytes, kAlignment) > file.size()) {
+    throw std::runtime_error("loader: " + file.path() + " is not a filter or key file");
+  }
+  if (h.type != type) {
+    throw std::runtime_error("loader: " + file.path() + " holds another type of data");
+  }
+  sums->resize(h.chunk_count);
+  file.ReadFully(reinterpret_cast<char *>(sums->data()), sizeof(h),
+                 sums->size() * sizeof(uint64_t));
+  if (Checksum(sums->data(), sums->size() * sizeof(uint64_t)) != h.table_checksum) {
+    throw std::runtime_error("loader: " + file.path() + " has a corrupt header");
+  }
+  return h;
+}
+
+// Reads the data of file into dest, which holds capacity bytes, at least
+// h.data_bytes, checking each chunk as it arrives.
+inline Stats ReadChecked(const File &file, const FileHeader &h,
+                         const std::vector<uint64_t> &sums, char *dest,
+                         size_t capacity, Options options) {
+  const auto start = std::chrono::steady_clock::now();
+  options.chunk_bytes = h.chunk_bytes;
+  // the padding too, when it fits, so the last chunk is read directly
+  const size_t length = std::min(RoundUp(h.data_bytes, kAlignment), capacity);
+  size_t bad = SIZE_MAX;
+  Stats s;
+  s.used = ReadInto(file, dest, h.data_offset, length, options,
+                    [&](size_t position, size_t bytes) {
+                      if (position >= h.data_bytes) {
+                        return;
+                      }
+                      bytes = std::min<size_t>(bytes, h.data_bytes - position);
+                      if (Checksum(dest + position, bytes) != sums[position / h.chunk_bytes]) {
+                        bad = std::min(bad, position / h.chunk_bytes);
+                      }
+                    });
+  if (bad != SIZE_MAX) {
+    throw std::runtime_error("loader: " + file.path() + ": checksum mismatch in chunk " +
+                             std::to_string(bad));
+  }
+  s.bytes = h.data_bytes;
+  s.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  return s;
+}
+} // namespace detail
+
+// Writes the image of table to path, in chunks of chunk_bytes.
+template <typename Table>
+void SaveFilter(const Table &table, const std::string &path,
+                size_t chunk_bytes = size_t(1) << 20) {
+  const size_t bytes = FilterImage<Table>::Bytes(table);
+  Buffer image(bytes);
+  FilterImage<Table>::Write(table, image.data());
+  detail::WriteFile(path, filter_image::TypeHash<Table>(), table.SizeInBytes(),
+                    image.data(), bytes, chunk_bytes);
+}
+
+// A filter read from a file written by SaveFilter. It is queried in place,
+// from the memory the file was read into.
+template <typename Table>
+class LoadedFilter {
+ public:
+  // Throws if the file cannot be read, is corrupt, or holds another type of
+  // filter.
+  explicit LoadedFilter(const std::string &path, const Options &options = Options()) {
+    File file(path, options.direct);
+    std::vector<uint64_t> sums;
+    const FileHeader h = detail::ReadHeader(file, filter_image::TypeHash<Table>(), &sums);
+    image_ = Buffer(h.data_bytes);
+    stats_ = detail::ReadChecked(file, h, sums, image_.data(), image_.capacity(), options);
+    filter_bytes_ = h.count;
+    FilterImage<Table>::View(image_.data(), table());
+  }
+
+  LoadedFilter(const LoadedFilter &) = delete;
+  LoadedFilter &operator=(const LoadedFilter &) = delete;
+
+  ~LoadedFilter() { FilterImage<Table>::Release(table()); }
+
+  bool Contain(uint64_t key) { return FilterAPI<Table>::Contain(key, table()); }
+
+  // The filter itself, for FilterAPI<Table> calls in a loop.
+  Table *table() { return reinterpret_cast<Table *>(&storage_); }
+
+  size_t SizeInBytes() const { return filter_bytes_; }
+  // how the image was read, and how long that took
+  const Stats &LoadStats() const { return stats_; }
+
+ private:
+  Buffer image_;
+  size_t filter_bytes_ = 0;
+  Stats stats_;
+  typename std::aligned_storage<sizeof(Table), alignof(Table)>::type storage_;
+};
+
+// Writes keys to path, in chunks of chunk_bytes.
+inline void WriteKeys(const std::vector<uint64_t> &keys, const std::string &path,
+                      size_t chunk_bytes = size_t(1) << 20) {
+  detail::WriteFile(path, filter_image::TypeHash<uint64_t>(), keys.size(),
+                    reinterpret_cast<const char *>(keys.data()),
+                    keys.size() * sizeof(uint64_t), chunk_bytes);
+}
+
+// Replaces *keys with the keys of a file written by WriteKeys. The reads go
+// straight into the vector, directly (O_DIRECT) only if its storage happens
+// to be page-aligned.
+inline Stats ReadKeys(const std::string &path, std::vector<uint64_t> *keys,
+                      const Options &options = Options()) {
+  File file(path, options.direct);
+  std::vector<uint64_t> sums;
+  const FileHeader h = detail::ReadHeader(file, filter_image::TypeHash<uint64_t>(), &sums);
+  if (h.data_bytes != h.count * sizeof(uint64_t)) {
+    throw std::runtime_error("loader: " + path + " is not a key file");
+  }
+  keys->resize(h.count);
+  return detail::ReadChecked(file, h, sums, reinterpret_cast<char *>(keys->data()),
+                             h.data_bytes, options);
+}
+
+// Appends hash(line) to *keys for every line of the text file at path, in
+// order; a trailing '\r' is not part of the line. Lines are hashed on the
+// calling thread as soon as all of the file up to them has arrived, while
+// the rest is being read.
+template <typename Hash>
+Stats HashLines(const std::string &path, const Hash &hash, std::vector<uint64_t> *keys,
+                const Options &options = Options()) {
+  const auto start = std::chrono::steady_clock::now();
+  File file(path, options.direct);
+  Buffer text(file.size());
+  const size_t chunk = RoundUp(std::max<size_t>(options.chunk_bytes, 1), kAlignment);
+  std::vector<bool> arrived((file.size() + chunk - 1) / chunk, false);
+  // the file up to here has arrived, and up to parsed been hashed
+  size_t contiguous = 0, parsed = 0;
+  auto parse = [&](size_t end, bool last) {
+    const char *data = text.data();
+    while (parsed < end) {
+      const char *newline = static_cast<const char *>(memchr(data + parsed, '\n', end - parsed));
+      if (newline == nullptr && !last) {
+        break;
+      }
+      const size_t stop = newline == nullptr ? end : size_t(newline - data);
+      size_t length = stop - parsed;
+      if (length > 0 && data[parsed + length - 1] == '\r') {
+        length--;
+      }
+      keys->push_back(hash(std::string_view(data + parsed, length)));
+      parsed = stop + 1;
+    }
+  };
+  Options o = options;
+  o.chunk_bytes = chunk;
+  Stats s;
+  // whole pages, so that every chunk can be read directly; past the end of
+  // the file, the reads come back short
+  s.used = ReadInto(file, text.data(), 0, RoundUp(file.size(), kAlignment), o,
+                    [&](size_t position, size_t) {
+                      arrived[position / chunk] = true;
+                      const size_t before = contiguous;
+                      while (contiguous < arrived.size() && arrived[contiguous]) {
+                        contiguous++;
+                      }
+                      if (contiguous > before) {
+                        parse(std::min(contiguous * chunk, file.size()), false);
+                      }
+                    });
+  parse(file.size(), true);
+  s.bytes = file.size();
+  s.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  return s;
+}
+
+} // namespace loader
+
+template <typename Table>
+struct FilterAPI<loader::LoadedFilter<Table>>
+{
+  static void Add(uint64_t, loader::LoadedFilter<Table> *)
+  {
+    throw std::runtime_error("Unsupported");
+  }
+  static void Remove(uint64_t, loader::LoadedFilter<Table> *)
+  {
+    throw std::runtime_error("Unsupported");
+  }
+  CONTAIN_ATTRIBUTES static bool Contain(uint64_t key, loader::LoadedFilter<Table> *table)
+  {
+    return table->Contain(key);
+  }
+};
+
+#endif // FILTER_LOADER_H_
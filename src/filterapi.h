@@ -22,17 +22,22 @@
 #include "./xorfilter/xorfilter.h"
 #include "./xorfilter/xorfilter_plus.h"
 #include "./xorfilter/xorfilter_singleheader.h"
+#include "./cpudispatch.h"
+#include "./batchlookup.h"
+// gqf and vqf are C sources written directly against BMI2/AVX2 (inline asm
+// and intrinsics) with no portable path, so they still need -mavx2.
 #ifdef __AVX2__
 #include "./gqf/gqf_cpp.h"
-#include "./bloom/simd-block.h"
 #include "./vqf/vqf_cpp.h"
 #endif
-#define __PF_AVX512__ \
-  (__AVX512BW__ & __AVX512VL__ & __AVX512CD__ & __AVX512DQ__)
-#if __PF_AVX512__
+// The block Bloom filters pick AVX2 or scalar kernels at startup.
+#if CPUDISPATCH_X86
+#include "./bloom/simd-block.h"
+#endif
+// The pocket dictionaries pick AVX-512, AVX2 or scalar kernels at startup
+// (see prefix/pd_bits.hpp), so these filters are available on every host.
 #include "./prefix/min_pd256.hpp"
 #include "./tc-shortcut/tc-shortcut.hpp"
-#endif
 #include "./ribbon/ribbon_impl.h"
 #include "./bloom/simd-block-fixed-fpp.h"
 
@@ -96,6 +101,23 @@ struct FilterAPI<CuckooFilter<ItemType, bits_per_item, TableType, HashFamily>>
   }
 };
 
+template <typename ItemType, size_t bits_per_item,
+          template <size_t> class TableType, typename HashFamily>
+struct LookupSteps<CuckooFilter<ItemType, bits_per_item, TableType, HashFamily>>
+{
+  using Table = CuckooFilter<ItemType, bits_per_item, TableType, HashFamily>;
+  using State = typename Table::ContainState;
+  static void Start(const Table *table, uint64_t key, State *s)
+  {
+    table->ContainStart(key, s);
+  }
+  static bool Resume(const Table *table, State *s, bool *found)
+  {
+    *found = (0 == table->ContainFinish(*s));
+    return true;
+  }
+};
+
 template <typename ItemType, size_t bits_per_item,
           template <size_t> class TableType, typename HashFamily>
 struct FilterAPI<
@@ -129,6 +151,25 @@ struct FilterAPI<
   }
 };
 
+template <typename ItemType, size_t bits_per_item,
+          template <size_t> class TableType, typename HashFamily>
+struct LookupSteps<
+    CuckooFilterStable<ItemType, bits_per_item, TableType, HashFamily>>
+{
+  using Table =
+      CuckooFilterStable<ItemType, bits_per_item, TableType, HashFamily>;
+  using State = typename Table::ContainState;
+  static void Start(const Table *table, uint64_t key, State *s)
+  {
+    table->ContainStart(key, s);
+  }
+  static bool Resume(const Table *table, State *s, bool *found)
+  {
+    *found = (0 == table->ContainFinish(*s));
+    return true;
+  }
+};
+
 template <typename ItemType, typename FingerprintType>
 struct FilterAPI<CuckooFuseFilter<ItemType, FingerprintType>>
 {
@@ -190,7 +231,7 @@ struct FilterAPI<SimdBlockFilterFixed<HashFamily>>
 
 #endif
 
-#ifdef __AVX2__
+#if CPUDISPATCH_X86
 template <typename HashFamily>
 struct FilterAPI<SimdBlockFilter<HashFamily>>
 {
@@ -272,8 +313,8 @@ struct FilterAPI<SimdBlockFilterFixed<HashFamily>>
   }
 };
 
-#endif
-#if __PF_AVX512__
+#endif // CPUDISPATCH_X86
+
 template <typename HashFamily>
 struct FilterAPI<TC_shortcut<HashFamily>>
 {
@@ -363,6 +404,7 @@ inline size_t get_l2_slots<TC_shortcut<>>(size_t l1_items,
   return slots_in_l2;
 }
 
+#if CPUDISPATCH_X86
 template <>
 inline size_t
 get_l2_slots<SimdBlockFilter<>>(size_t l1_items,
@@ -374,7 +416,9 @@ get_l2_slots<SimdBlockFilter<>>(size_t l1_items,
   size_t slots_in_l2 = (expected_items_reaching_next_level / loads[1]);
   return slots_in_l2 * 4;
 }
+#endif
 
+#if CPUDISPATCH_X86 || defined(__aarch64__)
 template <>
 inline size_t
 get_l2_slots<SimdBlockFilterFixed<>>(size_t l1_items,
@@ -386,6 +430,7 @@ get_l2_slots<SimdBlockFilterFixed<>>(size_t l1_items,
   size_t slots_in_l2 = (expected_items_reaching_next_level / loads[1]);
   return slots_in_l2 * 2;
 }
+#endif
 
 template <typename Table,
           typename HashFamily = hashing::TwoIndependentMultiplyShift>
@@ -396,7 +441,7 @@ class Prefix_Filter
   Table GenSpare;
 
   hashing::TwoIndependentMultiplyShift Hasher, H0;
-  __m256i *pd_array;
+  min_pd::pd256_t *pd_array;
   size_t cap[2] = {0};
   static double constexpr overflowing_items_ratio = 0.0586;
 
@@ -422,7 +467,7 @@ public:
         (((INT64_C(1) << min_pd::QUOTS) - 1) << 6) | 32;
     for (size_t i = 0; i < number_of_pd; i++)
     {
-      pd_array[i] = __m256i{pd256_plus_init_header, 0, 0, 0};
+      pd_array[i] = min_pd::pd256_t{{pd256_plus_init_header, 0, 0, 0}};
     }
   }
 
@@ -494,7 +539,7 @@ public:
       assert(!min_pd::is_pd_full(pd));
       size_t end = min_pd::pd_select64(header >> 6, quot);
       const size_t h_index = end + 6;
-      const u64 mask = _bzhi_u64(-1, h_index);
+      const u64 mask = pd_bits::bzhi64(-1, h_index);
       const u64 lo = header & mask;
       const u64 hi = ((header & ~mask) << 1u); // & h_mask;
       assert(!(lo & hi));
@@ -517,7 +562,7 @@ public:
 
   size_t SizeInBytes() const
   {
-    size_t l1 = sizeof(__m256i) * number_of_pd;
+    size_t l1 = sizeof(min_pd::pd256_t) * number_of_pd;
     size_t l2 = GenSpare.SizeInBytes();
     auto res = l1 + l2;
     return res;
@@ -554,9 +599,7 @@ struct FilterAPI<Prefix_Filter<filterTable>>
   }
 };
 
-#endif
-
-#ifdef __SSE41__
+#ifdef __SSE4_1__
 template <typename HashFamily>
 struct FilterAPI<SimdBlockFilterFixed16<HashFamily>>
 {
@@ -732,6 +775,18 @@ class BalancedRibbonFilter
   unique_ptr<char[]> meta_ptr;
   BalancedHasher hasher;
 
+  // A filter over a solution and metadata it does not own, for FilterImage
+  // (see filter_image.h).
+  template <typename Table> friend struct FilterImage;
+  BalancedRibbonFilter(uint32_t log2_vshards, size_t num_slots, size_t bytes,
+                       size_t num_starts, char *data, size_t meta_bytes,
+                       const char *meta)
+      : log2_vshards(log2_vshards), num_slots(num_slots), bytes(bytes),
+        soln(data, bytes), meta_bytes(meta_bytes), hasher(log2_vshards, meta)
+  {
+    soln.PrepareForNumStarts(num_starts);
+  }
+
 public:
   static constexpr double kFractionalCols =
       kNumColumns == 0 ? kMilliBitsPerKey / 1000.0 : kNumColumns;
@@ -1023,6 +1078,24 @@ struct FilterAPI<xorbinaryfusefilter_lowmem4wise::XorBinaryFuseFilter<
   }
 };
 
+template <typename ItemType, typename FingerprintType, typename HashFamily>
+struct LookupSteps<xorbinaryfusefilter_lowmem4wise::XorBinaryFuseFilter<
+    ItemType, FingerprintType, HashFamily>>
+{
+  using Table = xorbinaryfusefilter_lowmem4wise::XorBinaryFuseFilter<
+      ItemType, FingerprintType, HashFamily>;
+  using State = typename Table::ContainState;
+  static void Start(const Table *table, uint64_t key, State *s)
+  {
+    table->ContainStart(key, s);
+  }
+  static bool Resume(const Table *table, State *s, bool *found)
+  {
+    *found = (0 == table->ContainFinish(*s));
+    return true;
+  }
+};
+
 class MortonFilter
 {
   Morton3_8 *filter;
@@ -1051,6 +1124,15 @@ public:
     filter->insert_many(k, status, size);
   }
   inline bool Contain(uint64_t &item) { return filter->likely_contains(item); };
+  using LookupState = Morton3_8::lookup_state;
+  void ContainStart(uint64_t key, LookupState *s) const
+  {
+    filter->likely_contains_start(key, s);
+  }
+  bool ContainResume(LookupState *s) const
+  {
+    return filter->likely_contains_resume(s);
+  }
   size_t SizeInBytes() const
   {
     // according to morton_sample_configs.h:
@@ -1088,6 +1170,26 @@ struct FilterAPI<MortonFilter>
   }
 };
 
+template <>
+struct LookupSteps<MortonFilter>
+{
+  using Table = MortonFilter;
+  using State = MortonFilter::LookupState;
+  static void Start(const Table *table, uint64_t key, State *s)
+  {
+    table->ContainStart(key, s);
+  }
+  static bool Resume(const Table *table, State *s, bool *found)
+  {
+    if (!table->ContainResume(s))
+    {
+      return false;
+    }
+    *found = s->found;
+    return true;
+  }
+};
+
 class XorSingle
 {
 public:
@@ -1262,6 +1364,22 @@ struct FilterAPI<XorFilter<ItemType, FingerprintType, HashFamily>>
   }
 };
 
+template <typename ItemType, typename FingerprintType, typename HashFamily>
+struct LookupSteps<XorFilter<ItemType, FingerprintType, HashFamily>>
+{
+  using Table = XorFilter<ItemType, FingerprintType, HashFamily>;
+  using State = typename Table::ContainState;
+  static void Start(const Table *table, uint64_t key, State *s)
+  {
+    table->ContainStart(key, s);
+  }
+  static bool Resume(const Table *table, State *s, bool *found)
+  {
+    *found = (0 == table->ContainFinish(*s));
+    return true;
+  }
+};
+
 template <typename ItemType, typename FingerprintType, typename HashFamily>
 struct FilterAPI<naive::XorFilter<ItemType, FingerprintType, HashFamily>>
 {
@@ -1395,6 +1513,22 @@ struct FilterAPI<GQFilter<ItemType, bits_per_item, HashFamily>>
   }
 };
 
+template <typename ItemType, size_t bits_per_item, typename HashFamily>
+struct LookupSteps<GQFilter<ItemType, bits_per_item, HashFamily>>
+{
+  using Table = GQFilter<ItemType, bits_per_item, HashFamily>;
+  using State = uint64_t;
+  static void Start(const Table *table, uint64_t key, State *s)
+  {
+    *s = table->ContainStart(key);
+  }
+  static bool Resume(const Table *table, State *s, bool *found)
+  {
+    *found = (0 == table->ContainFinish(*s));
+    return true;
+  }
+};
+
 template <typename ItemType, typename HashFamily>
 struct FilterAPI<VQFilter<ItemType, HashFamily>>
 {
@@ -1421,6 +1555,22 @@ struct FilterAPI<VQFilter<ItemType, HashFamily>>
     return (0 == table->Contain(key));
   }
 };
+
+template <typename ItemType, typename HashFamily>
+struct LookupSteps<VQFilter<ItemType, HashFamily>>
+{
+  using Table = VQFilter<ItemType, HashFamily>;
+  using State = uint64_t;
+  static void Start(const Table *table, uint64_t key, State *s)
+  {
+    *s = table->ContainStart(key);
+  }
+  static bool Resume(const Table *table, State *s, bool *found)
+  {
+    *found = (0 == table->ContainFinish(*s));
+    return true;
+  }
+};
 #endif
 
 template <typename ItemType, size_t bits_per_item, bool branchless,
@@ -1548,4 +1698,81 @@ struct FilterAPI<SuccinctCountingBlockedBloomRankFilter<ItemType, bits_per_item,
   }
 };
 
+template <typename Table, typename = void>
+struct has_find_many : std::false_type
+{
+};
+
+template <typename Table>
+struct has_find_many<
+    Table, std::void_t<decltype(std::declval<const Table &>().FindMany(
+               (const uint64_t *)nullptr, size_t(0), (uint64_t *)nullptr))>>
+    : std::true_type
+{
+};
+
+// Batched membership test: bit i of out_bitmap, which must hold (n + 63) / 64
+// words, is set if keys[i] may be in the filter. Filters with LookupSteps go
+// through the software-pipelined executor of batchlookup.h, filters with a
+// hand-written FindMany use it, and all others fall back to Contain.
+template <typename Table>
+void ContainMany(const uint64_t *keys, const size_t n, Table *table,
+                 uint64_t *out_bitmap)
+{
+  if constexpr (has_lookup_steps<Table>::value)
+  {
+    PipelinedContainMany(table, keys, n, out_bitmap);
+  }
+  else if constexpr (has_find_many<Table>::value)
+  {
+    table->FindMany(keys, n, out_bitmap);
+  }
+  else
+  {
+    memset(out_bitmap, 0, ((n + 63) / 64) * sizeof(uint64_t));
+    for (size_t i = 0; i < n; i++)
+    {
+      out_bitmap[i >> 6] |= uint64_t(FilterAPI<Table>::Contain(keys[i], table))
+                            << (i & 63);
+    }
+  }
+}
+
+// The index of one of keys[0, n) that may be in the filter, or n if none is;
+// for alternatives, where any hit settles the answer. Filters with
+// LookupSteps prefetch all of them before probing and stop at the first hit,
+// filters with FindMany test them 64 at a time, the others one at a time.
+template <typename Table>
+size_t ContainAny(const uint64_t *keys, const size_t n, Table *table)
+{
+  if constexpr (has_lookup_steps<Table>::value)
+  {
+    return PipelinedContainAny(table, keys, n);
+  }
+  else if constexpr (has_find_many<Table>::value)
+  {
+    for (size_t i = 0; i < n; i += 64)
+    {
+      uint64_t found;
+      table->FindMany(keys + i, std::min<size_t>(64, n - i), &found);
+      if (found != 0)
+      {
+        return i + __builtin_ctzll(found);
+      }
+    }
+    return n;
+  }
+  else
+  {
+    for (size_t i = 0; i < n; i++)
+    {
+      if (FilterAPI<Table>::Contain(keys[i], table))
+      {
+        return i;
+      }
+    }
+    return n;
+  }
+}
+
 #endif
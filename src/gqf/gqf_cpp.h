@@ -72,6 +72,19 @@ class GQFilter {
   // Report if the item is inserted, with false positive rate.
   Status Contain(const ItemType &item) const;
 
+  // Contain() split in two for software-pipelined batches (batchlookup.h):
+  // ContainStart returns the masked hash after prefetching the block of its
+  // quotient.
+  uint64_t ContainStart(const ItemType &item) const {
+    uint64_t hash = hasher(item) & mask;
+    uint64_t quotient = hash >> qf.metadata->bits_per_slot;
+    __builtin_prefetch(get_block(&qf, quotient / QF_SLOTS_PER_BLOCK));
+    return hash;
+  }
+  Status ContainFinish(const uint64_t hash) const {
+    return qf_count_key_value(&qf, hash, 0, 0) > 0 ? Ok : NotFound;
+  }
+
   /* methods for providing stats  */
   // summary infomation
   std::string Info() const;
@@ -0,0 +1,242 @@
+// Huge-page backing for large filter arrays.
+//
+// A lookup in a filter of a few GB touches random pages: with 4 KB pages it
+// misses the TLB on top of the cache almost every time. With 2 MB pages the
+// whole array fits the second-level TLB up to a few GB; with 1 GB pages, far
+// beyond. allocate() takes a policy:
+//
+//   none         plain memory (what the kernel's transparent huge page
+//                setting makes of it)
+//   transparent  a 2 MB aligned anonymous mapping, madvise(MADV_HUGEPAGE)
+//   huge_2mb     MAP_HUGETLB with 2 MB pages, else as transparent
+//   huge_1gb     MAP_HUGETLB with 1 GB pages, else as huge_2mb
+//
+// MAP_HUGETLB needs pages reserved beforehand (vm.nr_hugepages, or
+// hugepagesz=1G hugepages=N on the kernel command line for 1 GB pages); when
+// there are none left the next policy down is tried, so asking never fails
+// where plain memory would not. backing() tells what an allocation got.
+// Arrays smaller than half a huge page get plain memory whatever the policy.
+//
+// The filters that take a policy use default_policy() unless told otherwise:
+// none, or what the FILTER_HUGEPAGES environment variable says ("none",
+// "thp", "2m" or "1g"), so an existing benchmark can be rerun on huge pages
+// without a rebuild.
+
+#ifndef HUGEPAGE_H_
+#define HUGEPAGE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <initializer_list>
+#include <mutex>
+#include <unordered_map>
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+#include "performancecounters/memory_counters.h"
+
+namespace hugepage {
+
+enum policy { none, transparent, huge_2mb, huge_1gb };
+
+inline const char *name(policy p) {
+  switch (p) {
+  case transparent:
+    return "thp";
+  case huge_2mb:
+    return "2m";
+  case huge_1gb:
+    return "1g";
+  default:
+    return "none";
+  }
+}
+
+// "none", "thp", "2m", "1g"; false for anything else
+inline bool parse(const char *s, policy *p) {
+  for (policy q : {none, transparent, huge_2mb, huge_1gb}) {
+    if (s != nullptr && strcmp(s, name(q)) == 0) {
+      *p = q;
+      return true;
+    }
+  }
+  return false;
+}
+
+inline policy default_policy() {
+  static const policy p = []() {
+    policy q = none;
+    parse(getenv("FILTER_HUGEPAGES"), &q);
+    return q;
+  }();
+  return p;
+}
+
+namespace detail {
+constexpr size_t kPage2m = size_t(1) << 21;
+constexpr size_t kPage1g = size_t(1) << 30;
+
+// What release() and backing() need to know about an allocation. It is kept
+// aside, keyed by the pointer, so that an array that fills whole huge pages
+// takes no more of them.
+struct allocation {
+  // 0 for plain memory, else the length of the mapping
+  size_t mapped;
+  policy backing;
+};
+
+inline std::mutex &registry_lock() {
+  static std::mutex m;
+  return m;
+}
+
+inline std::unordered_map<const void *, allocation> &registry() {
+  static std::unordered_map<const void *, allocation> r;
+  return r;
+}
+
+inline void record(const void *p, allocation a) {
+  std::lock_guard<std::mutex> lock(registry_lock());
+  registry()[p] = a;
+}
+
+// the record of p, removed if erase is set; plain memory if there is none
+inline allocation lookup(const void *p, bool erase) {
+  std::lock_guard<std::mutex> lock(registry_lock());
+  auto it = registry().find(p);
+  if (it == registry().end()) {
+    return allocation{0, none};
+  }
+  const allocation a = it->second;
+  if (erase) {
+    registry().erase(it);
+  }
+  return a;
+}
+
+inline size_t round_up(size_t n, size_t to) { return (n + to - 1) / to * to; }
+
+#if defined(__linux__)
+inline void *map_hugetlb(size_t length, size_t page) {
+#ifdef MAP_HUGETLB
+  int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB;
+#ifdef MAP_HUGE_SHIFT
+  flags |= (page == kPage1g ? 30 : 21) << MAP_HUGE_SHIFT;
+#endif
+  void *p = mmap(nullptr, length, PROT_READ | PROT_WRITE, flags, -1, 0);
+  return p == MAP_FAILED ? nullptr : p;
+#else
+  (void)length;
+  (void)page;
+  return nullptr;
+#endif
+}
+
+// A mapping aligned to 2 MB, so that all of it can be huge pages.
+inline void *map_transparent(size_t length) {
+  void *p = mmap(nullptr, length + kPage2m, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (p == MAP_FAILED) {
+    return nullptr;
+  }
+  const uintptr_t start = reinterpret_cast<uintptr_t>(p);
+  const uintptr_t aligned = round_up(start, kPage2m);
+  if (aligned > start) {
+    munmap(p, aligned - start);
+  }
+  munmap(reinterpret_cast<void *>(aligned + length), start + kPage2m - aligned);
+#ifdef MADV_HUGEPAGE
+  madvise(reinterpret_cast<void *>(aligned), length, MADV_HUGEPAGE);
+#endif
+  return reinterpret_cast<void *>(aligned);
+}
+#endif
+} // namespace detail
+
+// bytes of 64-byte aligned memory, backed as p asks; zeroed if zero is set
+// (memory from a mapping always is). nullptr if out of memory. Free with
+// release().
+inline void *allocate(size_t bytes, policy p, bool zero = false) {
+  if (bytes == 0) {
+    bytes = 1;
+  }
+#if defined(__linux__)
+  if (p == huge_1gb && bytes < detail::kPage1g / 2) {
+    p = huge_2mb;
+  }
+  if (p != none && bytes < detail::kPage2m / 2) {
+    p = none;
+  }
+  void *mapping = nullptr;
+  size_t length = 0;
+  policy got = p;
+  if (got == huge_1gb) {
+    length = detail::round_up(bytes, detail::kPage1g);
+    mapping = detail::map_hugetlb(length, detail::kPage1g);
+    if (mapping == nullptr) {
+      got = huge_2mb;
+    }
+  }
+  if (mapping == nullptr && got == huge_2mb) {
+    length = detail::round_up(bytes, detail::kPage2m);
+    mapping = detail::map_hugetlb(length, detail::kPage2m);
+    if (mapping == nullptr) {
+      got = transparent;
+    }
+  }
+  if (mapping == nullptr && got == transparent) {
+    length = detail::round_up(bytes, detail::kPage2m);
+    mapping = detail::map_transparent(length);
+  }
+  if (mapping != nullptr) {
+    detail::record(mapping, detail::allocation{length, got});
+    memtrack::on_alloc(length);
+    return mapping;
+  }
+#else
+  (void)p;
+#endif
+  // plain memory is not recorded: no record means free()
+  void *q = nullptr;
+  if (posix_memalign(&q, 64, detail::round_up(bytes, 64)) != 0) {
+    return nullptr;
+  }
+  if (zero) {
+    memset(q, 0, bytes);
+  }
+  return q;
+}
+
+template <typename T>
+T *allocate(size_t count, policy p, bool zero = false) {
+  return static_cast<T *>(allocate(count * sizeof(T), p, zero));
+}
+
+inline void release(void *p) {
+  if (p == nullptr) {
+    return;
+  }
+  const detail::allocation a = detail::lookup(p, true);
+#if defined(__linux__)
+  if (a.mapped != 0) {
+    munmap(p, a.mapped);
+    memtrack::on_free(a.mapped);
+    return;
+  }
+#endif
+  free(p);
+}
+
+// What memory from allocate() is backed by. For transparent, the kernel may
+// still have given some or all of it small pages.
+inline policy backing(const void *p) {
+  return p == nullptr ? none : detail::lookup(p, false).backing;
+}
+
+} // namespace hugepage
+
+#endif // HUGEPAGE_H_
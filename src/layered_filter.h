@@ -0,0 +1,295 @@
+// A static filter that still takes updates.
+//
+// LayeredFilter puts a small dynamic filter (cuckoo, counting Bloom: any
+// FilterAPI with Add and Remove) in front of a large static one (binary fuse,
+// xor, ribbon):
+//
+//   Contain(key) = (base(key) && !removed(key)) || delta(key)
+//
+// Keys added since the base was built go to the delta; keys of the base that
+// are removed go to a tombstone filter of the same kind as the delta, whose
+// hits are confirmed against the exact set of removed keys, so a tombstone
+// false positive never hides a base key. The base is probed first: its
+// positives are answered without the delta, and an empty delta or tombstone
+// filter is not probed at all, so right after a compaction a lookup costs what
+// a lookup in the base does.
+//
+// Updates take microseconds. Once max_delta_keys updates are pending, or the
+// estimated false-positive rate of the combination exceeds max_fpr,
+// NeedsCompaction() says so, and StartCompaction() rebuilds the base with the
+// updates folded in on a background thread. Lookups and updates go on in the
+// meantime: the delta has room for as many updates again, and they are
+// journaled and replayed onto the new, empty delta by FinishCompaction(). An
+// update only waits for the rebuild if that room runs out too. Poll() starts
+// and finishes rebuilds as needed.
+//
+// The filter keeps the sorted list of base keys (8 bytes per key), since a
+// rebuild needs them. Like the filters it is made of, it is not thread safe:
+// lookups and updates must be serialized by the caller, only the rebuild runs
+// concurrently.
+
+#ifndef LAYERED_FILTER_H_
+#define LAYERED_FILTER_H_
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <future>
+#include <memory>
+#include <random>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+template <typename Table> struct FilterAPI;
+
+template <typename Base, typename Delta>
+class LayeredFilter {
+ public:
+  struct Config {
+    size_t max_delta_keys = 1 << 16;
+    double max_fpr = 0.01;
+  };
+
+  // keys need not be sorted or distinct.
+  LayeredFilter(std::vector<uint64_t> keys, Config config = Config())
+      : config_(config) {
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+    base_keys_ = std::move(keys);
+    base_ = Build(base_keys_);
+    base_fpr_ = SampleFpr(base_.get());
+    ResetDelta();
+  }
+
+  ~LayeredFilter() {
+    if (compaction_.valid()) {
+      compaction_.wait();
+    }
+  }
+
+  bool Contain(uint64_t key) {
+    const bool in_base = FilterAPI<Base>::Contain(key, base_.get());
+    if (added_.empty() && removed_.empty()) {
+      // no branch on in_base, which would be mispredicted on mixed queries
+      return in_base;
+    }
+    if (in_base &&
+        (removed_.empty() || !FilterAPI<Delta>::Contain(key, tombstones_.get()) ||
+         removed_.count(key) == 0)) {
+      return true;
+    }
+    return !added_.empty() && FilterAPI<Delta>::Contain(key, delta_.get());
+  }
+
+  void Add(uint64_t key) {
+    MakeRoom();
+    Journal(key, true);
+    if (removed_.erase(key) > 0) {
+      // a base key, back again
+      FilterAPI<Delta>::Remove(key, tombstones_.get());
+      return;
+    }
+    if (added_.count(key) > 0 ||
+        std::binary_search(base_keys_.begin(), base_keys_.end(), key)) {
+      return;
+    }
+    FilterAPI<Delta>::Add(key, delta_.get());
+    added_.insert(key);
+    updates_++;
+  }
+
+  void Remove(uint64_t key) {
+    MakeRoom();
+    Journal(key, false);
+    if (added_.erase(key) > 0) {
+      FilterAPI<Delta>::Remove(key, delta_.get());
+      return;
+    }
+    if (removed_.count(key) > 0 ||
+        !std::binary_search(base_keys_.begin(), base_keys_.end(), key)) {
+      return;
+    }
+    FilterAPI<Delta>::Add(key, tombstones_.get());
+    removed_.insert(key);
+    updates_++;
+  }
+
+  // Estimated false-positive rate: that of the base, plus that of the delta
+  // as sampled after the last few updates.
+  double EstimatedFpr() {
+    if (updates_ >= fpr_sampled_at_ + std::max<size_t>(1, config_.max_delta_keys / 16)) {
+      delta_fpr_ = SampleFpr(delta_.get());
+      fpr_sampled_at_ = updates_;
+    }
+    return 1 - (1 - base_fpr_) * (1 - delta_fpr_);
+  }
+
+  bool NeedsCompaction() {
+    return added_.size() + removed_.size() >= config_.max_delta_keys ||
+           EstimatedFpr() > config_.max_fpr;
+  }
+
+  bool Compacting() const { return compaction_.valid(); }
+
+  // Starts rebuilding the base, with the delta folded in, on another thread.
+  void StartCompaction() {
+    if (compaction_.valid()) {
+      return;
+    }
+    std::vector<uint64_t> added(added_.begin(), added_.end());
+    std::vector<uint64_t> removed(removed_.begin(), removed_.end());
+    journal_.clear();
+    compaction_started_ = std::chrono::steady_clock::now();
+    // base_keys_ is only replaced by FinishCompaction, after the rebuild
+    compaction_ = std::async(std::launch::async, [this, added, removed]() mutable {
+      std::sort(added.begin(), added.end());
+      std::sort(removed.begin(), removed.end());
+      Rebuilt r;
+      r.keys.reserve(base_keys_.size() + added.size());
+      std::set_union(base_keys_.begin(), base_keys_.end(), added.begin(),
+                     added.end(), std::back_inserter(r.keys));
+      r.keys.erase(std::remove_if(r.keys.begin(), r.keys.end(),
+                                  [&](uint64_t k) {
+                                    return std::binary_search(removed.begin(), removed.end(), k);
+                                  }),
+                   r.keys.end());
+      r.base = Build(r.keys);
+      r.fpr = SampleFpr(r.base.get());
+      return r;
+    });
+  }
+
+  // Installs the rebuilt base if it is ready (or, with wait, once it is) and
+  // replays the updates made in the meantime. Returns true if it did.
+  bool FinishCompaction(bool wait = false) {
+    if (!compaction_.valid()) {
+      return false;
+    }
+    if (!wait && compaction_.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+      return false;
+    }
+    Rebuilt r = compaction_.get();
+    base_keys_ = std::move(r.keys);
+    base_ = std::move(r.base);
+    base_fpr_ = r.fpr;
+    ResetDelta();
+    std::vector<std::pair<uint64_t, bool>> journal;
+    journal.swap(journal_);
+    for (const auto &update : journal) {
+      if (update.second) {
+        Add(update.first);
+      } else {
+        Remove(update.first);
+      }
+    }
+    compactions_++;
+    last_compaction_ns_ = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                              std::chrono::steady_clock::now() - compaction_started_)
+                              .count();
+    return true;
+  }
+
+  // Rebuilds the base now.
+  void Compact() {
+    StartCompaction();
+    FinishCompaction(true);
+  }
+
+  // For an updater loop: finishes a rebuild that is done, starts one that is
+  // due.
+  void Poll() {
+    FinishCompaction();
+    if (!compaction_.valid() && NeedsCompaction()) {
+      StartCompaction();
+    }
+  }
+
+  size_t BaseKeys() const { return base_keys_.size(); }
+  size_t DeltaKeys() const { return added_.size(); }
+  size_t Tombstones() const { return removed_.size(); }
+  size_t Compactions() const { return compactions_; }
+  uint64_t LastCompactionNs() const { return last_compaction_ns_; }
+
+  // The filters only; the key list and the exact update sets come on top.
+  size_t SizeInBytes() const {
+    return base_->SizeInBytes() + delta_->SizeInBytes() + tombstones_->SizeInBytes();
+  }
+
+ private:
+  struct Rebuilt {
+    std::vector<uint64_t> keys;
+    std::unique_ptr<Base> base;
+    double fpr = 0;
+  };
+
+  static std::unique_ptr<Base> Build(const std::vector<uint64_t> &keys) {
+    std::unique_ptr<Base> base(new Base(FilterAPI<Base>::ConstructFromAddCount(keys.size())));
+    FilterAPI<Base>::AddAll(keys, 0, keys.size(), base.get());
+    return base;
+  }
+
+  // fraction of random keys found; the keys are almost surely not in table
+  template <typename Table>
+  static double SampleFpr(Table *table) {
+    const size_t samples = 1 << 14;
+    std::mt19937_64 rng(0x9E3779B97F4A7C15);
+    size_t found = 0;
+    for (size_t i = 0; i < samples; i++) {
+      found += FilterAPI<Table>::Contain(rng(), table);
+    }
+    return double(found) / samples;
+  }
+
+  // room for the updates that make a compaction due, and as many again while
+  // it runs
+  size_t Capacity() const { return 2 * config_.max_delta_keys; }
+
+  void ResetDelta() {
+    delta_.reset(new Delta(FilterAPI<Delta>::ConstructFromAddCount(Capacity())));
+    tombstones_.reset(new Delta(FilterAPI<Delta>::ConstructFromAddCount(Capacity())));
+    added_.clear();
+    removed_.clear();
+    updates_ = fpr_sampled_at_ = 0;
+    delta_fpr_ = 0;
+  }
+
+  void Journal(uint64_t key, bool add) {
+    if (compaction_.valid()) {
+      journal_.emplace_back(key, add);
+    }
+  }
+
+  // The delta is full: wait for the rebuild under way, or do one now.
+  void MakeRoom() {
+    if (added_.size() + removed_.size() < Capacity()) {
+      return;
+    }
+    if (compaction_.valid()) {
+      FinishCompaction(true);
+    } else {
+      Compact();
+    }
+  }
+
+  Config config_;
+  std::vector<uint64_t> base_keys_;
+  std::unique_ptr<Base> base_;
+  std::unique_ptr<Delta> delta_;
+  std::unique_ptr<Delta> tombstones_;
+  std::unordered_set<uint64_t> added_;
+  std::unordered_set<uint64_t> removed_;
+  double base_fpr_ = 0;
+  double delta_fpr_ = 0;
+  size_t updates_ = 0;
+  size_t fpr_sampled_at_ = 0;
+
+  std::future<Rebuilt> compaction_;
+  std::chrono::steady_clock::time_point compaction_started_;
+  std::vector<std::pair<uint64_t, bool>> journal_;
+  size_t compactions_ = 0;
+  uint64_t last_compaction_ns_ = 0;
+};
+
+#endif // LAYERED_FILTER_H_
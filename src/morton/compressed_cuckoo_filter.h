@@ -1186,6 +1186,51 @@ namespace CompressedCuckoo{
     }
   }
 
+  // likely_contains() as a resumable state machine for software-pipelined
+  // batches (see batchlookup.h). Start prefetches the primary block; each
+  // resume either finishes or prefetches the secondary block and returns
+  // false.
+  struct lookup_state{
+    hash_t bucket;
+    atom_t fingerprint;
+    bool found;
+    bool secondary;
+  };
+
+  inline void likely_contains_start(const keys_t key, lookup_state* s) const{
+    hash_t raw_hash = raw_primary_hash(key);
+    s->fingerprint = fingerprint_function(raw_hash);
+    s->bucket = map_to_bucket(raw_hash, _total_buckets);
+    s->found = false;
+    s->secondary = false;
+    __builtin_prefetch(&_storage[s->bucket / _buckets_per_block]);
+    if(_remap_enabled && !_morton_filter_functionality_enabled){
+      // Compressed cuckoo filter: both buckets are always read
+      hash_t secondary_bucket = determine_alternate_bucket(s->bucket,
+        s->fingerprint);
+      __builtin_prefetch(&_storage[secondary_bucket / _buckets_per_block]);
+    }
+  }
+
+  inline bool likely_contains_resume(lookup_state* s) const{
+    if(s->secondary){
+      s->found = table_read_and_compare(s->bucket, s->fingerprint);
+      return true;
+    }
+    s->found = table_read_and_compare(s->bucket, s->fingerprint);
+    if(s->found || !_remap_enabled){
+      return true;
+    }
+    if(_morton_filter_functionality_enabled &&
+      !get_overflow_status(s->bucket, s->fingerprint)){
+      return true;
+    }
+    s->bucket = determine_alternate_bucket(s->bucket, s->fingerprint);
+    s->secondary = true;
+    __builtin_prefetch(&_storage[s->bucket / _buckets_per_block]);
+    return false;
+  }
+
   inline counter_t get_bucket_start_index(uint64_t block_id, uint16_t
     counter_index) const{
     counter_t bucket_start_index;
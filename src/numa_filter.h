@@ -0,0 +1,224 @@
+// Read-only filters on multi-socket hosts.
+//
+// A filter built by one thread has its pages on that thread's NUMA node, so
+// query threads on the other sockets pay a remote access, over a shared
+// link, on every probe. NumaFilter copies a built filter (see FilterImage)
+// and places the copies explicitly:
+//
+//   replicate   one copy per memory node, bound to it; each query thread
+//               uses the copy on its own node, Local()
+//   interleave  a single copy whose pages are spread round-robin over the
+//               nodes, so that every socket sees the same mix of local and
+//               remote probes and no memory controller takes all the load
+//
+// Placement uses mbind(2) directly, so no libnuma is needed. On a host with
+// one node, or where the kernel has no NUMA support, there is one copy and
+// every call works the same; Placed() then tells that nothing was enforced.
+//
+// Pin query threads (affinity::pin_current_thread) before calling Local(),
+// and keep its result: the node is looked up with sched_getcpu(), which is
+// cheap, but not free enough to do per query.
+
+#ifndef NUMA_FILTER_H_
+#define NUMA_FILTER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+#include <sys/mman.h>
+
+#if defined(__linux__)
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "affinity.h"
+#include "filter_image.h"
+#include "filterapi.h"
+
+namespace numa {
+
+// The nodes that have memory, in increasing order; {0} without NUMA support.
+inline const std::vector<int> &memory_nodes() {
+  static const std::vector<int> nodes = []() {
+    std::vector<int> n = affinity::detail::read_list("/sys/devices/system/node/has_memory");
+    if (n.empty()) {
+      n = affinity::detail::read_list("/sys/devices/system/node/online");
+    }
+    if (n.empty()) {
+      n.push_back(0);
+    }
+    return n;
+  }();
+  return nodes;
+}
+
+// The node of the CPU the calling thread runs on, 0 if unknown.
+inline int current_node() {
+  static const std::vector<int> node_of = []() {
+    std::vector<int> n;
+    for (const affinity::cpu &c : affinity::online_cpus()) {
+      if (size_t(c.id) >= n.size()) {
+        n.resize(c.id + 1, 0);
+      }
+      n[c.id] = c.node;
+    }
+    return n;
+  }();
+#if defined(__linux__)
+  const int c = sched_getcpu();
+  if (c >= 0 && size_t(c) < node_of.size()) {
+    return node_of[c];
+  }
+#endif
+  return 0;
+}
+
+enum mode { bind_to, interleave_over };
+
+// Sets the policy of the untouched pages [p, p + bytes), p page-aligned:
+// all on the first of nodes, or interleaved over all of them. False if the
+// kernel refused, or has no NUMA support.
+inline bool place(void *p, size_t bytes, mode m, const std::vector<int> &nodes) {
+#if defined(__linux__) && defined(SYS_mbind)
+  constexpr int kMaxNodes = 1024;
+  constexpr int kBind = 2;       // MPOL_BIND
+  constexpr int kInterleave = 3; // MPOL_INTERLEAVE
+  unsigned long mask[kMaxNodes / (8 * sizeof(unsigned long))] = {};
+  for (size_t i = 0; i < nodes.size() && (m == interleave_over || i == 0); i++) {
+    if (nodes[i] < 0 || nodes[i] >= kMaxNodes) {
+      return false;
+    }
+    mask[nodes[i] / (8 * sizeof(unsigned long))] |= 1UL << (nodes[i] % (8 * sizeof(unsigned long)));
+  }
+  // the kernel reads maxnode - 1 bits
+  return syscall(SYS_mbind, p, bytes, m == bind_to ? kBind : kInterleave, mask,
+                 kMaxNodes + 1, 0) == 0;
+#else
+  (void)p;
+  (void)bytes;
+  (void)m;
+  (void)nodes;
+  return false;
+#endif
+}
+
+} // namespace numa
+
+template <typename Table>
+class NumaFilter {
+ public:
+  enum Mode { replicate, interleave };
+
+  // Copies source, which can then be dropped. Throws std::bad_alloc if a
+  // copy cannot be mapped.
+  explicit NumaFilter(const Table &source, Mode mode = replicate)
+      : mode_(mode), bytes_(FilterImage<Table>::Bytes(source)) {
+    const std::vector<int> &nodes = numa::memory_nodes();
+    placed_ = nodes.size() > 1;
+    if (mode == replicate) {
+      for (int node : nodes) {
+        Add(source, numa::bind_to, {node});
+      }
+    } else {
+      Add(source, numa::interleave_over, nodes);
+    }
+  }
+
+  NumaFilter(const NumaFilter &) = delete;
+  NumaFilter &operator=(const NumaFilter &) = delete;
+
+  ~NumaFilter() {
+    for (std::unique_ptr<Copy> &c : copies_) {
+      FilterImage<Table>::Release(c->table());
+      munmap(c->image, c->length);
+    }
+  }
+
+  // The copy to query from the calling thread: the one on its node.
+  Table *Local() { return Replica(numa::current_node()); }
+
+  // The copy on node; the first one if there is none there.
+  Table *Replica(int node) {
+    for (std::unique_ptr<Copy> &c : copies_) {
+      if (c->node == node) {
+        return c->table();
+      }
+    }
+    return copies_[0]->table();
+  }
+
+  bool Contain(uint64_t key) { return FilterAPI<Table>::Contain(key, Local()); }
+
+  Mode mode() const { return mode_; }
+  size_t Copies() const { return copies_.size(); }
+  // the nodes the copies are on, -1 for an interleaved one
+  std::vector<int> Nodes() const {
+    std::vector<int> nodes;
+    for (const std::unique_ptr<Copy> &c : copies_) {
+      nodes.push_back(c->node);
+    }
+    return nodes;
+  }
+  // True if the kernel took every placement; false on a single node.
+  bool Placed() const { return placed_; }
+  size_t BytesPerCopy() const { return bytes_; }
+  size_t SizeInBytes() const { return bytes_ * copies_.size(); }
+
+ private:
+  struct Copy {
+    char *image;
+    size_t length;
+    int node;
+    typename std::aligned_storage<sizeof(Table), alignof(Table)>::type storage;
+    Table *table() { return reinterpret_cast<Table *>(&storage); }
+  };
+
+  void Add(const Table &source, numa::mode m, const std::vector<int> &nodes) {
+    std::unique_ptr<Copy> c(new Copy());
+    c->length = bytes_ > 0 ? bytes_ : 1;
+    c->node = m == numa::bind_to ? nodes[0] : -1;
+    void *p = mmap(nullptr, c->length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+      throw std::bad_alloc();
+    }
+    c->image = static_cast<char *>(p);
+    // before the first write, which is what allocates the pages
+    if (placed_ && !numa::place(p, c->length, m, nodes)) {
+      placed_ = false;
+    }
+    FilterImage<Table>::Write(source, c->image);
+    FilterImage<Table>::View(c->image, c->table());
+    copies_.push_back(std::move(c));
+  }
+
+  Mode mode_;
+  size_t bytes_;
+  bool placed_ = false;
+  std::vector<std::unique_ptr<Copy>> copies_;
+};
+
+template <typename Table>
+struct FilterAPI<NumaFilter<Table>>
+{
+  static void Add(uint64_t, NumaFilter<Table> *)
+  {
+    throw std::runtime_error("Unsupported");
+  }
+  static void Remove(uint64_t, NumaFilter<Table> *)
+  {
+    throw std::runtime_error("Unsupported");
+  }
+  CONTAIN_ATTRIBUTES static bool Contain(uint64_t key, NumaFilter<Table> *table)
+  {
+    return table->Contain(key);
+  }
+};
+
+#endif // NUMA_FILTER_H_
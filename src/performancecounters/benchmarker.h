@@ -1,8 +1,14 @@
 #pragma once
 
+#include "performancecounters/cold_cache.h"
 #include "performancecounters/event_counter.h"
+#include "performancecounters/latency_histogram.h"
+#include "performancecounters/memory_tracker.h"
+#include "performancecounters/result_writer.h"
 #include  <atomic>
 event_collector collector;
+memory_profile memprofile;
+result_writer results;
 
 template <class function_type> 
 event_aggregate bench(const function_type& function, size_t min_repeat = 10, size_t min_time_ns = 1000000000, size_t max_repeat = 1000000) {
@@ -22,3 +28,46 @@ event_aggregate bench(const function_type& function, size_t min_repeat = 10, siz
     }
     return aggregate;
 }
+
+// Cache-cold counterpart of bench(): before each of the `repeat` calls,
+// prepare() is called and the caches are flushed, neither being timed.
+// prepare() is the place to reshuffle the query order, so that no two
+// repetitions touch the filter in the same order.
+template <class function_type, class prepare_type>
+event_aggregate bench_cold(const function_type& function, const prepare_type& prepare,
+                           cache_flusher& flusher, size_t repeat = 10) {
+    event_aggregate aggregate{};
+    if(repeat == 0) { repeat = 1; }
+    for (size_t i = 0; i < repeat; i++) {
+      prepare();
+      flusher.flush();
+      std::atomic_thread_fence(std::memory_order_acquire);
+      collector.start();
+      function();
+      std::atomic_thread_fence(std::memory_order_release);
+      event_count allocate_count = collector.end();
+      aggregate << allocate_count;
+    }
+    return aggregate;
+}
+
+// Latency-sampling counterpart of bench(): calls function(i) for every i in
+// [0, n), timing groups of `batch` consecutive calls, and records the
+// per-call latency of each group. batch == 1 times single calls; larger
+// batches amortize the ~20-cycle cost of the timer reads over the group.
+template <class function_type>
+latency_histogram bench_latency(const function_type& function, size_t n, size_t batch = 1) {
+    latency_histogram histogram{};
+    if(batch == 0) { batch = 1; }
+    const double ns_per_tick = latency_clock::ns_per_tick();
+    for (size_t i = 0; i < n; i += batch) {
+      const size_t end = (i + batch < n) ? i + batch : n;
+      const uint64_t t0 = latency_clock::start();
+      for (size_t j = i; j < end; j++) {
+        function(j);
+      }
+      const uint64_t t1 = latency_clock::stop();
+      histogram.record_ns((t1 - t0) * ns_per_tick / (end - i), end - i);
+    }
+    return histogram;
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+#if defined(__linux__)
+#include <unistd.h>
+#endif
+#if defined(__APPLE__)
+#include <sys/sysctl.h>
+#include <sys/types.h>
+#endif
+
+// Cache eviction between benchmark repetitions.
+//
+// bench() reports the fastest of many repetitions of the same loop, so any
+// filter that fits in the last-level cache is measured warm. cache_flusher
+// writes one byte per cache line of a buffer a few times the size of the LLC,
+// which evicts the filter (and its page-table entries) from every cache
+// level, whatever the replacement policy.
+
+// Size of the last-level cache in bytes, or 0 if unknown.
+inline size_t last_level_cache_bytes() {
+#if defined(__linux__)
+  long bytes = 0;
+#if defined(_SC_LEVEL3_CACHE_SIZE)
+  bytes = sysconf(_SC_LEVEL3_CACHE_SIZE);
+  if (bytes <= 0) {
+    bytes = sysconf(_SC_LEVEL2_CACHE_SIZE);
+  }
+#endif
+  if (bytes <= 0) {
+    for (const char* index : {"3", "2"}) {
+      char path[128];
+      snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu0/cache/index%s/size", index);
+      FILE* f = fopen(path, "r");
+      if (f == nullptr) {
+        continue;
+      }
+      char unit = 0;
+      if (fscanf(f, "%ld%c", &bytes, &unit) >= 1) {
+        if (unit == 'K') { bytes *= 1024; }
+        if (unit == 'M') { bytes *= 1024 * 1024; }
+      }
+      fclose(f);
+      if (bytes > 0) {
+        break;
+      }
+    }
+  }
+  return bytes > 0 ? size_t(bytes) : 0;
+#elif defined(__APPLE__)
+  for (const char* name : {"hw.l3cachesize", "hw.l2cachesize"}) {
+    int64_t bytes = 0;
+    size_t len = sizeof(bytes);
+    if (sysctlbyname(name, &bytes, &len, nullptr, 0) == 0 && bytes > 0) {
+      return size_t(bytes);
+    }
+  }
+  return 0;
+#else
+  return 0;
+#endif
+}
+
+struct cache_flusher {
+  std::vector<uint8_t> buffer;
+  uint8_t round = 0;
+
+  // bytes == 0: four times the LLC, or 256 MB if its size is unknown
+  explicit cache_flusher(size_t bytes = 0) {
+    if (bytes == 0) {
+      const size_t llc = last_level_cache_bytes();
+      bytes = llc ? 4 * llc : size_t(256) << 20;
+    }
+    buffer.resize(bytes);
+  }
+
+  void flush() {
+    round++;
+    volatile uint8_t* p = buffer.data();
+    for (size_t i = 0; i < buffer.size(); i += 64) {
+      p[i] = uint8_t(p[i] + round);
+    }
+  }
+};
@@ -24,17 +24,25 @@
 struct event_count {
   std::chrono::duration<double> elapsed;
   std::vector<unsigned long long> event_counts;
-  event_count() : elapsed(0), event_counts{0, 0, 0, 0, 0} {}
+  event_count() : elapsed(0), event_counts(NUM_EVENTS, 0) {}
   event_count(const std::chrono::duration<double> _elapsed,
               const std::vector<unsigned long long> _event_counts)
       : elapsed(_elapsed), event_counts(_event_counts) {}
   event_count(const event_count& other)
       : elapsed(other.elapsed), event_counts(other.event_counts) {}
 
-  // The types of counters (so we can read the getter more easily)
+  // The types of counters (so we can read the getter more easily). Cache and
+  // TLB misses count loads (reads) only. Not every platform has every event;
+  // missing ones read as 0.
   enum event_counter_types {
     CPU_CYCLES,
     INSTRUCTIONS,
+    BRANCH_MISSES,
+    BRANCHES,
+    L1D_MISSES,
+    LLC_MISSES,
+    DTLB_MISSES,
+    NUM_EVENTS
   };
 
   double elapsed_sec() const {
@@ -49,6 +57,21 @@ struct event_count {
   double instructions() const {
     return static_cast<double>(event_counts[INSTRUCTIONS]);
   }
+  double branch_misses() const {
+    return static_cast<double>(event_counts[BRANCH_MISSES]);
+  }
+  double branches() const {
+    return static_cast<double>(event_counts[BRANCHES]);
+  }
+  double l1d_misses() const {
+    return static_cast<double>(event_counts[L1D_MISSES]);
+  }
+  double llc_misses() const {
+    return static_cast<double>(event_counts[LLC_MISSES]);
+  }
+  double dtlb_misses() const {
+    return static_cast<double>(event_counts[DTLB_MISSES]);
+  }
 
   event_count& operator=(const event_count& other) {
     this->elapsed = other.elapsed;
@@ -56,14 +79,11 @@ struct event_count {
     return *this;
   }
   event_count operator+(const event_count& other) const {
-    return event_count(elapsed + other.elapsed,
-                       {
-                           event_counts[0] + other.event_counts[0],
-                           event_counts[1] + other.event_counts[1],
-                           event_counts[2] + other.event_counts[2],
-                           event_counts[3] + other.event_counts[3],
-                           event_counts[4] + other.event_counts[4],
-                       });
+    std::vector<unsigned long long> sum(event_counts);
+    for (size_t i = 0; i < sum.size(); i++) {
+      sum[i] += other.event_counts[i];
+    }
+    return event_count(elapsed + other.elapsed, sum);
   }
 
   void operator+=(const event_count& other) { *this = *this + other; }
@@ -97,6 +117,16 @@ struct event_aggregate {
   double fastest_elapsed_ns() const { return best.elapsed_ns(); }
   double fastest_cycles() const { return best.cycles(); }
   double fastest_instructions() const { return best.instructions(); }
+  double branch_misses() const { return total.branch_misses() / iterations; }
+  double branches() const { return total.branches() / iterations; }
+  double l1d_misses() const { return total.l1d_misses() / iterations; }
+  double llc_misses() const { return total.llc_misses() / iterations; }
+  double dtlb_misses() const { return total.dtlb_misses() / iterations; }
+  double fastest_branch_misses() const { return best.branch_misses(); }
+  double fastest_branches() const { return best.branches(); }
+  double fastest_l1d_misses() const { return best.l1d_misses(); }
+  double fastest_llc_misses() const { return best.llc_misses(); }
+  double fastest_dtlb_misses() const { return best.dtlb_misses(); }
 };
 
 struct event_collector {
@@ -104,25 +134,46 @@ struct event_collector {
   std::chrono::time_point<std::chrono::steady_clock> start_clock{};
 
 #if defined(__linux__)
+  // Two groups, so that the kernel can still schedule the core counters when
+  // the PMU has too few programmable counters for all of them at once.
   LinuxEvents<PERF_TYPE_HARDWARE> linux_events;
+  LinuxEvents<PERF_TYPE_HW_CACHE> cache_events;
+  std::vector<unsigned long long> cache_counts;
+  static constexpr uint64_t read_misses(uint64_t cache) {
+    return cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+           (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+  }
   event_collector()
-      : linux_events(std::vector<int>{
+      // in the order of event_count::event_counter_types, up to BRANCHES
+      : linux_events(std::vector<uint64_t>{
             PERF_COUNT_HW_CPU_CYCLES,
             PERF_COUNT_HW_INSTRUCTIONS,
-        }) {}
+            PERF_COUNT_HW_BRANCH_MISSES,
+            PERF_COUNT_HW_BRANCH_INSTRUCTIONS,
+        }),
+        cache_events(std::vector<uint64_t>{
+            read_misses(PERF_COUNT_HW_CACHE_L1D),
+            read_misses(PERF_COUNT_HW_CACHE_LL),
+            read_misses(PERF_COUNT_HW_CACHE_DTLB),
+        }),
+        cache_counts(3) {}
   bool has_events() { return linux_events.is_working(); }
+  bool has_cache_events() { return cache_events.is_working(); }
 #elif __APPLE__ && __aarch64__
   AppleEvents apple_events;
   performance_counters diff;
   event_collector() : diff(0) { apple_events.setup_performance_counters(); }
   bool has_events() { return apple_events.setup_performance_counters(); }
+  bool has_cache_events() { return false; }
 #else
   event_collector() {}
   bool has_events() { return false; }
+  bool has_cache_events() { return false; }
 #endif
 
   inline void start() {
 #if defined(__linux)
+    cache_events.start();
     linux_events.start();
 #elif __APPLE__ && __aarch64__
     if (has_events()) {
@@ -135,16 +186,19 @@ struct event_collector {
     const auto end_clock = std::chrono::steady_clock::now();
 #if defined(__linux)
     linux_events.end(count.event_counts);
+    cache_events.end(cache_counts);
+    count.event_counts[event_count::L1D_MISSES] = cache_counts[0];
+    count.event_counts[event_count::LLC_MISSES] = cache_counts[1];
+    count.event_counts[event_count::DTLB_MISSES] = cache_counts[2];
 #elif __APPLE__ && __aarch64__
     if (has_events()) {
       performance_counters end = apple_events.get_counters();
       diff = end - diff;
     }
-    count.event_counts[0] = diff.cycles;
-    count.event_counts[1] = diff.instructions;
-    count.event_counts[2] = diff.missed_branches;
-    count.event_counts[3] = 0;
-    count.event_counts[4] = diff.branches;
+    count.event_counts[event_count::CPU_CYCLES] = diff.cycles;
+    count.event_counts[event_count::INSTRUCTIONS] = diff.instructions;
+    count.event_counts[event_count::BRANCH_MISSES] = diff.missed_branches;
+    count.event_counts[event_count::BRANCHES] = diff.branches;
 #endif
     count.elapsed = end_clock - start_clock;
     return count;
@@ -0,0 +1,162 @@
+#pragma once
+
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// Latency sampling for tail-latency measurements.
+//
+// latency_clock reads the TSC on x86 (fenced, so that the measured code
+// cannot drift across the reads) and steady_clock elsewhere; its ticks are
+// converted to nanoseconds with a ratio calibrated once against steady_clock.
+//
+// latency_histogram is an HDR-style histogram: values below 32 have their own
+// bucket, larger ones fall in one of 32 linear sub-buckets per power of two,
+// so any recorded value is known to within about 3%. Values are kept in
+// picoseconds, which keeps sub-nanosecond per-query latencies of batched
+// samples apart.
+
+struct latency_clock {
+  static inline uint64_t start() {
+#if defined(__x86_64__) || defined(__i386__)
+    _mm_lfence();
+    return __rdtsc();
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+#endif
+  }
+
+  static inline uint64_t stop() {
+#if defined(__x86_64__) || defined(__i386__)
+    unsigned int aux;
+    const uint64_t t = __rdtscp(&aux);
+    _mm_lfence();
+    return t;
+#else
+    return start();
+#endif
+  }
+
+  // Nanoseconds per tick.
+  static double ns_per_tick() {
+    static const double ratio = calibrate();
+    return ratio;
+  }
+
+ private:
+  static double calibrate() {
+#if defined(__x86_64__) || defined(__i386__)
+    const auto t0 = std::chrono::steady_clock::now();
+    const uint64_t c0 = start();
+    while (std::chrono::steady_clock::now() - t0 < std::chrono::milliseconds(20)) {
+    }
+    const uint64_t c1 = stop();
+    const auto t1 = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(t1 - t0).count() / double(c1 - c0);
+#else
+    return 1.0;
+#endif
+  }
+};
+
+struct latency_histogram {
+  static constexpr int sub_bits = 5;
+  static constexpr uint64_t sub_count = uint64_t(1) << sub_bits;
+  static constexpr size_t bucket_count = (64 - sub_bits + 1) * sub_count;
+
+  std::vector<uint64_t> buckets;
+  uint64_t count = 0;
+  uint64_t min_ps = UINT64_MAX;
+  uint64_t max_ps = 0;
+  double sum_ps = 0;
+
+  latency_histogram() : buckets(bucket_count, 0) {}
+
+  static size_t bucket_of(uint64_t v) {
+    if (v < sub_count) {
+      return v;
+    }
+    const int e = 63 - __builtin_clzll(v);
+    return (e - sub_bits + 1) * sub_count + ((v >> (e - sub_bits)) & (sub_count - 1));
+  }
+
+  // The middle of bucket b.
+  static double value_of(size_t b) {
+    if (b < sub_count) {
+      return double(b);
+    }
+    const int e = int(b / sub_count) + sub_bits - 1;
+    const uint64_t width = uint64_t(1) << (e - sub_bits);
+    return double((sub_count + b % sub_count) * width) + width / 2.0;
+  }
+
+  void record_ps(uint64_t ps, uint64_t times = 1) {
+    buckets[bucket_of(ps)] += times;
+    count += times;
+    sum_ps += double(ps) * times;
+    if (ps < min_ps) { min_ps = ps; }
+    if (ps > max_ps) { max_ps = ps; }
+  }
+
+  void record_ns(double ns, uint64_t times = 1) {
+    record_ps(uint64_t(std::llround(ns * 1000.0)), times);
+  }
+
+  void operator<<(const latency_histogram& other) {
+    for (size_t b = 0; b < bucket_count; b++) {
+      buckets[b] += other.buckets[b];
+    }
+    count += other.count;
+    sum_ps += other.sum_ps;
+    if (other.min_ps < min_ps) { min_ps = other.min_ps; }
+    if (other.max_ps > max_ps) { max_ps = other.max_ps; }
+  }
+
+  // Smallest recorded latency such that a fraction q of the samples are at or
+  // below it (q in [0, 1]).
+  double percentile_ns(double q) const {
+    if (count == 0) {
+      return 0;
+    }
+    if (q >= 1.0) {
+      return max_ns();
+    }
+    uint64_t rank = uint64_t(std::ceil(q * double(count)));
+    if (rank == 0) {
+      rank = 1;
+    }
+    uint64_t seen = 0;
+    for (size_t b = 0; b < bucket_count; b++) {
+      seen += buckets[b];
+      if (seen >= rank) {
+        // never report past the exact extremes
+        double v = value_of(b);
+        if (v > double(max_ps)) { v = double(max_ps); }
+        if (v < double(min_ps)) { v = double(min_ps); }
+        return v / 1000.0;
+      }
+    }
+    return max_ns();
+  }
+
+  double p50_ns() const { return percentile_ns(0.50); }
+  double p90_ns() const { return percentile_ns(0.90); }
+  double p99_ns() const { return percentile_ns(0.99); }
+  double p999_ns() const { return percentile_ns(0.999); }
+  double max_ns() const { return count ? max_ps / 1000.0 : 0; }
+  double mean_ns() const { return count ? sum_ps / count / 1000.0 : 0; }
+
+  void print(const char* name, FILE* out = stdout) const {
+    fprintf(out, "%-30s : %10.1f %10.1f %10.1f %10.1f %10.1f ns  (%llu samples)\n",
+            name, p50_ns(), p90_ns(), p99_ns(), p999_ns(), max_ns(),
+            (unsigned long long)count);
+  }
+};
@@ -13,6 +13,10 @@
 #include <iostream>
 #include <vector>
 
+// One perf event group of the given TYPE. The first event that opens leads the
+// group; events the CPU or kernel does not support are skipped and read as 0.
+// When the kernel has to multiplex several groups on the PMU, counts are
+// scaled by time_enabled / time_running.
 template <int TYPE = PERF_TYPE_HARDWARE>
 class LinuxEvents {
   int fd;
@@ -21,9 +25,11 @@ class LinuxEvents {
   size_t num_events{};
   std::vector<uint64_t> temp_result_vec{};
   std::vector<uint64_t> ids{};
+  std::vector<bool> opened{};
+  std::vector<int> fds{};
 
  public:
-  explicit LinuxEvents(std::vector<int> config_vec) : fd(0), working(true) {
+  explicit LinuxEvents(std::vector<uint64_t> config_vec) : fd(-1), working(true) {
     memset(&attribs, 0, sizeof(attribs));
     attribs.type = TYPE;
     attribs.size = sizeof(attribs);
@@ -32,35 +38,41 @@ class LinuxEvents {
     attribs.exclude_hv = 1;
 
     attribs.sample_period = 0;
-    attribs.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_ID;
+    attribs.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_ID |
+                          PERF_FORMAT_TOTAL_TIME_ENABLED |
+                          PERF_FORMAT_TOTAL_TIME_RUNNING;
     const int pid = 0;   // the current process
     const int cpu = -1;  // all CPUs
     const unsigned long flags = 0;
 
-    int group = -1;  // no group
     num_events = config_vec.size();
-    ids.resize(config_vec.size());
-    uint32_t i = 0;
-    for (auto config : config_vec) {
-      attribs.config = config;
+    ids.resize(num_events);
+    opened.resize(num_events);
+    for (size_t i = 0; i < num_events; i++) {
+      attribs.config = config_vec[i];
       int _fd = static_cast<int>(
-          syscall(__NR_perf_event_open, &attribs, pid, cpu, group, flags));
+          syscall(__NR_perf_event_open, &attribs, pid, cpu, fd, flags));
       if (_fd == -1) {
-        report_error("perf_event_open");
+        continue;
       }
-      ioctl(_fd, PERF_EVENT_IOC_ID, &ids[i++]);
-      if (group == -1) {
-        group = _fd;
+      ioctl(_fd, PERF_EVENT_IOC_ID, &ids[i]);
+      opened[i] = true;
+      fds.push_back(_fd);
+      if (fd == -1) {
         fd = _fd;
       }
     }
+    if (fd == -1) {
+      report_error("perf_event_open");
+    }
 
-    temp_result_vec.resize(num_events * 2 + 1);
+    // nr, time_enabled, time_running, then a (value, id) pair per event
+    temp_result_vec.resize(3 + 2 * fds.size());
   }
 
   ~LinuxEvents() {
-    if (fd != -1) {
-      close(fd);
+    for (int f : fds) {
+      close(f);
     }
   }
 
@@ -76,30 +88,48 @@ class LinuxEvents {
     }
   }
 
+  // Writes the count of event i to results[i].
   inline void end(std::vector<unsigned long long> &results) {
-    if (fd != -1) {
-      if (ioctl(fd, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP) == -1) {
-        report_error("ioctl(PERF_EVENT_IOC_DISABLE)");
-      }
-
-      if (read(fd, temp_result_vec.data(), temp_result_vec.size() * 8) == -1) {
-        report_error("read");
-      }
+    for (size_t i = 0; i < num_events; i++) {
+      results[i] = 0;
+    }
+    if (fd == -1) {
+      return;
+    }
+    if (ioctl(fd, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP) == -1) {
+      report_error("ioctl(PERF_EVENT_IOC_DISABLE)");
     }
-    // our actual results are in slots 1,3,5, ... of this structure
-    for (uint32_t i = 1; i < temp_result_vec.size(); i += 2) {
-      results[i / 2] = temp_result_vec[i];
+    if (read(fd, temp_result_vec.data(), temp_result_vec.size() * 8) == -1) {
+      report_error("read");
+      return;
     }
-    for (uint32_t i = 2; i < temp_result_vec.size(); i += 2) {
-      if (ids[i / 2 - 1] != temp_result_vec[i]) {
+    const uint64_t nr = temp_result_vec[0];
+    const uint64_t enabled = temp_result_vec[1];
+    const uint64_t running = temp_result_vec[2];
+    for (uint64_t k = 0; k < nr && 4 + 2 * k < temp_result_vec.size(); k++) {
+      const uint64_t value = temp_result_vec[3 + 2 * k];
+      const uint64_t id = temp_result_vec[4 + 2 * k];
+      size_t i = 0;
+      while (i < num_events && !(opened[i] && ids[i] == id)) {
+        i++;
+      }
+      if (i == num_events) {
         report_error("event mismatch");
+        continue;
       }
+      results[i] = (running == 0 || running == enabled)
+                       ? value
+                       : static_cast<unsigned long long>(
+                             double(value) * enabled / running);
     }
   }
 
   bool is_working() { return working; }
 
+  // Whether event i (in constructor order) could be opened.
+  bool has_event(size_t i) const { return i < num_events && opened[i]; }
+
  private:
   void report_error(const std::string &) { working = false; }
 };
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// The byte counters behind memory_tracker.h, without its allocator hooks, so
+// that code that gets memory elsewhere (hugepage.h maps its arrays) can
+// report it from any translation unit.
+
+namespace memtrack {
+
+inline std::atomic<int64_t> live_bytes{0};
+inline std::atomic<int64_t> peak_bytes{0};
+
+inline void on_alloc(size_t n) {
+  const int64_t now =
+      live_bytes.fetch_add(int64_t(n), std::memory_order_relaxed) + int64_t(n);
+  int64_t peak = peak_bytes.load(std::memory_order_relaxed);
+  while (now > peak &&
+         !peak_bytes.compare_exchange_weak(peak, now, std::memory_order_relaxed)) {
+  }
+}
+
+inline void on_free(size_t n) {
+  live_bytes.fetch_sub(int64_t(n), std::memory_order_relaxed);
+}
+
+} // namespace memtrack
@@ -0,0 +1,327 @@
+#pragma once
+
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+#if defined(__linux__)
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#if defined(__APPLE__)
+#include <mach/mach.h>
+#include <malloc/malloc.h>
+#endif
+#include <sys/resource.h>
+
+#include "performancecounters/memory_counters.h"
+
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
+// Heap and RSS accounting for the benchmark drivers.
+//
+// SizeInBytes() only reports what a filter keeps. Construction can need
+// several times more (binary fuse Populate holds t2hash, reverseOrder, alone,
+// t2count and reverseH next to the fingerprints), and that is what decides
+// whether a rebuild fits on a memory-constrained builder.
+//
+// With glibc every malloc, calloc, realloc, aligned allocation and free of the
+// process is counted (operator new goes through malloc), so the C filters are
+// covered as well as the C++ ones. On macOS, where malloc cannot be interposed
+// this way, operator new and delete are replaced instead. Sizes are the usable
+// sizes reported by the allocator. Arrays that hugepage.h maps are counted
+// too, by length of the mapping. Define NO_MEMORY_TRACKING to compile the
+// hooks out; the RSS figures stay available.
+//
+// Like the event collector, this header defines its hooks, so it must be
+// included from a single translation unit (the driver).
+
+namespace memtrack {
+
+#if defined(NO_MEMORY_TRACKING)
+inline bool heap_tracking() { return false; }
+#elif defined(__GLIBC__) || defined(__APPLE__)
+inline bool heap_tracking() { return true; }
+#else
+inline bool heap_tracking() { return false; }
+#endif
+
+// Bytes currently allocated.
+inline size_t heap_bytes() {
+  const int64_t v = live_bytes.load(std::memory_order_relaxed);
+  return v > 0 ? size_t(v) : 0;
+}
+
+// Most bytes allocated at once since the last reset_heap_peak().
+inline size_t heap_peak_bytes() {
+  const int64_t v = peak_bytes.load(std::memory_order_relaxed);
+  return v > 0 ? size_t(v) : 0;
+}
+
+inline void reset_heap_peak() {
+  peak_bytes.store(live_bytes.load(std::memory_order_relaxed),
+                   std::memory_order_relaxed);
+}
+
+#if defined(__linux__)
+// Reads a "Name:   1234 kB" line of /proc/self/status.
+inline size_t proc_status_bytes(const char *name) {
+  FILE *f = fopen("/proc/self/status", "r");
+  if (f == nullptr) {
+    return 0;
+  }
+  char line[256];
+  size_t kb = 0;
+  const size_t len = strlen(name);
+  while (fgets(line, sizeof(line), f) != nullptr) {
+    if (strncmp(line, name, len) == 0 && line[len] == ':') {
+      kb = strtoull(line + len + 1, nullptr, 10);
+      break;
+    }
+  }
+  fclose(f);
+  return kb * 1024;
+}
+#endif
+
+// Resident set size of the process.
+inline size_t rss_bytes() {
+#if defined(__linux__)
+  return proc_status_bytes("VmRSS");
+#elif defined(__APPLE__)
+  mach_task_basic_info_data_t info;
+  mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+  if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO, (task_info_t)&info,
+                &count) != KERN_SUCCESS) {
+    return 0;
+  }
+  return info.resident_size;
+#else
+  return 0;
+#endif
+}
+
+// RSS high-water mark, since the last successful reset_rss_peak() or else
+// since the process started.
+inline size_t rss_peak_bytes() {
+#if defined(__linux__)
+  return proc_status_bytes("VmHWM");
+#else
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+#if defined(__APPLE__)
+  return size_t(usage.ru_maxrss);
+#else
+  return size_t(usage.ru_maxrss) * 1024;
+#endif
+#endif
+}
+
+// Linux (4.0+) lets a process reset its own VmHWM; elsewhere this fails and
+// the high-water mark stays process-wide.
+inline bool reset_rss_peak() {
+#if defined(__linux__)
+  const int fd = open("/proc/self/clear_refs", O_WRONLY);
+  if (fd < 0) {
+    return false;
+  }
+  const bool ok = write(fd, "5", 1) == 1;
+  close(fd);
+  return ok;
+#else
+  return false;
+#endif
+}
+
+} // namespace memtrack
+
+#if !defined(NO_MEMORY_TRACKING) && defined(__GLIBC__)
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+void *__libc_memalign(size_t alignment, size_t size);
+void __libc_free(void *ptr);
+
+void *malloc(size_t size) noexcept {
+  void *p = __libc_malloc(size);
+  if (p != nullptr) { memtrack::on_alloc(malloc_usable_size(p)); }
+  return p;
+}
+
+void *calloc(size_t count, size_t size) noexcept {
+  void *p = __libc_calloc(count, size);
+  if (p != nullptr) { memtrack::on_alloc(malloc_usable_size(p)); }
+  return p;
+}
+
+void *realloc(void *ptr, size_t size) noexcept {
+  const size_t old = ptr != nullptr ? malloc_usable_size(ptr) : 0;
+  void *p = __libc_realloc(ptr, size);
+  if (p != nullptr || size == 0) {
+    memtrack::on_free(old);
+  }
+  if (p != nullptr) { memtrack::on_alloc(malloc_usable_size(p)); }
+  return p;
+}
+
+void *memalign(size_t alignment, size_t size) noexcept {
+  void *p = __libc_memalign(alignment, size);
+  if (p != nullptr) { memtrack::on_alloc(malloc_usable_size(p)); }
+  return p;
+}
+
+void *aligned_alloc(size_t alignment, size_t size) noexcept {
+  return memalign(alignment, size);
+}
+
+int posix_memalign(void **out, size_t alignment, size_t size) noexcept {
+  if (alignment < sizeof(void *) || (alignment & (alignment - 1)) != 0) {
+    return EINVAL;
+  }
+  void *p = memalign(alignment, size);
+  if (p == nullptr) {
+    return ENOMEM;
+  }
+  *out = p;
+  return 0;
+}
+
+void free(void *ptr) noexcept {
+  if (ptr != nullptr) {
+    memtrack::on_free(malloc_usable_size(ptr));
+    __libc_free(ptr);
+  }
+}
+}
+#elif !defined(NO_MEMORY_TRACKING) && defined(__APPLE__)
+namespace memtrack {
+inline void *tracked_new(size_t size, size_t alignment, bool nothrow) {
+  void *p = nullptr;
+  if (alignment <= alignof(std::max_align_t)) {
+    p = malloc(size ? size : 1);
+  } else if (posix_memalign(&p, alignment, size ? size : 1) != 0) {
+    p = nullptr;
+  }
+  if (p == nullptr) {
+    if (nothrow) {
+      return nullptr;
+    }
+    throw std::bad_alloc();
+  }
+  on_alloc(malloc_size(p));
+  return p;
+}
+
+inline void tracked_delete(void *p) {
+  if (p != nullptr) {
+    on_free(malloc_size(p));
+    free(p);
+  }
+}
+} // namespace memtrack
+
+void *operator new(size_t n) { return memtrack::tracked_new(n, 0, false); }
+void *operator new[](size_t n) { return memtrack::tracked_new(n, 0, false); }
+void *operator new(size_t n, const std::nothrow_t &) noexcept {
+  return memtrack::tracked_new(n, 0, true);
+}
+void *operator new[](size_t n, const std::nothrow_t &) noexcept {
+  return memtrack::tracked_new(n, 0, true);
+}
+void *operator new(size_t n, std::align_val_t a) {
+  return memtrack::tracked_new(n, size_t(a), false);
+}
+void *operator new[](size_t n, std::align_val_t a) {
+  return memtrack::tracked_new(n, size_t(a), false);
+}
+void operator delete(void *p) noexcept { memtrack::tracked_delete(p); }
+void operator delete[](void *p) noexcept { memtrack::tracked_delete(p); }
+void operator delete(void *p, size_t) noexcept { memtrack::tracked_delete(p); }
+void operator delete[](void *p, size_t) noexcept { memtrack::tracked_delete(p); }
+void operator delete(void *p, std::align_val_t) noexcept {
+  memtrack::tracked_delete(p);
+}
+void operator delete[](void *p, std::align_val_t) noexcept {
+  memtrack::tracked_delete(p);
+}
+void operator delete(void *p, size_t, std::align_val_t) noexcept {
+  memtrack::tracked_delete(p);
+}
+void operator delete[](void *p, size_t, std::align_val_t) noexcept {
+  memtrack::tracked_delete(p);
+}
+#endif
+
+// Memory use of the phases of a driver run. begin(phase) closes the running
+// phase, if any, and starts the next one; end() closes the running phase.
+// Each phase records how far the heap grew above its level at the start of
+// the phase, what it left allocated at the end, and the RSS high-water mark.
+enum memory_phase { LOAD, HASH, DEDUP, CONSTRUCT, QUERY, NUM_MEMORY_PHASES };
+
+struct memory_profile {
+  struct phase_usage {
+    size_t heap_start = 0;
+    size_t heap_peak = 0;
+    size_t heap_end = 0;
+    size_t rss_peak = 0;
+
+    // growth of the heap above its level at the start of the phase
+    size_t peak_growth() const { return heap_peak - heap_start; }
+    // memory that was needed during the phase but released by its end
+    size_t scratch() const { return heap_peak - heap_end; }
+  };
+
+  phase_usage phases[NUM_MEMORY_PHASES];
+  int current = -1;
+
+  void begin(memory_phase phase) {
+    end();
+    current = phase;
+    memtrack::reset_heap_peak();
+    memtrack::reset_rss_peak();
+    phases[phase].heap_start = memtrack::heap_bytes();
+  }
+
+  void end() {
+    if (current < 0) {
+      return;
+    }
+    phase_usage &p = phases[current];
+    p.heap_peak = memtrack::heap_peak_bytes();
+    p.heap_end = memtrack::heap_bytes();
+    if (p.heap_peak < p.heap_start) { p.heap_peak = p.heap_start; }
+    if (p.heap_peak < p.heap_end) { p.heap_peak = p.heap_end; }
+    p.rss_peak = memtrack::rss_peak_bytes();
+    current = -1;
+  }
+
+  const phase_usage &operator[](memory_phase phase) const {
+    return phases[phase];
+  }
+
+  // Appends, comma-separated: the heap peak growth of the load, hash, dedup,
+  // construct and query phases (bytes), the construction peak in bytes per
+  // key, the construction scratch (bytes), and the RSS high-water mark during
+  // construction and over the whole run (bytes).
+  void write_csv(FILE *out, size_t keys) {
+    end();
+    for (const phase_usage &p : phases) {
+      fprintf(out, ",%zu", p.peak_growth());
+    }
+    size_t rss_peak = 0;
+    for (const phase_usage &p : phases) {
+      if (p.rss_peak > rss_peak) { rss_peak = p.rss_peak; }
+    }
+    const phase_usage &c = phases[CONSTRUCT];
+    fprintf(out, ",%.2f,%zu,%zu,%zu",
+            keys ? double(c.peak_growth()) / keys : 0.0, c.scratch(),
+            c.rss_peak, rss_peak);
+  }
+};
@@ -0,0 +1,300 @@
+#pragma once
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <thread>
+
+#if defined(__linux__) || defined(__APPLE__)
+#include <sys/utsname.h>
+#include <unistd.h>
+#endif
+#if defined(__APPLE__)
+#include <sys/sysctl.h>
+#include <sys/types.h>
+#endif
+
+#include "cpudispatch.h"
+#include "performancecounters/event_counter.h"
+
+// Labeled benchmark results.
+//
+// stat1/stat2/data_reliability hold bare numbers, one file per group of
+// columns, with the filter name on a line of its own if at all. When the
+// BENCH_RESULTS environment variable names a file, the stat drivers also
+// append one self-describing record per filter and size to it: a JSON object
+// per line, or, if the name ends in ".csv", a CSV row (with a header when
+// the file is new). Every record carries the host it was measured on, so
+// files from many machines can simply be concatenated.
+//
+// A driver brackets each filter with begin() ... write(); in between the
+// existing writers fill the record in: pretty_print() the timings (lookups
+// first, then construction, as in stat2), writeStat1() the sizes,
+// writeOutput() the accuracy.
+
+// Compiler flags, passed by the Makefile.
+#ifndef RESULT_BUILD_FLAGS
+#define RESULT_BUILD_FLAGS ""
+#endif
+
+struct machine_info {
+  std::string host;
+  std::string os;
+  std::string arch;
+  std::string cpu;
+  unsigned logical_cpus = 0;
+  // selected at run time, see cpudispatch.h
+  std::string isa;
+  std::string compiler;
+  std::string flags;
+
+  static const machine_info &get() {
+    static const machine_info info = detect();
+    return info;
+  }
+
+private:
+  static machine_info detect() {
+    machine_info m;
+#if defined(__linux__) || defined(__APPLE__)
+    struct utsname u;
+    if (uname(&u) == 0) {
+      m.host = u.nodename;
+      m.os = std::string(u.sysname) + " " + u.release;
+      m.arch = u.machine;
+    }
+#endif
+#if defined(__linux__)
+    if (FILE *f = fopen("/proc/cpuinfo", "r")) {
+      char line[512];
+      while (fgets(line, sizeof(line), f) != nullptr) {
+        // "model name" on x86, "Model" or "CPU part" only on most arm64
+        if (strncmp(line, "model name", 10) == 0 || strncmp(line, "Model", 5) == 0) {
+          const char *colon = strchr(line, ':');
+          if (colon != nullptr) {
+            m.cpu = colon + 1;
+            m.cpu.erase(0, m.cpu.find_first_not_of(" \t"));
+            m.cpu.erase(m.cpu.find_last_not_of(" \t\n") + 1);
+            break;
+          }
+        }
+      }
+      fclose(f);
+    }
+#elif defined(__APPLE__)
+    char brand[256];
+    size_t len = sizeof(brand);
+    if (sysctlbyname("machdep.cpu.brand_string", brand, &len, nullptr, 0) == 0) {
+      m.cpu = brand;
+    }
+#endif
+    m.logical_cpus = std::thread::hardware_concurrency();
+    m.isa = cpudispatch::isa_name(cpudispatch::selected);
+#if defined(__clang__)
+    m.compiler = "clang " __clang_version__;
+#elif defined(__GNUC__)
+    m.compiler = "gcc " __VERSION__;
+#endif
+    m.flags = RESULT_BUILD_FLAGS;
+    return m;
+  }
+};
+
+struct result_record {
+  std::string filter;
+  // template arguments, e.g. "uint64_t, uint16_t"
+  std::string params;
+  size_t data_size = 0;
+  size_t test_size = 0;
+  size_t filter_bytes = 0;
+  // fp / (fp + tn) over the URLs not added, and over random strings
+  double fpr = -1;
+  double bogus_fpr = -1;
+  size_t false_negatives = 0;
+  // per lookup / per key added; cycles and instructions are negative without
+  // performance counters
+  double lookup_ns = -1;
+  double lookup_mean_ns = -1;
+  double lookup_cycles = -1;
+  double lookup_instructions = -1;
+  // misses per lookup, negative without the counters
+  double lookup_branch_misses = -1;
+  double lookup_l1d_misses = -1;
+  double lookup_llc_misses = -1;
+  double lookup_dtlb_misses = -1;
+  double construction_ns = -1;
+  double construction_mean_ns = -1;
+  double construction_cycles = -1;
+  double construction_instructions = -1;
+
+  double bits_per_key() const {
+    return test_size ? 8.0 * filter_bytes / test_size : 0;
+  }
+};
+
+class result_writer {
+  result_record current;
+  int timings = 0;
+  bool active = false;
+
+  static std::string quoted(const std::string &s) {
+    std::string out = "\"";
+    for (char c : s) {
+      if (c == '"' || c == '\\') {
+        out += '\\';
+        out += c;
+      } else if ((unsigned char)c < 0x20) {
+        char escape[8];
+        snprintf(escape, sizeof(escape), "\\u%04x", c);
+        out += escape;
+      } else {
+        out += c;
+      }
+    }
+    return out + "\"";
+  }
+
+  static std::string csv_quoted(const std::string &s) {
+    std::string out = "\"";
+    for (char c : s) {
+      out += c;
+      if (c == '"') {
+        out += '"';
+      }
+    }
+    return out + "\"";
+  }
+
+  // "null" (JSON) or "" (CSV) for the missing measurements
+  static std::string number(double v, bool json) {
+    if (v < 0) {
+      return json ? "null" : "";
+    }
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), "%.4g", v);
+    return buffer;
+  }
+
+public:
+  void begin(const std::string &filter, const std::string &params) {
+    current = result_record();
+    current.filter = filter;
+    current.params = params;
+    timings = 0;
+    active = true;
+  }
+
+  void timing(size_t volume, const event_aggregate &agg) {
+    if (!active || volume == 0 || timings >= 2) {
+      return;
+    }
+    // all zero when the performance counters are unavailable
+    const bool counters = agg.fastest_cycles() > 0;
+    double *fields[2][4] = {
+        {&current.lookup_ns, &current.lookup_mean_ns, &current.lookup_cycles,
+         &current.lookup_instructions},
+        {&current.construction_ns, &current.construction_mean_ns,
+         &current.construction_cycles, &current.construction_instructions}};
+    double **f = fields[timings];
+    *f[0] = agg.fastest_elapsed_ns() / volume;
+    *f[1] = agg.elapsed_ns() / volume;
+    *f[2] = counters ? agg.fastest_cycles() / volume : -1;
+    *f[3] = counters ? agg.fastest_instructions() / volume : -1;
+    if (timings++ == 0) {
+      // a lookup loop always misses L1 somewhere, so 0 means no counters
+      const bool cache_counters = agg.fastest_l1d_misses() > 0;
+      current.lookup_branch_misses = counters ? agg.fastest_branch_misses() / volume : -1;
+      current.lookup_l1d_misses = cache_counters ? agg.fastest_l1d_misses() / volume : -1;
+      current.lookup_llc_misses = cache_counters ? agg.fastest_llc_misses() / volume : -1;
+      current.lookup_dtlb_misses = cache_counters ? agg.fastest_dtlb_misses() / volume : -1;
+    }
+  }
+
+  void sizes(size_t data_size, size_t test_size, size_t filter_bytes) {
+    current.data_size = data_size;
+    current.test_size = test_size;
+    current.filter_bytes = filter_bytes;
+  }
+
+  void accuracy(size_t tn, size_t fp, size_t fn, size_t fp_bogus,
+                size_t bogus_size) {
+    current.fpr = (fp + tn) ? double(fp) / (fp + tn) : -1;
+    current.bogus_fpr = bogus_size ? double(fp_bogus) / bogus_size : -1;
+    current.false_negatives = fn;
+  }
+
+  // Appends the record to $BENCH_RESULTS, if set.
+  void write() {
+    if (!active) {
+      return;
+    }
+    active = false;
+    const char *path = getenv("BENCH_RESULTS");
+    if (path == nullptr || *path == 0) {
+      return;
+    }
+    FILE *f = fopen(path, "a");
+    if (f == nullptr) {
+      return;
+    }
+    const size_t length = strlen(path);
+    const bool json = !(length > 4 && strcmp(path + length - 4, ".csv") == 0);
+    const machine_info &m = machine_info::get();
+    const result_record &r = current;
+    const std::string fields[][2] = {
+        {"filter", json ? quoted(r.filter) : csv_quoted(r.filter)},
+        {"params", json ? quoted(r.params) : csv_quoted(r.params)},
+        {"data_size", std::to_string(r.data_size)},
+        {"test_size", std::to_string(r.test_size)},
+        {"filter_bytes", std::to_string(r.filter_bytes)},
+        {"bits_per_key", number(r.bits_per_key(), json)},
+        {"fpr", number(r.fpr, json)},
+        {"bogus_fpr", number(r.bogus_fpr, json)},
+        {"false_negatives", std::to_string(r.false_negatives)},
+        {"lookup_ns", number(r.lookup_ns, json)},
+        {"lookup_mean_ns", number(r.lookup_mean_ns, json)},
+        {"lookup_cycles", number(r.lookup_cycles, json)},
+        {"lookup_instructions", number(r.lookup_instructions, json)},
+        {"lookup_branch_misses", number(r.lookup_branch_misses, json)},
+        {"lookup_l1d_misses", number(r.lookup_l1d_misses, json)},
+        {"lookup_llc_misses", number(r.lookup_llc_misses, json)},
+        {"lookup_dtlb_misses", number(r.lookup_dtlb_misses, json)},
+        {"construction_ns_per_key", number(r.construction_ns, json)},
+        {"construction_mean_ns_per_key", number(r.construction_mean_ns, json)},
+        {"construction_cycles_per_key", number(r.construction_cycles, json)},
+        {"construction_instructions_per_key", number(r.construction_instructions, json)},
+        {"host", json ? quoted(m.host) : csv_quoted(m.host)},
+        {"os", json ? quoted(m.os) : csv_quoted(m.os)},
+        {"arch", json ? quoted(m.arch) : csv_quoted(m.arch)},
+        {"cpu", json ? quoted(m.cpu) : csv_quoted(m.cpu)},
+        {"logical_cpus", std::to_string(m.logical_cpus)},
+        {"isa", json ? quoted(m.isa) : csv_quoted(m.isa)},
+        {"compiler", json ? quoted(m.compiler) : csv_quoted(m.compiler)},
+        {"flags", json ? quoted(m.flags) : csv_quoted(m.flags)},
+        {"timestamp", std::to_string((long long)time(nullptr))},
+    };
+    const size_t n = sizeof(fields) / sizeof(fields[0]);
+    if (json) {
+      fprintf(f, "{");
+      for (size_t i = 0; i < n; i++) {
+        fprintf(f, "%s\"%s\": %s", i ? ", " : "", fields[i][0].c_str(), fields[i][1].c_str());
+      }
+      fprintf(f, "}\n");
+    } else {
+      fseek(f, 0, SEEK_END);
+      if (ftell(f) == 0) {
+        for (size_t i = 0; i < n; i++) {
+          fprintf(f, "%s%s", i ? "," : "", fields[i][0].c_str());
+        }
+        fprintf(f, "\n");
+      }
+      for (size_t i = 0; i < n; i++) {
+        fprintf(f, "%s%s", i ? "," : "", fields[i][1].c_str());
+      }
+      fprintf(f, "\n");
+    }
+    fclose(f);
+  }
+};
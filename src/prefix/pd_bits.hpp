@@ -0,0 +1,302 @@
+/*
+ * Portable building blocks for the pocket dictionaries (PDs) used by the
+ * prefix filter (min_pd256.hpp) and TC-shortcut (tc-sym.hpp).
+ *
+ * The PDs were written against BMI2 and AVX-512. This header provides:
+ *  - the BMI/LZCNT bit tricks (pdep, select, tzcnt, ...) with a scalar
+ *    fallback when BMI2 is not available at compile time or at run time;
+ *  - the three byte-level kernels the PDs need (compare all bytes against a
+ *    remainder, insert a byte, remove a byte) in AVX-512, AVX2 and scalar
+ *    flavours, for 32- and 64-byte PDs.
+ *
+ * The SIMD kernels are picked once, at startup, from the ISA level selected
+ * in cpudispatch.h, through a small table of function pointers.
+ */
+
+#ifndef PD_BITS_HPP
+#define PD_BITS_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include "../cpudispatch.h"
+
+namespace pd_bits {
+
+using isa = cpudispatch::isa;
+
+/*
+ * Bit manipulation.
+ */
+
+inline uint64_t tzcnt64(uint64_t x) { return x ? __builtin_ctzll(x) : 64; }
+
+inline uint64_t lzcnt64(uint64_t x) { return x ? __builtin_clzll(x) : 64; }
+
+inline int64_t popcnt64(uint64_t x) { return __builtin_popcountll(x); }
+
+inline uint64_t blsr64(uint64_t x) { return x & (x - 1); }
+
+inline uint64_t blsmsk64(uint64_t x) { return x ^ (x - 1); }
+
+inline uint64_t bzhi64(uint64_t x, uint64_t n) {
+  return (n >= 64) ? x : x & ((UINT64_C(1) << n) - 1);
+}
+
+inline uint64_t bextr64(uint64_t x, uint64_t start, uint64_t len) {
+  return bzhi64(x >> start, len);
+}
+
+inline uint64_t pdep64_scalar(uint64_t src, uint64_t mask) {
+  uint64_t res = 0;
+  for (uint64_t bb = 1; mask; bb += bb) {
+    if (src & bb) {
+      res |= mask & -mask;
+    }
+    mask &= mask - 1;
+  }
+  return res;
+}
+
+#if CPUDISPATCH_X86 && !defined(__BMI2__)
+__attribute__((target("bmi2"))) inline uint64_t pdep64_bmi2(uint64_t src,
+                                                             uint64_t mask) {
+  return _pdep_u64(src, mask);
+}
+
+inline const bool has_bmi2 =
+    (__builtin_cpu_init(), __builtin_cpu_supports("bmi2"));
+#endif
+
+inline uint64_t pdep64(uint64_t src, uint64_t mask) {
+#if defined(__BMI2__)
+  return _pdep_u64(src, mask);
+#elif CPUDISPATCH_X86
+  return has_bmi2 ? pdep64_bmi2(src, mask) : pdep64_scalar(src, mask);
+#else
+  return pdep64_scalar(src, mask);
+#endif
+}
+
+/**
+ * @return The position (starting from 0) of the jth set bit of x, or 64 if x
+ * has at most j set bits.
+ */
+inline uint64_t select_bit64(uint64_t x, int64_t j) {
+#if defined(__BMI2__)
+  return tzcnt64(_pdep_u64(UINT64_C(1) << j, x));
+#else
+#if CPUDISPATCH_X86
+  if (has_bmi2) {
+    return tzcnt64(pdep64_bmi2(UINT64_C(1) << j, x));
+  }
+#endif
+  for (; j > 0 && x; j--) {
+    x &= x - 1;
+  }
+  return tzcnt64(x);
+#endif
+}
+
+/*
+ * Byte kernels. "n" is the PD size in bytes (32 or 64).
+ *
+ * cmpeq:  bit i of the result is set iff byte i of pd equals rem.
+ * insert: bytes [index, n - 1) move up by one (the last byte is dropped) and
+ *         rem is written at index.
+ * remove: bytes (index, n) move down by one, the last byte becomes 0.
+ */
+
+template <size_t n> inline uint64_t cmpeq_scalar(uint8_t rem, const void *pd) {
+  const uint8_t *p = static_cast<const uint8_t *>(pd);
+  uint64_t res = 0;
+  for (size_t i = 0; i < n; i++) {
+    res |= uint64_t(p[i] == rem) << i;
+  }
+  return res;
+}
+
+template <size_t n>
+inline void insert_scalar(size_t index, uint8_t rem, void *pd) {
+  uint8_t *p = static_cast<uint8_t *>(pd);
+  memmove(p + index + 1, p + index, n - 1 - index);
+  p[index] = rem;
+}
+
+template <size_t n> inline void remove_scalar(size_t index, void *pd) {
+  uint8_t *p = static_cast<uint8_t *>(pd);
+  memmove(p + index, p + index + 1, n - 1 - index);
+  p[n - 1] = 0;
+}
+
+#if CPUDISPATCH_X86
+
+// Byte-wise mask selecting the bytes [32 * half, 32 * half + 32) below "end".
+CPUDISPATCH_AVX2 inline __m256i avx2_below(size_t end, int half) {
+  const __m256i iota =
+      _mm256_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+                       16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29,
+                       30, 31);
+  const __m256i idx = _mm256_add_epi8(iota, _mm256_set1_epi8(32 * half));
+  return _mm256_cmpgt_epi8(_mm256_set1_epi8((char)end), idx);
+}
+
+// out[i] = a[i - 1], out[0] = carry
+CPUDISPATCH_AVX2 inline __m256i avx2_shift_up(__m256i a, __m256i carry_lo) {
+  const __m256i lo = _mm256_permute2x128_si256(a, carry_lo, 0x03);
+  return _mm256_alignr_epi8(a, lo, 15);
+}
+
+// out[i] = a[i + 1], out[31] = 0
+CPUDISPATCH_AVX2 inline __m256i avx2_shift_down(__m256i a) {
+  const __m256i hi = _mm256_permute2x128_si256(a, a, 0x81);
+  return _mm256_alignr_epi8(hi, a, 1);
+}
+
+CPUDISPATCH_AVX2 inline uint64_t cmpeq32_avx2(uint8_t rem, const void *pd) {
+  const __m256i x = _mm256_load_si256(static_cast<const __m256i *>(pd));
+  return (uint32_t)_mm256_movemask_epi8(
+      _mm256_cmpeq_epi8(x, _mm256_set1_epi8((char)rem)));
+}
+
+CPUDISPATCH_AVX2 inline uint64_t cmpeq64_avx2(uint8_t rem, const void *pd) {
+  const __m256i *p = static_cast<const __m256i *>(pd);
+  const __m256i target = _mm256_set1_epi8((char)rem);
+  const uint64_t lo = (uint32_t)_mm256_movemask_epi8(
+      _mm256_cmpeq_epi8(_mm256_load_si256(p), target));
+  const uint64_t hi = (uint32_t)_mm256_movemask_epi8(
+      _mm256_cmpeq_epi8(_mm256_load_si256(p + 1), target));
+  return lo | (hi << 32);
+}
+
+CPUDISPATCH_AVX2 inline void insert32_avx2(size_t index, uint8_t rem, void *pd) {
+  __m256i *p = static_cast<__m256i *>(pd);
+  const __m256i x = _mm256_load_si256(p);
+  const __m256i shifted = avx2_shift_up(x, _mm256_setzero_si256());
+  static_cast<uint8_t *>(pd)[index] = rem;
+  const __m256i keep = avx2_below(index + 1, 0);
+  _mm256_store_si256(p, _mm256_blendv_epi8(shifted, _mm256_load_si256(p), keep));
+}
+
+CPUDISPATCH_AVX2 inline void insert64_avx2(size_t index, uint8_t rem, void *pd) {
+  __m256i *p = static_cast<__m256i *>(pd);
+  const __m256i x0 = _mm256_load_si256(p);
+  const __m256i x1 = _mm256_load_si256(p + 1);
+  const __m256i s0 = avx2_shift_up(x0, _mm256_setzero_si256());
+  const __m256i s1 = avx2_shift_up(x1, x0);
+  static_cast<uint8_t *>(pd)[index] = rem;
+  _mm256_store_si256(p, _mm256_blendv_epi8(s0, _mm256_load_si256(p),
+                                           avx2_below(index + 1, 0)));
+  _mm256_store_si256(p + 1, _mm256_blendv_epi8(s1, _mm256_load_si256(p + 1),
+                                               avx2_below(index + 1, 1)));
+}
+
+CPUDISPATCH_AVX2 inline void remove64_avx2(size_t index, void *pd) {
+  __m256i *p = static_cast<__m256i *>(pd);
+  const __m256i x0 = _mm256_load_si256(p);
+  const __m256i x1 = _mm256_load_si256(p + 1);
+  const __m256i s0 = _mm256_loadu_si256(
+      reinterpret_cast<const __m256i *>(static_cast<const uint8_t *>(pd) + 1));
+  const __m256i s1 = avx2_shift_down(x1);
+  _mm256_store_si256(p, _mm256_blendv_epi8(s0, x0, avx2_below(index, 0)));
+  _mm256_store_si256(p + 1, _mm256_blendv_epi8(s1, x1, avx2_below(index, 1)));
+}
+
+CPUDISPATCH_AVX512 inline uint64_t cmpeq32_avx512(uint8_t rem, const void *pd) {
+  const __m256i x = _mm256_load_si256(static_cast<const __m256i *>(pd));
+  return _mm256_cmpeq_epu8_mask(_mm256_set1_epi8((char)rem), x);
+}
+
+CPUDISPATCH_AVX512 inline uint64_t cmpeq64_avx512(uint8_t rem, const void *pd) {
+  const __m512i x = _mm512_load_si512(pd);
+  return _mm512_cmpeq_epu8_mask(_mm512_set1_epi8((char)rem), x);
+}
+
+CPUDISPATCH_AVX512 inline void insert32_avx512(size_t index, uint8_t rem,
+                                               void *pd) {
+  // idx is an "uint8_t arr[32]" where "arr[i] = i-1" (arr[0] = 0).
+  const __m256i idx = _mm256_setr_epi8(0, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11,
+                                       12, 13, 14, 15, 16, 17, 18, 19, 20, 21,
+                                       22, 23, 24, 25, 26, 27, 28, 29, 30);
+  __m256i *p = static_cast<__m256i *>(pd);
+  const __m256i shifted =
+      _mm256_maskz_permutexvar_epi8(UINT32_C(0xffffffff), idx, _mm256_load_si256(p));
+  static_cast<uint8_t *>(pd)[index] = rem;
+  const __mmask32 mask = bzhi64(-1, index + 1);
+  _mm256_store_si256(p, _mm256_mask_blend_epi8(mask, shifted, _mm256_load_si256(p)));
+}
+
+CPUDISPATCH_AVX512 inline void insert64_avx512(size_t index, uint8_t rem,
+                                               void *pd) {
+  // idx is an "uint8_t arr[64]" where "arr[i] = i-1" (arr[0] = 0).
+  const __m512i idx = _mm512_set_epi64(
+      4484807029008447543, 3906085646303834159, 3327364263599220775,
+      2748642880894607391, 2169921498189994007, 1591200115485380623,
+      1012478732780767239, 433757350076153919);
+  const __m512i shifted =
+      _mm512_maskz_permutexvar_epi8(~UINT64_C(1), idx, _mm512_load_si512(pd));
+  static_cast<uint8_t *>(pd)[index] = rem;
+  const __mmask64 mask = bzhi64(-1, index + 1);
+  _mm512_store_si512(pd, _mm512_mask_blend_epi8(mask, shifted, _mm512_load_si512(pd)));
+}
+
+CPUDISPATCH_AVX512 inline void remove64_avx512(size_t index, void *pd) {
+  // idx is an "uint8_t arr[64]" where "arr[i] = i+1".
+  const __m512i idx = _mm512_set_epi64(
+      17801356257212985, 4050765991979987505, 3472044609275374121,
+      2893323226570760737, 2314601843866147353, 1735880461161533969,
+      1157159078456920585, 578437695752307201);
+  const __m512i x = _mm512_load_si512(pd);
+  const __m512i shifted =
+      _mm512_maskz_permutexvar_epi8(UINT64_C(0x7fffffffffffffff), idx, x);
+  const __mmask64 mask = bzhi64(-1, index);
+  _mm512_store_si512(pd, _mm512_mask_blend_epi8(mask, shifted, x));
+}
+
+#endif // CPUDISPATCH_X86
+
+struct kernels32 {
+  uint64_t (*cmpeq)(uint8_t rem, const void *pd);
+  void (*insert)(size_t index, uint8_t rem, void *pd);
+};
+
+struct kernels64 {
+  uint64_t (*cmpeq)(uint8_t rem, const void *pd);
+  void (*insert)(size_t index, uint8_t rem, void *pd);
+  void (*remove)(size_t index, void *pd);
+};
+
+inline kernels32 select_kernels32(isa i) {
+  switch (i) {
+#if CPUDISPATCH_X86
+  case isa::avx512:
+    return {cmpeq32_avx512, insert32_avx512};
+  case isa::avx2:
+    return {cmpeq32_avx2, insert32_avx2};
+#endif
+  default:
+    return {cmpeq_scalar<32>, insert_scalar<32>};
+  }
+}
+
+inline kernels64 select_kernels64(isa i) {
+  switch (i) {
+#if CPUDISPATCH_X86
+  case isa::avx512:
+    return {cmpeq64_avx512, insert64_avx512, remove64_avx512};
+  case isa::avx2:
+    return {cmpeq64_avx2, insert64_avx2, remove64_avx2};
+#endif
+  default:
+    return {cmpeq_scalar<64>, insert_scalar<64>, remove_scalar<64>};
+  }
+}
+
+inline const isa active_isa = cpudispatch::selected;
+inline const kernels32 k32 = select_kernels32(active_isa);
+inline const kernels64 k64 = select_kernels64(active_isa);
+
+} // namespace pd_bits
+
+#endif // PD_BITS_HPP
@@ -0,0 +1,601 @@
+// Serving filter lookups to other processes on the same host.
+//
+// query::Server answers membership queries against one read-only filter over
+// a Unix domain socket or loopback TCP. Clients send batches, so the cost of
+// a system call and of a wakeup is spread over many keys, and each batch is
+// answered with one ContainMany call, which pipelines the lookups of the
+// filters that support it (see batchlookup.h).
+//
+// Protocol, in host byte order (both ends are on one machine). A request is
+//
+//   RequestHeader { magic, kind, count, payload_bytes }
+//   payload       hashes: count 64-bit keys
+//                 urls:   count times { uint16 length, length bytes },
+//                         each URL normalized and hashed by the server as
+//                         in url.h
+//
+// with payload_bytes a multiple of 8 (URL payloads are zero-padded), so that
+// keys can be read in place from the receive buffer. The answer is
+//
+//   ResponseHeader { magic, status, count, payload_bytes }
+//   payload        (count + 63) / 64 words, bit i set if key or URL i may be
+//                  in the filter
+//
+// Requests on one connection are answered in order, so a client can have
+// several in flight. A request that cannot be framed (bad magic, or a
+// payload over the limit) closes the connection; one that is framed but
+// malformed is answered with status bad_request.
+//
+// The server runs one event loop (epoll) per thread, each pinned to a CPU. The
+// threads share the listening socket; a connection stays with the thread
+// that accepted it. A connection whose answers are not being read stops
+// being read from until they are.
+
+#ifndef QUERY_SERVER_H_
+#define QUERY_SERVER_H_
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "affinity.h"
+#include "filterapi.h"
+#include "url.h"
+
+namespace query {
+
+constexpr uint32_t kRequestMagic = 0x31515246;  // "FRQ1"
+constexpr uint32_t kResponseMagic = 0x31535246; // "FRS1"
+
+enum kind : uint32_t { hashes = 0, urls = 1 };
+enum status : uint32_t { ok = 0, bad_request = 1 };
+
+struct RequestHeader {
+  uint32_t magic;
+  uint32_t kind;
+  uint32_t count;
+  uint32_t payload_bytes;
+};
+
+struct ResponseHeader {
+  uint32_t magic;
+  uint32_t status;
+  uint32_t count;
+  uint32_t payload_bytes;
+};
+
+inline size_t BitmapWords(size_t count) { return (count + 63) / 64; }
+
+[[noreturn]] inline void Fail(const char *what, const std::string &address) {
+  throw std::system_error(errno, std::generic_category(),
+                          std::string("query: ") + what + " " + address);
+}
+
+namespace detail {
+// "/path" or "./path": a Unix domain socket; "port" or "host:port": TCP.
+inline int Socket(const std::string &address, sockaddr_storage *where, socklen_t *length) {
+  memset(where, 0, sizeof(*where));
+  if (address.find('/') != std::string::npos) {
+    sockaddr_un *un = reinterpret_cast<sockaddr_un *>(where);
+    if (address.size() >= sizeof(un->sun_path)) {
+      errno = ENAMETOOLONG;
+      Fail("socket", address);
+    }
+    un->sun_family = AF_UNIX;
+    memcpy(un->sun_path, address.c_str(), address.size() + 1);
+    *length = sizeof(sockaddr_un);
+  } else {
+    sockaddr_in *in = reinterpret_cast<sockaddr_in *>(where);
+    const size_t colon = address.rfind(':');
+    const std::string host = colon == std::string::npos ? "127.0.0.1" : address.substr(0, colon);
+    in->sin_family = AF_INET;
+    in->sin_port = htons(uint16_t(atoi(address.c_str() + (colon == std::string::npos ? 0 : colon + 1))));
+    if (inet_pton(AF_INET, host.c_str(), &in->sin_addr) != 1) {
+      errno = EINVAL;
+      Fail("address", address);
+    }
+    *length = sizeof(sockaddr_in);
+  }
+  const int fd = socket(where->ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    Fail("socket", address);
+  }
+  if (where->ss_family == AF_INET) {
+    const int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  }
+  return fd;
+}
+} // namespace detail
+
+// A non-blocking socket listening on address; a stale Unix socket file is
+// replaced.
+inline int Listen(const std::string &address) {
+  sockaddr_storage where;
+  socklen_t length;
+  const int fd = detail::Socket(address, &where, &length);
+  if (where.ss_family == AF_UNIX) {
+    unlink(address.c_str());
+  } else {
+    const int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  }
+  if (bind(fd, reinterpret_cast<sockaddr *>(&where), length) != 0 || listen(fd, 1024) != 0 ||
+      fcntl(fd, F_SETFL, O_NONBLOCK) != 0) {
+    const int error = errno;
+    close(fd);
+    errno = error;
+    Fail("listen", address);
+  }
+  return fd;
+}
+
+// A blocking socket connected to address.
+inline int Connect(const std::string &address) {
+  sockaddr_storage where;
+  socklen_t length;
+  const int fd = detail::Socket(address, &where, &length);
+  if (connect(fd, reinterpret_cast<sockaddr *>(&where), length) != 0) {
+    const int error = errno;
+    close(fd);
+    errno = error;
+    Fail("connect", address);
+  }
+  return fd;
+}
+
+// Appends a request for keys[0, n) to out.
+inline void AppendHashes(const uint64_t *keys, size_t n, std::vector<char> *out) {
+  const RequestHeader h{kRequestMagic, hashes, uint32_t(n), uint32_t(n * sizeof(uint64_t))};
+  out->insert(out->end(), reinterpret_cast<const char *>(&h),
+              reinterpret_cast<const char *>(&h + 1));
+  out->insert(out->end(), reinterpret_cast<const char *>(keys),
+              reinterpret_cast<const char *>(keys + n));
+}
+
+// Appends a request for urls to out; URLs are cut at 65535 bytes.
+inline void AppendUrls(const std::vector<std::string_view> &urls, std::vector<char> *out) {
+  const size_t start = out->size();
+  out->resize(start + sizeof(RequestHeader));
+  for (std::string_view u : urls) {
+    const uint16_t length = uint16_t(std::min<size_t>(u.size(), UINT16_MAX));
+    out->insert(out->end(), reinterpret_cast<const char *>(&length),
+                reinterpret_cast<const char *>(&length + 1));
+    out->insert(out->end(), u.data(), u.data() + length);
+  }
+  out->resize(start + sizeof(RequestHeader) +
+              (out->size() - start - sizeof(RequestHeader) + 7) / 8 * 8);
+  const RequestHeader h{kRequestMagic, query::urls, uint32_t(urls.size()),
+                        uint32_t(out->size() - start - sizeof(RequestHeader))};
+  memcpy(out->data() + start, &h, sizeof(h));
+}
+
+// The client end of a connection, blocking.
+class Client {
+ public:
+  explicit Client(const std::string &address) : fd_(Connect(address)), address_(address) {}
+  Client(const Client &) = delete;
+  Client &operator=(const Client &) = delete;
+  ~Client() { close(fd_); }
+
+  // Sends one or more requests built with AppendHashes / AppendUrls.
+  void Send(const char *data, size_t bytes) {
+    while (bytes > 0) {
+      const ssize_t n = send(fd_, data, bytes, MSG_NOSIGNAL);
+      if (n < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        Fail("send", address_);
+      }
+      data += n;
+      bytes -= n;
+    }
+  }
+  void Send(const std::vector<char> &requests) { Send(requests.data(), requests.size()); }
+
+  // Waits for the next answer; its bitmap goes to *bitmap. Returns its
+  // status; throws if the server closed the connection.
+  status Receive(std::vector<uint64_t> *bitmap, uint32_t *count) {
+    ResponseHeader h;
+    Read(&h, sizeof(h));
+    if (h.magic != kResponseMagic || h.payload_bytes % 8 != 0) {
+      errno = EPROTO;
+      Fail("receive", address_);
+    }
+    bitmap->resize(h.payload_bytes / 8);
+    Read(bitmap->data(), h.payload_bytes);
+    *count = h.count;
+    return status(h.status);
+  }
+
+ private:
+  void Read(void *data, size_t bytes) {
+    char *p = static_cast<char *>(data);
+    while (bytes > 0) {
+      const ssize_t n = recv(fd_, p, bytes, 0);
+      if (n <= 0) {
+        if (n < 0 && errno == EINTR) {
+          continue;
+        }
+        if (n == 0) {
+          errno = ECONNRESET;
+        }
+        Fail("receive", address_);
+      }
+      p += n;
+      bytes -= n;
+    }
+  }
+
+  int fd_;
+  std::string address_;
+};
+
+struct ServerOptions {
+  // event loops, 0 for one per CPU
+  size_t threads = 0;
+  // pin the event loops to CPUs (see affinity.h)
+  bool pin = true;
+  // the largest request payload accepted
+  size_t max_payload_bytes = size_t(16) << 20;
+};
+
+struct ServerStats {
+  uint64_t connections = 0;
+  uint64_t requests = 0;
+  uint64_t keys = 0;
+  uint64_t errors = 0;
+};
+
+template <typename Table>
+class Server {
+ public:
+  // Serves table, which must stay valid and unchanged until the server is
+  // destroyed, on address (see Listen()). Starts right away.
+  Server(Table *table, const std::string &address, ServerOptions options = ServerOptions())
+      : table_(table), address_(address), options_(options) {
+    listen_ = Listen(address);
+    stop_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (stop_ < 0) {
+      Fail("eventfd", address);
+    }
+    const std::vector<int> cpus = affinity::placement(affinity::online_cpus(), false);
+    const size_t threads = options_.threads > 0 ? options_.threads : cpus.size();
+    for (size_t t = 0; t < threads; t++) {
+      workers_.emplace_back(new Worker(this));
+    }
+    for (size_t t = 0; t < threads; t++) {
+      const int cpu = cpus[t % cpus.size()];
+      workers_[t]->thread = std::thread([this, t, cpu]() {
+        if (options_.pin) {
+          affinity::pin_current_thread(cpu);
+        }
+        workers_[t]->Run();
+      });
+    }
+  }
+
+  Server(const Server &) = delete;
+  Server &operator=(const Server &) = delete;
+
+  ~Server() {
+    Stop();
+    Wait();
+    close(stop_);
+    close(listen_);
+    if (address_.find('/') != std::string::npos) {
+      unlink(address_.c_str());
+    }
+  }
+
+  // Makes the event loops return. Async-signal-safe.
+  void Stop() {
+    const uint64_t one = 1;
+    (void)!write(stop_, &one, sizeof(one));
+  }
+
+  // Blocks until the event loops have returned, after Stop().
+  void Wait() {
+    for (std::unique_ptr<Worker> &w : workers_) {
+      if (w->thread.joinable()) {
+        w->thread.join();
+      }
+    }
+  }
+
+  size_t Threads() const { return workers_.size(); }
+
+  ServerStats Stats() const {
+    ServerStats s;
+    for (const std::unique_ptr<Worker> &w : workers_) {
+      s.connections += w->connections.load(std::memory_order_relaxed);
+      s.requests += w->requests.load(std::memory_order_relaxed);
+      s.keys += w->keys.load(std::memory_order_relaxed);
+      s.errors += w->errors.load(std::memory_order_relaxed);
+    }
+    return s;
+  }
+
+ private:
+  struct Connection {
+    int fd;
+    // 64-bit words, so that the keys of a request can be used in place
+    std::vector<uint64_t> in;
+    size_t in_bytes = 0;
+    std::vector<char> out;
+    size_t out_sent = 0;
+    // watching for EPOLLOUT rather than EPOLLIN
+    bool writing = false;
+    char *in_data() { return reinterpret_cast<char *>(in.data()); }
+  };
+
+  struct Worker {
+    explicit Worker(Server *s) : server(s) {}
+
+    void Run() {
+      epoll_ = epoll_create1(EPOLL_CLOEXEC);
+      if (epoll_ < 0) {
+        return;
+      }
+      epoll_event e{};
+#ifdef EPOLLEXCLUSIVE
+      // one loop woken per new connection, not all of them
+      e.events = EPOLLIN | EPOLLEXCLUSIVE;
+#else
+      e.events = EPOLLIN;
+#endif
+      e.data.ptr = &listen_tag;
+      epoll_ctl(epoll_, EPOLL_CTL_ADD, server->listen_, &e);
+      // never read, so it wakes every loop
+      e.events = EPOLLIN;
+      e.data.ptr = &stop_tag;
+      epoll_ctl(epoll_, EPOLL_CTL_ADD, server->stop_, &e);
+
+      epoll_event events[64];
+      for (bool running = true; running;) {
+        const int n = epoll_wait(epoll_, events, 64, -1);
+        for (int i = 0; i < n; i++) {
+          void *tag = events[i].data.ptr;
+          if (tag == &stop_tag) {
+            running = false;
+          } else if (tag == &listen_tag) {
+            Accept();
+          } else {
+            Connection *c = static_cast<Connection *>(tag);
+            if (!Serve(c, events[i].events)) {
+              Close(c);
+            }
+          }
+        }
+      }
+      while (!open.empty()) {
+        Close(open.begin()->second.get());
+      }
+      close(epoll_);
+    }
+
+    void Accept() {
+      // one per wakeup, so that connections spread over the loops
+      const int fd = accept4(server->listen_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+      if (fd < 0) {
+        return;
+      }
+      const int one = 1;
+      setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+      std::unique_ptr<Connection> c(new Connection());
+      c->fd = fd;
+      c->in.resize(kInitialBuffer / 8);
+      epoll_event e{};
+      e.events = EPOLLIN | EPOLLRDHUP;
+      e.data.ptr = c.get();
+      if (epoll_ctl(epoll_, EPOLL_CTL_ADD, fd, &e) != 0) {
+        close(fd);
+        return;
+      }
+      open[fd] = std::move(c);
+      connections.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void Close(Connection *c) {
+      epoll_ctl(epoll_, EPOLL_CTL_DEL, c->fd, nullptr);
+      close(c->fd);
+      open.erase(c->fd);
+    }
+
+    // False once the connection is to be closed.
+    bool Serve(Connection *c, uint32_t events) {
+      if (events & EPOLLERR) {
+        return false;
+      }
+      if (!c->out.empty()) {
+        // waiting for the client to read its answers
+        if (!Flush(c)) {
+          return false;
+        }
+        if (!c->out.empty()) {
+          return true;
+        }
+        // drained: answer what was received meanwhile, then read again
+        if (!Answer(c) || !Flush(c)) {
+          return false;
+        }
+        return Watch(c);
+      }
+      if (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP)) {
+        if (c->in_bytes == c->in.size() * 8) {
+          // Answer() leaves a full buffer only when a request does not fit
+          c->in.resize(c->in.size() * 2);
+        }
+        const ssize_t n = recv(c->fd, c->in_data() + c->in_bytes, c->in.size() * 8 - c->in_bytes, 0);
+        if (n == 0) {
+          return false;
+        }
+        if (n < 0) {
+          return errno == EAGAIN || errno == EINTR;
+        }
+        c->in_bytes += n;
+        if (!Answer(c) || !Flush(c)) {
+          return false;
+        }
+        return Watch(c);
+      }
+      return true;
+    }
+
+    // Answers the complete requests at the start of the buffer, appending
+    // the answers to out. False if a request cannot be framed.
+    bool Answer(Connection *c) {
+      const char *data = c->in_data();
+      size_t pos = 0, pending = 0;
+      while (c->in_bytes - pos >= sizeof(RequestHeader)) {
+        RequestHeader h;
+        memcpy(&h, data + pos, sizeof(h));
+        if (h.magic != kRequestMagic || h.payload_bytes % 8 != 0 ||
+            h.payload_bytes > server->options_.max_payload_bytes) {
+          errors.fetch_add(1, std::memory_order_relaxed);
+          return false;
+        }
+        const size_t length = sizeof(h) + h.payload_bytes;
+        if (c->in_bytes - pos < length) {
+          pending = length;
+          break;
+        }
+        Answer(h, data + pos + sizeof(h), &c->out);
+        pos += length;
+      }
+      if (pos > 0) {
+        memmove(c->in_data(), data + pos, c->in_bytes - pos);
+        c->in_bytes -= pos;
+      }
+      if (pending > c->in.size() * 8) {
+        c->in.resize((pending + 7) / 8);
+      }
+      return true;
+    }
+
+    void Answer(const RequestHeader &h, const char *payload, std::vector<char> *out) {
+      const uint64_t *query = nullptr;
+      bool valid = false;
+      if (h.kind == hashes) {
+        valid = h.payload_bytes == uint64_t(h.count) * sizeof(uint64_t);
+        query = reinterpret_cast<const uint64_t *>(payload);
+      } else if (h.kind == urls) {
+        valid = Hash(h, payload);
+        query = keys_.data();
+      }
+      ResponseHeader r{kResponseMagic, valid ? ok : bad_request, valid ? h.count : 0, 0};
+      const size_t words = valid ? BitmapWords(h.count) : 0;
+      r.payload_bytes = uint32_t(words * sizeof(uint64_t));
+      const size_t start = out->size();
+      out->resize(start + sizeof(r) + r.payload_bytes);
+      memcpy(out->data() + start, &r, sizeof(r));
+      if (!valid) {
+        errors.fetch_add(1, std::memory_order_relaxed);
+        return;
+      }
+      bitmap_.resize(words);
+      ContainMany(query, h.count, server->table_, bitmap_.data());
+      memcpy(out->data() + start + sizeof(r), bitmap_.data(), r.payload_bytes);
+      requests.fetch_add(1, std::memory_order_relaxed);
+      keys.fetch_add(h.count, std::memory_order_relaxed);
+    }
+
+    // The keys of a URL request, into keys_. False if it is malformed.
+    bool Hash(const RequestHeader &h, const char *payload) {
+      keys_.clear();
+      const char *end = payload + h.payload_bytes;
+      for (uint32_t i = 0; i < h.count; i++) {
+        uint16_t length;
+        if (end - payload < ptrdiff_t(sizeof(length))) {
+          return false;
+        }
+        memcpy(&length, payload, sizeof(length));
+        payload += sizeof(length);
+        if (end - payload < length) {
+          return false;
+        }
+        url::normalize(std::string_view(payload, length), &normalized_);
+        keys_.push_back(url::hash(normalized_));
+        payload += length;
+      }
+      return true;
+    }
+
+    // Sends what it can of out. False if the connection is gone.
+    bool Flush(Connection *c) {
+      while (c->out_sent < c->out.size()) {
+        const ssize_t n = send(c->fd, c->out.data() + c->out_sent,
+                               c->out.size() - c->out_sent, MSG_NOSIGNAL);
+        if (n < 0) {
+          if (errno == EINTR) {
+            continue;
+          }
+          return errno == EAGAIN;
+        }
+        c->out_sent += n;
+      }
+      c->out.clear();
+      c->out_sent = 0;
+      return true;
+    }
+
+    // Waits for the socket to take more output while answers are pending,
+    // else for more requests.
+    bool Watch(Connection *c) {
+      const bool writing = !c->out.empty();
+      if (writing == c->writing) {
+        return true;
+      }
+      c->writing = writing;
+      epoll_event e{};
+      e.events = writing ? EPOLLOUT : EPOLLIN | EPOLLRDHUP;
+      e.data.ptr = c;
+      return epoll_ctl(epoll_, EPOLL_CTL_MOD, c->fd, &e) == 0;
+    }
+
+    static constexpr size_t kInitialBuffer = 64 * 1024;
+
+    Server *server;
+    std::thread thread;
+    int epoll_ = -1;
+    char listen_tag = 0, stop_tag = 0;
+    std::unordered_map<int, std::unique_ptr<Connection>> open;
+    std::vector<uint64_t> keys_;
+    std::vector<uint64_t> bitmap_;
+    std::string normalized_;
+    std::atomic<uint64_t> connections{0}, requests{0}, keys{0}, errors{0};
+  };
+
+  Table *table_;
+  std::string address_;
+  ServerOptions options_;
+  int listen_ = -1;
+  int stop_ = -1;
+  std::vector<std::unique_ptr<Worker>> workers_;
+};
+
+} // namespace query
+
+#endif // QUERY_SERVER_H_
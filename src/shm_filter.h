@@ -0,0 +1,395 @@
+// Filters in shared memory.
+//
+// A host that runs many query processes needs one copy of a static filter,
+// not one per process. SharedFilterPublisher copies a built filter (xor,
+// binary fuse, blocked Bloom, balanced ribbon) into a named segment: a POSIX
+// shared-memory object, or, when the name has a '/' past its first
+// character, a file, for instance on a hugetlbfs mount. Any number of
+// processes then map it read-only, with a single mmap, as a SharedFilter, and
+// query it with the filter's own lookup code.
+//
+// Each Publish() writes a new generation to a segment of its own,
+// "<name>.<generation>", stores the generation in the control segment, then
+// marks the previous generation superseded and unlinks it. The control
+// segment is always a shared-memory object, "<name>" with any '/' but a
+// leading one made a '_', as it is a single word read and written through a
+// mapping, which a hugetlbfs file would round up to a huge page. A
+// generation stays mapped, and valid, until the last process unmaps it, so
+// publishing never waits for readers: they check Stale() (one load from their
+// own mapping) every so often and attach the new generation. Wrap the
+// SharedFilter in a FilterHandle to move the threads of a process over
+// without locking.
+//
+// A segment is a header (magic, version, generation, filter type, sizes)
+// followed by the filter's image, see FilterImage. It is meant to be read by
+// the build that wrote it, on the same host. There must be one publisher per
+// name at a time.
+
+#ifndef SHM_FILTER_H_
+#define SHM_FILTER_H_
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <type_traits>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "filter_image.h"
+#include "filterapi.h"
+
+// A mapping of a segment, and how segments are named.
+class SharedSegment {
+ public:
+  // "name" or "/name": a POSIX shared-memory object; anything else with a
+  // '/', such as "/mnt/huge/name": a file.
+  static bool IsFile(const std::string &name) {
+    return name.find('/', 1) != std::string::npos;
+  }
+
+  static int Open(const std::string &name, int flags, mode_t mode = 0644) {
+    const int fd = IsFile(name) ? open(name.c_str(), flags, mode)
+                                : shm_open(ObjectName(name).c_str(), flags, mode);
+    if (fd < 0 && errno != ENOENT) {
+      Fail("open", name);
+    }
+    return fd;
+  }
+
+  // Removes the name; existing mappings stay valid. False if there was none.
+  static bool Unlink(const std::string &name) {
+    const int r = IsFile(name) ? unlink(name.c_str()) : shm_unlink(ObjectName(name).c_str());
+    if (r != 0 && errno != ENOENT) {
+      Fail("unlink", name);
+    }
+    return r == 0;
+  }
+
+  [[noreturn]] static void Fail(const char *what, const std::string &name) {
+    throw std::system_error(errno, std::generic_category(),
+                            std::string("SharedSegment: ") + what + " " + name);
+  }
+
+  SharedSegment() = default;
+
+  // Sizes the segment open at fd to at least length bytes -- a whole number
+  // of (huge) pages on hugetlbfs -- and maps it read-write. A new segment
+  // reads as zeros.
+  static SharedSegment Create(int fd, size_t length, const std::string &name) {
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+      Fail("fstat", name);
+    }
+    const size_t block = st.st_blksize > 0 ? st.st_blksize : 4096;
+    length = (length + block - 1) / block * block;
+    if (ftruncate(fd, length) != 0) {
+      Fail("ftruncate", name);
+    }
+    return SharedSegment(fd, length, PROT_READ | PROT_WRITE, name);
+  }
+
+  // Maps all of the segment open at fd, read-only unless protection says
+  // otherwise.
+  static SharedSegment Attach(int fd, const std::string &name, int protection = PROT_READ) {
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+      Fail("fstat", name);
+    }
+    return SharedSegment(fd, st.st_size, protection, name);
+  }
+
+  SharedSegment(SharedSegment &&other) noexcept
+      : data_(std::exchange(other.data_, nullptr)), length_(other.length_) {}
+  SharedSegment &operator=(SharedSegment &&other) noexcept {
+    std::swap(data_, other.data_);
+    std::swap(length_, other.length_);
+    return *this;
+  }
+  ~SharedSegment() {
+    if (data_ != nullptr) {
+      munmap(data_, length_);
+    }
+  }
+
+  char *data() const { return data_; }
+  size_t length() const { return length_; }
+
+ private:
+  SharedSegment(int fd, size_t length, int protection, const std::string &name)
+      : length_(length) {
+    void *p = length > 0 ? mmap(nullptr, length, protection, MAP_SHARED, fd, 0) : MAP_FAILED;
+    const int error = errno;
+    close(fd);
+    if (p == MAP_FAILED) {
+      errno = length > 0 ? error : EINVAL;
+      Fail("mmap", name);
+    }
+    data_ = static_cast<char *>(p);
+  }
+
+  static std::string ObjectName(const std::string &name) {
+    return name[0] == '/' ? name : "/" + name;
+  }
+
+  char *data_ = nullptr;
+  size_t length_ = 0;
+};
+
+// The start of every generation segment. The image follows at image_offset.
+struct SharedFilterHeader {
+  static constexpr uint64_t kMagic = 0x314d485352544c46ULL; // "FLTRSHM1"
+  static constexpr uint32_t kVersion = 1;
+  static_assert(std::atomic<uint64_t>::is_always_lock_free,
+                "the flags are shared between processes");
+
+  // written last: a segment without it is incomplete
+  std::atomic<uint64_t> magic;
+  uint32_t version;
+  uint32_t image_offset;
+  uint64_t generation;
+  // hash of the filter's type name
+  uint64_t type;
+  uint64_t image_bytes;
+  // SizeInBytes() of the filter
+  uint64_t filter_bytes;
+  // the generation that replaced this one, 0 while it is current
+  std::atomic<uint64_t> superseded;
+
+  static std::string GenerationName(const std::string &name, uint64_t generation) {
+    return name + "." + std::to_string(generation);
+  }
+};
+
+// The control segment of a name: the number of its current generation.
+struct SharedFilterControl {
+  static_assert(std::atomic<uint64_t>::is_always_lock_free,
+                "the generation is shared between processes");
+
+  // 0 until the first Publish()
+  std::atomic<uint64_t> generation;
+
+  static std::string Name(const std::string &name) {
+    if (!SharedSegment::IsFile(name)) {
+      return name;
+    }
+    std::string object = name.substr(name[0] == '/');
+    std::replace(object.begin(), object.end(), '/', '_');
+    return object;
+  }
+
+  // The current generation published under name; 0 if none.
+  static uint64_t Read(const std::string &name) {
+    const std::string control_name = Name(name);
+    const int fd = SharedSegment::Open(control_name, O_RDONLY);
+    if (fd < 0) {
+      return 0;
+    }
+    // the publisher may not have sized it yet
+    struct stat st;
+    if (fstat(fd, &st) != 0 || size_t(st.st_size) < sizeof(SharedFilterControl)) {
+      close(fd);
+      return 0;
+    }
+    const SharedSegment segment = SharedSegment::Attach(fd, control_name);
+    return reinterpret_cast<const SharedFilterControl *>(segment.data())
+        ->generation.load(std::memory_order_acquire);
+  }
+};
+
+// The writer of a filter segment.
+template <typename Table>
+class SharedFilterPublisher {
+ public:
+  // Continues from the last generation published under name, if any.
+  explicit SharedFilterPublisher(std::string name, mode_t mode = 0644)
+      : name_(std::move(name)), mode_(mode) {
+    const std::string control_name = SharedFilterControl::Name(name_);
+    const int fd = SharedSegment::Open(control_name, O_RDWR | O_CREAT, mode_);
+    if (fd < 0) {
+      SharedSegment::Fail("open", control_name);
+    }
+    // a new object reads as generation 0; an existing one keeps its contents
+    control_ = SharedSegment::Create(fd, sizeof(SharedFilterControl), control_name);
+    generation_ = control()->generation.load(std::memory_order_acquire);
+    // a previous publisher's last generation, so that Publish() can mark it
+    // superseded and unlink it
+    if (generation_ != 0) {
+      const std::string segment_name = SharedFilterHeader::GenerationName(name_, generation_);
+      const int fd = SharedSegment::Open(segment_name, O_RDWR);
+      if (fd >= 0) {
+        current_ = SharedSegment::Attach(fd, segment_name, PROT_READ | PROT_WRITE);
+      }
+    }
+  }
+
+  SharedFilterPublisher(const SharedFilterPublisher &) = delete;
+  SharedFilterPublisher &operator=(const SharedFilterPublisher &) = delete;
+
+  // The segments stay, for the processes still to attach; see Unlink().
+
+  // Copies table into a new generation and makes it the current one;
+  // returns its number.
+  uint64_t Publish(const Table &table) {
+    const uint64_t generation = generation_ + 1;
+    const std::string segment_name = SharedFilterHeader::GenerationName(name_, generation);
+    // left over by a publisher that did not finish
+    SharedSegment::Unlink(segment_name);
+    const int fd = SharedSegment::Open(segment_name, O_RDWR | O_CREAT | O_EXCL, mode_);
+    if (fd < 0) {
+      SharedSegment::Fail("open", segment_name);
+    }
+    const size_t offset = filter_image::Align(sizeof(SharedFilterHeader));
+    const size_t image_bytes = FilterImage<Table>::Bytes(table);
+    SharedSegment segment;
+    try {
+      segment = SharedSegment::Create(fd, offset + image_bytes, segment_name);
+    } catch (...) {
+      SharedSegment::Unlink(segment_name);
+      throw;
+    }
+    SharedFilterHeader *header = new (segment.data()) SharedFilterHeader;
+    header->version = SharedFilterHeader::kVersion;
+    header->image_offset = offset;
+    header->generation = generation;
+    header->type = filter_image::TypeHash<Table>();
+    header->image_bytes = image_bytes;
+    header->filter_bytes = table.SizeInBytes();
+    header->superseded.store(0, std::memory_order_relaxed);
+    FilterImage<Table>::Write(table, segment.data() + offset);
+    header->magic.store(SharedFilterHeader::kMagic, std::memory_order_release);
+
+    control()->generation.store(generation, std::memory_order_release);
+    if (current_.data() != nullptr) {
+      reinterpret_cast<SharedFilterHeader *>(current_.data())
+          ->superseded.store(generation, std::memory_order_release);
+      SharedSegment::Unlink(SharedFilterHeader::GenerationName(name_, generation_));
+    }
+    current_ = std::move(segment);
+    generation_ = generation;
+    return generation;
+  }
+
+  uint64_t Generation() const { return generation_; }
+
+  // Removes the names of the control segment and of the current generation.
+  // Processes that have it mapped keep their copy; no one else can attach.
+  void Unlink() {
+    if (current_.data() != nullptr) {
+      SharedSegment::Unlink(SharedFilterHeader::GenerationName(name_, generation_));
+    }
+    SharedSegment::Unlink(SharedFilterControl::Name(name_));
+  }
+
+ private:
+  SharedFilterControl *control() {
+    return reinterpret_cast<SharedFilterControl *>(control_.data());
+  }
+
+  std::string name_;
+  mode_t mode_;
+  SharedSegment control_;
+  uint64_t generation_ = 0;
+  // the current generation, to flag it when it is replaced
+  SharedSegment current_;
+};
+
+// The current generation of a published filter, mapped read-only.
+template <typename Table>
+class SharedFilter {
+ public:
+  // Throws if nothing was published under name, or if it was published as
+  // another type of filter.
+  explicit SharedFilter(const std::string &name) {
+    // a generation can be replaced, and unlinked, between reading its number
+    // and opening it
+    for (int attempt = 0;; attempt++) {
+      const uint64_t generation = SharedFilterControl::Read(name);
+      if (generation == 0) {
+        throw std::runtime_error("SharedFilter: nothing published as " + name);
+      }
+      const std::string segment_name = SharedFilterHeader::GenerationName(name, generation);
+      const int fd = SharedSegment::Open(segment_name, O_RDONLY);
+      if (fd < 0) {
+        if (attempt == 100) {
+          SharedSegment::Fail("open", segment_name);
+        }
+        std::this_thread::yield();
+        continue;
+      }
+      segment_ = SharedSegment::Attach(fd, segment_name);
+      break;
+    }
+    const SharedFilterHeader *h = header();
+    if (segment_.length() < sizeof(SharedFilterHeader) ||
+        h->magic.load(std::memory_order_acquire) != SharedFilterHeader::kMagic ||
+        h->version != SharedFilterHeader::kVersion ||
+        h->image_offset + h->image_bytes > segment_.length()) {
+      throw std::runtime_error("SharedFilter: " + name + " is not a filter segment");
+    }
+    if (h->type != filter_image::TypeHash<Table>()) {
+      throw std::runtime_error("SharedFilter: " + name + " holds another type of filter");
+    }
+    FilterImage<Table>::View(segment_.data() + h->image_offset, table());
+  }
+
+  SharedFilter(const SharedFilter &) = delete;
+  SharedFilter &operator=(const SharedFilter &) = delete;
+
+  ~SharedFilter() { FilterImage<Table>::Release(table()); }
+
+  bool Contain(uint64_t key) { return FilterAPI<Table>::Contain(key, table()); }
+
+  // The filter itself, for FilterAPI<Table> calls in a loop.
+  Table *table() { return reinterpret_cast<Table *>(&storage_); }
+
+  uint64_t Generation() const { return header()->generation; }
+
+  // True once a newer generation has been published.
+  bool Stale() const {
+    return header()->superseded.load(std::memory_order_acquire) != 0;
+  }
+
+  size_t SizeInBytes() const { return header()->filter_bytes; }
+  // what the mapping takes, header and page rounding included
+  size_t SegmentBytes() const { return segment_.length(); }
+
+ private:
+  const SharedFilterHeader *header() const {
+    return reinterpret_cast<const SharedFilterHeader *>(segment_.data());
+  }
+
+  SharedSegment segment_;
+  typename std::aligned_storage<sizeof(Table), alignof(Table)>::type storage_;
+};
+
+template <typename Table>
+struct FilterAPI<SharedFilter<Table>>
+{
+  static void Add(uint64_t, SharedFilter<Table> *)
+  {
+    throw std::runtime_error("Unsupported");
+  }
+  static void Remove(uint64_t, SharedFilter<Table> *)
+  {
+    throw std::runtime_error("Unsupported");
+  }
+  CONTAIN_ATTRIBUTES static bool Contain(uint64_t key, SharedFilter<Table> *table)
+  {
+    return table->Contain(key);
+  }
+};
+
+#endif // SHM_FILTER_H_
@@ -2,6 +2,9 @@
 #ifndef TC_SHORTCUT_HPP
 #define TC_SHORTCUT_HPP
 
+#include <cmath>
+#include <sstream>
+
 #include "./tc-sym.hpp"
 #include "hashutil.h"
 
@@ -14,7 +17,7 @@ class TC_shortcut {
   HashFamily h0;
 
   const size_t quotient_range = tc_sym::QUOTS;
-  __m512i *pd_array{};
+  tc_sym::pd512_t *pd_array{};
   size_t capacity{0};
   size_t insert_existing_counter{0};
   size_t add_op_counter{0};
@@ -44,7 +47,8 @@ public:
     }
     static_assert(UINT64_C(-1) == 0xffff'ffff'ffff'ffff);
     std::fill(pd_array, pd_array + number_of_pd,
-              __m512i{-1, 0x00000000'0000ffff, 0, 0, 0, 0, 0, 0});
+              tc_sym::pd512_t{{UINT64_C(-1), 0x00000000'0000ffff, 0, 0, 0, 0,
+                               0, 0}});
   }
 
   virtual ~TC_shortcut() { free(pd_array); }
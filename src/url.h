@@ -0,0 +1,125 @@
+// URL canonicalization and hashing, as done in front of the filter lookup.
+//
+// A URL and its trivial variants must map to the same filter key, so both the
+// URLs added to a filter and the URLs queried go through normalize() first:
+//
+//   - surrounding ASCII whitespace is trimmed
+//   - the scheme ("http://", "HTTPS://", ...) and any user info are dropped
+//   - the host is lowercased, a leading "www." and a trailing dot are removed,
+//     and so are the default ports :80 and :443
+//   - the fragment is dropped, and so is a path consisting of a lone "/"
+//
+// The path and query are kept as is (they are case sensitive). Inputs without
+// a scheme, such as the bare domains of top-1m lists, are handled the same
+// way. hash() is the string hash used by the drivers (simple_hash).
+
+#ifndef URL_H_
+#define URL_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+namespace url {
+
+enum class verdict : uint8_t { allow, block };
+
+namespace detail {
+inline bool is_space(char c) {
+  return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f' ||
+         c == '\v';
+}
+
+inline char to_lower(char c) {
+  return (c >= 'A' && c <= 'Z') ? char(c | 0x20) : c;
+}
+
+// One pass over the authority (everything before the first '/', '?' or '#'):
+// copies it lowercased to o and notes the last '@' and ':'. Returns its
+// length. (string_view::find_first_of would make a memchr call per
+// character; the separate scans cost more than the copy.)
+inline size_t scan_authority(std::string_view s, char *o, size_t *at,
+                             size_t *colon) {
+  *at = *colon = SIZE_MAX;
+  for (size_t i = 0; i < s.size(); i++) {
+    const char c = s[i];
+    if (c == '/' || c == '?' || c == '#') {
+      return i;
+    }
+    if (c == '@') { *at = i; }
+    if (c == ':') { *colon = i; }
+    o[i] = to_lower(c);
+  }
+  return s.size();
+}
+} // namespace detail
+
+// Replaces the contents of *out with the canonical form of raw. *out is
+// reused across calls, so normalizing does not allocate once it has grown to
+// the longest URL.
+inline void normalize(std::string_view raw, std::string *out) {
+  size_t begin = 0, end = raw.size();
+  while (begin < end && detail::is_space(raw[begin])) { begin++; }
+  while (end > begin && detail::is_space(raw[end - 1])) { end--; }
+  std::string_view s = raw.substr(begin, end - begin);
+
+  out->resize(s.size());
+  char *o = &(*out)[0];
+  size_t at, colon;
+  size_t authority = detail::scan_authority(s, o, &at, &colon);
+  if (authority > 0 && authority + 1 < s.size() && s[authority - 1] == ':' &&
+      s[authority] == '/' && s[authority + 1] == '/') {
+    // "scheme://"
+    s.remove_prefix(authority + 2);
+    authority = detail::scan_authority(s, o, &at, &colon);
+  }
+  // the host is o[host_begin, host_end)
+  size_t host_begin = at == SIZE_MAX ? 0 : at + 1;
+  size_t host_end = authority;
+  if (host_end - host_begin >= 4 && memcmp(o + host_begin, "www.", 4) == 0) {
+    host_begin += 4;
+  }
+  if (colon != SIZE_MAX && colon >= host_begin) {
+    const std::string_view port(o + colon, host_end - colon);
+    if (port == ":80" || port == ":443") {
+      host_end = colon;
+    }
+  }
+  if (host_end > host_begin && o[host_end - 1] == '.') {
+    host_end--;
+  }
+
+  std::string_view rest = s.substr(authority);
+  const size_t fragment = rest.find('#');
+  if (fragment != std::string_view::npos) {
+    rest.remove_suffix(rest.size() - fragment);
+  }
+  if (rest == "/") {
+    rest = std::string_view();
+  }
+  const size_t host_size = host_end - host_begin;
+  memmove(o, o + host_begin, host_size);
+  memcpy(o + host_size, rest.data(), rest.size());
+  out->resize(host_size + rest.size());
+}
+
+inline std::string normalize(std::string_view raw) {
+  std::string out;
+  normalize(raw, &out);
+  return out;
+}
+
+inline uint64_t hash(std::string_view s) {
+  uint64_t h = 0;
+  for (unsigned char c : s) {
+    h = (h * 177) + c;
+  }
+  h ^= s.size();
+  return h;
+}
+
+} // namespace url
+
+#endif // URL_H_
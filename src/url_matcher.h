@@ -0,0 +1,233 @@
+// Matching a URL against a filter of domains, hosts and path prefixes.
+//
+// A filter entry such as "example.com" or "example.com/x" (normalized as in
+// url.h) must also block "www.a.example.com/x/y". A URL therefore has
+// several lookup keys, one per combination of
+//
+//   host suffix   the host, then the broader suffixes, broadest first,
+//                 down to the registrable part: a.example.com, example.com
+//                 (never a bare top-level domain, and only the host itself
+//                 for an IP address)
+//   path prefix   nothing, then the path up to each '/' after the first
+//                 character, the path without the query, and all of it:
+//                 "", /x, /x/y, /x/y?q
+//
+// and the URL matches if any of those strings is in the filter. At most
+// max_hosts suffixes and max_paths prefixes (not counting the empty one)
+// are formed; with the defaults, up to 5 x 7 keys.
+//
+// candidates() computes the keys without forming the strings: url::hash is
+// a polynomial hash, so the hashes of all the host suffixes come out of one
+// pass over the host from the right, those of the path prefixes out of one
+// pass from the left, and each combination is one multiply-add. Matcher then
+// probes all of them as one batch against the filter (ContainAny in
+// filterapi.h): the lookups are prefetched together and the first hit ends
+// the batch, so a URL costs little more than a single lookup.
+
+#ifndef URL_MATCHER_H_
+#define URL_MATCHER_H_
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "filterapi.h"
+#include "url.h"
+
+namespace url {
+
+constexpr size_t kMaxHostSuffixes = 8;
+constexpr size_t kMaxPathPrefixes = 8;
+constexpr size_t kMaxCandidates = kMaxHostSuffixes * (kMaxPathPrefixes + 1);
+
+namespace detail {
+constexpr uint64_t kHashBase = 177;
+
+inline bool is_ip(std::string_view host) {
+  for (char c : host) {
+    if ((c < '0' || c > '9') && c != '.' && c != ':') {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Where a canonical URL's host ends: its first '/' or '?'.
+inline size_t host_length(std::string_view canonical) {
+  size_t i = 0;
+  while (i < canonical.size() && canonical[i] != '/' && canonical[i] != '?') {
+    i++;
+  }
+  return i;
+}
+
+// The start of each host suffix, broadest first, the whole host last.
+inline size_t host_suffixes(std::string_view host, size_t max_hosts, size_t *starts) {
+  size_t n = 0;
+  if (!is_ip(host)) {
+    // skip the top-level domain
+    size_t dots = 0;
+    for (size_t i = host.size(); i-- > 0 && n + 1 < max_hosts;) {
+      if (host[i] == '.' && dots++ > 0) {
+        starts[n++] = i + 1;
+      }
+    }
+  }
+  starts[n++] = 0;
+  return n;
+}
+
+// The end of each path prefix, shortest first; rest is everything after
+// the host.
+inline size_t path_prefixes(std::string_view rest, size_t max_paths, size_t *ends) {
+  size_t n = 0;
+  if (rest.empty()) {
+    return 0;
+  }
+  for (size_t i = 1; i < rest.size() && n + 1 < max_paths; i++) {
+    if (rest[i] == '/' || rest[i] == '?') {
+      ends[n++] = i;
+      if (rest[i] == '?') {
+        break;
+      }
+    }
+  }
+  ends[n++] = rest.size();
+  return n;
+}
+} // namespace detail
+
+// The lookup keys of canonical, a normalized URL, into keys (which holds
+// kMaxCandidates): for each host suffix, broadest first, the suffix alone
+// and then with each path prefix. Returns their number. Each key is
+// url::hash of the string it stands for.
+inline size_t candidates(std::string_view canonical, uint64_t *keys,
+                         size_t max_hosts = 5, size_t max_paths = 6) {
+  max_hosts = std::max<size_t>(1, std::min(max_hosts, kMaxHostSuffixes));
+  max_paths = std::max<size_t>(1, std::min(max_paths, kMaxPathPrefixes));
+  const size_t host_size = detail::host_length(canonical);
+  const std::string_view host = canonical.substr(0, host_size);
+  const std::string_view rest = canonical.substr(host_size);
+
+  size_t starts[kMaxHostSuffixes], ends[kMaxPathPrefixes];
+  const size_t hosts = detail::host_suffixes(host, max_hosts, starts);
+  const size_t paths = detail::path_prefixes(rest, max_paths, ends);
+
+  // suffix hashes, from the right: hash(host[i..]) = host[i] * 177^(n-1-i)
+  // + hash(host[i+1..])
+  uint64_t suffix_hash[kMaxHostSuffixes];
+  {
+    uint64_t h = 0, power = 1;
+    size_t s = 0;
+    for (size_t i = host.size(); s < hosts;) {
+      // the suffixes are in decreasing order of start
+      while (s < hosts && starts[s] == i) {
+        suffix_hash[s++] = h;
+      }
+      if (i == 0) {
+        break;
+      }
+      i--;
+      h += uint64_t((unsigned char)host[i]) * power;
+      power *= detail::kHashBase;
+    }
+  }
+  // prefix hashes, from the left, with 177^length to shift a suffix by
+  uint64_t prefix_hash[kMaxPathPrefixes], prefix_power[kMaxPathPrefixes];
+  {
+    uint64_t h = 0, power = 1;
+    size_t p = 0;
+    for (size_t i = 0; p < paths; i++) {
+      while (p < paths && ends[p] == i) {
+        prefix_hash[p] = h;
+        prefix_power[p++] = power;
+      }
+      if (i == rest.size()) {
+        break;
+      }
+      h = h * detail::kHashBase + (unsigned char)rest[i];
+      power *= detail::kHashBase;
+    }
+  }
+  size_t n = 0;
+  for (size_t s = 0; s < hosts; s++) {
+    const size_t length = host.size() - starts[s];
+    keys[n++] = suffix_hash[s] ^ length;
+    for (size_t p = 0; p < paths; p++) {
+      keys[n++] = (suffix_hash[s] * prefix_power[p] + prefix_hash[p]) ^ (length + ends[p]);
+    }
+  }
+  return n;
+}
+
+// The strings candidates() hashes, in the same order; for building a filter
+// of entries, and for checking.
+inline void candidate_strings(std::string_view canonical, std::vector<std::string> *out,
+                              size_t max_hosts = 5, size_t max_paths = 6) {
+  max_hosts = std::max<size_t>(1, std::min(max_hosts, kMaxHostSuffixes));
+  max_paths = std::max<size_t>(1, std::min(max_paths, kMaxPathPrefixes));
+  const size_t host_size = detail::host_length(canonical);
+  const std::string_view host = canonical.substr(0, host_size);
+  const std::string_view rest = canonical.substr(host_size);
+  size_t starts[kMaxHostSuffixes], ends[kMaxPathPrefixes];
+  const size_t hosts = detail::host_suffixes(host, max_hosts, starts);
+  const size_t paths = detail::path_prefixes(rest, max_paths, ends);
+  out->clear();
+  for (size_t s = 0; s < hosts; s++) {
+    const std::string suffix(host.substr(starts[s]));
+    out->push_back(suffix);
+    for (size_t p = 0; p < paths; p++) {
+      out->push_back(suffix + std::string(rest.substr(0, ends[p])));
+    }
+  }
+}
+
+// Matches URLs against a filter of url::hash'ed entries. Not thread-safe
+// (it keeps scratch space); use one per thread.
+template <typename Table>
+class Matcher {
+ public:
+  explicit Matcher(Table *table, size_t max_hosts = 5, size_t max_paths = 6)
+      : table_(table), max_hosts_(max_hosts), max_paths_(max_paths) {}
+
+  // raw is normalized first.
+  bool Match(std::string_view raw) {
+    normalize(raw, &canonical_);
+    return MatchNormalized(canonical_);
+  }
+
+  bool MatchNormalized(std::string_view canonical) {
+    count_ = candidates(canonical, keys_, max_hosts_, max_paths_);
+    matched_ = ContainAny(keys_, count_, table_);
+    return matched_ < count_;
+  }
+
+  // Bit i of out_bitmap, which must hold (n + 63) / 64 words, is set if
+  // raw[i] matches.
+  void MatchMany(const std::string_view *raw, size_t n, uint64_t *out_bitmap) {
+    std::fill(out_bitmap, out_bitmap + (n + 63) / 64, 0);
+    for (size_t i = 0; i < n; i++) {
+      out_bitmap[i >> 6] |= uint64_t(Match(raw[i])) << (i & 63);
+    }
+  }
+
+  // The keys of the last URL matched, and which of them hit (Candidates()
+  // if none did).
+  size_t Candidates() const { return count_; }
+  const uint64_t *Keys() const { return keys_; }
+  size_t Matched() const { return matched_; }
+
+ private:
+  Table *table_;
+  size_t max_hosts_, max_paths_;
+  std::string canonical_;
+  uint64_t keys_[kMaxCandidates];
+  size_t count_ = 0, matched_ = 0;
+};
+
+} // namespace url
+
+#endif // URL_MATCHER_H_
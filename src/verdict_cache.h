@@ -0,0 +1,267 @@
+// A small cache of hot positive verdicts in front of a filter.
+//
+// Real traffic is skewed: a few thousand URLs make up most of the queries,
+// yet each query hashes its key again and probes one or more random lines of
+// a filter that can be far larger than the CPU caches. VerdictCache keeps
+// the hot keys the filter found, in a table small enough to stay in L1/L2
+// (16K entries, 64 KB, by default), and answers those without the filter.
+//
+// It is opt-in and cheap where it does not help. A key that is not cached
+// costs one 8-byte load on top of the filter lookup, and writes nothing
+// unless the filter found it:
+//
+//   - Negatives are never cached. In a blocklist they are the long tail of
+//     the traffic, and each one cached would push out a hot positive.
+//   - A positive is admitted on its second miss only. A doorkeeper, as many
+//     16-bit fingerprints as the cache has entries, remembers the positives
+//     that missed once; keys seen once never reach the cache.
+//
+// The table is 2-way set associative, a set being one 64-bit word: two
+// 32-bit tags, the newer one in the low half. The key is multiplied by an
+// odd constant; the top bits of the product pick the set and the next 32,
+// with the lowest forced to 1 to tell a tag from an empty way, are the tag.
+// Two keys can thus share a tag, which turns a negative into a positive for
+// about one lookup in 2^30, far below the false positive rate of any filter
+// here. An admitted key goes in front of its set and pushes the older entry
+// out; a hit never writes.
+//
+// Nothing is atomic: each thread constructs its own cache. The filter must
+// not change while cached; Clear() after swapping it.
+//
+// Use batches (ContainMany, which uses FindMany here): they send all the
+// misses of a batch to the filter together, so that their cache misses
+// overlap. One at a time, the branch on a hit is hard to predict, and its
+// mispredictions keep the cache misses of successive filter lookups from
+// overlapping, which costs more than the hits save. Even batched, the hits
+// save less than their share of the traffic: the filter lines of hot keys
+// are mostly in the CPU caches already. Measure before turning it on (see
+// tests/cache.cpp).
+//
+// Counters: hits, misses and admissions, and, if sample_every is set, the
+// latency of 1 lookup in sample_every, split by hits and misses.
+
+#ifndef VERDICT_CACHE_H_
+#define VERDICT_CACHE_H_
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+
+#include "filterapi.h"
+
+template <typename Table>
+class VerdictCache {
+ public:
+  struct Options {
+    // rounded up to a power of two, at least 32
+    size_t entries = 1 << 14;
+    // time one lookup in this many (a power of two); 0 = never
+    size_t sample_every = 0;
+  };
+
+  struct Stats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t admitted = 0;
+    uint64_t sampled_hits = 0;
+    uint64_t sampled_misses = 0;
+    uint64_t hit_ns = 0;
+    uint64_t miss_ns = 0;
+
+    double HitRate() const {
+      return hits + misses > 0 ? double(hits) / (hits + misses) : 0.0;
+    }
+    double MeanHitNs() const { return sampled_hits > 0 ? double(hit_ns) / sampled_hits : 0.0; }
+    double MeanMissNs() const {
+      return sampled_misses > 0 ? double(miss_ns) / sampled_misses : 0.0;
+    }
+    Stats &operator+=(const Stats &o) {
+      hits += o.hits;
+      misses += o.misses;
+      admitted += o.admitted;
+      sampled_hits += o.sampled_hits;
+      sampled_misses += o.sampled_misses;
+      hit_ns += o.hit_ns;
+      miss_ns += o.miss_ns;
+      return *this;
+    }
+  };
+
+  VerdictCache(Table *table, Options options) : table_(table), options_(options) {
+    if (options_.sample_every & (options_.sample_every - 1)) {
+      throw std::invalid_argument("VerdictCache: sample_every must be a power of two");
+    }
+    int log_sets = 4;
+    while ((size_t(2) << log_sets) < options_.entries) {
+      log_sets++;
+    }
+    log_sets_ = log_sets;
+    sets_.reset(new uint64_t[size_t(1) << log_sets]());
+    seen_.reset(new uint16_t[size_t(2) << log_sets]());
+  }
+
+  explicit VerdictCache(Table *table) : VerdictCache(table, Options()) {}
+
+  bool Contain(uint64_t key) const {
+    if (options_.sample_every != 0 && (++lookups_ & (options_.sample_every - 1)) == 0) {
+      return TimedContain(key);
+    }
+    bool hit;
+    return Lookup(key, &hit);
+  }
+
+  // Bit i of out_bitmap, which must hold (n + 63) / 64 words, is set if
+  // keys[i] may be in the filter. A chunk of up to 256 keys is probed first;
+  // the misses go to the filter together (ContainMany), so that their cache
+  // misses overlap, and only the positives among them are then offered for
+  // admission. Not sampled for latency.
+  void FindMany(const uint64_t *keys, size_t n, uint64_t *out_bitmap) const {
+    uint64_t products[kChunk];
+    uint64_t missed[kChunk];
+    uint16_t index[kChunk];
+    uint64_t found[kChunk / 64];
+    for (size_t first = 0; first < n; first += kChunk) {
+      const uint64_t *chunk = keys + first;
+      const size_t count = std::min(kChunk, n - first);
+      uint64_t *bits = out_bitmap + first / 64;
+      size_t m = 0;
+      for (size_t w = 0; w < (count + 63) / 64; w++) {
+        // in a register: or-ing into bits[w] would chain every key through
+        // a store and a load
+        uint64_t word = 0;
+        for (size_t i = 64 * w; i < std::min(64 * w + 64, count); i++) {
+          const uint64_t p = chunk[i] * kMultiplier;
+          const bool hit = Cached(*Set(p), Tag(p));
+          word |= uint64_t(hit) << (i % 64);
+          missed[m] = chunk[i];
+          products[m] = p;
+          index[m] = uint16_t(i);
+          m += !hit;
+        }
+        bits[w] = word;
+      }
+      stats_.hits += count - m;
+      stats_.misses += m;
+      if (m > 0) {
+        ContainMany(missed, m, table_, found);
+        for (size_t w = 0; w < (m + 63) / 64; w++) {
+          for (uint64_t f = found[w]; f != 0; f &= f - 1) {
+            const size_t j = 64 * w + __builtin_ctzll(f);
+            bits[index[j] / 64] |= uint64_t(1) << (index[j] % 64);
+            Admit(products[j]);
+          }
+        }
+      }
+    }
+  }
+
+  // Forgets every key, and the doorkeeper too.
+  void Clear() {
+    std::fill(sets_.get(), sets_.get() + Entries() / 2, 0);
+    std::fill(seen_.get(), seen_.get() + Entries(), 0);
+  }
+
+  const Stats &stats() const { return stats_; }
+  void ResetStats() { stats_ = Stats(); }
+  size_t Entries() const { return size_t(2) << log_sets_; }
+  // the table and the doorkeeper
+  size_t SizeInBytes() const { return Entries() * (sizeof(uint32_t) + sizeof(uint16_t)); }
+  Table *table() const { return table_; }
+
+ private:
+  static constexpr uint64_t kMultiplier = UINT64_C(0x9E3779B97F4A7C15);
+  static constexpr size_t kChunk = 256;
+
+  // p is key * kMultiplier.
+  uint64_t *Set(uint64_t p) const { return sets_.get() + (p >> (64 - log_sets_)); }
+  uint32_t Tag(uint64_t p) const { return uint32_t(p >> (32 - log_sets_)) | 1; }
+
+  static bool Cached(uint64_t set, uint32_t tag) {
+    return (uint32_t(set) == tag) | (uint32_t(set >> 32) == tag);
+  }
+
+  // A positive that missed: into its set if the doorkeeper has seen it
+  // before, else into the doorkeeper. The doorkeeper is indexed by bits of
+  // p below the tag and holds its top 16 bits; a collision only admits a
+  // key early.
+  void Admit(uint64_t p) const {
+    uint16_t &seen = seen_[uint32_t(p) >> (31 - log_sets_)];
+    const uint16_t fingerprint = uint16_t(p >> 48);
+    if (seen != fingerprint) {
+      seen = fingerprint;
+      return;
+    }
+    uint64_t *set = Set(p);
+    const uint32_t tag = Tag(p);
+    // a key repeated within a FindMany chunk may be in already
+    if (uint32_t(*set) != tag) {
+      stats_.admitted++;
+      *set = (*set << 32) | tag;
+    }
+  }
+
+  bool Lookup(uint64_t key, bool *hit) const {
+    const uint64_t p = key * kMultiplier;
+    *hit = Cached(*Set(p), Tag(p));
+    if (*hit) {
+      stats_.hits++;
+      return true;
+    }
+    stats_.misses++;
+    const bool found = FilterAPI<Table>::Contain(key, table_);
+    if (found) {
+      Admit(p);
+    }
+    return found;
+  }
+
+  bool TimedContain(uint64_t key) const {
+    const auto start = std::chrono::steady_clock::now();
+    bool hit;
+    const bool found = Lookup(key, &hit);
+    const uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                            std::chrono::steady_clock::now() - start)
+                            .count();
+    if (hit) {
+      stats_.sampled_hits++;
+      stats_.hit_ns += ns;
+    } else {
+      stats_.sampled_misses++;
+      stats_.miss_ns += ns;
+    }
+    return found;
+  }
+
+  Table *table_;
+  Options options_;
+  int log_sets_;
+  // two tags per set
+  std::unique_ptr<uint64_t[]> sets_;
+  // the doorkeeper, as many fingerprints as there are entries
+  std::unique_ptr<uint16_t[]> seen_;
+  // counters only: lookups are logically const
+  mutable Stats stats_;
+  mutable uint64_t lookups_ = 0;
+};
+
+template <typename Table>
+struct FilterAPI<VerdictCache<Table>>
+{
+  static void Add(uint64_t, VerdictCache<Table> *)
+  {
+    throw std::runtime_error("Unsupported");
+  }
+  static void Remove(uint64_t, VerdictCache<Table> *)
+  {
+    throw std::runtime_error("Unsupported");
+  }
+  CONTAIN_ATTRIBUTES static bool Contain(uint64_t key, VerdictCache<Table> *table)
+  {
+    return table->Contain(key);
+  }
+};
+
+#endif // VERDICT_CACHE_H_
@@ -72,6 +72,13 @@ public:
   // Report if the item is inserted, with false positive rate.
   Status Contain(const ItemType &item) const;
 
+  // Contain() split in two for software-pipelined batches (batchlookup.h):
+  // ContainStart returns the hash after prefetching both candidate blocks.
+  uint64_t ContainStart(const ItemType &item) const;
+  Status ContainFinish(const uint64_t hash) const {
+    return vqf_is_present(filter, hash) ? Ok : NotFound;
+  }
+
   /* methods for providing stats  */
   // summary infomation
   std::string Info() const;
@@ -101,6 +108,18 @@ Status VQFilter<ItemType, HashFamily>::Contain(const ItemType &key) const {
   return ret ? Ok : NotFound;
 }
 
+template <typename ItemType, typename HashFamily>
+uint64_t VQFilter<ItemType, HashFamily>::ContainStart(const ItemType &key) const {
+  uint64_t hash = hasher(key);
+  uint64_t range = filter->metadata.range;
+  uint64_t block_index = (uint64_t)(((__uint128_t)hash * range) >> 64);
+  uint64_t alt_block_index =
+      (uint64_t)(((__uint128_t)rotateLeft(hash, 32) * range) >> 64);
+  __builtin_prefetch(&filter->blocks[block_index / QUQU_BUCKETS_PER_BLOCK]);
+  __builtin_prefetch(&filter->blocks[alt_block_index / QUQU_BUCKETS_PER_BLOCK]);
+  return hash;
+}
+
 const int blockShift = 15;
 const int blockLen = 1 << blockShift;
 
@@ -0,0 +1,197 @@
+// Realistic query streams for filter benchmarks.
+//
+// The drivers query every key once, in load order, followed by as many
+// uniformly random misses. Real traffic looks different: a few keys are
+// queried far more often than the rest, most queries may be misses (or most
+// hits), only part of the key set is active at any time, and the same key
+// tends to come back in short bursts. All of these change which filter lines
+// stay in cache and how well the branches in Contain are predicted.
+//
+// GenerateWorkload builds such a stream from the loaded keys and a pool of
+// keys known not to be in the filter:
+//
+//   zipf_s          popularity skew; rank r is drawn with probability
+//                   proportional to 1 / r^zipf_s (0 = uniform)
+//   positive_ratio  fraction of queries drawn from the key set
+//   working_set     number of distinct keys (resp. negatives) that can be
+//                   queried, 0 = all of them
+//   burst           mean length of a run of repeated queries of the same key
+//                   (geometrically distributed, 1 = no bursts)
+//
+// Popularity ranks are assigned to a seeded shuffle of the keys, so the hot
+// keys are not clustered in load order. Replay feeds a stream to any filter
+// that has a FilterAPI.
+
+#ifndef WORKLOAD_H_
+#define WORKLOAD_H_
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+template <typename Table> struct FilterAPI;
+
+namespace workload {
+
+// Zipf-distributed ranks in [1, n] by rejection-inversion (Hormann and
+// Derflinger, "Rejection-inversion to generate variates from monotone discrete
+// distributions", 1996). O(1) setup and O(1) expected time per sample, for any
+// exponent s > 0 including s = 1, so no CDF over the key set is needed.
+class ZipfDistribution {
+ public:
+  ZipfDistribution(uint64_t n, double s) : n_(n), s_(s) {
+    if (n == 0) {
+      throw std::invalid_argument("ZipfDistribution: empty range");
+    }
+    if (s_ > 0) {
+      h_integral_x1_ = HIntegral(1.5) - 1.0;
+      h_integral_n_ = HIntegral(double(n_) + 0.5);
+      squeeze_ = 2.0 - HIntegralInverse(HIntegral(2.5) - H(2.0));
+    }
+  }
+
+  template <typename Rng> uint64_t operator()(Rng &rng) {
+    if (s_ <= 0) {
+      return 1 + std::uniform_int_distribution<uint64_t>(0, n_ - 1)(rng);
+    }
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+    while (true) {
+      const double u =
+          h_integral_n_ + unit(rng) * (h_integral_x1_ - h_integral_n_);
+      const double x = HIntegralInverse(u);
+      double k = std::floor(x + 0.5);
+      if (k < 1) {
+        k = 1;
+      } else if (k > double(n_)) {
+        k = double(n_);
+      }
+      if (k - x <= squeeze_ || u >= HIntegral(k + 0.5) - H(k)) {
+        return uint64_t(k);
+      }
+    }
+  }
+
+ private:
+  // log1p(x) / x and expm1(x) / x, continuous at 0
+  static double Helper1(double x) {
+    return std::fabs(x) > 1e-8 ? std::log1p(x) / x
+                               : 1.0 - x * (0.5 - x * (1.0 / 3.0 - 0.25 * x));
+  }
+  static double Helper2(double x) {
+    return std::fabs(x) > 1e-8
+               ? std::expm1(x) / x
+               : 1.0 + x * 0.5 * (1.0 + x * (1.0 / 3.0) * (1.0 + 0.25 * x));
+  }
+  // h(x) = x^-s and its antiderivative H(x) = (x^(1-s) - 1) / (1 - s)
+  double H(double x) const { return std::exp(-s_ * std::log(x)); }
+  double HIntegral(double x) const {
+    const double log_x = std::log(x);
+    return Helper2((1.0 - s_) * log_x) * log_x;
+  }
+  double HIntegralInverse(double x) const {
+    double t = x * (1.0 - s_);
+    if (t < -1.0) {
+      t = -1.0;
+    }
+    return std::exp(Helper1(t) * x);
+  }
+
+  uint64_t n_;
+  double s_;
+  double h_integral_x1_ = 0;
+  double h_integral_n_ = 0;
+  double squeeze_ = 0;
+};
+
+struct WorkloadConfig {
+  size_t queries = 1000000;
+  double zipf_s = 0.99;
+  double positive_ratio = 0.5;
+  size_t working_set = 0;
+  double burst = 1.0;
+  uint64_t seed = 1234;
+
+  void print(FILE *out = stdout) const {
+    fprintf(out,
+            "workload: %zu queries, zipf %.2f, %.0f%% positive, working set "
+            "%zu, burst %.1f, seed %llu\n",
+            queries, zipf_s, positive_ratio * 100, working_set, burst,
+            (unsigned long long)seed);
+  }
+};
+
+struct Workload {
+  std::vector<uint64_t> queries;
+  // 1 if queries[i] was drawn from the key set
+  std::vector<uint8_t> positive;
+  size_t positives = 0;
+};
+
+namespace detail {
+inline std::vector<uint64_t> HotSet(const std::vector<uint64_t> &keys,
+                                    size_t working_set, std::mt19937_64 &rng) {
+  std::vector<uint64_t> hot(keys);
+  std::shuffle(hot.begin(), hot.end(), rng);
+  if (working_set != 0 && working_set < hot.size()) {
+    hot.resize(working_set);
+  }
+  return hot;
+}
+} // namespace detail
+
+inline Workload GenerateWorkload(const std::vector<uint64_t> &keys,
+                                 const std::vector<uint64_t> &negatives,
+                                 const WorkloadConfig &config) {
+  const double positive_ratio =
+      std::min(1.0, std::max(0.0, config.positive_ratio));
+  if ((positive_ratio > 0 && keys.empty()) ||
+      (positive_ratio < 1 && negatives.empty())) {
+    throw std::invalid_argument("GenerateWorkload: empty key pool");
+  }
+  std::mt19937_64 rng(config.seed);
+  const std::vector<uint64_t> hot_keys =
+      detail::HotSet(keys, config.working_set, rng);
+  const std::vector<uint64_t> hot_negatives =
+      detail::HotSet(negatives, config.working_set, rng);
+  ZipfDistribution positive_rank(std::max<size_t>(hot_keys.size(), 1),
+                                 config.zipf_s);
+  ZipfDistribution negative_rank(std::max<size_t>(hot_negatives.size(), 1),
+                                 config.zipf_s);
+  std::bernoulli_distribution is_positive(positive_ratio);
+  std::geometric_distribution<size_t> extra_repeats(
+      1.0 / std::max(1.0, config.burst));
+
+  Workload w;
+  w.queries.reserve(config.queries);
+  w.positive.reserve(config.queries);
+  while (w.queries.size() < config.queries) {
+    const bool positive = is_positive(rng);
+    const uint64_t key = positive ? hot_keys[positive_rank(rng) - 1]
+                                  : hot_negatives[negative_rank(rng) - 1];
+    const size_t run = std::min(1 + extra_repeats(rng),
+                                config.queries - w.queries.size());
+    w.queries.insert(w.queries.end(), run, key);
+    w.positive.insert(w.positive.end(), run, positive);
+    w.positives += positive ? run : 0;
+  }
+  return w;
+}
+
+// Query every key of the stream, in order; returns the number of hits.
+template <typename Table>
+size_t Replay(const std::vector<uint64_t> &queries, Table *table) {
+  size_t found = 0;
+  for (uint64_t q : queries) {
+    found += FilterAPI<Table>::Contain(q, table);
+  }
+  return found;
+}
+
+} // namespace workload
+
+#endif // WORKLOAD_H_
@@ -106,6 +106,16 @@ public:
   // Report if the item is inserted, with false positive rate.
   Status Contain(const ItemType &item) const;
 
+  // Contain() split in two for software-pipelined batches (batchlookup.h):
+  // ContainStart hashes the item and prefetches its four locations,
+  // ContainFinish reads them.
+  struct ContainState {
+    size_t h[4];
+    FingerprintType f;
+  };
+  void ContainStart(const ItemType &item, ContainState *s) const;
+  Status ContainFinish(const ContainState &s) const;
+
   /* methods for providing stats  */
   // summary infomation
   std::string Info() const;
@@ -290,6 +300,27 @@ Status XorBinaryFuseFilter<ItemType, FingerprintType, HashFamily>::Contain(
   return f == 0 ? Ok : NotFound;
 }
 
+template <typename ItemType, typename FingerprintType, typename HashFamily>
+void XorBinaryFuseFilter<ItemType, FingerprintType, HashFamily>::ContainStart(
+    const ItemType &key, ContainState *s) const {
+  uint64_t hash = (*hasher)(key);
+  s->f = fingerprint(hash);
+  for (int hi = 0; hi < 4; hi++) {
+    s->h[hi] = getHashFromHash(hash, hi);
+    __builtin_prefetch(&fingerprints[s->h[hi]]);
+  }
+}
+
+template <typename ItemType, typename FingerprintType, typename HashFamily>
+Status XorBinaryFuseFilter<ItemType, FingerprintType, HashFamily>::ContainFinish(
+    const ContainState &s) const {
+  FingerprintType f = s.f;
+  for (int hi = 0; hi < 4; hi++) {
+    f ^= fingerprints[s.h[hi]];
+  }
+  return f == 0 ? Ok : NotFound;
+}
+
 template <typename ItemType, typename FingerprintType, typename HashFamily>
 std::string
 XorBinaryFuseFilter<ItemType, FingerprintType, HashFamily>::Info() const {
@@ -79,6 +79,16 @@ class XorFilter {
   // Report if the item is inserted, with false positive rate.
   Status Contain(const ItemType &item) const;
 
+  // Contain() split in two for software-pipelined batches (batchlookup.h):
+  // ContainStart hashes the item and prefetches its three locations,
+  // ContainFinish reads them.
+  struct ContainState {
+    uint32_t h0, h1, h2;
+    FingerprintType f;
+  };
+  void ContainStart(const ItemType &item, ContainState *s) const;
+  Status ContainFinish(const ContainState &s) const;
+
   /* methods for providing stats  */
   // summary infomation
   std::string Info() const;
@@ -306,6 +316,28 @@ Status XorFilter<ItemType, FingerprintType, HashFamily>::Contain(
     return f == 0 ? Ok : NotFound;
 }
 
+template <typename ItemType, typename FingerprintType,
+          typename HashFamily>
+void XorFilter<ItemType, FingerprintType, HashFamily>::ContainStart(
+    const ItemType &key, ContainState *s) const {
+    uint64_t hash = (*hasher)(key);
+    s->f = fingerprint(hash);
+    s->h0 = reduce((uint32_t) hash, blockLength);
+    s->h1 = reduce((uint32_t) rotl64(hash, 21), blockLength) + blockLength;
+    s->h2 = reduce((uint32_t) rotl64(hash, 42), blockLength) + 2 * blockLength;
+    __builtin_prefetch(&fingerprints[s->h0]);
+    __builtin_prefetch(&fingerprints[s->h1]);
+    __builtin_prefetch(&fingerprints[s->h2]);
+}
+
+template <typename ItemType, typename FingerprintType,
+          typename HashFamily>
+Status XorFilter<ItemType, FingerprintType, HashFamily>::ContainFinish(
+    const ContainState &s) const {
+    FingerprintType f = s.f ^ fingerprints[s.h0] ^ fingerprints[s.h1] ^ fingerprints[s.h2];
+    return f == 0 ? Ok : NotFound;
+}
+
 template <typename ItemType, typename FingerprintType,
           typename HashFamily>
 std::string XorFilter<ItemType, FingerprintType, HashFamily>::Info() const {
@@ -44,22 +44,28 @@ int convert(char *str)
 void pretty_print(size_t volume, size_t bytes, // std::string name,
                   event_aggregate agg, FILE *filename)
 {
-  fprintf(filename, ",%.2f,%.2f,%.2f", bytes / agg.fastest_elapsed_ns(), volume * 1000.0 / agg.fastest_elapsed_ns(), agg.fastest_elapsed_ns() / volume);
+  fprintf(filename, ",%.2f,%.2f,%.2f,%.2f", bytes / agg.fastest_elapsed_ns(), volume * 1000.0 / agg.fastest_elapsed_ns(), agg.fastest_elapsed_ns() / volume, agg.elapsed_ns() / volume);
+  results.timing(volume, agg);
 }
 
 // data size, test size, true positive, true negative, false positive, false negative, bogus size, false_pos_bogus, duplicates data
 void writeOutput(size_t tp, size_t tn, size_t fp, size_t fn, size_t fp_bogus, int dup_num, FILE *filename)
 {
   fprintf(filename, "%d,%d,%zu,%zu,%zu,%zu,%d,%zu,%d\n", data_size, test_size, tp, tn, fp, fn, bogus_size, fp_bogus, dup_num);
+  results.accuracy(tn, fp, fn, fp_bogus, bogus_size);
+  results.write();
 }
 
-// data_size, test_size, total_data_volume, average_len (bytes/name), test_volume, filter_volume, %usage(wrt to test_volume), usuage (wrt to test_size[bits / entry])
+// data_size, test_size, total_data_volume, average_len (bytes/name), test_volume, filter_volume, %usage(wrt to test_volume), usuage (wrt to test_size[bits / entry]), heap peak growth of the load, hash, dedup, construct and query phases (bytes), construct peak (bytes / entry), construct scratch (bytes), construct RSS high-water (bytes), run RSS high-water (bytes)
 void writeStat1(size_t input_volume, size_t test_volume, size_t filter_volume, FILE *filename)
 {
-  fprintf(filename, "%d,%d,%zu,%.1f,%zu,%zu,%.2f %%,%.1f\n", data_size, test_size, input_volume, double(input_volume) / data_size, test_volume, filter_volume, 100.0 * filter_volume / test_volume, 8.0 * filter_volume / test_size);
+  fprintf(filename, "%d,%d,%zu,%.1f,%zu,%zu,%.2f %%,%.1f", data_size, test_size, input_volume, double(input_volume) / data_size, test_volume, filter_volume, 100.0 * filter_volume / test_volume, 8.0 * filter_volume / test_size);
+  results.sizes(data_size, test_size, filter_volume);
+  memprofile.write_csv(filename, test_size);
+  fprintf(filename, "\n");
 }
 
-// data_size, test_size, Benchmarking queries[time/entry, GB/s, Ma/s, ns/d], Benchmarking construction[time/entry, GB/s, Ma/s, ns/d]
+// data_size, test_size, Benchmarking queries[GB/s, Ma/s, ns/d, mean ns/d], Benchmarking construction[GB/s, Ma/s, ns/d, mean ns/d]
 
 void writeStat2(FILE *filename)
 {
@@ -91,6 +97,7 @@ int main(int argc, char **argv)
   }
   else
   {
+    memprofile.begin(LOAD);
     std::ifstream input(argv[1]);
     if (!input)
     {
@@ -129,6 +136,7 @@ int main(int argc, char **argv)
 
   std::vector<std::pair<bool, bool>> dataValidity(data_size, {false, false}); // original, modified
 
+  memprofile.begin(DEDUP);
   /* We are going to check for duplicates. If you have too many duplicates, something might be wrong. */
   int dup_num = 0;
   std::sort(inputs.begin(), inputs.end());
@@ -148,6 +156,7 @@ int main(int argc, char **argv)
 
   /* We are going to test our hash function to make sure that it is sane. */
 
+  memprofile.begin(HASH);
   // hashes is *temporary* and does not count in the memory budget
   std::vector<uint64_t> test_hashes(test_size), hashes(data_size), bogus_hashes(bogus_size);
   for (size_t i = 0; i < (size_t)data_size; i++)
@@ -174,7 +183,10 @@ int main(int argc, char **argv)
   }
 
   // printf("-------------- Xor - 16 Filter --------------\n");
-  XorFilter<uint64_t, uint16_t> filter_16(filter_size), filter_16_test(filter_size);
+  XorFilter<uint64_t, uint16_t> filter_16_test(filter_size);
+  results.begin("Xor", "uint64_t, uint16_t");
+  memprofile.begin(CONSTRUCT);
+  XorFilter<uint64_t, uint16_t> filter_16(filter_size);
 
   // Construction
 
@@ -208,6 +220,7 @@ int main(int argc, char **argv)
   // printf("Bogus false-positives: %zu\n", fpp);
   // printf("Bogus false-positive rate %f\n", fpp / double(query_set_bogus.size()));
 
+  memprofile.begin(QUERY);
   writeStat2(stat2);
 
   // Benchmarking queries:
@@ -219,6 +232,7 @@ int main(int argc, char **argv)
                    dataValidity[i].second = 1 - filter_16.Contain(hashes[i]);
                  } }),
                stat2);
+  memprofile.end();
 
   // Benchmarking construction speed
   pretty_print(test_hashes.size(), bytes,
@@ -67,22 +67,52 @@ void pretty_print(size_t volume, size_t bytes, // std::string name,
   // }
   // printf("\n");
 
-  fprintf(filename, ",%.2f,%.2f,%.2f", bytes / agg.fastest_elapsed_ns(), volume * 1000.0 / agg.fastest_elapsed_ns(), agg.fastest_elapsed_ns() / volume);
+  fprintf(filename, ",%.2f,%.2f,%.2f,%.2f", bytes / agg.fastest_elapsed_ns(), volume * 1000.0 / agg.fastest_elapsed_ns(), agg.fastest_elapsed_ns() / volume, agg.elapsed_ns() / volume);
+  results.timing(volume, agg);
+}
+
+// The misses per lookup of the fastest run: branch, L1D, LLC and dTLB. Empty
+// fields when the performance counters are unavailable. They go after the
+// construction timings, so that the timing columns keep their places.
+void writeMisses(size_t volume, event_aggregate agg, FILE *filename)
+{
+  if (collector.has_events())
+  {
+    fprintf(filename, ",%.3f", agg.fastest_branch_misses() / volume);
+  }
+  else
+  {
+    fprintf(filename, ",");
+  }
+  if (collector.has_cache_events())
+  {
+    fprintf(filename, ",%.3f,%.3f,%.3f", agg.fastest_l1d_misses() / volume, agg.fastest_llc_misses() / volume, agg.fastest_dtlb_misses() / volume);
+  }
+  else
+  {
+    fprintf(filename, ",,,");
+  }
 }
 
 // data size, test size, true positive, true negative, false positive, false negative, bogus size, false_pos_bogus, duplicates data
 void writeOutput(size_t tp, size_t tn, size_t fp, size_t fn, size_t fp_bogus, int dup_num, FILE *filename)
 {
   fprintf(filename, "%d,%d,%zu,%zu,%zu,%zu,%d,%zu,%d\n", data_size, test_size, tp, tn, fp, fn, bogus_size, fp_bogus, dup_num);
+  results.accuracy(tn, fp, fn, fp_bogus, bogus_size);
+  results.write();
 }
 
-// data_size, test_size, total_data_volume, average_len (bytes/name), test_volume, filter_volume, %usage(wrt to test_volume), usuage (wrt to test_size[bits / entry])
+// data_size, test_size, total_data_volume, average_len (bytes/name), test_volume, filter_volume, %usage(wrt to test_volume), usuage (wrt to test_size[bits / entry]), heap peak growth of the load, hash, dedup, construct and query phases (bytes), construct peak (bytes / entry), construct scratch (bytes), construct RSS high-water (bytes), run RSS high-water (bytes)
 void writeStat1(size_t input_volume, size_t test_volume, size_t filter_volume, FILE *filename)
 {
-  fprintf(filename, "%d,%d,%zu,%.1f,%zu,%zu,%.2f %%,%.1f\n", data_size, test_size, input_volume, double(input_volume) / data_size, test_volume, filter_volume, 100.0 * filter_volume / test_volume, 8.0 * filter_volume / test_size);
+  fprintf(filename, "%d,%d,%zu,%.1f,%zu,%zu,%.2f %%,%.1f", data_size, test_size, input_volume, double(input_volume) / data_size, test_volume, filter_volume, 100.0 * filter_volume / test_volume, 8.0 * filter_volume / test_size);
+  results.sizes(data_size, test_size, filter_volume);
+  memprofile.write_csv(filename, test_size);
+  fprintf(filename, "\n");
 }
 
-// data_size, test_size, Benchmarking queries[time/entry, GB/s, Ma/s, ns/d], Benchmarking construction[time/entry, GB/s, Ma/s, ns/d]
+// data_size, test_size, Benchmarking queries[GB/s, Ma/s, ns/d, mean ns/d], Benchmarking construction[GB/s, Ma/s, ns/d, mean ns/d], queries[bm/d, L1/d, LLC/d, TLB/d]
+// built with -DBINARY_FUSE_CONSTRUCTION_STATS, followed by the breakdown of the construction: hash, count, peel, assign, retry (ns), retries, duplicates removed, queue high-water
 
 void writeStat2(FILE *filename)
 {
@@ -114,6 +144,7 @@ int main(int argc, char **argv)
   }
   else
   {
+    memprofile.begin(LOAD);
     std::ifstream input(argv[1]);
     if (!input)
     {
@@ -152,6 +183,7 @@ int main(int argc, char **argv)
 
   std::vector<std::pair<bool, bool>> dataValidity(data_size, {false, false}); // original, modified
 
+  memprofile.begin(DEDUP);
   /* We are going to check for duplicates. If you have too many duplicates, something might be wrong. */
   int dup_num = 0;
   std::sort(inputs.begin(), inputs.end());
@@ -171,6 +203,7 @@ int main(int argc, char **argv)
 
   /* We are going to test our hash function to make sure that it is sane. */
 
+  memprofile.begin(HASH);
   // hashes is *temporary* and does not count in the memory budget
   std::vector<uint64_t> test_hashes(test_size), hashes(data_size), bogus_hashes(bogus_size);
   for (size_t i = 0; i < (size_t)data_size; i++)
@@ -443,7 +476,10 @@ int main(int argc, char **argv)
 
   // printf("-------------- Binary Fuse - 32 Filter --------------\n");
 
-  BinaryFuseFilter<uint64_t, uint48_t> bf_48(size), bf_48_test(size);
+  BinaryFuseFilter<uint64_t, uint48_t> bf_48_test(size);
+  results.begin("Binary Fuse", "uint64_t, uint48_t");
+  memprofile.begin(CONSTRUCT);
+  BinaryFuseFilter<uint64_t, uint48_t> bf_48(size);
 
   // Construction:
   is_ok = bf_48.Populate(test_hashes.data(), size);
@@ -476,23 +512,28 @@ int main(int argc, char **argv)
   // printf("Bogus false-positives: %zu\n", fp_bogus);
   // printf("Bogus false-positive rate %f\n", fp_bogus / double(query_set_bogus.size()));
 
+  memprofile.begin(QUERY);
   writeStat2(stat2);
 
   // Benchmarking queries:
-  pretty_print(inputs.size(), bytes,
-               bench([&hashes, &bf_48, &dataValidity]()
-                     {
+  const event_aggregate queries = bench([&hashes, &bf_48, &dataValidity]()
+                                        {
                  for (int i = 0; i < data_size; i++)
                  {
                    dataValidity[i].second = bf_48.Contain(hashes[i]);
-                 } }),
-               stat2);
+                 } });
+  pretty_print(inputs.size(), bytes, queries, stat2);
+  memprofile.end();
 
   // Benchmarking construction speed
   pretty_print(test_hashes.size(), bytes,
                bench([&test_hashes, &bf_48_test, &size]()
                      { bf_48_test.Populate(test_hashes.data(), size); }),
                stat2);
+  writeMisses(inputs.size(), queries, stat2);
+#ifdef BINARY_FUSE_CONSTRUCTION_STATS
+  bf_48.GetConstructionStats().write_csv(stat2);
+#endif
 
   fprintf(stat2, "\n");
 
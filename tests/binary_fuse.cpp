@@ -62,22 +62,28 @@ void pretty_print(size_t volume, size_t bytes, // std::string name,
   // }
   // printf("\n");
 
-  fprintf(filename, ",%.2f,%.2f,%.2f", bytes / agg.fastest_elapsed_ns(), volume * 1000.0 / agg.fastest_elapsed_ns(), agg.fastest_elapsed_ns() / volume);
+  fprintf(filename, ",%.2f,%.2f,%.2f,%.2f", bytes / agg.fastest_elapsed_ns(), volume * 1000.0 / agg.fastest_elapsed_ns(), agg.fastest_elapsed_ns() / volume, agg.elapsed_ns() / volume);
+  results.timing(volume, agg);
 }
 
 // data size, test size, true positive, true negative, false positive, false negative, bogus size, false_pos_bogus, duplicates data
 void writeOutput(size_t tp, size_t tn, size_t fp, size_t fn, size_t fp_bogus, int dup_num, FILE *filename)
 {
   fprintf(filename, "%d,%d,%zu,%zu,%zu,%zu,%d,%zu,%d\n", data_size, test_size, tp, tn, fp, fn, bogus_size, fp_bogus, dup_num);
+  results.accuracy(tn, fp, fn, fp_bogus, bogus_size);
+  results.write();
 }
 
-// data_size, test_size, total_data_volume, average_len (bytes/name), test_volume, filter_volume, %usage(wrt to test_volume), usuage (wrt to test_size[bits / entry])
+// data_size, test_size, total_data_volume, average_len (bytes/name), test_volume, filter_volume, %usage(wrt to test_volume), usuage (wrt to test_size[bits / entry]), heap peak growth of the load, hash, dedup, construct and query phases (bytes), construct peak (bytes / entry), construct scratch (bytes), construct RSS high-water (bytes), run RSS high-water (bytes)
 void writeStat1(size_t input_volume, size_t test_volume, size_t filter_volume, FILE *filename)
 {
-  fprintf(filename, "%d,%d,%zu,%.1f,%zu,%zu,%.2f %%,%.1f\n", data_size, test_size, input_volume, double(input_volume) / data_size, test_volume, filter_volume, 100.0 * filter_volume / test_volume, 8.0 * filter_volume / test_size);
+  fprintf(filename, "%d,%d,%zu,%.1f,%zu,%zu,%.2f %%,%.1f", data_size, test_size, input_volume, double(input_volume) / data_size, test_volume, filter_volume, 100.0 * filter_volume / test_volume, 8.0 * filter_volume / test_size);
+  results.sizes(data_size, test_size, filter_volume);
+  memprofile.write_csv(filename, test_size);
+  fprintf(filename, "\n");
 }
 
-// data_size, test_size, Benchmarking queries[time/entry, GB/s, Ma/s, ns/d], Benchmarking construction[time/entry, GB/s, Ma/s, ns/d]
+// data_size, test_size, Benchmarking queries[GB/s, Ma/s, ns/d, mean ns/d], Benchmarking construction[GB/s, Ma/s, ns/d, mean ns/d]
 
 void writeStat2(FILE *filename)
 {
@@ -109,6 +115,7 @@ int main(int argc, char **argv)
   }
   else
   {
+    memprofile.begin(LOAD);
     std::ifstream input(argv[1]);
     if (!input)
     {
@@ -147,6 +154,7 @@ int main(int argc, char **argv)
 
   std::vector<std::pair<bool, bool>> dataValidity(data_size, {false, false}); // original, modified
 
+  memprofile.begin(DEDUP);
   /* We are going to check for duplicates. If you have too many duplicates, something might be wrong. */
   int dup_num = 0;
   std::sort(inputs.begin(), inputs.end());
@@ -166,6 +174,7 @@ int main(int argc, char **argv)
 
   /* We are going to test our hash function to make sure that it is sane. */
 
+  memprofile.begin(HASH);
   // hashes is *temporary* and does not count in the memory budget
   std::vector<uint64_t> test_hashes(test_size), hashes(data_size), bogus_hashes(bogus_size);
   for (size_t i = 0; i < (size_t)data_size; i++)
@@ -437,6 +446,8 @@ int main(int argc, char **argv)
   // }
 
   // printf("-------------- Binary Fuse - 32 Filter --------------\n");
+  results.begin("binary_fuse32 (single header)", "");
+  memprofile.begin(CONSTRUCT);
   binary_fuse32_t filter2;
   // Memory allocation (trivial):
   is_ok = binary_fuse32_allocate(size, &filter2);
@@ -476,6 +487,7 @@ int main(int argc, char **argv)
   // printf("Bogus false-positives: %zu\n", fp_bogus);
   // printf("Bogus false-positive rate %f\n", fp_bogus / double(query_set_bogus.size()));
 
+  memprofile.begin(QUERY);
   writeStat2(stat2);
 
   // Benchmarking queries:
@@ -487,6 +499,7 @@ int main(int argc, char **argv)
                    dataValidity[i].second = binary_fuse32_contain(hashes[i], &filter2);
                  } }),
                stat2);
+  memprofile.end();
 
   // Benchmarking construction speed
   pretty_print(test_hashes.size(), bytes,
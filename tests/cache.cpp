@@ -0,0 +1,236 @@
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <stdlib.h>
+#include <string>
+#include <thread>
+#include <vector>
+#include "filterapi.h"
+#include "performancecounters/cold_cache.h"
+#include "verdict_cache.h"
+#include "workload.h"
+#include "test_util.h"
+
+// A verdict cache in front of a filter under skewed traffic (see
+// src/verdict_cache.h and src/workload.h).
+//
+// usage: ./cache urls.txt test_size [zipf_s] [positive_ratio] [threads] [queries] [filter]
+//
+// The filter holds the first test_size URLs (then random keys); the stream
+// draws Zipf-distributed positives from them and negatives from as many
+// random keys, or as many as there are queries if fewer (defaults: zipf
+// 0.99, half positive, 10 * test_size queries, at most 20M). Only positives
+// are cached, so the positive ratio bounds the hit rate.
+// The cache only pays when the filter is out of the CPU caches: make
+// test_size large enough for the filter to be several times the LLC, whose
+// size is printed. Reported, for the filter alone and behind caches of 4K,
+// 16K and 64K entries:
+//
+//   ns/q       per query, single thread, whole stream: one at a time, and
+//              with ContainMany in batches of 256
+//   hit rate   share of queries answered by the cache
+//   admitted   keys put in the cache, per 1000 queries
+//   hit, miss  latency of the cached lookups, by outcome, sampled in a
+//              separate pass
+//
+// and with `threads` threads (default 4) replaying the stream from different
+// offsets, each with its own cache: Mq/s without and with the cache. Every
+// cached verdict is checked against the filter's. Naming a filter
+// (BinaryFuse8_4wise, Xor8 or BlockedBloom) measures that one only: at a few
+// hundred million keys the others take too much memory to build.
+
+volatile size_t sink = 0;
+
+double since(std::chrono::steady_clock::time_point start)
+{
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Each thread replays the whole stream, from its own offset; returns Mq/s.
+template <typename Lookup>
+double threaded(size_t threads, const std::vector<uint64_t> &queries, Lookup make_lookup)
+{
+  std::vector<std::thread> pool;
+  std::vector<size_t> found(threads);
+  const auto start = std::chrono::steady_clock::now();
+  for (size_t t = 0; t < threads; t++)
+  {
+    pool.emplace_back([&, t]()
+                      {
+      auto lookup = make_lookup(t);
+      const size_t n = queries.size(), offset = t * n / threads;
+      size_t f = 0;
+      for (size_t i = 0; i < n; i++) {
+        f += lookup(queries[(offset + i) % n]);
+      }
+      found[t] = f; });
+  }
+  for (std::thread &t : pool)
+  {
+    t.join();
+  }
+  const double seconds = since(start);
+  for (size_t f : found)
+  {
+    sink += f;
+  }
+  return threads * queries.size() / seconds / 1e6;
+}
+
+template <typename Table>
+void measure(const std::string &name, const std::vector<uint64_t> &keys,
+             const workload::Workload &w, size_t threads)
+{
+  std::unique_ptr<Table> table(new Table(FilterAPI<Table>::ConstructFromAddCount(keys.size())));
+  FilterAPI<Table>::AddAll(keys, 0, keys.size(), table.get());
+  const std::vector<uint64_t> &queries = w.queries;
+  std::vector<uint8_t> expected(queries.size());
+
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < queries.size(); i++)
+  {
+    expected[i] = FilterAPI<Table>::Contain(queries[i], table.get());
+  }
+  const double single_ns = since(start) * 1e9 / queries.size();
+  const size_t llc = last_level_cache_bytes();
+  if (llc != 0)
+  {
+    printf("%s: %.1f MB, %.1fx the LLC\n", name.c_str(), table->SizeInBytes() / 1e6,
+           double(table->SizeInBytes()) / llc);
+  }
+  else
+  {
+    printf("%s: %.1f MB\n", name.c_str(), table->SizeInBytes() / 1e6);
+  }
+  const size_t batch = 256;
+  uint64_t bitmap[batch / 64];
+  size_t wrong = 0;
+  start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < queries.size(); i += batch)
+  {
+    ContainMany(queries.data() + i, std::min(batch, queries.size() - i), table.get(), bitmap);
+    sink += bitmap[0];
+  }
+  printf("  %-21s %6.2f ns/q %6.2f ns/q batched\n", "no cache", single_ns,
+         since(start) * 1e9 / queries.size());
+
+  for (size_t entries : {size_t(1) << 12, size_t(1) << 14, size_t(1) << 16})
+  {
+    typename VerdictCache<Table>::Options options;
+    options.entries = entries;
+    VerdictCache<Table> cache(table.get(), options);
+    start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < queries.size(); i++)
+    {
+      wrong += cache.Contain(queries[i]) != expected[i];
+    }
+    const double ns = since(start) * 1e9 / queries.size();
+    const auto s = cache.stats();
+
+    VerdictCache<Table> batched(table.get(), options);
+    start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < queries.size(); i += batch)
+    {
+      const size_t n = std::min(batch, queries.size() - i);
+      ContainMany(queries.data() + i, n, &batched, bitmap);
+      for (size_t j = 0; j < n; j++)
+      {
+        wrong += ((bitmap[j / 64] >> (j % 64)) & 1) != expected[i + j];
+      }
+    }
+    const double batched_ns = since(start) * 1e9 / queries.size();
+
+    options.sample_every = 64;
+    VerdictCache<Table> sampled(table.get(), options);
+    for (uint64_t q : queries)
+    {
+      sink += sampled.Contain(q);
+    }
+    const auto t = sampled.stats();
+    printf("  %3zuK entries %4zu KB %6.2f ns/q %6.2f ns/q batched  hit rate %5.1f%%  "
+           "admitted %5.2f/1000  hit %5.1f ns  miss %6.1f ns\n",
+           cache.Entries() >> 10, cache.SizeInBytes() >> 10, ns, batched_ns,
+           100 * s.HitRate(), 1000.0 * s.admitted / queries.size(), t.MeanHitNs(),
+           t.MeanMissNs());
+  }
+  if (wrong != 0)
+  {
+    printf("  %zu wrong verdicts\n", wrong);
+  }
+
+  Table *tp = table.get();
+  const double plain = threaded(threads, queries, [tp](size_t)
+                                { return [tp](uint64_t k)
+                                  { return FilterAPI<Table>::Contain(k, tp); }; });
+  std::vector<std::unique_ptr<VerdictCache<Table>>> own(threads);
+  const double per_thread = threaded(threads, queries, [&](size_t i)
+                                     {
+    own[i].reset(new VerdictCache<Table>(tp));
+    VerdictCache<Table> *c = own[i].get();
+    return [c](uint64_t k) { return c->Contain(k); }; });
+  typename VerdictCache<Table>::Stats total;
+  for (const auto &c : own)
+  {
+    total += c->stats();
+  }
+  printf("  %zu threads: %.1f Mq/s without cache, %.1f Mq/s with a cache per thread "
+         "(hit rate %.1f%%)\n",
+         threads, plain, per_thread, 100 * total.HitRate());
+}
+
+int main(int argc, char **argv)
+{
+  if (argc < 3)
+  {
+    printf("usage: %s urls.txt test_size [zipf_s] [positive_ratio] [threads] [queries] [filter]\n",
+           argv[0]);
+    return EXIT_FAILURE;
+  }
+  std::ifstream input(argv[1]);
+  if (!input)
+  {
+    std::cerr << "Could not open " << argv[1] << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  const size_t test_size = atoll(argv[2]);
+
+  std::vector<uint64_t> keys = testutil::load_keys(input, test_size);
+  workload::WorkloadConfig config;
+  config.queries = std::min<size_t>(10 * keys.size(), 20000000);
+  if (argc > 3) { config.zipf_s = atof(argv[3]); }
+  if (argc > 4) { config.positive_ratio = atof(argv[4]); }
+  const size_t threads = argc > 5 ? std::max(1ll, atoll(argv[5])) : 4;
+  if (argc > 6) { config.queries = atoll(argv[6]); }
+  // no more negatives than queries, which keeps big key sets in memory
+  std::vector<uint64_t> negatives(std::min(keys.size(), config.queries));
+  uint64_t negative_state = 5678;
+  for (uint64_t &n : negatives)
+  {
+    n = testutil::splitmix64(&negative_state);
+  }
+
+  const workload::Workload w = workload::GenerateWorkload(keys, negatives, config);
+
+  printf("%zu keys\n", keys.size());
+  config.print();
+  auto wanted = [&](const std::string &name)
+  { return argc <= 7 || name == argv[7]; };
+  if (wanted("BinaryFuse8_4wise"))
+  {
+    measure<xorbinaryfusefilter_lowmem4wise::XorBinaryFuseFilter<uint64_t, uint8_t>>(
+        "BinaryFuse8_4wise", keys, w, threads);
+  }
+  if (wanted("Xor8"))
+  {
+    measure<XorFilter<uint64_t, uint8_t>>("Xor8", keys, w, threads);
+  }
+#if CPUDISPATCH_X86 || defined(__aarch64__)
+  if (wanted("BlockedBloom"))
+  {
+    measure<SimdBlockFilterFixed<>>("BlockedBloom", keys, w, threads);
+  }
+#endif
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,155 @@
+#include "performancecounters/benchmarker.h"
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <stdlib.h>
+#include <vector>
+#include "filterapi.h"
+#include "test_util.h"
+
+// Lookup cost once the filter no longer sits in cache.
+//
+// usage: ./cold urls.txt test_size [footprint_mb] [repeat]
+//
+// test_size keys are taken from the URLs; if the file has fewer distinct
+// URLs, the rest are random 64-bit keys, so filters of 100M+ keys can be built
+// from any list. Each filter is measured three ways on the same mixed stream
+// of positive and negative queries:
+//
+//   warm    the query loop of the other drivers: fastest of repeated runs
+//   cold    caches flushed and queries reshuffled before every run
+//   spread  as cold, but every query goes to a random one of as many filter
+//           instances as it takes to fill footprint_mb (default: 4 x LLC),
+//           i.e. the DRAM-bound cost of a filter much larger than the LLC
+
+void pretty_print(size_t volume, std::string name, event_aggregate agg)
+{
+  printf("%-36s : ", name.c_str());
+  printf(" %7.2f ns/q ", agg.fastest_elapsed_ns() / volume);
+  printf(" %7.2f avg ns/q ", agg.elapsed_ns() / volume);
+  if (collector.has_events())
+  {
+    printf(" %6.2f c/q ", agg.fastest_cycles() / volume);
+    printf(" %5.3f bm/q ", agg.fastest_branch_misses() / volume);
+  }
+  if (collector.has_cache_events())
+  {
+    printf(" %5.3f L1/q ", agg.fastest_l1d_misses() / volume);
+    printf(" %5.3f LLC/q ", agg.fastest_llc_misses() / volume);
+    printf(" %5.3f TLB/q ", agg.fastest_dtlb_misses() / volume);
+  }
+  printf("\n");
+}
+
+volatile size_t sink = 0;
+
+template <typename Table>
+void measure(const std::string &name, const std::vector<uint64_t> &keys,
+             std::vector<uint64_t> queries, size_t footprint, size_t repeat,
+             cache_flusher &flusher)
+{
+  std::vector<std::unique_ptr<Table>> tables;
+  tables.emplace_back(new Table(FilterAPI<Table>::ConstructFromAddCount(keys.size())));
+  FilterAPI<Table>::AddAll(keys, 0, keys.size(), tables[0].get());
+  const size_t bytes = tables[0]->SizeInBytes();
+  const size_t instances = std::max<size_t>(1, (footprint + bytes - 1) / bytes);
+  for (size_t t = 1; t < instances; t++)
+  {
+    tables.emplace_back(new Table(FilterAPI<Table>::ConstructFromAddCount(keys.size())));
+    FilterAPI<Table>::AddAll(keys, 0, keys.size(), tables[t].get());
+  }
+  printf("%s: %.1f MB per filter, %zu instances (%.1f MB)\n", name.c_str(),
+         bytes / 1e6, instances, instances * bytes / 1e6);
+
+  std::mt19937_64 rng(1234);
+  std::vector<uint32_t> instance(queries.size());
+  size_t found = 0;
+  Table *table = tables[0].get();
+  auto one = [&]()
+  {
+    for (uint64_t q : queries)
+    {
+      found += FilterAPI<Table>::Contain(q, table);
+    }
+  };
+  auto reshuffle = [&]()
+  {
+    std::shuffle(queries.begin(), queries.end(), rng);
+  };
+  auto spread = [&]()
+  {
+    for (size_t i = 0; i < queries.size(); i++)
+    {
+      found += FilterAPI<Table>::Contain(queries[i], tables[instance[i]].get());
+    }
+  };
+  auto redistribute = [&]()
+  {
+    reshuffle();
+    std::uniform_int_distribution<uint32_t> pick(0, uint32_t(instances - 1));
+    for (uint32_t &i : instance)
+    {
+      i = pick(rng);
+    }
+  };
+  pretty_print(queries.size(), name + " warm", bench(one, repeat));
+  pretty_print(queries.size(), name + " cold",
+               bench_cold(one, reshuffle, flusher, repeat));
+  pretty_print(queries.size(), name + " spread",
+               bench_cold(spread, redistribute, flusher, repeat));
+  sink += found;
+}
+
+int main(int argc, char **argv)
+{
+  if (argc < 3)
+  {
+    printf("usage: %s urls.txt test_size [footprint_mb] [repeat]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+  std::ifstream input(argv[1]);
+  if (!input)
+  {
+    std::cerr << "Could not open " << argv[1] << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  const size_t test_size = atoll(argv[2]);
+  const size_t llc = last_level_cache_bytes();
+  const size_t footprint = argc > 3 ? size_t(atoll(argv[3])) << 20
+                                    : (llc ? 4 * llc : size_t(256) << 20);
+  const size_t repeat = argc > 4 ? atoll(argv[4]) : 5;
+
+  std::vector<uint64_t> keys = testutil::read_keys(input, test_size);
+  const size_t from_file = keys.size();
+  testutil::pad_keys(&keys, test_size);
+
+  // half positives, half negatives, at most 4M queries
+  const size_t half = std::min<size_t>(keys.size(), size_t(2) << 20);
+  std::vector<uint64_t> queries(keys.begin(), keys.begin() + half);
+  uint64_t negative_state = 5678;
+  for (size_t i = 0; i < half; i++)
+  {
+    queries.push_back(testutil::splitmix64(&negative_state));
+  }
+
+  cache_flusher flusher;
+  printf("%zu keys (%zu from %s), %zu queries, LLC %.1f MB, flush %.1f MB, "
+         "footprint %.1f MB\n",
+         keys.size(), from_file, argv[1], queries.size(), llc / 1e6,
+         flusher.buffer.size() / 1e6, footprint / 1e6);
+  measure<XorFilter<uint64_t, uint8_t>>("Xor8", keys, queries, footprint,
+                                        repeat, flusher);
+  measure<xorbinaryfusefilter_lowmem4wise::XorBinaryFuseFilter<uint64_t, uint8_t>>(
+      "BinaryFuse8_4wise", keys, queries, footprint, repeat, flusher);
+  measure<CuckooFilter<uint64_t, 12>>("Cuckoo12", keys, queries, footprint,
+                                      repeat, flusher);
+  measure<BloomFilter<uint64_t, 12, false>>("Bloom12", keys, queries,
+                                            footprint, repeat, flusher);
+#if CPUDISPATCH_X86 || defined(__aarch64__)
+  measure<SimdBlockFilterFixed<>>("BlockedBloom", keys, queries, footprint,
+                                  repeat, flusher);
+#endif
+  return EXIT_SUCCESS;
+}
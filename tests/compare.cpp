@@ -0,0 +1,259 @@
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <stdlib.h>
+#include <string>
+#include <tuple>
+#include <vector>
+
+// Regression gate: compares a candidate run of the stat drivers against a
+// baseline run.
+//
+// usage: ./compare baseline_dir candidate_dir [--lookup pct]
+//                  [--construction pct] [--bits pct]
+//
+// Each directory holds the stat1.csv and stat2.csv of one script.sh pass (the
+// files the drivers append to). Rows are matched on filter name -- the
+// preceding line holding only a name, if any -- data size, test size and,
+// for drivers that write one row per filter, their position among the rows
+// with the same name and sizes. Compared per matched row:
+//
+//   lookup ns/key        stat2, fastest query time per key
+//   construction ns/key  stat2, fastest construction time per key
+//   bits/entry           stat1
+//
+// A time counts as noisy to the extent the mean of bench()'s iterations is
+// above the fastest (the "mean ns/d" columns; rows written before they
+// existed have no estimate). A metric regresses when it grows by more than
+// its threshold (default 5% lookup, 10% construction, 0.5% bits/entry) plus
+// the larger noise of the two runs. The exit status is 1 if any metric
+// regressed, 2 on bad input, 0 otherwise.
+
+enum metric
+{
+  LOOKUP,
+  CONSTRUCTION,
+  BITS,
+  NUM_METRICS
+};
+
+const char *metric_names[NUM_METRICS] = {"lookup ns/key", "construction ns/key",
+                                         "bits/entry"};
+
+struct sample
+{
+  double value = 0;
+  // relative, (mean - fastest) / fastest
+  double noise = 0;
+  bool present = false;
+};
+
+// name, data size, test size, occurrence
+typedef std::tuple<std::string, long, long, int> row_key;
+typedef std::map<row_key, std::vector<sample>> run;
+
+std::vector<std::string> split(const std::string &line)
+{
+  std::vector<std::string> fields;
+  std::stringstream ss(line);
+  for (std::string field; std::getline(ss, field, ',');)
+  {
+    fields.push_back(field);
+  }
+  return fields;
+}
+
+bool is_number(const std::string &s)
+{
+  char *end = nullptr;
+  strtod(s.c_str(), &end);
+  return !s.empty() && end != s.c_str();
+}
+
+// Calls row(key, fields) for every data row of the file; false if it cannot
+// be read.
+template <typename Row>
+bool read_rows(const std::string &path, const Row &row)
+{
+  std::ifstream input(path);
+  if (!input)
+  {
+    return false;
+  }
+  std::string name;
+  std::map<std::tuple<std::string, long, long>, int> seen;
+  for (std::string line; std::getline(input, line);)
+  {
+    line.erase(std::find_if(line.rbegin(), line.rend(),
+                            [](unsigned char ch)
+                            { return !std::isspace(ch); })
+                   .base(),
+               line.end());
+    if (line.empty())
+    {
+      continue;
+    }
+    std::vector<std::string> fields = split(line);
+    if (fields.size() == 1 && !is_number(fields[0]))
+    {
+      name = fields[0];
+      continue;
+    }
+    if (fields.size() < 3 || !is_number(fields[0]) || !is_number(fields[1]))
+    {
+      // header
+      continue;
+    }
+    const long data_size = atol(fields[0].c_str());
+    const long test_size = atol(fields[1].c_str());
+    const int occurrence = seen[std::make_tuple(name, data_size, test_size)]++;
+    row(row_key(name, data_size, test_size, occurrence), fields);
+  }
+  return true;
+}
+
+sample time_sample(const std::vector<std::string> &fields, size_t fastest,
+                   size_t mean)
+{
+  sample s;
+  if (fastest < fields.size())
+  {
+    s.value = atof(fields[fastest].c_str());
+    s.present = s.value > 0;
+  }
+  if (s.present && mean < fields.size())
+  {
+    s.noise = std::max(0.0, atof(fields[mean].c_str()) / s.value - 1);
+  }
+  return s;
+}
+
+bool load(const std::string &dir, run *r)
+{
+  // data_size, test_size, query GB/s, Ma/s, ns/d, mean ns/d, construction
+  // GB/s, Ma/s, ns/d, mean ns/d. Before the mean columns were added the rows
+  // had 8 fields: the construction ns/d was the 8th.
+  const bool has_stat2 = read_rows(dir + "/stat2.csv", [&](const row_key &key, const std::vector<std::string> &fields)
+                                   {
+    std::vector<sample> &samples = (*r)[key];
+    samples.resize(NUM_METRICS);
+    if (fields.size() == 8) {
+      samples[LOOKUP] = time_sample(fields, 4, fields.size());
+      samples[CONSTRUCTION] = time_sample(fields, 7, fields.size());
+    } else {
+      samples[LOOKUP] = time_sample(fields, 4, 5);
+      samples[CONSTRUCTION] = time_sample(fields, 8, 9);
+    } });
+  // data_size, test_size, input volume, average length, test volume, filter
+  // volume, % usage, bits/entry, ...
+  read_rows(dir + "/stat1.csv", [&](const row_key &key, const std::vector<std::string> &fields)
+            {
+    std::vector<sample> &samples = (*r)[key];
+    samples.resize(NUM_METRICS);
+    if (fields.size() > 7 && is_number(fields[7])) {
+      samples[BITS].value = atof(fields[7].c_str());
+      samples[BITS].present = true;
+    } });
+  return has_stat2;
+}
+
+int main(int argc, char **argv)
+{
+  if (argc < 3)
+  {
+    printf("usage: %s baseline_dir candidate_dir [--lookup pct] "
+           "[--construction pct] [--bits pct]\n",
+           argv[0]);
+    return 2;
+  }
+  double threshold[NUM_METRICS] = {5, 10, 0.5};
+  for (int i = 3; i + 1 < argc; i += 2)
+  {
+    const std::string option = argv[i];
+    if (option == "--lookup")
+    {
+      threshold[LOOKUP] = atof(argv[i + 1]);
+    }
+    else if (option == "--construction")
+    {
+      threshold[CONSTRUCTION] = atof(argv[i + 1]);
+    }
+    else if (option == "--bits")
+    {
+      threshold[BITS] = atof(argv[i + 1]);
+    }
+    else
+    {
+      std::cerr << "unknown option " << option << std::endl;
+      return 2;
+    }
+  }
+  run baseline, candidate;
+  for (auto &side : {std::make_pair(argv[1], &baseline), std::make_pair(argv[2], &candidate)})
+  {
+    if (!load(side.first, side.second))
+    {
+      std::cerr << "Could not open " << side.first << "/stat2.csv" << std::endl;
+      return 2;
+    }
+  }
+
+  size_t matched = 0, unmatched = 0, regressions = 0, improvements = 0;
+  printf("%-24s %9s %9s %-20s %10s %10s %8s %7s\n", "filter", "data", "test",
+         "metric", "baseline", "candidate", "change", "noise");
+  for (const auto &entry : baseline)
+  {
+    auto other = candidate.find(entry.first);
+    if (other == candidate.end())
+    {
+      unmatched++;
+      continue;
+    }
+    matched++;
+    const row_key &key = entry.first;
+    for (int m = 0; m < NUM_METRICS; m++)
+    {
+      const sample &b = entry.second[m];
+      const sample &c = other->second[m];
+      if (!b.present || !c.present)
+      {
+        continue;
+      }
+      const double change = 100 * (c.value / b.value - 1);
+      const double noise = 100 * std::max(b.noise, c.noise);
+      const char *verdict = "";
+      if (change > threshold[m] + noise)
+      {
+        verdict = "REGRESSION";
+        regressions++;
+      }
+      else if (-change > threshold[m] + noise)
+      {
+        verdict = "improved";
+        improvements++;
+      }
+      if (*verdict == 0)
+      {
+        continue;
+      }
+      const std::string &name = std::get<0>(key);
+      printf("%-24s %9ld %9ld %-20s %10.2f %10.2f %+7.1f%% %6.1f%% %s\n",
+             name.empty() ? ("#" + std::to_string(std::get<3>(key))).c_str()
+                          : name.c_str(),
+             std::get<1>(key), std::get<2>(key), metric_names[m], b.value,
+             c.value, change, noise, verdict);
+    }
+  }
+  for (const auto &entry : candidate)
+  {
+    unmatched += baseline.count(entry.first) == 0;
+  }
+  printf("%zu rows matched, %zu unmatched; %zu regressions, %zu improvements "
+         "(thresholds: lookup %.1f%%, construction %.1f%%, bits/entry %.1f%%)\n",
+         matched, unmatched, regressions, improvements, threshold[LOOKUP],
+         threshold[CONSTRUCTION], threshold[BITS]);
+  return regressions > 0 ? 1 : 0;
+}
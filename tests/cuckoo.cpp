@@ -33,22 +33,28 @@ std::string random_string()
 void pretty_print(size_t input_volume, size_t bytes, // std::string name,
                   event_aggregate agg, FILE *filename)
 {
-  fprintf(filename, ",%.2f,%.2f,%.2f", bytes / agg.fastest_elapsed_ns(), input_volume * 1000.0 / agg.fastest_elapsed_ns(), agg.fastest_elapsed_ns() / input_volume);
+  fprintf(filename, ",%.2f,%.2f,%.2f,%.2f", bytes / agg.fastest_elapsed_ns(), input_volume * 1000.0 / agg.fastest_elapsed_ns(), agg.fastest_elapsed_ns() / input_volume, agg.elapsed_ns() / input_volume);
+  results.timing(input_volume, agg);
 }
 
 // data size, test size, true positive, true negative, false positive, false negative, bogus size, false_pos_bogus, duplicates data
 void writeOutput(size_t tp, size_t tn, size_t fp, size_t fn, size_t fp_bogus, int dup_num, FILE *filename)
 {
   fprintf(filename, "%d,%d,%zu,%zu,%zu,%zu,%d,%zu,%d\n", data_size, test_size, tp, tn, fp, fn, bogus_size, fp_bogus, dup_num);
+  results.accuracy(tn, fp, fn, fp_bogus, bogus_size);
+  results.write();
 }
 
-// data_size, test_size, average_len (bytes/name), total_data_input_volume, test_input_volume, filter_volume, %usage(wrt to test_input_volume), usuage (wrt to test_size[bits / entry])
+// data_size, test_size, average_len (bytes/name), total_data_input_volume, test_input_volume, filter_volume, %usage(wrt to test_input_volume), usuage (wrt to test_size[bits / entry]), heap peak growth of the load, hash, dedup, construct and query phases (bytes), construct peak (bytes / entry), construct scratch (bytes), construct RSS high-water (bytes), run RSS high-water (bytes)
 void writeStat1(size_t input_input_volume, size_t test_input_volume, size_t filter_volume, FILE *filename)
 {
-  fprintf(filename, "%d,%d,%zu,%.1f,%zu,%zu,%.2f %%,%.1f\n", data_size, test_size, input_input_volume, double(input_input_volume) / data_size, test_input_volume, filter_volume, 100.0 * filter_volume / test_input_volume, 8.0 * filter_volume / test_size);
+  fprintf(filename, "%d,%d,%zu,%.1f,%zu,%zu,%.2f %%,%.1f", data_size, test_size, input_input_volume, double(input_input_volume) / data_size, test_input_volume, filter_volume, 100.0 * filter_volume / test_input_volume, 8.0 * filter_volume / test_size);
+  results.sizes(data_size, test_size, filter_volume);
+  memprofile.write_csv(filename, test_size);
+  fprintf(filename, "\n");
 }
 
-// data_size, test_size, Benchmarking queries[time/entry, GB/s, Ma/s, ns/d], Benchmarking construction[time/entry, GB/s, Ma/s, ns/d]
+// data_size, test_size, Benchmarking queries[GB/s, Ma/s, ns/d, mean ns/d], Benchmarking construction[GB/s, Ma/s, ns/d, mean ns/d]
 void writeStat2(FILE *filename)
 {
   fprintf(filename, "%d,%d", data_size, test_size);
@@ -88,6 +94,7 @@ int main(int argc, char **argv)
   }
   else
   {
+    memprofile.begin(LOAD);
     std::ifstream input(argv[1]);
     if (!input)
     {
@@ -129,6 +136,7 @@ int main(int argc, char **argv)
 
   /* We are going to check for duplicates. If you have too many duplicates, something might be wrong. */
 
+  memprofile.begin(DEDUP);
   int dup_num = 0;
   std::sort(inputs.begin(), inputs.end());
   auto dup_str = std::adjacent_find(inputs.begin(), inputs.end());
@@ -145,6 +153,7 @@ int main(int argc, char **argv)
   // printf("total volume %zu bytes\n", bytes);
   /* We are going to test our hash function to make sure that it is sane. */
 
+  memprofile.begin(HASH);
   // hashes is *temporary* and does not count in the memory budget
   std::vector<uint64_t> test_hashes(test_size), hashes(data_size), bogus_hashes(bogus_size);
   for (size_t i = 0; i < data_size; i++)
@@ -466,7 +475,10 @@ int main(int argc, char **argv)
 
   // writeOutput(truePositive, trueNegative, falsePositive, falseNegative, fp_bogus, dup_num, data_reliability);
 
-  CuckooFilterStable<uint64_t, 24> fuse_24(data_size), fuse_24_test(data_size);
+  CuckooFilterStable<uint64_t, 24> fuse_24_test(data_size);
+  results.begin("Cuckoo Stable", "uint64_t, 24");
+  memprofile.begin(CONSTRUCT);
+  CuckooFilterStable<uint64_t, 24> fuse_24(data_size);
 
   // Construction
   for (int i = 0; i < test_size; i++)
@@ -497,6 +509,7 @@ int main(int argc, char **argv)
   // printf("Bogus false-positive rate %f\n", fpp / double(query_set_bogus.size()));
 
   // printf("Benchmarking queries:\n");
+  memprofile.begin(QUERY);
   writeStat2(stat2);
 
   // printf("Benchmarking queries:\n");
@@ -509,6 +522,7 @@ int main(int argc, char **argv)
                    dataValidity[i].second = fuse_24.Contain(hashes[i]);
                  } }),
                stat2);
+  memprofile.end();
 
   // printf("Benchmarking construction speed\n");
   pretty_print(test_hashes.size(), bytes,
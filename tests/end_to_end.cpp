@@ -0,0 +1,163 @@
+#include "performancecounters/benchmarker.h"
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#include "filterapi.h"
+#include "url.h"
+
+// URL-string-to-verdict throughput, broken down per stage.
+//
+// usage: ./end_to_end urls.txt test_size
+//
+// The first test_size URLs, normalized and hashed, are added to each filter;
+// every URL of the file is then queried. The stages of the path a proxy runs
+// are timed separately and together:
+//
+//   normalize   raw URL -> canonical form (src/url.h)
+//   hash        canonical form -> 64-bit key
+//   contain     key -> filter answer (what the other drivers measure)
+//   end-to-end  raw URL -> normalize -> hash -> contain -> verdict
+//
+// GB/s is always computed over the raw URL bytes, so the figures of the
+// stages are directly comparable with the end-to-end one.
+
+volatile size_t sink = 0;
+
+void pretty_print(size_t volume, size_t bytes, std::string name,
+                  event_aggregate agg)
+{
+  printf("%-30s : ", name.c_str());
+  printf(" %5.2f GB/s ", bytes / agg.fastest_elapsed_ns());
+  printf(" %5.1f Mu/s ", volume * 1000.0 / agg.fastest_elapsed_ns());
+  printf(" %6.2f ns/u ", agg.fastest_elapsed_ns() / volume);
+  if (collector.has_events())
+  {
+    printf(" %6.2f c/u ", agg.fastest_cycles() / volume);
+    printf(" %6.2f i/u ", agg.fastest_instructions() / volume);
+    printf(" %5.3f bm/u ", agg.fastest_branch_misses() / volume);
+  }
+  if (collector.has_cache_events())
+  {
+    printf(" %5.3f L1/u ", agg.fastest_l1d_misses() / volume);
+    printf(" %5.3f LLC/u ", agg.fastest_llc_misses() / volume);
+  }
+  printf("\n");
+}
+
+template <typename Table>
+void measure(const std::string &name, const std::vector<uint64_t> &keys,
+             const std::vector<std::string> &urls,
+             const std::vector<uint64_t> &hashes, size_t bytes,
+             double normalize_ns, double hash_ns)
+{
+  Table table = FilterAPI<Table>::ConstructFromAddCount(keys.size());
+  FilterAPI<Table>::AddAll(keys, 0, keys.size(), &table);
+
+  size_t blocked = 0;
+  event_aggregate contain = bench([&]()
+                                  {
+    for (uint64_t h : hashes) {
+      blocked += FilterAPI<Table>::Contain(h, &table);
+    } });
+  pretty_print(urls.size(), bytes, name + " contain", contain);
+
+  std::string canonical;
+  event_aggregate full = bench([&]()
+                               {
+    for (const std::string &u : urls) {
+      url::normalize(u, &canonical);
+      const url::verdict v =
+          FilterAPI<Table>::Contain(url::hash(canonical), &table)
+              ? url::verdict::block
+              : url::verdict::allow;
+      blocked += v == url::verdict::block;
+    } });
+  pretty_print(urls.size(), bytes, name + " end-to-end", full);
+  sink += blocked;
+
+  const double n = urls.size();
+  const double contain_ns = contain.fastest_elapsed_ns() / n;
+  const double full_ns = full.fastest_elapsed_ns() / n;
+  const double parts = normalize_ns + hash_ns + contain_ns;
+  printf("%-30s :  normalize %4.1f%%  hash %4.1f%%  contain %4.1f%%  "
+         "(stages %.2f ns/u, end-to-end %.2f ns/u)\n",
+         "", 100 * normalize_ns / parts, 100 * hash_ns / parts,
+         100 * contain_ns / parts, parts, full_ns);
+}
+
+int main(int argc, char **argv)
+{
+  if (argc < 3)
+  {
+    printf("usage: %s urls.txt test_size\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+  std::ifstream input(argv[1]);
+  if (!input)
+  {
+    std::cerr << "Could not open " << argv[1] << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  // raw lines, as a proxy would see them
+  std::vector<std::string> urls;
+  size_t bytes = 0;
+  for (std::string line; std::getline(input, line);)
+  {
+    bytes += line.size();
+    urls.push_back(line);
+  }
+  const size_t test_size = std::min<size_t>(atoll(argv[2]), urls.size());
+
+  std::vector<std::string> canonical(urls.size());
+  std::vector<uint64_t> hashes(urls.size());
+  for (size_t i = 0; i < urls.size(); i++)
+  {
+    canonical[i] = url::normalize(urls[i]);
+    hashes[i] = url::hash(canonical[i]);
+  }
+  std::vector<uint64_t> keys(hashes.begin(), hashes.begin() + test_size);
+  // duplicates (including URLs that only differ before normalization) break
+  // the static filters
+  std::sort(keys.begin(), keys.end());
+  keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+
+  printf("%zu URLs (%zu bytes), %zu distinct keys in the filters\n",
+         urls.size(), bytes, keys.size());
+
+  std::string buffer;
+  size_t total = 0;
+  event_aggregate normalize = bench([&]()
+                                    {
+    for (const std::string &u : urls) {
+      url::normalize(u, &buffer);
+      total += buffer.size();
+    } });
+  pretty_print(urls.size(), bytes, "normalize", normalize);
+  uint64_t mixed = 0;
+  event_aggregate hash = bench([&]()
+                               {
+    for (const std::string &c : canonical) {
+      mixed += url::hash(c);
+    } });
+  pretty_print(urls.size(), bytes, "hash", hash);
+  sink += total + mixed;
+
+  const double normalize_ns = normalize.fastest_elapsed_ns() / urls.size();
+  const double hash_ns = hash.fastest_elapsed_ns() / urls.size();
+  measure<XorFilter<uint64_t, uint8_t>>("Xor8", keys, urls, hashes, bytes,
+                                        normalize_ns, hash_ns);
+  measure<xorbinaryfusefilter_lowmem4wise::XorBinaryFuseFilter<uint64_t, uint8_t>>(
+      "BinaryFuse8_4wise", keys, urls, hashes, bytes, normalize_ns, hash_ns);
+  measure<CuckooFilter<uint64_t, 12>>("Cuckoo12", keys, urls, hashes, bytes,
+                                      normalize_ns, hash_ns);
+  measure<BloomFilter<uint64_t, 12, false>>("Bloom12", keys, urls, hashes,
+                                            bytes, normalize_ns, hash_ns);
+#if CPUDISPATCH_X86 || defined(__aarch64__)
+  measure<SimdBlockFilterFixed<>>("BlockedBloom", keys, urls, hashes, bytes,
+                                  normalize_ns, hash_ns);
+#endif
+  return EXIT_SUCCESS;
+}
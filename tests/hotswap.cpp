@@ -0,0 +1,194 @@
+#include "performancecounters/benchmarker.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <stdlib.h>
+#include <thread>
+#include <vector>
+#include "filter_handle.h"
+#include "filterapi.h"
+#include "test_util.h"
+
+// Lookups against a filter that is being replaced under them.
+//
+// usage: ./hotswap urls.txt test_size [readers] [swaps]
+//
+// Half of the test_size keys come from the URLs and are in every generation
+// of the filter; the other half is different in each generation. Reader
+// threads look the stable keys up through a FilterHandle, in batches, while
+// a builder thread builds the next generation and publishes it, `swaps`
+// times. Reported:
+//
+//   handle overhead   ns per lookup through Reader::Contain and through
+//                     Reader::Read batches, against a plain FilterAPI lookup
+//   throughput        reader lookups/s without swaps and while swapping
+//   build / publish   time to build a generation, and to swap it in
+//   drain             time from a swap until the old filter was freed
+//
+// Every stable key must be found in every generation; any miss is reported
+// as an error.
+
+volatile size_t sink = 0;
+
+template <typename Table>
+std::unique_ptr<Table> build(const std::vector<uint64_t> &stable, uint64_t generation)
+{
+  std::vector<uint64_t> keys(stable);
+  uint64_t state = generation * UINT64_C(0x5851F42D4C957F2D);
+  for (size_t i = 0; i < stable.size(); i++)
+  {
+    keys.push_back(testutil::splitmix64(&state));
+  }
+  std::unique_ptr<Table> table(new Table(FilterAPI<Table>::ConstructFromAddCount(keys.size())));
+  FilterAPI<Table>::AddAll(keys, 0, keys.size(), table.get());
+  return table;
+}
+
+double elapsed_ns(std::chrono::steady_clock::time_point start)
+{
+  return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+}
+
+template <typename Table>
+void measure(const std::string &name, const std::vector<uint64_t> &stable,
+             size_t readers, size_t swaps)
+{
+  const size_t batch = 64;
+  FilterHandle<Table> handle(build<Table>(stable, 0));
+  printf("%s\n", name.c_str());
+
+  {
+    std::unique_ptr<Table> plain = build<Table>(stable, 0);
+    typename FilterHandle<Table>::Reader reader(handle);
+    size_t found = 0;
+    event_aggregate direct = bench([&]()
+                                   {
+      for (uint64_t key : stable) {
+        found += FilterAPI<Table>::Contain(key, plain.get());
+      } });
+    event_aggregate single = bench([&]()
+                                   {
+      for (uint64_t key : stable) {
+        found += reader.Contain(key);
+      } });
+    event_aggregate batched = bench([&]()
+                                    {
+      for (size_t i = 0; i < stable.size(); i += batch) {
+        const size_t end = std::min(i + batch, stable.size());
+        found += reader.Read([&](Table *table) {
+          size_t f = 0;
+          for (size_t j = i; j < end; j++) {
+            f += FilterAPI<Table>::Contain(stable[j], table);
+          }
+          return f;
+        });
+      } });
+    sink += found;
+    printf("  handle overhead   direct %.2f ns/q, Contain %.2f ns/q, Read(%zu) %.2f ns/q\n",
+           direct.fastest_elapsed_ns() / stable.size(),
+           single.fastest_elapsed_ns() / stable.size(), batch,
+           batched.fastest_elapsed_ns() / stable.size());
+  }
+
+  std::atomic<bool> stop{false};
+  std::atomic<size_t> lookups{0}, misses{0};
+  // runs the readers for as long as during() takes; returns their lookups/s
+  auto with_readers = [&](const auto &during)
+  {
+    stop = false;
+    lookups = 0;
+    std::vector<std::thread> pool;
+    for (size_t t = 0; t < readers; t++)
+    {
+      pool.emplace_back([&, t]()
+                        {
+        typename FilterHandle<Table>::Reader reader(handle);
+        size_t i = t * stable.size() / readers, done = 0, missed = 0;
+        while (!stop.load(std::memory_order_relaxed)) {
+          const size_t end = std::min(i + batch, stable.size());
+          missed += reader.Read([&](Table *table) {
+            size_t m = 0;
+            for (size_t j = i; j < end; j++) {
+              m += !FilterAPI<Table>::Contain(stable[j], table);
+            }
+            return m;
+          });
+          done += end - i;
+          i = end == stable.size() ? 0 : end;
+        }
+        lookups += done;
+        misses += missed; });
+    }
+    const auto start = std::chrono::steady_clock::now();
+    during();
+    stop = true;
+    for (std::thread &th : pool)
+    {
+      th.join();
+    }
+    return lookups * 1e9 / elapsed_ns(start);
+  };
+
+  const double quiet_rate = with_readers([]()
+                                         { std::this_thread::sleep_for(std::chrono::milliseconds(500)); });
+  double build_ns = 0, drain_ns = 0, max_drain_ns = 0;
+  const double busy_rate = with_readers([&]()
+                                        {
+    for (size_t g = 1; g <= swaps; g++) {
+      const auto start = std::chrono::steady_clock::now();
+      std::unique_ptr<Table> next = build<Table>(stable, g);
+      build_ns += elapsed_ns(start);
+      handle.Publish(std::move(next));
+      while (handle.Reclaim() > 0) {
+        std::this_thread::yield();
+      }
+      const SwapStats s = handle.Stats();
+      drain_ns += s.last_drain_ns;
+      max_drain_ns = std::max(max_drain_ns, double(s.last_drain_ns));
+    } });
+  const SwapStats s = handle.Stats();
+  printf("  throughput        %.1f Mq/s without swaps, %.1f Mq/s while swapping (%zu readers)\n",
+         quiet_rate / 1e6, busy_rate / 1e6, readers);
+  printf("  build             %.2f ms per generation of %zu keys\n",
+         build_ns / swaps / 1e6, 2 * stable.size());
+  printf("  publish           %llu ns last, %llu ns max over %zu swaps\n",
+         (unsigned long long)s.last_publish_ns, (unsigned long long)s.max_publish_ns, s.swaps);
+  printf("  drain             %.1f us mean, %.1f us max, %zu reclaimed\n",
+         drain_ns / swaps / 1e3, max_drain_ns / 1e3, s.reclaimed);
+  if (misses > 0)
+  {
+    printf("  ERROR: %zu stable keys not found\n", misses.load());
+  }
+}
+
+int main(int argc, char **argv)
+{
+  if (argc < 3)
+  {
+    printf("usage: %s urls.txt test_size [readers] [swaps]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+  std::ifstream input(argv[1]);
+  if (!input)
+  {
+    std::cerr << "Could not open " << argv[1] << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  const size_t test_size = atoll(argv[2]);
+  const size_t hardware = std::max(1u, std::thread::hardware_concurrency());
+  const size_t readers = argc > 3 ? atoll(argv[3]) : std::max<size_t>(1, hardware - 1);
+  const size_t swaps = argc > 4 ? std::max(1LL, atoll(argv[4])) : 20;
+
+  std::vector<uint64_t> stable = testutil::read_keys(input, test_size / 2);
+  printf("%zu stable keys, %zu readers, %zu swaps\n", stable.size(), readers, swaps);
+
+  measure<XorFilter<uint64_t, uint8_t>>("Xor8", stable, readers, swaps);
+  measure<xorbinaryfusefilter_lowmem4wise::XorBinaryFuseFilter<uint64_t, uint8_t>>(
+      "BinaryFuse8_4wise", stable, readers, swaps);
+  measure<BalancedRibbonFilter<uint64_t, 8, 0>>("BalancedRibbon8", stable,
+                                                readers, swaps);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,140 @@
+#include "performancecounters/benchmarker.h"
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <stdlib.h>
+#include <vector>
+#include "filterapi.h"
+#include "binary_fuse/binary_fuse_new.h"
+#include "hugepage.h"
+#include "test_util.h"
+
+// The same filters on small and on huge pages.
+//
+// usage: ./hugepages urls.txt test_size [queries]
+//
+// test_size keys: the URLs, then random keys if there are not enough of them,
+// so that the filters can be made as large as memory allows (the TLB matters
+// from a few hundred MB up). Each filter is built once per page policy (see
+// hugepage.h) and queried with random keys, half of them in the set. For each
+// policy:
+//
+//   backing   what the array actually got: huge pages must be reserved for
+//             2m and 1g (vm.nr_hugepages), else the next policy down is used
+//   build     ns per key, scratch arrays included for the binary fuse filter
+//   lookup    ns per query, fastest run
+//   dTLB      data TLB load misses per query, when the performance counters
+//             are available
+//   speedup   lookup time on 4 KB pages over lookup time with this policy
+
+volatile size_t sink = 0;
+
+// The filters built through FilterAPI, with the page policy passed on.
+template <typename Table>
+struct paged
+{
+  static Table *build(const std::vector<uint64_t> &keys, hugepage::policy pages)
+  {
+    Table *table = new Table(keys.size(), pages);
+    FilterAPI<Table>::AddAll(keys, 0, keys.size(), table);
+    return table;
+  }
+  static bool contain(uint64_t key, Table *table)
+  {
+    return FilterAPI<Table>::Contain(key, table);
+  }
+};
+
+template <typename ItemType, typename FingerprintType>
+struct paged<binary_fuse::BinaryFuseFilter<ItemType, FingerprintType>>
+{
+  using Table = binary_fuse::BinaryFuseFilter<ItemType, FingerprintType>;
+  static Table *build(const std::vector<uint64_t> &keys, hugepage::policy pages)
+  {
+    Table *table = new Table(keys.size(), pages);
+    std::vector<uint64_t> copy(keys);
+    if (!table->Populate(copy.data(), copy.size()))
+    {
+      printf("  construction failed\n");
+    }
+    return table;
+  }
+  static bool contain(uint64_t key, Table *table) { return table->Contain(key); }
+};
+
+template <typename Table>
+void measure(const std::string &name, const std::vector<uint64_t> &keys,
+             const std::vector<uint64_t> &queries)
+{
+  printf("%s\n", name.c_str());
+  printf("  %-6s %-9s %12s %12s %10s %8s\n", "policy", "backing", "build ns/key",
+         "lookup ns/q", "dTLB/q", "speedup");
+  double baseline_ns = 0;
+  for (hugepage::policy pages : {hugepage::none, hugepage::transparent,
+                                 hugepage::huge_2mb, hugepage::huge_1gb})
+  {
+    const auto start = std::chrono::steady_clock::now();
+    std::unique_ptr<Table> table(paged<Table>::build(keys, pages));
+    const double build_ns =
+        std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    size_t found = 0;
+    event_aggregate agg = bench([&]()
+                                {
+      for (uint64_t q : queries) {
+        found += paged<Table>::contain(q, table.get());
+      } }, 3, 100000000);
+    sink += found;
+    const double lookup_ns = agg.fastest_elapsed_ns() / queries.size();
+    if (pages == hugepage::none)
+    {
+      baseline_ns = lookup_ns;
+    }
+    char tlb[16] = "-";
+    if (agg.fastest_cycles() > 0)
+    {
+      snprintf(tlb, sizeof(tlb), "%.3f", agg.fastest_dtlb_misses() / queries.size());
+    }
+    printf("  %-6s %-9s %12.2f %12.2f %10s %7.2fx\n", hugepage::name(pages),
+           hugepage::name(table->PageBacking()), build_ns / keys.size(), lookup_ns,
+           tlb, baseline_ns / lookup_ns);
+  }
+}
+
+int main(int argc, char **argv)
+{
+  if (argc < 3)
+  {
+    printf("usage: %s urls.txt test_size [queries]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+  std::ifstream input(argv[1]);
+  if (!input)
+  {
+    std::cerr << "Could not open " << argv[1] << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  const size_t test_size = atoll(argv[2]);
+  const size_t query_count = argc > 3 ? atoll(argv[3]) : 10000000;
+
+  std::vector<uint64_t> keys = testutil::load_keys(input, test_size);
+
+  std::vector<uint64_t> queries;
+  std::mt19937_64 rng(5678);
+  for (size_t i = 0; i < query_count; i++)
+  {
+    queries.push_back(i % 2 ? keys[rng() % keys.size()] : rng());
+  }
+  printf("%zu keys, %zu queries, default policy %s\n", keys.size(), queries.size(),
+         hugepage::name(hugepage::default_policy()));
+
+  measure<binary_fuse::BinaryFuseFilter<uint64_t, uint8_t>>("BinaryFuse8", keys, queries);
+  measure<SimdBlockFilterFixed<>>("BlockedBloom", keys, queries);
+  measure<BloomFilter<uint64_t, 12, false>>("Bloom12", keys, queries);
+#ifdef __BMI2__
+  measure<CountingBloomFilter<uint64_t, 12, false>>("CountingBloom12", keys, queries);
+#endif
+  return EXIT_SUCCESS;
+}
@@ -35,6 +35,12 @@ void pretty_print(size_t volume, size_t bytes, std::string name,
     printf(" %5.1f c/b ", agg.fastest_cycles() / bytes);
     printf(" %5.2f i/b ", agg.fastest_instructions() / bytes);
     printf(" %5.2f i/c ", agg.fastest_instructions() / agg.fastest_cycles());
+    printf(" %5.3f bm/d ", agg.fastest_branch_misses() / volume);
+  }
+  if (collector.has_cache_events()) {
+    printf(" %5.3f L1/d ", agg.fastest_l1d_misses() / volume);
+    printf(" %5.3f LLC/d ", agg.fastest_llc_misses() / volume);
+    printf(" %5.3f TLB/d ", agg.fastest_dtlb_misses() / volume);
   }
   printf("\n");
 }
@@ -0,0 +1,140 @@
+#include "performancecounters/benchmarker.h"
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <stdlib.h>
+#include <vector>
+#include "filterapi.h"
+
+// Tail latency of individual filter operations.
+//
+// usage: ./latency urls.txt test_size [batch] [builds]
+//
+// The first test_size URLs are added to each filter. Positive lookups query
+// those URLs, negative lookups query random strings. Lookups are timed in
+// groups of `batch` (default 1, i.e. single queries); construction is timed
+// per build of the whole filter, `builds` times (default 10).
+
+std::string random_string()
+{
+  auto randchar = []() -> char
+  {
+    const char charset[] =
+        "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz";
+    const size_t max_index = (sizeof(charset) - 1);
+    return charset[rand() % max_index];
+  };
+  size_t desired_length = rand() % 128;
+  std::string str(desired_length, 0);
+  std::generate_n(str.begin(), desired_length, randchar);
+  return str;
+}
+
+uint64_t simple_hash(const std::string &line)
+{
+  uint64_t h = 0;
+  for (unsigned char c : line)
+  {
+    h = (h * 177) + c;
+  }
+  h ^= line.size();
+  return h;
+}
+
+volatile size_t sink = 0;
+
+template <typename Table>
+void measure(const std::string &name, const std::vector<uint64_t> &keys,
+             const std::vector<uint64_t> &negatives, size_t batch,
+             size_t builds)
+{
+  latency_histogram construction{};
+  const double ns_per_tick = latency_clock::ns_per_tick();
+  for (size_t b = 0; b < builds; b++)
+  {
+    const uint64_t t0 = latency_clock::start();
+    Table table = FilterAPI<Table>::ConstructFromAddCount(keys.size());
+    FilterAPI<Table>::AddAll(keys, 0, keys.size(), &table);
+    const uint64_t t1 = latency_clock::stop();
+    construction.record_ns((t1 - t0) * ns_per_tick);
+  }
+
+  Table table = FilterAPI<Table>::ConstructFromAddCount(keys.size());
+  FilterAPI<Table>::AddAll(keys, 0, keys.size(), &table);
+  size_t found = 0;
+  latency_histogram positive = bench_latency(
+      [&](size_t i)
+      { found += FilterAPI<Table>::Contain(keys[i], &table); },
+      keys.size(), batch);
+  latency_histogram negative = bench_latency(
+      [&](size_t i)
+      { found += FilterAPI<Table>::Contain(negatives[i], &table); },
+      negatives.size(), batch);
+  sink += found;
+
+  construction.print((name + " construction").c_str());
+  positive.print((name + " positive").c_str());
+  negative.print((name + " negative").c_str());
+}
+
+int main(int argc, char **argv)
+{
+  if (argc < 3)
+  {
+    printf("usage: %s urls.txt test_size [batch] [builds]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+  std::ifstream input(argv[1]);
+  if (!input)
+  {
+    std::cerr << "Could not open " << argv[1] << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  std::vector<std::string> inputs;
+  for (std::string line; std::getline(input, line);)
+  {
+    std::string ref = line;
+    ref.erase(std::find_if(ref.rbegin(), ref.rend(),
+                           [](unsigned char ch)
+                           { return !std::isspace(ch); })
+                  .base(),
+              ref.end());
+    inputs.push_back(ref);
+  }
+  size_t test_size = std::min<size_t>(atoll(argv[2]), inputs.size());
+  size_t batch = argc > 3 ? atoll(argv[3]) : 1;
+  size_t builds = argc > 4 ? atoll(argv[4]) : 10;
+
+  std::vector<uint64_t> keys(test_size), negatives(test_size);
+  for (size_t i = 0; i < test_size; i++)
+  {
+    keys[i] = simple_hash(inputs[i]);
+  }
+  // duplicates break the static filters
+  std::sort(keys.begin(), keys.end());
+  keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+  std::shuffle(keys.begin(), keys.end(), std::mt19937_64(1234));
+  negatives.resize(keys.size());
+  for (size_t i = 0; i < negatives.size(); i++)
+  {
+    negatives[i] = simple_hash(random_string());
+  }
+
+  printf("%zu keys, batch %zu, %zu builds, %.3f ns/tick\n", keys.size(), batch,
+         builds, latency_clock::ns_per_tick());
+  printf("%-30s : %10s %10s %10s %10s %10s\n", "", "p50", "p90", "p99", "p999",
+         "max");
+  measure<XorFilter<uint64_t, uint8_t>>("Xor8", keys, negatives, batch, builds);
+  measure<xorbinaryfusefilter_lowmem4wise::XorBinaryFuseFilter<uint64_t, uint8_t>>(
+      "BinaryFuse8_4wise", keys, negatives, batch, builds);
+  measure<CuckooFilter<uint64_t, 12>>("Cuckoo12", keys, negatives, batch,
+                                      builds);
+  measure<BloomFilter<uint64_t, 12, false>>("Bloom12", keys, negatives, batch,
+                                            builds);
+#if CPUDISPATCH_X86 || defined(__aarch64__)
+  measure<SimdBlockFilterFixed<>>("BlockedBloom", keys, negatives, batch,
+                                  builds);
+#endif
+  return EXIT_SUCCESS;
+}
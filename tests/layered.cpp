@@ -0,0 +1,173 @@
+#include "performancecounters/benchmarker.h"
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <stdlib.h>
+#include <vector>
+#include "filterapi.h"
+#include "layered_filter.h"
+#include "test_util.h"
+
+// Incremental updates to a static filter through a LayeredFilter.
+//
+// usage: ./layered urls.txt test_size [updates]
+//
+// The base is built from test_size URLs; then `updates` random keys are
+// added and as many base keys removed, one at a time, with compactions in
+// the background as the delta fills. Reported:
+//
+//   lookup    ns per query, mixed positives and negatives, for the plain
+//             static filter and for the layered one with an empty delta,
+//             with a half-full delta, and with tombstones
+//   update    ns per Add / Remove: mean, median and worst (the worst being
+//             an update that had to wait for a rebuild)
+//   rebuild   compactions and the time of the last one, start to finish
+//
+// and, at the end, whether every key that should be in is found (all must
+// be), the fraction of removed keys still found and the false-positive rate
+// (which should be about the same).
+
+volatile size_t sink = 0;
+
+template <typename Filter>
+double lookup_ns(Filter *filter, const std::vector<uint64_t> &queries)
+{
+  size_t found = 0;
+  event_aggregate agg = bench([&]()
+                              {
+    for (uint64_t q : queries) {
+      found += filter->Contain(q);
+    } });
+  sink += found;
+  return agg.fastest_elapsed_ns() / queries.size();
+}
+
+template <typename Base, typename Delta>
+void measure(const std::string &name, const std::vector<uint64_t> &keys,
+             size_t updates)
+{
+  typedef LayeredFilter<Base, Delta> Layered;
+  typename Layered::Config config;
+  config.max_delta_keys = std::max<size_t>(1024, keys.size() / 100);
+  Layered layered(keys, config);
+  printf("%s: %zu base keys, delta of %zu, %.2f bits/key\n", name.c_str(),
+         keys.size(), config.max_delta_keys,
+         8.0 * layered.SizeInBytes() / keys.size());
+
+  std::vector<uint64_t> queries(keys.begin(), keys.begin() + std::min<size_t>(keys.size(), 1 << 20));
+  uint64_t state = 5678;
+  for (size_t i = 0, n = queries.size(); i < n; i++)
+  {
+    queries.push_back(testutil::splitmix64(&state));
+  }
+  std::shuffle(queries.begin(), queries.end(), std::mt19937_64(1234));
+  {
+    Base base = FilterAPI<Base>::ConstructFromAddCount(keys.size());
+    FilterAPI<Base>::AddAll(keys, 0, keys.size(), &base);
+    struct
+    {
+      Base *table;
+      bool Contain(uint64_t key) { return FilterAPI<Base>::Contain(key, table); }
+    } plain{&base};
+    printf("  lookup  static %.2f ns/q", lookup_ns(&plain, queries));
+  }
+  printf(", empty delta %.2f ns/q", lookup_ns(&layered, queries));
+
+  // additions up to half the delta
+  std::vector<uint64_t> added;
+  uint64_t add_state = 4321;
+  for (size_t i = 0; i < config.max_delta_keys / 2; i++)
+  {
+    added.push_back(testutil::splitmix64(&add_state));
+    layered.Add(added.back());
+  }
+  printf(", half-full delta %.2f ns/q", lookup_ns(&layered, queries));
+  for (size_t i = 0; i < config.max_delta_keys / 4; i++)
+  {
+    layered.Remove(keys[keys.size() - 1 - i]);
+  }
+  printf(", with tombstones %.2f ns/q\n", lookup_ns(&layered, queries));
+
+  // timed updates, compacting as needed
+  std::vector<uint64_t> removed(keys.end() - config.max_delta_keys / 4, keys.end());
+  std::vector<double> add_ns, remove_ns;
+  size_t next_removal = keys.size() - 1 - config.max_delta_keys / 4;
+  for (size_t i = 0; i < updates && next_removal > 0; i++)
+  {
+    added.push_back(testutil::splitmix64(&add_state));
+    auto start = std::chrono::steady_clock::now();
+    layered.Add(added.back());
+    add_ns.push_back(std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count());
+
+    removed.push_back(keys[next_removal--]);
+    start = std::chrono::steady_clock::now();
+    layered.Remove(removed.back());
+    remove_ns.push_back(std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count());
+    layered.Poll();
+  }
+  for (auto *ns : {&add_ns, &remove_ns})
+  {
+    double total = 0;
+    for (double t : *ns)
+    {
+      total += t;
+    }
+    std::sort(ns->begin(), ns->end());
+    printf("  update  %s %.0f ns mean, %.0f ns median, %.0f us worst\n",
+           ns == &add_ns ? "add   " : "remove", total / ns->size(),
+           (*ns)[ns->size() / 2], ns->back() / 1e3);
+  }
+  layered.Compact();
+  printf("  rebuild %zu compactions, last %.1f ms\n", layered.Compactions(),
+         layered.LastCompactionNs() / 1e6);
+
+  size_t missing = 0, resurrected = 0, false_positives = 0;
+  for (size_t i = 0; i <= next_removal; i++)
+  {
+    missing += !layered.Contain(keys[i]);
+  }
+  for (uint64_t k : added)
+  {
+    missing += !layered.Contain(k);
+  }
+  for (uint64_t k : removed)
+  {
+    resurrected += layered.Contain(k);
+  }
+  uint64_t negative_state = 8765;
+  const size_t probes = 1 << 20;
+  for (size_t i = 0; i < probes; i++)
+  {
+    false_positives += layered.Contain(testutil::splitmix64(&negative_state));
+  }
+  printf("  check   %zu missing, %.5f of removed keys found, fpr %.5f\n", missing,
+         double(resurrected) / removed.size(), double(false_positives) / probes);
+}
+
+int main(int argc, char **argv)
+{
+  if (argc < 3)
+  {
+    printf("usage: %s urls.txt test_size [updates]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+  std::ifstream input(argv[1]);
+  if (!input)
+  {
+    std::cerr << "Could not open " << argv[1] << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  const size_t test_size = atoll(argv[2]);
+  const size_t updates = argc > 3 ? atoll(argv[3]) : 100000;
+
+  std::vector<uint64_t> keys = testutil::read_keys(input, test_size);
+  std::shuffle(keys.begin(), keys.end(), std::mt19937_64(1234));
+
+  measure<xorbinaryfusefilter_lowmem4wise::XorBinaryFuseFilter<uint64_t, uint8_t>,
+          CuckooFilter<uint64_t, 12>>("BinaryFuse8_4wise + Cuckoo12", keys, updates);
+  measure<XorFilter<uint64_t, uint8_t>, CuckooFilter<uint64_t, 12>>(
+      "Xor8 + Cuckoo12", keys, updates);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,313 @@
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <stdlib.h>
+#include <string>
+#include <sys/mman.h>
+#include <vector>
+#include "filter_loader.h"
+#include "filterapi.h"
+#include "url.h"
+#include "test_util.h"
+
+// Time from a cold start to a filter ready to answer queries.
+//
+// usage: ./loader urls.txt test_size [directory]
+//
+// test_size keys (the URLs, then random keys) are put in a filter, which is
+// saved with SaveFilter to a file in directory (default: the current one),
+// along with the keys (WriteKeys). Before each load the files are dropped
+// from the page cache, so that the reads go to the disk. Each file is then
+// loaded:
+//
+//   ifstream  one read of the whole file, then the checks, on one thread
+//   mmap      filters only: the file mapped and queried in place, so the
+//             reads happen as page faults during the first queries
+//   threads   src/filter_loader.h with its pread thread pool
+//   uring     src/filter_loader.h with io_uring
+//
+// Reported: the time until the filter (or key vector) is ready, the
+// resulting GB/s, and the ns per query of a first pass of random queries
+// right after, which is where mmap pays. Every key is then looked up in the
+// loaded filter, and any one missing is an error. urls.txt itself is also
+// read and hashed both ways.
+
+volatile size_t sink = 0;
+
+double since(std::chrono::steady_clock::time_point start)
+{
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Drops path from the page cache.
+void evict(const std::string &path)
+{
+  const int fd = open(path.c_str(), O_RDONLY);
+  if (fd >= 0)
+  {
+    fdatasync(fd);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+  }
+}
+
+void report(const char *how, double seconds, size_t bytes, double first_pass_ns)
+{
+  printf("  %-9s %9.3f s", how, seconds);
+  if (bytes > 0)
+  {
+    printf(" %8.2f GB/s", bytes / seconds / 1e9);
+  }
+  else
+  {
+    printf(" %8s GB/s", "-");
+  }
+  if (first_pass_ns >= 0)
+  {
+    printf(" %10.1f ns/q first pass", first_pass_ns);
+  }
+  printf("\n");
+}
+
+template <typename Table>
+double first_pass(Table *table, const std::vector<uint64_t> &queries)
+{
+  const auto start = std::chrono::steady_clock::now();
+  size_t found = 0;
+  for (uint64_t q : queries)
+  {
+    found += FilterAPI<Table>::Contain(q, table);
+  }
+  sink += found;
+  return since(start) * 1e9 / queries.size();
+}
+
+// Every key must be found in a loaded filter; exits if one is not.
+template <typename Table>
+void check(const char *how, Table *table, const std::vector<uint64_t> &keys)
+{
+  size_t missing = 0;
+  for (uint64_t k : keys)
+  {
+    missing += !FilterAPI<Table>::Contain(k, table);
+  }
+  if (missing != 0)
+  {
+    printf("  %-9s %zu of %zu keys missing\n", how, missing, keys.size());
+    exit(EXIT_FAILURE);
+  }
+}
+
+// The whole file into a page-aligned buffer with an ifstream, then the
+// header and chunk checks, all on this thread; returns the header.
+loader::FileHeader read_whole(const std::string &path, loader::Buffer *data)
+{
+  std::ifstream in(path, std::ios::binary);
+  in.seekg(0, std::ios::end);
+  const size_t size = in.tellg();
+  in.seekg(0);
+  std::vector<char> file(size);
+  in.read(file.data(), size);
+  loader::FileHeader h;
+  memcpy(&h, file.data(), sizeof(h));
+  *data = loader::Buffer(h.data_bytes);
+  memcpy(data->data(), file.data() + h.data_offset, h.data_bytes);
+  const uint64_t *sums = reinterpret_cast<const uint64_t *>(file.data() + sizeof(h));
+  for (size_t c = 0; c < h.chunk_count; c++)
+  {
+    const size_t at = c * h.chunk_bytes;
+    if (loader::Checksum(data->data() + at, std::min<size_t>(h.chunk_bytes, h.data_bytes - at)) != sums[c])
+    {
+      printf("  checksum mismatch in chunk %zu\n", c);
+    }
+  }
+  return h;
+}
+
+template <typename Table>
+void measure(const std::string &name, const std::vector<uint64_t> &keys,
+             const std::vector<uint64_t> &queries, const std::string &path)
+{
+  size_t bytes;
+  {
+    std::unique_ptr<Table> table(new Table(FilterAPI<Table>::ConstructFromAddCount(keys.size())));
+    FilterAPI<Table>::AddAll(keys, 0, keys.size(), table.get());
+    loader::SaveFilter(*table, path);
+    bytes = FilterImage<Table>::Bytes(*table);
+  }
+  printf("%s: %.1f MB\n", name.c_str(), bytes / 1e6);
+  typename std::aligned_storage<sizeof(Table), alignof(Table)>::type storage;
+  Table *view = reinterpret_cast<Table *>(&storage);
+
+  evict(path);
+  auto start = std::chrono::steady_clock::now();
+  {
+    loader::Buffer image;
+    read_whole(path, &image);
+    FilterImage<Table>::View(image.data(), view);
+    const double ready = since(start);
+    report("ifstream", ready, bytes, first_pass(view, queries));
+    check("ifstream", view, keys);
+    FilterImage<Table>::Release(view);
+  }
+
+  evict(path);
+  start = std::chrono::steady_clock::now();
+  {
+    const int fd = open(path.c_str(), O_RDONLY);
+    loader::FileHeader h;
+    if (pread(fd, &h, sizeof(h), 0) != sizeof(h))
+    {
+      printf("  short read\n");
+    }
+    const size_t length = h.data_offset + h.data_bytes;
+    char *mapped = static_cast<char *>(mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0));
+    close(fd);
+    FilterImage<Table>::View(mapped + h.data_offset, view);
+    const double ready = since(start);
+    // nothing read yet
+    report("mmap", ready, 0, first_pass(view, queries));
+    check("mmap", view, keys);
+    FilterImage<Table>::Release(view);
+    munmap(mapped, length);
+  }
+
+  for (loader::backend b : {loader::threads, loader::uring})
+  {
+    evict(path);
+    loader::Options options;
+    options.use = b;
+    start = std::chrono::steady_clock::now();
+    try
+    {
+      loader::LoadedFilter<Table> loaded(path, options);
+      const double ready = since(start);
+      report(loader::name(b), ready, bytes, first_pass(loaded.table(), queries));
+      check(loader::name(b), loaded.table(), keys);
+    }
+    catch (const std::exception &e)
+    {
+      printf("  %-9s %s\n", loader::name(b), e.what());
+    }
+  }
+  unlink(path.c_str());
+}
+
+int main(int argc, char **argv)
+{
+  if (argc < 3)
+  {
+    printf("usage: %s urls.txt test_size [directory]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+  std::ifstream input(argv[1]);
+  if (!input)
+  {
+    std::cerr << "Could not open " << argv[1] << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  const size_t test_size = atoll(argv[2]);
+  const std::string directory = argc > 3 ? argv[3] : ".";
+
+  std::vector<uint64_t> keys = testutil::load_keys(input, test_size);
+
+  std::vector<uint64_t> queries;
+  std::mt19937_64 rng(5678);
+  for (size_t i = 0; i < std::min<size_t>(keys.size(), 1000000); i++)
+  {
+    queries.push_back(i % 2 ? keys[rng() % keys.size()] : rng());
+  }
+  printf("%zu keys\n", keys.size());
+
+  measure<xorbinaryfusefilter_lowmem4wise::XorBinaryFuseFilter<uint64_t, uint8_t>>(
+      "BinaryFuse8_4wise", keys, queries, directory + "/loader_filter.bin");
+#if CPUDISPATCH_X86 || defined(__aarch64__)
+  measure<SimdBlockFilterFixed<>>("BlockedBloom", keys, queries,
+                                  directory + "/loader_filter.bin");
+#endif
+
+  const std::string key_path = directory + "/loader_keys.bin";
+  loader::WriteKeys(keys, key_path);
+  const size_t key_bytes = keys.size() * sizeof(uint64_t);
+  printf("keys: %.1f MB\n", key_bytes / 1e6);
+  evict(key_path);
+  auto start = std::chrono::steady_clock::now();
+  {
+    loader::Buffer data;
+    read_whole(key_path, &data);
+    std::vector<uint64_t> read(keys.size());
+    memcpy(read.data(), data.data(), key_bytes);
+    report("ifstream", since(start), key_bytes, -1);
+  }
+  for (loader::backend b : {loader::threads, loader::uring})
+  {
+    evict(key_path);
+    loader::Options options;
+    options.use = b;
+    std::vector<uint64_t> read;
+    try
+    {
+      const loader::Stats s = loader::ReadKeys(key_path, &read, options);
+      report(loader::name(b), s.seconds, key_bytes, -1);
+      if (read != keys)
+      {
+        printf("  keys differ\n");
+      }
+    }
+    catch (const std::exception &e)
+    {
+      printf("  %-9s %s\n", loader::name(b), e.what());
+    }
+  }
+  unlink(key_path.c_str());
+
+  // the URL file, normalized and hashed
+  auto hash = [](std::string_view line)
+  {
+    static thread_local std::string canonical;
+    url::normalize(line, &canonical);
+    return url::hash(canonical);
+  };
+  evict(argv[1]);
+  start = std::chrono::steady_clock::now();
+  std::vector<uint64_t> expected;
+  size_t url_bytes = 0;
+  {
+    std::ifstream urls(argv[1]);
+    for (std::string line; std::getline(urls, line);)
+    {
+      url_bytes += line.size() + 1;
+      if (!line.empty() && line.back() == '\r')
+      {
+        line.pop_back();
+      }
+      expected.push_back(hash(line));
+    }
+  }
+  printf("URLs: %.1f MB, %zu lines, hashed\n", url_bytes / 1e6, expected.size());
+  report("ifstream", since(start), url_bytes, -1);
+  for (loader::backend b : {loader::threads, loader::uring})
+  {
+    evict(argv[1]);
+    loader::Options options;
+    options.use = b;
+    std::vector<uint64_t> hashed;
+    try
+    {
+      const loader::Stats s = loader::HashLines(argv[1], hash, &hashed, options);
+      report(loader::name(b), s.seconds, s.bytes, -1);
+      if (hashed != expected)
+      {
+        printf("  hashes differ\n");
+      }
+    }
+    catch (const std::exception &e)
+    {
+      printf("  %-9s %s\n", loader::name(b), e.what());
+    }
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,183 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <random>
+#include <stdlib.h>
+#include <thread>
+#include <vector>
+#include "affinity.h"
+#include "filterapi.h"
+#include "numa_filter.h"
+#include "test_util.h"
+
+// Lookup throughput of a read-only filter on a multi-socket host, by where
+// its memory is.
+//
+// usage: ./numa urls.txt test_size [threads] [seconds]
+//
+// test_size keys: the URLs, then random keys, so the filters can be made
+// much larger than the LLC. Each filter is built once, by the main thread,
+// and queried by `threads` threads (default: all CPUs), pinned alternately
+// to each socket, for `seconds` (default 1) per placement:
+//
+//   first-touch  the filter as built: all of it on the main thread's node
+//   interleave   one copy, pages spread over the nodes (see numa_filter.h)
+//   replicate    one copy per node; each thread queries its own node's
+//
+// Reported: the aggregate lookups per second, the rate of the threads of
+// each node, and whether the kernel enforced the placement (on a single
+// node, it cannot, and all three are the same).
+
+volatile size_t sink = 0;
+
+// Runs `threads` pinned threads over queries for `seconds`, each asking
+// table_for() for the table to use once pinned; prints the rates.
+template <typename Table, typename TableFor>
+void run(const char *placement, bool placed, const std::vector<int> &cpus,
+         const std::vector<affinity::cpu> &online, size_t threads,
+         double seconds, const std::vector<uint64_t> &queries,
+         const TableFor &table_for)
+{
+  std::map<int, int> node_of;
+  for (const affinity::cpu &c : online)
+  {
+    node_of[c.id] = c.node;
+  }
+  std::vector<size_t> done(threads), found(threads);
+  std::atomic<size_t> ready{0};
+  std::atomic<bool> go{false}, stop{false};
+  std::vector<std::thread> pool;
+  for (size_t t = 0; t < threads; t++)
+  {
+    pool.emplace_back([&, t]()
+                      {
+      affinity::pin_current_thread(cpus[t % cpus.size()]);
+      Table *table = table_for();
+      ready++;
+      while (!go.load(std::memory_order_acquire)) {
+      }
+      const size_t n = queries.size();
+      size_t i = n / threads * t, d = 0, f = 0;
+      while (!stop.load(std::memory_order_relaxed)) {
+        for (size_t j = 0; j < 4096; j++) {
+          f += FilterAPI<Table>::Contain(queries[i], table);
+          i = i + 1 == n ? 0 : i + 1;
+        }
+        d += 4096;
+      }
+      done[t] = d;
+      found[t] = f; });
+  }
+  while (ready.load() < threads)
+  {
+  }
+  const auto start = std::chrono::steady_clock::now();
+  go.store(true, std::memory_order_release);
+  std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+  stop.store(true);
+  for (std::thread &th : pool)
+  {
+    th.join();
+  }
+  const double elapsed =
+      std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  std::map<int, size_t> per_node;
+  size_t total = 0;
+  for (size_t t = 0; t < threads; t++)
+  {
+    per_node[node_of[cpus[t % cpus.size()]]] += done[t];
+    total += done[t];
+    sink += found[t];
+  }
+  printf("  %-12s %10.1f", placement, total / elapsed / 1e6);
+  for (const auto &n : per_node)
+  {
+    printf("  node%d %8.1f", n.first, n.second / elapsed / 1e6);
+  }
+  printf("  %s\n", placed ? "placed" : "not placed");
+}
+
+template <typename Table>
+void measure(const std::string &name, const std::vector<uint64_t> &keys,
+             const std::vector<uint64_t> &queries, const std::vector<int> &cpus,
+             const std::vector<affinity::cpu> &online, size_t threads,
+             double seconds)
+{
+  Table *table = new Table(FilterAPI<Table>::ConstructFromAddCount(keys.size()));
+  FilterAPI<Table>::AddAll(keys, 0, keys.size(), table);
+  printf("%s: %.1f MB\n", name.c_str(), table->SizeInBytes() / 1e6);
+  printf("  %-12s %10s  per node Mq/s\n", "placement", "Mq/s");
+  run<Table>("first-touch", false, cpus, online, threads, seconds, queries,
+             [&]()
+             { return table; });
+  {
+    NumaFilter<Table> interleaved(*table, NumaFilter<Table>::interleave);
+    run<Table>("interleave", interleaved.Placed(), cpus, online, threads, seconds,
+               queries, [&]()
+               { return interleaved.Local(); });
+  }
+  {
+    NumaFilter<Table> replicated(*table, NumaFilter<Table>::replicate);
+    run<Table>("replicate", replicated.Placed(), cpus, online, threads, seconds,
+               queries, [&]()
+               { return replicated.Local(); });
+  }
+  delete table;
+}
+
+int main(int argc, char **argv)
+{
+  if (argc < 3)
+  {
+    printf("usage: %s urls.txt test_size [threads] [seconds]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+  std::ifstream input(argv[1]);
+  if (!input)
+  {
+    std::cerr << "Could not open " << argv[1] << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  const std::vector<affinity::cpu> online = affinity::online_cpus();
+  const size_t test_size = atoll(argv[2]);
+  const size_t threads = argc > 3 ? atoll(argv[3]) : online.size();
+  const double seconds = argc > 4 ? atof(argv[4]) : 1.0;
+  const std::vector<int> cpus = affinity::placement(online, true);
+  if (threads == 0)
+  {
+    printf("threads must be at least 1\n");
+    return EXIT_FAILURE;
+  }
+
+  std::vector<uint64_t> keys = testutil::load_keys(input, test_size);
+
+  // half positives, half negatives, shuffled, at most 4M queries
+  const size_t half = std::min<size_t>(keys.size(), size_t(2) << 20);
+  std::vector<uint64_t> queries;
+  std::mt19937_64 rng(5678);
+  for (size_t i = 0; i < half; i++)
+  {
+    queries.push_back(keys[rng() % keys.size()]);
+    queries.push_back(rng());
+  }
+  std::shuffle(queries.begin(), queries.end(), rng);
+
+  printf("%zu keys, %zu threads on %d socket(s), %d NUMA node(s), %zu with memory\n",
+         keys.size(), threads, affinity::socket_count(online),
+         affinity::node_count(online), numa::memory_nodes().size());
+  measure<XorFilter<uint64_t, uint8_t>>("Xor8", keys, queries, cpus, online,
+                                        threads, seconds);
+  measure<xorbinaryfusefilter_lowmem4wise::XorBinaryFuseFilter<uint64_t, uint8_t>>(
+      "BinaryFuse8_4wise", keys, queries, cpus, online, threads, seconds);
+  measure<BalancedRibbonFilter<uint64_t, 8, 0>>("BalancedRibbon8", keys, queries,
+                                                cpus, online, threads, seconds);
+#if CPUDISPATCH_X86 || defined(__aarch64__)
+  measure<SimdBlockFilterFixed<>>("BlockedBloom", keys, queries, cpus, online,
+                                  threads, seconds);
+#endif
+  return EXIT_SUCCESS;
+}
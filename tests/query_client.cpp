@@ -0,0 +1,174 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <stdlib.h>
+#include <string>
+#include <thread>
+#include <vector>
+#include "query_server.h"
+#include "url.h"
+
+// Load generator for ./query_server.
+//
+// usage: ./query_client address urls.txt [connections] [batch] [depth]
+//                       [seconds] [urls|hashes]
+//
+// Each of `connections` threads (default 4) opens a connection and keeps
+// `depth` requests (default 1) of `batch` URLs (default 64) in flight for
+// `seconds` (default 5): a new request goes out as soon as an answer comes
+// back. Half the URLs are lines of urls.txt, the other half the same with a
+// path added, which the server has not seen. With "hashes" the client
+// normalizes and hashes the URLs itself and sends 64-bit keys. Reported:
+//
+//   QPS        requests per second, and URLs per second
+//   positive   share of the URLs the filter reported, about half plus the
+//              false positives if the server was built from the same file
+//   latency    from sending a request to receiving its answer: percentiles
+//              and maximum, in microseconds
+
+int main(int argc, char **argv)
+{
+  if (argc < 3)
+  {
+    printf("usage: %s address urls.txt [connections] [batch] [depth] [seconds] "
+           "[urls|hashes]\n",
+           argv[0]);
+    return EXIT_FAILURE;
+  }
+  const std::string address = argv[1];
+  std::ifstream input(argv[2]);
+  if (!input)
+  {
+    std::cerr << "Could not open " << argv[2] << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  const size_t connections = argc > 3 ? std::max(1ll, atoll(argv[3])) : 4;
+  const size_t batch = argc > 4 ? std::max(1ll, atoll(argv[4])) : 64;
+  const size_t depth = argc > 5 ? std::max(1ll, atoll(argv[5])) : 1;
+  const double seconds = argc > 6 ? atof(argv[6]) : 5.0;
+  const bool send_hashes = argc > 7 && std::string(argv[7]) == "hashes";
+
+  std::vector<std::string> lines;
+  for (std::string line; std::getline(input, line);)
+  {
+    lines.push_back(line);
+    lines.push_back(line + "/not-in-the-filter");
+  }
+  if (lines.empty())
+  {
+    printf("no URLs in %s\n", argv[2]);
+    return EXIT_FAILURE;
+  }
+
+  // requests are encoded beforehand, so that the client measures the server
+  const size_t request_count = std::max<size_t>(1, std::min<size_t>(4096, lines.size() / batch));
+  std::vector<std::vector<char>> requests(request_count);
+  std::string canonical;
+  for (size_t r = 0; r < request_count; r++)
+  {
+    std::vector<std::string_view> urls;
+    std::vector<uint64_t> keys;
+    for (size_t i = 0; i < batch; i++)
+    {
+      const std::string &u = lines[(r * batch + i) % lines.size()];
+      urls.push_back(u);
+      url::normalize(u, &canonical);
+      keys.push_back(url::hash(canonical));
+    }
+    if (send_hashes)
+    {
+      query::AppendHashes(keys.data(), keys.size(), &requests[r]);
+    }
+    else
+    {
+      query::AppendUrls(urls, &requests[r]);
+    }
+  }
+
+  std::vector<std::vector<uint32_t>> latencies(connections);
+  std::vector<size_t> answered(connections), positives(connections);
+  std::atomic<bool> stop{false}, failed{false};
+  std::vector<std::thread> pool;
+  const auto start = std::chrono::steady_clock::now();
+  for (size_t c = 0; c < connections; c++)
+  {
+    pool.emplace_back([&, c]()
+                      {
+      try {
+        query::Client client(address);
+        std::vector<uint64_t> bitmap;
+        std::deque<std::chrono::steady_clock::time_point> sent;
+        size_t next = c * request_count / connections;
+        auto send_one = [&]() {
+          client.Send(requests[next]);
+          sent.push_back(std::chrono::steady_clock::now());
+          next = next + 1 == request_count ? 0 : next + 1;
+        };
+        for (size_t d = 0; d < depth; d++) {
+          send_one();
+        }
+        latencies[c].reserve(size_t(1) << 20);
+        while (!sent.empty()) {
+          uint32_t count;
+          if (client.Receive(&bitmap, &count) != query::ok || count != batch) {
+            failed = true;
+            return;
+          }
+          const auto now = std::chrono::steady_clock::now();
+          latencies[c].push_back(uint32_t(std::min<int64_t>(
+              UINT32_MAX,
+              std::chrono::duration_cast<std::chrono::nanoseconds>(now - sent.front()).count())));
+          sent.pop_front();
+          for (uint64_t w : bitmap) {
+            positives[c] += __builtin_popcountll(w);
+          }
+          answered[c]++;
+          if (!stop.load(std::memory_order_relaxed)) {
+            send_one();
+          }
+        }
+      } catch (const std::exception &e) {
+        fprintf(stderr, "%s\n", e.what());
+        failed = true;
+      } });
+  }
+  std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+  stop = true;
+  for (std::thread &t : pool)
+  {
+    t.join();
+  }
+  const double elapsed =
+      std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  if (failed)
+  {
+    printf("a connection failed\n");
+    return EXIT_FAILURE;
+  }
+
+  std::vector<uint32_t> all;
+  size_t total = 0, found = 0;
+  for (size_t c = 0; c < connections; c++)
+  {
+    all.insert(all.end(), latencies[c].begin(), latencies[c].end());
+    total += answered[c];
+    found += positives[c];
+  }
+  std::sort(all.begin(), all.end());
+  auto percentile = [&](double p)
+  {
+    return all.empty() ? 0.0 : all[std::min(all.size() - 1, size_t(p * all.size()))] / 1e3;
+  };
+  printf("%zu connections, %zu %s per request, %zu in flight per connection, %.1f s\n",
+         connections, batch, send_hashes ? "hashes" : "URLs", depth, elapsed);
+  printf("QPS       %.0f requests/s, %.2f M URLs/s\n", total / elapsed,
+         total * batch / elapsed / 1e6);
+  printf("positive  %.1f%%\n", total > 0 ? 100.0 * found / (total * batch) : 0.0);
+  printf("latency   p50 %.1f us, p90 %.1f us, p99 %.1f us, p99.9 %.1f us, max %.1f us\n",
+         percentile(0.5), percentile(0.9), percentile(0.99), percentile(0.999),
+         all.empty() ? 0.0 : all.back() / 1e3);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,136 @@
+#include <algorithm>
+#include <csignal>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#include "filterapi.h"
+#include "query_server.h"
+#include "shm_filter.h"
+#include "url.h"
+
+// A query server over one filter (see src/query_server.h).
+//
+// usage: ./query_server xor8|fuse8|bloom|ribbon8 urls FILE address [threads]
+//        ./query_server xor8|fuse8|bloom|ribbon8 segment NAME address [threads]
+//
+// The filter is either built from the URLs of FILE, normalized and hashed as
+// in src/url.h, or attached read-only from a segment published with
+// SharedFilterPublisher (src/shm_filter.h), so that several servers share
+// one copy. address is a Unix socket path (anything with a '/') or a TCP
+// port on the loopback interface, or host:port. The server runs until
+// SIGINT or SIGTERM, then prints what it answered. Use ./query_client to
+// load it.
+
+// Stop() of the running server, for the signal handler
+void (*stop_server)() = nullptr;
+
+void on_signal(int)
+{
+  if (stop_server != nullptr)
+  {
+    stop_server();
+  }
+}
+
+template <typename Table>
+query::Server<Table> *&running()
+{
+  static query::Server<Table> *server = nullptr;
+  return server;
+}
+
+template <typename Table>
+void serve(Table *table, size_t filter_bytes, const std::string &address,
+           size_t threads)
+{
+  query::ServerOptions options;
+  options.threads = threads;
+  query::Server<Table> server(table, address, options);
+  running<Table>() = &server;
+  stop_server = []()
+  { running<Table>()->Stop(); };
+  printf("serving %.1f MB on %s with %zu threads\n", filter_bytes / 1e6,
+         address.c_str(), server.Threads());
+  fflush(stdout);
+  server.Wait();
+  stop_server = nullptr;
+  const query::ServerStats s = server.Stats();
+  printf("%llu connections, %llu requests, %llu keys, %llu errors\n",
+         (unsigned long long)s.connections, (unsigned long long)s.requests,
+         (unsigned long long)s.keys, (unsigned long long)s.errors);
+}
+
+template <typename Table>
+int run(const std::string &source, const std::string &name,
+        const std::string &address, size_t threads)
+{
+  if (source == "segment")
+  {
+    SharedFilter<Table> shared(name);
+    serve(shared.table(), shared.SizeInBytes(), address, threads);
+    return EXIT_SUCCESS;
+  }
+  std::ifstream input(name);
+  if (!input)
+  {
+    std::cerr << "Could not open " << name << std::endl;
+    return EXIT_FAILURE;
+  }
+  std::vector<uint64_t> keys;
+  std::string canonical;
+  for (std::string line; std::getline(input, line);)
+  {
+    url::normalize(line, &canonical);
+    keys.push_back(url::hash(canonical));
+  }
+  // duplicates break the static filters
+  std::sort(keys.begin(), keys.end());
+  keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+  std::unique_ptr<Table> table(
+      new Table(FilterAPI<Table>::ConstructFromAddCount(keys.size())));
+  FilterAPI<Table>::AddAll(keys, 0, keys.size(), table.get());
+  printf("%zu keys from %s\n", keys.size(), name.c_str());
+  serve(table.get(), table->SizeInBytes(), address, threads);
+  return EXIT_SUCCESS;
+}
+
+int main(int argc, char **argv)
+{
+  if (argc < 5 || (std::string(argv[2]) != "urls" && std::string(argv[2]) != "segment"))
+  {
+    printf("usage: %s xor8|fuse8|bloom|ribbon8 urls FILE address [threads]\n"
+           "       %s xor8|fuse8|bloom|ribbon8 segment NAME address [threads]\n",
+           argv[0], argv[0]);
+    return EXIT_FAILURE;
+  }
+  const std::string type = argv[1];
+  const size_t threads = argc > 5 ? atoll(argv[5]) : 0;
+  struct sigaction action = {};
+  action.sa_handler = on_signal;
+  sigaction(SIGINT, &action, nullptr);
+  sigaction(SIGTERM, &action, nullptr);
+  if (type == "xor8")
+  {
+    return run<XorFilter<uint64_t, uint8_t>>(argv[2], argv[3], argv[4], threads);
+  }
+  if (type == "fuse8")
+  {
+    return run<xorbinaryfusefilter_lowmem4wise::XorBinaryFuseFilter<uint64_t, uint8_t>>(
+        argv[2], argv[3], argv[4], threads);
+  }
+#if CPUDISPATCH_X86 || defined(__aarch64__)
+  if (type == "bloom")
+  {
+    return run<SimdBlockFilterFixed<>>(argv[2], argv[3], argv[4], threads);
+  }
+#endif
+  if (type == "ribbon8")
+  {
+    return run<BalancedRibbonFilter<uint64_t, 8, 0>>(argv[2], argv[3], argv[4], threads);
+  }
+  printf("unknown filter %s\n", type.c_str());
+  return EXIT_FAILURE;
+}
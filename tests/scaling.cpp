@@ -0,0 +1,376 @@
+#include "performancecounters/benchmarker.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <vector>
+#include "affinity.h"
+#include "filter_image.h"
+#include "filterapi.h"
+#include "hugepage.h"
+#include "test_util.h"
+
+// Lookup throughput of one shared, read-only filter as query threads are
+// added.
+//
+// usage: ./scaling urls.txt test_size [max_threads] [compact|scatter]
+//
+// test_size keys are taken from the URLs and, past the end of the file,
+// random 64-bit keys (so the filters can be made much larger than the LLC).
+// For 1, 2, 4, ... max_threads threads (default: all CPUs), pinned in the
+// given placement (see src/affinity.h), every thread runs the same mixed
+// positive/negative query stream against the one filter, each from a
+// different offset. Reported per thread count:
+//
+//   Mq/s   aggregate lookups per second
+//   eff    aggregate / (threads x single-thread rate)
+//   GB/s   estimated memory traffic: lookups x cache lines per lookup x 64,
+//          where lines/q is the number of random lines a lookup touches
+//   %bw    that traffic against the read bandwidth measured with as many
+//          threads streaming through a buffer four times the LLC; above
+//          100% the filter is being served from cache, so use a test_size
+//          that makes it several times the LLC to see the DRAM limit
+//
+// Then the parallel construction of the Bloom filters: for each thread
+// count, the time AddAllParallel takes to build the filter, its speedup over
+// AddAll, and whether it set exactly the same bits. The driver fails if it
+// did not.
+
+volatile size_t sink = 0;
+
+// Runs body(thread index) on `threads` pinned threads, released together;
+// returns the wall-clock seconds until the last one finishes.
+template <typename Body>
+double run_pinned(const std::vector<int> &cpus, size_t threads, const Body &body)
+{
+  std::atomic<size_t> ready{0};
+  std::atomic<bool> go{false};
+  std::vector<std::thread> pool;
+  for (size_t t = 0; t < threads; t++)
+  {
+    pool.emplace_back([&, t]()
+                      {
+      affinity::pin_current_thread(cpus[t % cpus.size()]);
+      ready++;
+      while (!go.load(std::memory_order_acquire)) {
+      }
+      body(t); });
+  }
+  while (ready.load() < threads)
+  {
+  }
+  const auto start = std::chrono::steady_clock::now();
+  go.store(true, std::memory_order_release);
+  for (std::thread &th : pool)
+  {
+    th.join();
+  }
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start)
+      .count();
+}
+
+// Read bandwidth in bytes/s with `threads` threads streaming over buffer.
+double read_bandwidth(const std::vector<int> &cpus, size_t threads,
+                      const std::vector<uint64_t> &buffer)
+{
+  double best = 0;
+  for (int r = 0; r < 3; r++)
+  {
+    std::vector<uint64_t> sums(threads);
+    const double seconds = run_pinned(cpus, threads, [&](size_t t)
+                                      {
+      const size_t chunk = buffer.size() / threads;
+      uint64_t s = 0;
+      for (size_t i = t * chunk; i < (t + 1) * chunk; i++) {
+        s += buffer[i];
+      }
+      sums[t] = s; });
+    for (uint64_t s : sums)
+    {
+      sink += s;
+    }
+    best = std::max(best, buffer.size() / threads * threads * 8 / seconds);
+  }
+  return best;
+}
+
+template <typename Table>
+void measure(const std::string &name, double lines_per_query,
+             const std::vector<uint64_t> &keys,
+             const std::vector<uint64_t> &queries, const std::vector<int> &cpus,
+             const std::vector<size_t> &thread_counts,
+             const std::vector<double> &bandwidth)
+{
+  Table table = FilterAPI<Table>::ConstructFromAddCount(keys.size());
+  FilterAPI<Table>::AddAll(keys, 0, keys.size(), &table);
+  printf("%s: %.1f MB, %.1f lines/q\n", name.c_str(), table.SizeInBytes() / 1e6,
+         lines_per_query);
+  printf("%8s %10s %8s %10s %8s\n", "threads", "Mq/s", "eff", "GB/s", "%bw");
+
+  std::vector<size_t> found(thread_counts.back());
+  auto pass = [&](size_t t, size_t passes, size_t threads)
+  {
+    const size_t n = queries.size();
+    const size_t offset = n / threads * t;
+    size_t f = 0;
+    for (size_t p = 0; p < passes; p++)
+    {
+      for (size_t i = offset; i < n; i++)
+      {
+        f += FilterAPI<Table>::Contain(queries[i], &table);
+      }
+      for (size_t i = 0; i < offset; i++)
+      {
+        f += FilterAPI<Table>::Contain(queries[i], &table);
+      }
+    }
+    found[t] += f;
+  };
+  // enough passes for about 0.3 s per run
+  const double one_pass =
+      run_pinned(cpus, 1, [&](size_t t)
+                 { pass(t, 1, 1); });
+  const size_t passes = std::max<size_t>(1, size_t(0.3 / one_pass));
+
+  double single = 0;
+  for (size_t i = 0; i < thread_counts.size(); i++)
+  {
+    const size_t threads = thread_counts[i];
+    double best = 1e300;
+    for (int r = 0; r < 3; r++)
+    {
+      best = std::min(best, run_pinned(cpus, threads, [&](size_t t)
+                                       { pass(t, passes, threads); }));
+    }
+    const double rate = double(queries.size()) * passes * threads / best;
+    if (threads == 1)
+    {
+      single = rate;
+    }
+    const double traffic = rate * lines_per_query * 64;
+    printf("%8zu %10.1f %8.2f %10.2f %7.1f%%\n", threads, rate / 1e6,
+           single > 0 ? rate / (single * threads) : 0.0, traffic / 1e9,
+           100 * traffic / bandwidth[i]);
+  }
+  for (size_t f : found)
+  {
+    sink += f;
+  }
+}
+
+// Empty blocked Bloom filters that hash like reference, each over a flat
+// image (src/filter_image.h), so that a build can be compared with the
+// reference bit for bit.
+#if CPUDISPATCH_X86 || defined(__aarch64__)
+class BlockedBloomBuilds
+{
+public:
+  using Table = SimdBlockFilterFixed<>;
+
+  BlockedBloomBuilds(const Table &reference, size_t)
+      : bytes_(FilterImage<Table>::Bytes(reference)),
+        directory_(reference.SizeInBytes()),
+        reference_(static_cast<char *>(hugepage::allocate(bytes_, hugepage::none))),
+        image_(static_cast<char *>(hugepage::allocate(bytes_, hugepage::none)))
+  {
+    FilterImage<Table>::Write(reference, reference_);
+  }
+  ~BlockedBloomBuilds()
+  {
+    hugepage::release(reference_);
+    hugepage::release(image_);
+  }
+
+  Table *Empty()
+  {
+    memcpy(image_, reference_, bytes_ - directory_);
+    memset(image_ + bytes_ - directory_, 0, directory_);
+    FilterImage<Table>::View(image_, reinterpret_cast<Table *>(view_));
+    return reinterpret_cast<Table *>(view_);
+  }
+
+  // Whether built, from Empty(), matches the reference; then drops it.
+  bool Finish(Table *built)
+  {
+    FilterImage<Table>::Release(built);
+    return memcmp(image_, reference_, bytes_) == 0;
+  }
+
+private:
+  const size_t bytes_, directory_;
+  char *reference_, *image_;
+  alignas(Table) char view_[sizeof(Table)];
+};
+#endif
+
+// The same for the standard Bloom filter, whose hash function and bits are
+// public.
+template <typename Table>
+class BloomBuilds
+{
+public:
+  BloomBuilds(const Table &reference, size_t add_count)
+      : reference_(reference), add_count_(add_count) {}
+
+  Table *Empty()
+  {
+    built_.reset(new Table(FilterAPI<Table>::ConstructFromAddCount(add_count_)));
+    built_->hasher = reference_.hasher;
+    return built_.get();
+  }
+
+  bool Finish(Table *built)
+  {
+    const bool same = memcmp(built->data, reference_.data, reference_.arrayLength * 8) == 0;
+    built_.reset();
+    return same;
+  }
+
+private:
+  const Table &reference_;
+  const size_t add_count_;
+  std::unique_ptr<Table> built_;
+};
+
+// AddAllParallel against AddAll, best of 3 builds each; false if a parallel
+// build set other bits than AddAll.
+template <typename Table, typename Builds>
+bool construction(const std::string &name, const std::vector<uint64_t> &keys,
+                  const std::vector<size_t> &thread_counts)
+{
+  std::unique_ptr<Table> reference(new Table(FilterAPI<Table>::ConstructFromAddCount(keys.size())));
+  reference->AddAll(keys, 0, keys.size());
+  Builds builds(*reference, keys.size());
+  // threads == 0: AddAll
+  auto build = [&](size_t threads, bool *same)
+  {
+    double best = 1e300;
+    for (int r = 0; r < 3; r++)
+    {
+      Table *table = builds.Empty();
+      const auto start = std::chrono::steady_clock::now();
+      if (threads == 0)
+      {
+        table->AddAll(keys, 0, keys.size());
+      }
+      else
+      {
+        table->AddAllParallel(keys, 0, keys.size(), threads);
+      }
+      best = std::min(best, std::chrono::duration<double>(
+                                std::chrono::steady_clock::now() - start)
+                                .count());
+      *same = builds.Finish(table) && *same;
+    }
+    return best;
+  };
+  bool same = true;
+  const double serial = build(0, &same);
+  printf("%s construction: AddAll %.1f ms\n", name.c_str(), serial * 1e3);
+  printf("%8s %10s %8s %10s\n", "threads", "ms", "speedup", "same bits");
+  for (size_t threads : thread_counts)
+  {
+    bool identical = true;
+    const double seconds = build(threads, &identical);
+    printf("%8zu %10.1f %8.2f %10s\n", threads, seconds * 1e3, serial / seconds,
+           identical ? "yes" : "NO");
+    same = same && identical;
+  }
+  return same;
+}
+
+int main(int argc, char **argv)
+{
+  if (argc < 3)
+  {
+    printf("usage: %s urls.txt test_size [max_threads] [compact|scatter]\n",
+           argv[0]);
+    return EXIT_FAILURE;
+  }
+  std::ifstream input(argv[1]);
+  if (!input)
+  {
+    std::cerr << "Could not open " << argv[1] << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  const std::vector<affinity::cpu> online = affinity::online_cpus();
+  size_t test_size = atoll(argv[2]);
+  const size_t max_threads = argc > 3 ? atoll(argv[3]) : online.size();
+  const bool scatter = argc > 4 && std::string(argv[4]) == "scatter";
+  const std::vector<int> cpus = affinity::placement(online, scatter);
+
+  std::vector<uint64_t> keys = testutil::load_keys(input, test_size);
+  // Morton's bulk insertion works in whole batches of 128 keys
+  if (keys.size() < 128)
+  {
+    std::cerr << "test_size must be at least 128" << std::endl;
+    return EXIT_FAILURE;
+  }
+  keys.resize(keys.size() / 128 * 128);
+
+  // half positives, half negatives, shuffled, at most 4M queries
+  const size_t half = std::min<size_t>(keys.size(), size_t(2) << 20);
+  std::vector<uint64_t> queries(keys.begin(), keys.begin() + half);
+  uint64_t negative_state = 5678;
+  for (size_t i = 0; i < half; i++)
+  {
+    queries.push_back(testutil::splitmix64(&negative_state));
+  }
+  std::shuffle(queries.begin(), queries.end(), std::mt19937_64(1234));
+
+  std::vector<size_t> thread_counts;
+  for (size_t t = 1; t < max_threads; t *= 2)
+  {
+    thread_counts.push_back(t);
+  }
+  thread_counts.push_back(std::max<size_t>(1, max_threads));
+
+  const size_t llc = last_level_cache_bytes();
+  std::vector<uint64_t> buffer((llc ? 4 * llc : size_t(256) << 20) / 8, 1);
+  std::vector<double> bandwidth;
+  for (size_t threads : thread_counts)
+  {
+    bandwidth.push_back(read_bandwidth(cpus, threads, buffer));
+  }
+  buffer = std::vector<uint64_t>();
+
+  printf("%zu keys, %zu queries, %zu CPUs on %d socket(s), %s placement\n",
+         keys.size(), queries.size(), online.size(),
+         affinity::socket_count(online), scatter ? "scatter" : "compact");
+  for (size_t i = 0; i < thread_counts.size(); i++)
+  {
+    printf("read bandwidth, %zu threads: %.2f GB/s\n", thread_counts[i],
+           bandwidth[i] / 1e9);
+  }
+  measure<XorFilter<uint64_t, uint8_t>>("Xor8", 3, keys, queries, cpus,
+                                        thread_counts, bandwidth);
+  measure<xorbinaryfusefilter_lowmem4wise::XorBinaryFuseFilter<uint64_t, uint8_t>>(
+      "BinaryFuse8_4wise", 4, keys, queries, cpus, thread_counts, bandwidth);
+  measure<BalancedRibbonFilter<uint64_t, 8, 0>>("BalancedRibbon8", 2, keys,
+                                                queries, cpus, thread_counts,
+                                                bandwidth);
+  measure<CuckooFilter<uint64_t, 12>>("Cuckoo12", 2, keys, queries, cpus,
+                                      thread_counts, bandwidth);
+  measure<MortonFilter>("Morton3_8", 1, keys, queries, cpus, thread_counts,
+                        bandwidth);
+#if CPUDISPATCH_X86 || defined(__aarch64__)
+  measure<SimdBlockFilterFixed<>>("BlockedBloom", 1, keys, queries, cpus,
+                                  thread_counts, bandwidth);
+#endif
+
+  bool same = true;
+#if CPUDISPATCH_X86 || defined(__aarch64__)
+  same = construction<SimdBlockFilterFixed<>, BlockedBloomBuilds>("BlockedBloom", keys,
+                                                                  thread_counts) &&
+         same;
+#endif
+  using Bloom12 = BloomFilter<uint64_t, 12, false>;
+  same = construction<Bloom12, BloomBuilds<Bloom12>>("Bloom12", keys, thread_counts) && same;
+  return same ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,309 @@
+#include "performancecounters/benchmarker.h"
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <stdlib.h>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+#include "filterapi.h"
+#include "shm_filter.h"
+#include "test_util.h"
+
+// A filter in shared memory, queried by several processes.
+//
+// usage: ./shm urls.txt test_size [workers] [generations] [name]
+//
+// Half of the test_size keys come from the URLs and are in every generation
+// of the filter; the other half is different in each. The filter is
+// published under name (default /filter_bench_<pid>; give a path on a
+// hugetlbfs mount to use huge pages) and `workers` processes are forked that
+// look the stable keys up in it, while the parent publishes `generations`
+// more generations. Reported:
+//
+//   publish   time to copy a built filter into a new generation, and the
+//             size of the segment
+//   attach    time for a process to map the current generation
+//   lookup    ns per query in a private filter and in the shared one
+//   workers   lookups/s over all workers, and the time they took to move
+//             to a new generation
+//   memory    proportional set size (Pss) of the segment, summed over the
+//             workers and the publisher: the segment is there once, however
+//             many processes map it
+//
+// Every stable key must be found in every generation; any miss is reported
+// as an error.
+
+volatile size_t sink = 0;
+
+template <typename Table>
+std::unique_ptr<Table> build(const std::vector<uint64_t> &stable, uint64_t generation)
+{
+  std::vector<uint64_t> keys(stable);
+  uint64_t state = generation * UINT64_C(0x5851F42D4C957F2D);
+  for (size_t i = 0; i < stable.size(); i++)
+  {
+    keys.push_back(testutil::splitmix64(&state));
+  }
+  std::unique_ptr<Table> table(new Table(FilterAPI<Table>::ConstructFromAddCount(keys.size())));
+  FilterAPI<Table>::AddAll(keys, 0, keys.size(), table.get());
+  return table;
+}
+
+double elapsed_ns(std::chrono::steady_clock::time_point start)
+{
+  return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Pss, in bytes, of the mappings of a process whose name contains needle.
+size_t mapping_pss(const std::string &process, const std::string &needle)
+{
+  std::ifstream smaps("/proc/" + process + "/smaps");
+  size_t kb = 0;
+  bool in_mapping = false;
+  for (std::string line; std::getline(smaps, line);)
+  {
+    const size_t space = line.find(' ');
+    if (space != std::string::npos && line.find('-') < space)
+    {
+      // a mapping: "start-end perms offset dev inode name"
+      in_mapping = line.find(needle) != std::string::npos;
+    }
+    else if (in_mapping && line.compare(0, 4, "Pss:") == 0)
+    {
+      kb += atoll(line.c_str() + 4);
+    }
+  }
+  return kb * 1024;
+}
+
+// what a worker sends back
+struct worker_report
+{
+  size_t lookups;
+  size_t misses;
+  size_t generations;
+  double seconds;
+  double max_attach_ns;
+};
+
+template <typename Table>
+worker_report work(const std::string &name, const std::vector<uint64_t> &stable,
+                   uint64_t last_generation, int ready_fd, int exit_fd)
+{
+  worker_report r = {};
+  const size_t batch = 64;
+  const auto start = std::chrono::steady_clock::now();
+  std::unique_ptr<SharedFilter<Table>> filter(new SharedFilter<Table>(name));
+  r.generations = 1;
+  size_t i = 0;
+  // until a full pass over the last generation
+  for (size_t last_pass = 0; last_pass < stable.size();)
+  {
+    if (filter->Stale())
+    {
+      const auto attach = std::chrono::steady_clock::now();
+      filter.reset(new SharedFilter<Table>(name));
+      r.max_attach_ns = std::max(r.max_attach_ns, elapsed_ns(attach));
+      r.generations++;
+    }
+    const size_t end = std::min(i + batch, stable.size());
+    Table *table = filter->table();
+    for (size_t j = i; j < end; j++)
+    {
+      r.misses += !FilterAPI<Table>::Contain(stable[j], table);
+    }
+    r.lookups += end - i;
+    if (filter->Generation() == last_generation)
+    {
+      last_pass += end - i;
+    }
+    i = end == stable.size() ? 0 : end;
+  }
+  r.seconds = elapsed_ns(start) / 1e9;
+  // keep the mapping until every worker is on the last generation and the
+  // parent has measured
+  char c = 0;
+  if (write(ready_fd, &c, 1) != 1 || read(exit_fd, &c, 1) != 1)
+  {
+    _exit(EXIT_FAILURE);
+  }
+  return r;
+}
+
+template <typename Table>
+void measure(const std::string &label, const std::string &name,
+             const std::vector<uint64_t> &stable, size_t workers, size_t generations)
+{
+  printf("%s\n", label.c_str());
+  SharedFilterPublisher<Table> publisher(name);
+  std::unique_ptr<Table> table = build<Table>(stable, 0);
+  auto start = std::chrono::steady_clock::now();
+  const uint64_t first = publisher.Publish(*table);
+  const double publish_ns = elapsed_ns(start);
+  const uint64_t last = first + generations;
+  size_t filter_bytes = 0;
+
+  {
+    start = std::chrono::steady_clock::now();
+    SharedFilter<Table> shared(name);
+    const double attach_ns = elapsed_ns(start);
+    filter_bytes = shared.SizeInBytes();
+    printf("  publish   %.2f ms, segment of %.2f MB for a %.2f MB filter\n",
+           publish_ns / 1e6, shared.SegmentBytes() / 1e6, shared.SizeInBytes() / 1e6);
+    size_t found = 0;
+    event_aggregate direct = bench([&]()
+                                   {
+      for (uint64_t key : stable) {
+        found += FilterAPI<Table>::Contain(key, table.get());
+      } });
+    Table *view = shared.table();
+    event_aggregate mapped = bench([&]()
+                                   {
+      for (uint64_t key : stable) {
+        found += FilterAPI<Table>::Contain(key, view);
+      } });
+    sink += found;
+    printf("  attach    %.1f us\n", attach_ns / 1e3);
+    printf("  lookup    private %.2f ns/q, shared %.2f ns/q\n",
+           direct.fastest_elapsed_ns() / stable.size(),
+           mapped.fastest_elapsed_ns() / stable.size());
+  }
+  table.reset();
+
+  std::vector<pid_t> pids;
+  std::vector<int> ready, exits, results;
+  for (size_t w = 0; w < workers; w++)
+  {
+    int ready_pipe[2], exit_pipe[2], result_pipe[2];
+    if (pipe(ready_pipe) != 0 || pipe(exit_pipe) != 0 || pipe(result_pipe) != 0)
+    {
+      perror("pipe");
+      exit(EXIT_FAILURE);
+    }
+    const pid_t pid = fork();
+    if (pid == 0)
+    {
+      worker_report r = {};
+      try
+      {
+        r = work<Table>(name, stable, last, ready_pipe[1], exit_pipe[0]);
+      }
+      catch (const std::exception &e)
+      {
+        fprintf(stderr, "worker: %s\n", e.what());
+        _exit(EXIT_FAILURE);
+      }
+      _exit(write(result_pipe[1], &r, sizeof(r)) == sizeof(r) ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+    close(ready_pipe[1]);
+    close(exit_pipe[0]);
+    close(result_pipe[1]);
+    pids.push_back(pid);
+    ready.push_back(ready_pipe[0]);
+    exits.push_back(exit_pipe[1]);
+    results.push_back(result_pipe[0]);
+  }
+
+  double build_ns = 0, republish_ns = 0;
+  for (uint64_t g = first + 1; g <= last; g++)
+  {
+    start = std::chrono::steady_clock::now();
+    table = build<Table>(stable, g);
+    build_ns += elapsed_ns(start);
+    start = std::chrono::steady_clock::now();
+    publisher.Publish(*table);
+    republish_ns += elapsed_ns(start);
+  }
+  table.reset();
+
+  char c = 0;
+  for (int fd : ready)
+  {
+    if (read(fd, &c, 1) != 1)
+    {
+      printf("  ERROR: a worker failed\n");
+    }
+  }
+  // the publisher maps the last generation too
+  const std::string segment = name.substr(name.rfind('/') + 1) + "." + std::to_string(last);
+  size_t pss = mapping_pss("self", segment);
+  for (pid_t pid : pids)
+  {
+    pss += mapping_pss(std::to_string(pid), segment);
+  }
+  for (int fd : exits)
+  {
+    if (write(fd, &c, 1) != 1)
+    {
+      perror("write");
+    }
+  }
+  double rate = 0, max_attach_ns = 0;
+  size_t misses = 0, min_generations = SIZE_MAX;
+  for (size_t w = 0; w < workers; w++)
+  {
+    worker_report r = {};
+    if (read(results[w], &r, sizeof(r)) != sizeof(r))
+    {
+      printf("  ERROR: no report from worker %zu\n", w);
+    }
+    waitpid(pids[w], nullptr, 0);
+    close(ready[w]);
+    close(exits[w]);
+    close(results[w]);
+    rate += r.lookups / std::max(r.seconds, 1e-9);
+    max_attach_ns = std::max(max_attach_ns, r.max_attach_ns);
+    misses += r.misses;
+    min_generations = std::min(min_generations, r.generations);
+  }
+  publisher.Unlink();
+  if (generations > 0)
+  {
+    printf("  republish %.2f ms per generation (build %.2f ms)\n",
+           republish_ns / generations / 1e6, build_ns / generations / 1e6);
+  }
+  printf("  workers   %zu, %.1f Mq/s in all, each saw at least %zu of %zu generations, "
+         "reattach %.1f us max\n",
+         workers, rate / 1e6, min_generations, generations + 1, max_attach_ns / 1e3);
+  printf("  memory    %.2f MB Pss over %zu processes (%.2f MB as private copies)\n",
+         pss / 1e6, workers + 1, (workers + 1) * filter_bytes / 1e6);
+  if (misses > 0)
+  {
+    printf("  ERROR: %zu stable keys not found\n", misses);
+  }
+}
+
+int main(int argc, char **argv)
+{
+  if (argc < 3)
+  {
+    printf("usage: %s urls.txt test_size [workers] [generations] [name]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+  std::ifstream input(argv[1]);
+  if (!input)
+  {
+    std::cerr << "Could not open " << argv[1] << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  const size_t test_size = atoll(argv[2]);
+  const size_t workers = argc > 3 ? atoll(argv[3]) : 4;
+  const size_t generations = argc > 4 ? atoll(argv[4]) : 5;
+  const std::string name = argc > 5 ? argv[5] : "/filter_bench_" + std::to_string(getpid());
+
+  std::vector<uint64_t> stable = testutil::read_keys(input, test_size / 2);
+  printf("%zu stable keys, %zu workers, %zu generations, segment %s\n", stable.size(),
+         workers, generations, name.c_str());
+
+  measure<XorFilter<uint64_t, uint8_t>>("Xor8", name, stable, workers, generations);
+  measure<xorbinaryfusefilter_lowmem4wise::XorBinaryFuseFilter<uint64_t, uint8_t>>(
+      "BinaryFuse8_4wise", name, stable, workers, generations);
+  measure<SimdBlockFilterFixed<>>("BlockedBloom", name, stable, workers, generations);
+  measure<BalancedRibbonFilter<uint64_t, 8, 0>>("BalancedRibbon8", name, stable,
+                                                workers, generations);
+  return EXIT_SUCCESS;
+}
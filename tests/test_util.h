@@ -0,0 +1,82 @@
+// Key sets for the benchmark drivers.
+//
+// A driver's keys are the url::hash of the lines of a URL file (trailing
+// whitespace removed), topped up with random keys when the file is short,
+// without duplicates: the static filters (xor, binary fuse, ribbon) fail to
+// build when a key is repeated.
+
+#ifndef TEST_UTIL_H_
+#define TEST_UTIL_H_
+
+#include <algorithm>
+#include <cctype>
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+#include <string>
+#include <vector>
+
+#include "url.h"
+
+namespace testutil
+{
+
+inline uint64_t splitmix64(uint64_t *state)
+{
+  uint64_t z = (*state += UINT64_C(0x9E3779B97F4A7C15));
+  z = (z ^ (z >> 30)) * UINT64_C(0xBF58476D1CE4E5B9);
+  z = (z ^ (z >> 27)) * UINT64_C(0x94D049BB133111EB);
+  return z ^ (z >> 31);
+}
+
+// Sorts keys and drops the repeats.
+inline void dedup(std::vector<uint64_t> *keys)
+{
+  std::sort(keys->begin(), keys->end());
+  keys->erase(std::unique(keys->begin(), keys->end()), keys->end());
+}
+
+// The keys of the first count lines of input, deduplicated (so possibly
+// fewer than count).
+inline std::vector<uint64_t> read_keys(std::istream &input, size_t count)
+{
+  std::vector<uint64_t> keys;
+  for (std::string line; keys.size() < count && std::getline(input, line);)
+  {
+    line.erase(std::find_if(line.rbegin(), line.rend(),
+                            [](unsigned char ch)
+                            { return !std::isspace(ch); })
+                   .base(),
+               line.end());
+    keys.push_back(url::hash(line));
+  }
+  dedup(&keys);
+  return keys;
+}
+
+// Adds random keys (from a fixed seed) until there are count distinct ones;
+// keys ends up sorted.
+inline void pad_keys(std::vector<uint64_t> *keys, size_t count)
+{
+  uint64_t state = 1234;
+  while (keys->size() < count)
+  {
+    while (keys->size() < count)
+    {
+      keys->push_back(splitmix64(&state));
+    }
+    dedup(keys);
+  }
+}
+
+// read_keys, then pad_keys: count distinct keys, sorted.
+inline std::vector<uint64_t> load_keys(std::istream &input, size_t count)
+{
+  std::vector<uint64_t> keys = read_keys(input, count);
+  pad_keys(&keys, count);
+  return keys;
+}
+
+} // namespace testutil
+
+#endif // TEST_UTIL_H_
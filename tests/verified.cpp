@@ -0,0 +1,145 @@
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#include "exact_set.h"
+#include "filterapi.h"
+#include "test_util.h"
+
+// Filters with their positives verified against an exact key set
+// (src/exact_set.h).
+//
+// usage: ./verified urls.txt test_size
+//
+// A filter is built from test_size keys (the URLs, then random keys), alone
+// and as a VerifiedFilter with each exact set. The queries are, in random
+// order, the keys themselves and as many random keys that are not in the
+// set. For each, reported:
+//
+//   size     bits per key: the filter, and the whole
+//   lookup   ns per query with Contain, and with ContainMany in batches of
+//            256
+//   answers  false positives (none, once verified) and missing keys (never
+//            any)
+
+volatile size_t sink = 0;
+
+template <typename Table>
+void report(const char *name, Table *table, size_t filter_bytes, size_t bytes,
+            const std::vector<uint64_t> &keys, const std::vector<uint64_t> &queries,
+            const std::vector<uint8_t> &in_set)
+{
+  auto start = std::chrono::steady_clock::now();
+  size_t false_positives = 0, missing = 0;
+  for (size_t i = 0; i < queries.size(); i++)
+  {
+    const bool found = FilterAPI<Table>::Contain(queries[i], table);
+    false_positives += found && !in_set[i];
+    missing += !found && in_set[i];
+  }
+  const double single_ns = std::chrono::duration<double, std::nano>(
+                               std::chrono::steady_clock::now() - start)
+                               .count() /
+                           queries.size();
+
+  const size_t batch = 256;
+  uint64_t bitmap[batch / 64];
+  size_t found = 0;
+  start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < queries.size(); i += batch)
+  {
+    const size_t n = std::min(batch, queries.size() - i);
+    ContainMany(queries.data() + i, n, table, bitmap);
+    for (size_t w = 0; w < (n + 63) / 64; w++)
+    {
+      found += __builtin_popcountll(bitmap[w]);
+    }
+  }
+  const double batch_ns = std::chrono::duration<double, std::nano>(
+                              std::chrono::steady_clock::now() - start)
+                              .count() /
+                          queries.size();
+  sink += found;
+  printf("  %-10s %6.2f + %5.2f bits/key %8.1f ns/q %8.1f ns/q batched %7zu false positives %zu missing\n",
+         name, 8.0 * filter_bytes / keys.size(), 8.0 * (bytes - filter_bytes) / keys.size(),
+         single_ns, batch_ns, false_positives, missing);
+}
+
+template <typename Table>
+void measure(const std::string &name, const std::vector<uint64_t> &keys,
+             const std::vector<uint64_t> &queries, const std::vector<uint8_t> &in_set)
+{
+  printf("%s\n", name.c_str());
+  {
+    std::unique_ptr<Table> table(new Table(FilterAPI<Table>::ConstructFromAddCount(keys.size())));
+    FilterAPI<Table>::AddAll(keys, 0, keys.size(), table.get());
+    report("filter", table.get(), table->SizeInBytes(), table->SizeInBytes(), keys, queries, in_set);
+  }
+  {
+    VerifiedFilter<Table, exact::EytzingerSet> verified(keys);
+    report("eytzinger", &verified, verified.FilterBytes(), verified.SizeInBytes(), keys,
+           queries, in_set);
+  }
+  {
+    VerifiedFilter<Table, exact::BucketSet> verified(keys);
+    report("buckets", &verified, verified.FilterBytes(), verified.SizeInBytes(), keys,
+           queries, in_set);
+  }
+}
+
+int main(int argc, char **argv)
+{
+  if (argc < 3)
+  {
+    printf("usage: %s urls.txt test_size\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+  std::ifstream input(argv[1]);
+  if (!input)
+  {
+    std::cerr << "Could not open " << argv[1] << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  const size_t test_size = atoll(argv[2]);
+
+  std::vector<uint64_t> keys = testutil::load_keys(input, test_size);
+
+  // the keys, then as many keys not in the set, shuffled together
+  std::vector<std::pair<uint64_t, uint8_t>> mixed;
+  for (uint64_t k : keys)
+  {
+    mixed.emplace_back(k, 1);
+  }
+  uint64_t negative_state = 5678;
+  while (mixed.size() < 2 * keys.size())
+  {
+    const uint64_t k = testutil::splitmix64(&negative_state);
+    if (!std::binary_search(keys.begin(), keys.end(), k))
+    {
+      mixed.emplace_back(k, 0);
+    }
+  }
+  std::shuffle(mixed.begin(), mixed.end(), std::mt19937_64(1234));
+  std::vector<uint64_t> queries;
+  std::vector<uint8_t> in_set;
+  for (const auto &m : mixed)
+  {
+    queries.push_back(m.first);
+    in_set.push_back(m.second);
+  }
+  printf("%zu keys, %zu queries, %s\n", keys.size(), queries.size(),
+         cpudispatch::isa_name(cpudispatch::selected));
+
+  measure<xorbinaryfusefilter_lowmem4wise::XorBinaryFuseFilter<uint64_t, uint8_t>>(
+      "BinaryFuse8_4wise", keys, queries, in_set);
+  measure<XorFilter<uint64_t, uint8_t>>("Xor8", keys, queries, in_set);
+#if CPUDISPATCH_X86 || defined(__aarch64__)
+  measure<SimdBlockFilterFixed<>>("BlockedBloom", keys, queries, in_set);
+#endif
+  return EXIT_SUCCESS;
+}
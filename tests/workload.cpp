@@ -0,0 +1,159 @@
+#include "performancecounters/benchmarker.h"
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <stdlib.h>
+#include <vector>
+#include "filterapi.h"
+#include "workload.h"
+
+// Lookup throughput under a skewed, mixed query stream (see src/workload.h).
+//
+// usage: ./workload urls.txt test_size [zipf_s] [positive_ratio]
+//                   [working_set] [burst] [queries]
+//
+// The first test_size URLs are added to each filter; the stream draws its
+// positives from them and its negatives from as many random strings. Defaults:
+// zipf 0.99, 50% positive, whole key set, no bursts, 10 * test_size queries.
+
+std::string random_string()
+{
+  auto randchar = []() -> char
+  {
+    const char charset[] =
+        "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz";
+    const size_t max_index = (sizeof(charset) - 1);
+    return charset[rand() % max_index];
+  };
+  size_t desired_length = rand() % 128;
+  std::string str(desired_length, 0);
+  std::generate_n(str.begin(), desired_length, randchar);
+  return str;
+}
+
+uint64_t simple_hash(const std::string &line)
+{
+  uint64_t h = 0;
+  for (unsigned char c : line)
+  {
+    h = (h * 177) + c;
+  }
+  h ^= line.size();
+  return h;
+}
+
+void pretty_print(size_t volume, std::string name, event_aggregate agg)
+{
+  printf("%-30s : ", name.c_str());
+  printf(" %5.1f Mq/s ", volume * 1000.0 / agg.fastest_elapsed_ns());
+  printf(" %5.2f ns/q ", agg.fastest_elapsed_ns() / volume);
+  if (collector.has_events())
+  {
+    printf(" %5.2f c/q ", agg.fastest_cycles() / volume);
+    printf(" %5.2f i/q ", agg.fastest_instructions() / volume);
+    printf(" %5.3f bm/q ", agg.fastest_branch_misses() / volume);
+  }
+  if (collector.has_cache_events())
+  {
+    printf(" %5.3f L1/q ", agg.fastest_l1d_misses() / volume);
+    printf(" %5.3f LLC/q ", agg.fastest_llc_misses() / volume);
+    printf(" %5.3f TLB/q ", agg.fastest_dtlb_misses() / volume);
+  }
+  printf("\n");
+}
+
+volatile size_t sink = 0;
+
+template <typename Table>
+void measure(const std::string &name, const std::vector<uint64_t> &keys,
+             const workload::Workload &w)
+{
+  Table table = FilterAPI<Table>::ConstructFromAddCount(keys.size());
+  FilterAPI<Table>::AddAll(keys, 0, keys.size(), &table);
+  size_t found = 0;
+  pretty_print(w.queries.size(), name,
+               bench([&]()
+                     { found += workload::Replay(w.queries, &table); }));
+  sink += found;
+
+  size_t false_positives = 0, false_negatives = 0;
+  for (size_t i = 0; i < w.queries.size(); i++)
+  {
+    const bool hit = FilterAPI<Table>::Contain(w.queries[i], &table);
+    false_positives += hit && !w.positive[i];
+    false_negatives += !hit && w.positive[i];
+  }
+  if (false_negatives != 0)
+  {
+    printf("%-30s : %zu false negatives!\n", name.c_str(), false_negatives);
+  }
+  const size_t negatives = w.queries.size() - w.positives;
+  printf("%-30s :  %.5f%% of negative queries hit\n", "",
+         negatives ? 100.0 * false_positives / negatives : 0.0);
+}
+
+int main(int argc, char **argv)
+{
+  if (argc < 3)
+  {
+    printf("usage: %s urls.txt test_size [zipf_s] [positive_ratio] "
+           "[working_set] [burst] [queries]\n",
+           argv[0]);
+    return EXIT_FAILURE;
+  }
+  std::ifstream input(argv[1]);
+  if (!input)
+  {
+    std::cerr << "Could not open " << argv[1] << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  std::vector<std::string> inputs;
+  for (std::string line; std::getline(input, line);)
+  {
+    std::string ref = line;
+    ref.erase(std::find_if(ref.rbegin(), ref.rend(),
+                           [](unsigned char ch)
+                           { return !std::isspace(ch); })
+                  .base(),
+              ref.end());
+    inputs.push_back(ref);
+  }
+  size_t test_size = std::min<size_t>(atoll(argv[2]), inputs.size());
+
+  std::vector<uint64_t> keys(test_size);
+  for (size_t i = 0; i < test_size; i++)
+  {
+    keys[i] = simple_hash(inputs[i]);
+  }
+  // duplicates break the static filters
+  std::sort(keys.begin(), keys.end());
+  keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+  std::vector<uint64_t> negatives(keys.size());
+  for (size_t i = 0; i < negatives.size(); i++)
+  {
+    negatives[i] = simple_hash(random_string());
+  }
+
+  workload::WorkloadConfig config;
+  config.queries = 10 * keys.size();
+  if (argc > 3) { config.zipf_s = atof(argv[3]); }
+  if (argc > 4) { config.positive_ratio = atof(argv[4]); }
+  if (argc > 5) { config.working_set = atoll(argv[5]); }
+  if (argc > 6) { config.burst = atof(argv[6]); }
+  if (argc > 7) { config.queries = atoll(argv[7]); }
+  const workload::Workload w =
+      workload::GenerateWorkload(keys, negatives, config);
+
+  printf("%zu keys\n", keys.size());
+  config.print();
+  measure<XorFilter<uint64_t, uint8_t>>("Xor8", keys, w);
+  measure<xorbinaryfusefilter_lowmem4wise::XorBinaryFuseFilter<uint64_t, uint8_t>>(
+      "BinaryFuse8_4wise", keys, w);
+  measure<CuckooFilter<uint64_t, 12>>("Cuckoo12", keys, w);
+  measure<BloomFilter<uint64_t, 12, false>>("Bloom12", keys, w);
+#if CPUDISPATCH_X86 || defined(__aarch64__)
+  measure<SimdBlockFilterFixed<>>("BlockedBloom", keys, w);
+#endif
+  return EXIT_SUCCESS;
+}